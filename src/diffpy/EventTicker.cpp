@@ -20,12 +20,43 @@
 *
 *****************************************************************************/
 
+#include <climits>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
 #include <diffpy/EventTicker.hpp>
 #include <diffpy/serialization.ipp>
 
 namespace diffpy {
 namespace eventticker {
 
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+typedef boost::uint64_t CounterType;
+
+/// number of counts per one step of the value_type first item
+const CounterType GCOUNTER_SECONDS = CounterType(LONG_MAX) + 1;
+
+/// global counter, which may be advanced from several threads
+boost::atomic<CounterType>& gcounter()
+{
+    static boost::atomic<CounterType> cnt(0);
+    return cnt;
+}
+
+
+/// convert counter to the (first, second) pair with a matching order
+EventTicker::value_type counterToValue(CounterType cnt)
+{
+    EventTicker::value_type rv(
+            long(cnt / GCOUNTER_SECONDS), long(cnt % GCOUNTER_SECONDS));
+    return rv;
+}
+
+}   // namespace
+
 //////////////////////////////////////////////////////////////////////////////
 // class EventTicker
 //////////////////////////////////////////////////////////////////////////////
@@ -39,13 +70,8 @@ EventTicker::EventTicker() : mtick(0, 0)
 
 void EventTicker::click()
 {
-    ++gtick.second;
-    if (0 >= gtick.second)
-    {
-        ++gtick.first;
-        gtick.second = 0;
-    }
-    mtick = gtick;
+    CounterType cnt = gcounter().fetch_add(1, boost::memory_order_relaxed) + 1;
+    mtick = counterToValue(cnt);
 }
 
 
@@ -97,9 +123,13 @@ bool EventTicker::operator!=(const EventTicker& other) const
 }
 
 
-// Static Global Data --------------------------------------------------------
+// Private Methods -----------------------------------------------------------
 
-EventTicker::value_type EventTicker::gtick(0, 0);
+EventTicker::value_type EventTicker::globalValue()
+{
+    CounterType cnt = gcounter().load(boost::memory_order_relaxed);
+    return counterToValue(cnt);
+}
 
 }   // namespace eventticker
 }   // namespace diffpy
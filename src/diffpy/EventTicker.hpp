@@ -58,7 +58,7 @@ class EventTicker
     private:
 
         // global counter
-        static value_type gtick;
+        static value_type globalValue();
 
         // data
         value_type mtick;
@@ -68,7 +68,7 @@ class EventTicker
         template<class Archive>
             void save(Archive& ar, const unsigned int version) const
         {
-            ar << mtick << gtick;
+            ar << mtick << globalValue();
         }
 
         template<class Archive>
@@ -76,6 +76,7 @@ class EventTicker
         {
             value_type ga;
             ar >> mtick >> ga;
+            const value_type gtick = globalValue();
             if (ga > gtick)
             {
                 if (ga.first != gtick.first)  mtick.first = mtick.second = 0;
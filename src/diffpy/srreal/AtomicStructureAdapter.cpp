@@ -20,16 +20,27 @@
 #include <cassert>
 #include <algorithm>
 #include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
 
 #include <diffpy/serialization.ipp>
 #include <diffpy/srreal/AtomicStructureAdapter.hpp>
 #include <diffpy/srreal/StructureDifference.hpp>
+#include <diffpy/srreal/CellListBondGenerator.hpp>
 
 using std::string;
 
 namespace diffpy {
 namespace srreal {
 
+// Local Constants -----------------------------------------------------------
+
+namespace {
+
+/// minimum length of the change journal before old versions are dropped
+const size_t JOURNAL_MINIMUM_CAPACITY = 64;
+
+}   // namespace
+
 //////////////////////////////////////////////////////////////////////////////
 // class Atom
 //////////////////////////////////////////////////////////////////////////////
@@ -96,6 +107,68 @@ size_t hash_value(const Atom& a)
 // class AtomicStructureAdapter
 //////////////////////////////////////////////////////////////////////////////
 
+// Constructors --------------------------------------------------------------
+
+AtomicStructureAdapter::AtomicStructureAdapter()
+{ }
+
+
+/// The copy shares atom chunks with the source until they are modified.
+/// Chunks with mutable references in the source are copied right away.
+AtomicStructureAdapter::AtomicStructureAdapter(
+        const AtomicStructureAdapter& src) :
+    StructureAdapter(src),
+    mchunks(src.mchunks),
+    mexposedchunks(src.mexposedchunks),
+    mexposedsites(src.mexposedsites),
+    mjournal(src.mjournal)
+{
+    this->copyExposedChunks();
+}
+
+
+/// Atoms of chunks with mutable references are assigned in place so that
+/// the references stay valid when the number of atoms is unchanged.
+AtomicStructureAdapter&
+AtomicStructureAdapter::operator=(const AtomicStructureAdapter& src)
+{
+    using namespace std;
+    if (this == &src)  return *this;
+    this->StructureAdapter::operator=(src);
+    ChunkStorage chunks(src.mchunks);
+    vector<bool> exposedchunks(src.mexposedchunks);
+    const int nkeep = min(mchunks.size(), chunks.size());
+    for (int k = 0; k < nkeep; ++k)
+    {
+        if (!this->isExposedChunk(k))  continue;
+        if (mchunks[k]->size() == chunks[k]->size())
+        {
+            *mchunks[k] = *chunks[k];
+            chunks[k] = mchunks[k];
+        }
+        exposedchunks[k] = exposedchunks[k] || mexposedchunks[k];
+    }
+    SiteIndices exposedsites;
+    set_union(mexposedsites.begin(), mexposedsites.end(),
+            src.mexposedsites.begin(), src.mexposedsites.end(),
+            back_inserter(exposedsites));
+    mchunks.swap(chunks);
+    mexposedchunks.swap(exposedchunks);
+    mexposedsites.swap(exposedsites);
+    const int cntsites = this->countSites();
+    SiteIndices::iterator ii = lower_bound(
+            mexposedsites.begin(), mexposedsites.end(), cntsites);
+    mexposedsites.erase(ii, mexposedsites.end());
+    mjournal = src.mjournal;
+    // chunks with mutable references in src must not be shared
+    for (int k = 0; k < int(mchunks.size()); ++k)
+    {
+        if (mchunks[k] != src.mchunks[k])  continue;
+        if (src.isExposedChunk(k))  this->unshareChunk(k);
+    }
+    return *this;
+}
+
 // Public Methods ------------------------------------------------------------
 
 StructureAdapterPtr AtomicStructureAdapter::clone() const
@@ -107,52 +180,52 @@ StructureAdapterPtr AtomicStructureAdapter::clone() const
 
 BaseBondGeneratorPtr AtomicStructureAdapter::createBondGenerator() const
 {
-    BaseBondGeneratorPtr bnds(new BaseBondGenerator(shared_from_this()));
+    // use the cell list for large structures where it pays off
+    BaseBondGeneratorPtr bnds(this->countSites() < CELLLIST_MINIMUM_SITES ?
+            new BaseBondGenerator(shared_from_this()) :
+            new CellListBondGenerator(shared_from_this()));
     return bnds;
 }
 
 
 int AtomicStructureAdapter::countSites() const
 {
-    return matoms.size();
+    if (mchunks.empty())  return 0;
+    int rv = ((mchunks.size() - 1) << CHUNK_SHIFT) + mchunks.back()->size();
+    return rv;
 }
 
 
 const string& AtomicStructureAdapter::siteAtomType(int idx) const
 {
-    assert(0 <= idx && idx < this->countSites());
-    return matoms[idx].atomtype;
+    return (*this)[idx].atomtype;
 }
 
 
 const R3::Vector& AtomicStructureAdapter::siteCartesianPosition(int idx) const
 {
-    assert(0 <= idx && idx < this->countSites());
-    return matoms[idx].xyz_cartn;
+    return (*this)[idx].xyz_cartn;
 }
 
 
 double AtomicStructureAdapter::siteOccupancy(int idx) const
 {
-    assert(0 <= idx && idx < this->countSites());
-    return matoms[idx].occupancy;
+    return (*this)[idx].occupancy;
 }
 
 
 bool AtomicStructureAdapter::siteAnisotropy(int idx) const
 {
-    assert(0 <= idx && idx < this->countSites());
-    return matoms[idx].anisotropy;
+    return (*this)[idx].anisotropy;
 }
 
 
 const R3::Matrix& AtomicStructureAdapter::siteCartesianUij(int idx) const
 {
-    assert(0 <= idx && idx < this->countSites());
-    return matoms[idx].uij_cartn;
+    return (*this)[idx].uij_cartn;
 }
 
-// helper for diff
+// helpers for diff
 namespace {
 
 typedef std::pair<const Atom*, int> atomindex;
@@ -178,29 +251,45 @@ AtomicStructureAdapter::diff(StructureAdapterConstPtr other) const
     assert(pstru1);
     const AtomicStructureAdapter& astru0 = *pstru0;
     const AtomicStructureAdapter& astru1 = *pstru1;
+    // use the change journal when stru1 was derived from stru0
+    SiteIndices changed;
+    if (astru1.getChangedSites(changed, astru0.journalVersion()))
+    {
+        assert(astru0.countSites() == astru1.countSites());
+        sd.diffmethod = StructureDifference::Method::JOURNAL;
+        SiteIndices::const_iterator ii = changed.begin();
+        for (; ii != changed.end(); ++ii)
+        {
+            if (astru0[*ii] == astru1[*ii])  continue;
+            sd.pop0.push_back(*ii);
+            sd.add1.push_back(*ii);
+        }
+        return sd;
+    }
     sd.pop0.reserve(astru0.countSites());
     sd.add1.reserve(astru1.countSites());
     // try fast side-by-side comparison
     sd.diffmethod = StructureDifference::Method::SIDEBYSIDE;
-    const_iterator ai0 = astru0.matoms.begin();
-    const_iterator ai1 = astru1.matoms.begin();
-    int nboth = min(astru0.countSites(), astru1.countSites());
-    for (int i = 0; i < nboth; ++i, ++ai0, ++ai1)
+    const int cntsites0 = astru0.countSites();
+    const int cntsites1 = astru1.countSites();
+    const int nboth = min(cntsites0, cntsites1);
+    for (int i = 0; i < nboth; ++i)
     {
-        if (*ai0 != *ai1)
+        // skip over chunks shared by both structures
+        const int k = i >> CHUNK_SHIFT;
+        if (!(i & (CHUNK_SIZE - 1)) && astru0.mchunks[k] == astru1.mchunks[k])
+        {
+            i = min(i + CHUNK_SIZE, nboth) - 1;
+            continue;
+        }
+        if (astru0[i] != astru1[i])
         {
             sd.pop0.push_back(i);
             sd.add1.push_back(i);
         }
     }
-    for (int i = nboth; ai0 != astru0.matoms.end(); ++i, ++ai0)
-    {
-        sd.pop0.push_back(i);
-    }
-    for (int i = nboth; ai1 != astru1.matoms.end(); ++i, ++ai1)
-    {
-        sd.add1.push_back(i);
-    }
+    for (int i = nboth; i < cntsites0; ++i)  sd.pop0.push_back(i);
+    for (int i = nboth; i < cntsites1; ++i)  sd.add1.push_back(i);
     if (sd.allowsfastupdate())  return sd;
     // here the structures differ too much when compared side by side.
     // Let's compare assuming no relation in atom site order.
@@ -210,16 +299,16 @@ AtomicStructureAdapter::diff(StructureAdapterConstPtr other) const
     sd.diffmethod = StructureDifference::Method::SORTED;
     std::vector<atomindex> satoms0, satoms1;
     satoms0.reserve(astru0.countSites());
-    const_iterator ai = astru0.matoms.begin();
-    for (int i = 0; ai != astru0.matoms.end(); ++ai, ++i)
+    const_iterator ai = astru0.begin();
+    for (int i = 0; ai != astru0.end(); ++ai, ++i)
     {
         satoms0.push_back(atomindex(&(*ai), i));
     }
     // use negative index for stru1 atoms so we can tell them apart
     // in the output of set_symmetric_difference
     satoms1.reserve(astru1.countSites());
-    ai = astru1.matoms.begin();
-    for (int i = -1; ai != astru1.matoms.end(); ++ai, --i)
+    ai = astru1.begin();
+    for (int i = -1; ai != astru1.end(); ++ai, --i)
     {
         satoms1.push_back(atomindex(&(*ai), i));
     }
@@ -248,58 +337,246 @@ typedef AtomicStructureAdapter::iterator iterator;
 iterator AtomicStructureAdapter::insert(int idx, const Atom& atom)
 {
     assert(0 <= idx && idx <= this->countSites());
-    return this->insert(matoms.begin() + idx, atom);
+    this->spliceAtoms(idx, idx, AtomVector(1, atom));
+    return this->begin() + idx;
 }
 
 
 iterator AtomicStructureAdapter::insert(iterator ii, const Atom& atom)
 {
-    return matoms.insert(ii, atom);
+    return this->insert(ii.index(), atom);
 }
 
 
 void AtomicStructureAdapter::append(const Atom& atom)
 {
-    matoms.push_back(atom);
+    this->resetJournal();
+    if (mchunks.empty() || int(mchunks.back()->size()) == CHUNK_SIZE)
+    {
+        mchunks.push_back(boost::make_shared<AtomVector>());
+        mexposedchunks.push_back(false);
+    }
+    else  this->unshareChunk(mchunks.size() - 1);
+    mchunks.back()->push_back(atom);
 }
 
 
 void AtomicStructureAdapter::clear()
 {
-    matoms.clear();
+    this->resetJournal();
+    mchunks.clear();
+    mexposedchunks.clear();
+    mexposedsites.clear();
 }
 
 
 iterator AtomicStructureAdapter::erase(int idx)
 {
     assert(0 <= idx && idx < this->countSites());
-    return matoms.erase(matoms.begin() + idx);
+    this->spliceAtoms(idx, idx + 1, AtomVector());
+    return this->begin() + idx;
 }
 
 
 iterator AtomicStructureAdapter::erase(iterator pos)
 {
-    return matoms.erase(pos);
+    return this->erase(pos.index());
 }
 
 
 iterator AtomicStructureAdapter::erase(iterator first, iterator last)
 {
-    return matoms.erase(first, last);
+    const int idx = first.index();
+    this->spliceAtoms(idx, last.index(), AtomVector());
+    return this->begin() + idx;
 }
 
 
 Atom& AtomicStructureAdapter::operator[](int idx)
 {
     assert(0 <= idx && idx < this->countSites());
-    return matoms[idx];
+    this->unshareChunk(idx >> CHUNK_SHIFT);
+    this->touchSite(idx);
+    return (*mchunks[idx >> CHUNK_SHIFT])[idx & (CHUNK_SIZE - 1)];
 }
 
 
 const Atom& AtomicStructureAdapter::operator[](int idx) const
 {
     assert(0 <= idx && idx < this->countSites());
-    return matoms[idx];
+    return (*mchunks[idx >> CHUNK_SHIFT])[idx & (CHUNK_SIZE - 1)];
+}
+
+
+/// Return version of the change journal, which matches the version
+/// of structure copies made since the last site access.
+/// The version is zero when the journal has been reset.
+AtomicStructureAdapter::EventTicker
+AtomicStructureAdapter::journalVersion() const
+{
+    return mjournal.empty() ? EventTicker() : mjournal.back();
+}
+
+
+/// Retrieve sorted indices of sites that could change since
+/// the specified version of the change journal.  These are all sites
+/// with mutable references, because a reference can be written at any
+/// time after it was obtained.  Return false if the journal does not
+/// contain that version, for example, when sites were inserted or
+/// erased since then.  The output may include unchanged sites.
+bool AtomicStructureAdapter::getChangedSites(
+        SiteIndices& rv, const EventTicker& version) const
+{
+    using namespace std;
+    rv.clear();
+    if (!binary_search(mjournal.begin(), mjournal.end(), version))
+    {
+        return false;
+    }
+    const int cntsites = this->countSites();
+    SiteIndices::const_iterator ii = mexposedsites.begin();
+    for (int k = 0; k < int(mexposedchunks.size()); ++k)
+    {
+        const int lo = k << CHUNK_SHIFT;
+        const int hi = min(lo + int(CHUNK_SIZE), cntsites);
+        for (; ii != mexposedsites.end() && *ii < hi; ++ii)
+        {
+            if (!mexposedchunks[k])  rv.push_back(*ii);
+        }
+        for (int i = lo; mexposedchunks[k] && i < hi; ++i)  rv.push_back(i);
+    }
+    return true;
+}
+
+// Private Methods -----------------------------------------------------------
+
+/// Record mutable access to site idx in the change journal.
+void AtomicStructureAdapter::touchSite(int idx)
+{
+    using namespace std;
+    // old versions are dropped, their copies get compared in full
+    const size_t capacity =
+        max(JOURNAL_MINIMUM_CAPACITY, size_t(this->countSites()));
+    if (mjournal.size() >= capacity)
+    {
+        mjournal.erase(mjournal.begin(), mjournal.begin() + capacity / 2);
+    }
+    mjournal.push_back(EventTicker());
+    mjournal.back().click();
+    // remember the site of the new reference
+    const int k = idx >> CHUNK_SHIFT;
+    if (mexposedchunks[k])  return;
+    SiteIndices::iterator ii = lower_bound(
+            mexposedsites.begin(), mexposedsites.end(), idx);
+    if (ii != mexposedsites.end() && *ii == idx)  return;
+    // mark whole chunks when there are too many sites to keep sorted
+    if (mexposedsites.size() >= size_t(CHUNK_SIZE))
+    {
+        for (ii = mexposedsites.begin(); ii != mexposedsites.end(); ++ii)
+        {
+            mexposedchunks[*ii >> CHUNK_SHIFT] = true;
+        }
+        mexposedsites.clear();
+        mexposedchunks[k] = true;
+        return;
+    }
+    mexposedsites.insert(ii, idx);
+}
+
+
+/// Check if there can be mutable references to atoms in chunk k.
+bool AtomicStructureAdapter::isExposedChunk(int k) const
+{
+    using namespace std;
+    if (mexposedchunks[k])  return true;
+    SiteIndices::const_iterator ii = lower_bound(
+            mexposedsites.begin(), mexposedsites.end(), k << CHUNK_SHIFT);
+    bool rv = (ii != mexposedsites.end() && (*ii >> CHUNK_SHIFT) == k);
+    return rv;
+}
+
+
+/// Use private copies of chunks that may be written through references
+/// obtained from another structure.
+void AtomicStructureAdapter::copyExposedChunks()
+{
+    for (int k = 0; k < int(mchunks.size()); ++k)
+    {
+        if (!this->isExposedChunk(k))  continue;
+        mchunks[k] = boost::make_shared<AtomVector>(*mchunks[k]);
+    }
+}
+
+
+/// Make chunk k private to this structure before its modification.
+void AtomicStructureAdapter::unshareChunk(int k)
+{
+    AtomChunkPtr& chunk = mchunks[k];
+    if (chunk.use_count() > 1)
+    {
+        chunk = boost::make_shared<AtomVector>(*chunk);
+    }
+}
+
+
+/// Mutable iterators can modify any atom.  Make all chunks private
+/// and mark them as exposed to changes.
+void AtomicStructureAdapter::prepareMutableIteration()
+{
+    for (int k = 0; k < int(mchunks.size()); ++k)  this->unshareChunk(k);
+    mexposedchunks.assign(mchunks.size(), true);
+    mexposedsites.clear();
+}
+
+
+/// Replace atoms in the index range [first, last) with new atoms.
+/// Chunks before the first changed chunk are kept and may stay shared.
+/// References to atoms from the first changed chunk become invalid.
+void AtomicStructureAdapter::spliceAtoms(
+        int first, int last, const AtomVector& atoms)
+{
+    using std::min;
+    this->resetJournal();
+    const int cntsites = this->countSites();
+    assert(0 <= first && first <= last && last <= cntsites);
+    const AtomicStructureAdapter& cthis = *this;
+    const int k0 = first >> CHUNK_SHIFT;
+    AtomVector tail;
+    tail.reserve((first - (k0 << CHUNK_SHIFT)) +
+            atoms.size() + (cntsites - last));
+    for (int i = k0 << CHUNK_SHIFT; i < first; ++i)  tail.push_back(cthis[i]);
+    tail.insert(tail.end(), atoms.begin(), atoms.end());
+    for (int i = last; i < cntsites; ++i)  tail.push_back(cthis[i]);
+    mchunks.resize(k0);
+    mexposedchunks.resize(k0);
+    SiteIndices::iterator ii = lower_bound(
+            mexposedsites.begin(), mexposedsites.end(), k0 << CHUNK_SHIFT);
+    mexposedsites.erase(ii, mexposedsites.end());
+    AtomVector::const_iterator ai = tail.begin();
+    while (ai != tail.end())
+    {
+        int n = min(int(CHUNK_SIZE), int(tail.end() - ai));
+        mchunks.push_back(boost::make_shared<AtomVector>(ai, ai + n));
+        mexposedchunks.push_back(false);
+        ai += n;
+    }
+}
+
+// Comparison functions ------------------------------------------------------
+
+bool operator==(
+        const AtomicStructureAdapter& stru0,
+        const AtomicStructureAdapter& stru1)
+{
+    if (stru0.countSites() != stru1.countSites())  return false;
+    // equal site counts imply the same layout of chunks
+    assert(stru0.mchunks.size() == stru1.mchunks.size());
+    for (size_t k = 0; k < stru0.mchunks.size(); ++k)
+    {
+        if (stru0.mchunks[k] == stru1.mchunks[k])  continue;
+        if (*stru0.mchunks[k] != *stru1.mchunks[k])  return false;
+    }
+    return true;
 }
 
 }   // namespace srreal
@@ -21,8 +21,13 @@
 #define ATOMICSTRUCTUREADAPTER_HPP_INCLUDED
 
 #include <boost/serialization/vector.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/type_traits/is_convertible.hpp>
+#include <boost/utility/enable_if.hpp>
 
 #include <diffpy/srreal/StructureAdapter.hpp>
+#include <diffpy/EventTicker.hpp>
 
 namespace diffpy {
 namespace srreal {
@@ -76,16 +81,83 @@ size_t hash_value(const Atom&);
 
 class AtomicStructureAdapter : public StructureAdapter
 {
+    private:
+
+        // atoms are kept in shared chunks that are copied on write
+        enum { CHUNK_SHIFT = 8, CHUNK_SIZE = 1 << CHUNK_SHIFT };
+        typedef boost::shared_ptr< std::vector<Atom> > AtomChunkPtr;
+        typedef std::vector<AtomChunkPtr> ChunkStorage;
+
+        /// random access iterator over atoms in chunked storage
+        template <class V>
+        class ChunkIterator : public boost::iterator_facade<
+                              ChunkIterator<V>, V,
+                              boost::random_access_traversal_tag>
+        {
+            public:
+
+                ChunkIterator() : mchunks(NULL), midx(0)  { }
+                ChunkIterator(const ChunkStorage* chunks, int idx) :
+                    mchunks(chunks), midx(idx)
+                { }
+                // conversion from mutable to constant iterator
+                template <class V1>
+                ChunkIterator(const ChunkIterator<V1>& other,
+                        typename boost::enable_if<
+                        boost::is_convertible<V1*, V*> >::type* = NULL) :
+                    mchunks(other.mchunks), midx(other.midx)
+                { }
+
+                int index() const  { return midx; }
+
+            private:
+
+                friend class boost::iterator_core_access;
+                template <class> friend class ChunkIterator;
+
+                V& dereference() const
+                {
+                    return (*(*mchunks)[midx >> CHUNK_SHIFT])
+                        [midx & (CHUNK_SIZE - 1)];
+                }
+
+                template <class V1>
+                bool equal(const ChunkIterator<V1>& other) const
+                {
+                    return midx == other.midx;
+                }
+
+                void increment()  { ++midx; }
+                void decrement()  { --midx; }
+                void advance(std::ptrdiff_t n)  { midx += n; }
+
+                template <class V1>
+                std::ptrdiff_t distance_to(const ChunkIterator<V1>& other) const
+                {
+                    return other.midx - midx;
+                }
+
+                // data
+                const ChunkStorage* mchunks;
+                int midx;
+        };
+
     public:
 
         typedef std::vector<Atom> AtomVector;
         typedef AtomVector::value_type value_type;
-        typedef AtomVector::iterator iterator;
-        typedef AtomVector::const_iterator const_iterator;
-        typedef AtomVector::reverse_iterator reverse_iterator;
-        typedef AtomVector::const_reverse_iterator const_reverse_iterator;
+        typedef ChunkIterator<Atom> iterator;
+        typedef ChunkIterator<const Atom> const_iterator;
+        typedef std::reverse_iterator<iterator> reverse_iterator;
+        typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
         typedef AtomVector::difference_type difference_type;
         typedef AtomVector::size_type size_type;
+        typedef diffpy::eventticker::EventTicker EventTicker;
+
+        // constructors
+        AtomicStructureAdapter();
+        AtomicStructureAdapter(const AtomicStructureAdapter&);
+        AtomicStructureAdapter& operator=(const AtomicStructureAdapter&);
 
         // methods - overloaded
         virtual StructureAdapterPtr clone() const;
@@ -104,59 +176,117 @@ class AtomicStructureAdapter : public StructureAdapter
         template <class Iter>
         void insert(iterator position, Iter first, Iter last)
         {
-            matoms.insert(position, first, last);
+            const int idx = position.index();
+            this->spliceAtoms(idx, idx, AtomVector(first, last));
         }
         void append(const Atom&);
         void clear();
         iterator erase(int idx);
         iterator erase(iterator pos);
         iterator erase(iterator first, iterator last);
-        void reserve(size_t sz)  { matoms.reserve(sz); }
-        size_type size() const  { return matoms.size(); }
+        void reserve(size_t sz)  { mchunks.reserve(sz / CHUNK_SIZE + 1); }
+        size_type size() const  { return this->countSites(); }
+        // mutable references and iterators stay valid until atoms are
+        // inserted or removed.  Copies do not share chunks with such
+        // references and diff checks all their sites.
         Atom& operator[](int);
         const Atom& operator[](int) const;
         Atom& at(int idx)  { return (*this)[idx]; }
         const Atom& at(int idx) const  { return (*this)[idx]; }
         template <class Iter>
-            void assign (Iter first, Iter last)  { matoms.assign(first, last); }
-        void assign (size_t n, const Atom& a)  { matoms.assign(n, a); }
-        // iterator forwarding
-        iterator begin()  { return matoms.begin(); }
-        iterator end()  { return matoms.end(); }
-        const_iterator begin() const  { return matoms.begin(); }
-        const_iterator end() const  { return matoms.end(); }
-        reverse_iterator rbegin()  { return matoms.rbegin(); }
-        reverse_iterator rend()  { return matoms.rend(); }
-        const_reverse_iterator rbegin() const  { return matoms.rbegin(); }
-        const_reverse_iterator rend() const  { return matoms.rend(); }
+            void assign (Iter first, Iter last)
+        {
+            this->spliceAtoms(0, this->countSites(), AtomVector(first, last));
+        }
+        void assign (size_t n, const Atom& a)
+        {
+            this->spliceAtoms(0, this->countSites(), AtomVector(n, a));
+        }
+        // iterator forwarding, the mutable iterators mark all atoms
+        // as changed for the change journal
+        iterator begin()
+        {
+            this->prepareMutableIteration();
+            return iterator(&mchunks, 0);
+        }
+        iterator end()
+        {
+            this->prepareMutableIteration();
+            return iterator(&mchunks, this->countSites());
+        }
+        const_iterator begin() const  { return const_iterator(&mchunks, 0); }
+        const_iterator end() const
+        {
+            return const_iterator(&mchunks, this->countSites());
+        }
+        reverse_iterator rbegin()  { return reverse_iterator(this->end()); }
+        reverse_iterator rend()  { return reverse_iterator(this->begin()); }
+        const_reverse_iterator rbegin() const
+        {
+            return const_reverse_iterator(this->end());
+        }
+        const_reverse_iterator rend() const
+        {
+            return const_reverse_iterator(this->begin());
+        }
+        // change journal
+        EventTicker journalVersion() const;
+        bool getChangedSites(SiteIndices& rv, const EventTicker& version) const;
 
     private:
 
+        // types
+        typedef std::vector<EventTicker> JournalStorage;
+
         // data
-        AtomVector matoms;
+        ChunkStorage mchunks;
+        /// chunks where any atom may be changed through mutable references
+        std::vector<bool> mexposedchunks;
+        /// sorted sites that may be changed through mutable references
+        SiteIndices mexposedsites;
+        JournalStorage mjournal;
+
+        // methods
+        void touchSite(int idx);
+        void resetJournal()  { mjournal.clear(); }
+        bool isExposedChunk(int k) const;
+        void copyExposedChunks();
+        void unshareChunk(int k);
+        void prepareMutableIteration();
+        void spliceAtoms(int first, int last, const AtomVector& atoms);
 
         // comparison
         friend bool operator==(
-                const AtomicStructureAdapter& stru0,
-                const AtomicStructureAdapter& stru1)
-        {
-            return (stru0.matoms == stru1.matoms);
-        }
+                const AtomicStructureAdapter&, const AtomicStructureAdapter&);
 
         // serialization
         friend class boost::serialization::access;
         template<class Archive>
-            void serialize(Archive& ar, const unsigned int version)
+            void save(Archive& ar, const unsigned int version) const
+        {
+            ar << boost::serialization::base_object<StructureAdapter>(*this);
+            AtomVector atoms(this->begin(), this->end());
+            ar << atoms;
+        }
+
+        template<class Archive>
+            void load(Archive& ar, const unsigned int version)
         {
-            ar & boost::serialization::base_object<StructureAdapter>(*this);
-            ar & matoms;
+            ar >> boost::serialization::base_object<StructureAdapter>(*this);
+            AtomVector atoms;
+            ar >> atoms;
+            this->spliceAtoms(0, this->countSites(), atoms);
         }
 
+        BOOST_SERIALIZATION_SPLIT_MEMBER()
+
 };
 
 typedef boost::shared_ptr<AtomicStructureAdapter> AtomicStructureAdapterPtr;
 
-// Complementary comparison function
+// Comparison functions
+
+bool operator==(const AtomicStructureAdapter&, const AtomicStructureAdapter&);
 
 inline
 bool operator!=(
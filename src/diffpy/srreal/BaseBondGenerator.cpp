@@ -39,6 +39,9 @@ BaseBondGenerator::BaseBondGenerator(StructureAdapterConstPtr stru)
     msite_first = msite_all.begin();
     msite_last = msite_all.end();
     msite_current = msite_first;
+    mselection_isrange = true;
+    mselection_rangefirst = 0;
+    mselection_ranks_dirty = true;
     mstructure = stru;
     this->setRmin(0.0);
     this->setRmax(DEFAULT_BONDGENERATOR_RMAX);
@@ -87,6 +90,8 @@ void BaseBondGenerator::selectSiteRange(int first, int last)
     assert(last <= mstructure->countSites());
     msite_first = msite_all.begin() + first;
     msite_last = msite_all.begin() + last;
+    mselection_isrange = true;
+    mselection_rangefirst = first;
     this->setFinishedFlag();
 }
 
@@ -96,6 +101,8 @@ void BaseBondGenerator::selectSites(const SiteIndices& selection)
     msite_selection = selection;
     msite_first = msite_selection.begin();
     msite_last = msite_selection.end();
+    mselection_isrange = false;
+    mselection_ranks_dirty = true;
     this->setFinishedFlag();
 }
 
@@ -106,6 +113,8 @@ void BaseBondGenerator::selectSites(
 {
     msite_first = first;
     msite_last = last;
+    mselection_isrange = false;
+    mselection_ranks_dirty = true;
     this->setFinishedFlag();
 }
 
@@ -191,10 +200,21 @@ const R3::Matrix& BaseBondGenerator::Ucartesian1() const
 }
 
 
+const R3::Matrix& BaseBondGenerator::Rcartesian0() const
+{
+    return R3::identity();
+}
+
+
+const R3::Matrix& BaseBondGenerator::Rcartesian1() const
+{
+    return R3::identity();
+}
+
+
 double BaseBondGenerator::msd() const
 {
-    static R3::Vector s;
-    s = this->r01();
+    const R3::Vector& s = this->r01();
     double msd0 = meanSquareDisplacement(this->Ucartesian0(), s,
             mstructure->siteAnisotropy(this->site0()));
     double msd1 = meanSquareDisplacement(this->Ucartesian1(), s,
@@ -235,7 +255,6 @@ void BaseBondGenerator::updateDistance()
     mdistance = R3::norm(mr01);
 }
 
-// Private Methods -----------------------------------------------------------
 
 void BaseBondGenerator::advanceWhileInvalid()
 {
@@ -246,6 +265,27 @@ void BaseBondGenerator::advanceWhileInvalid()
     }
 }
 
+
+/// Append positions of the site in the current site selection.
+/// Positions are added in an increasing order.
+void BaseBondGenerator::appendSelectionPositions(
+        int site, SiteIndices& positions)
+{
+    if (mselection_isrange)
+    {
+        int pos = site - mselection_rangefirst;
+        if (0 <= pos && pos < msite_last - msite_first)
+        {
+            positions.push_back(pos);
+        }
+        return;
+    }
+    if (mselection_ranks_dirty)  this->updateSelectionRanks();
+    positions.insert(positions.end(),
+            mselection_ranks.begin() + mselection_rankstart[site],
+            mselection_ranks.begin() + mselection_rankstart[site + 1]);
+}
+
 // Private Methods -----------------------------------------------------------
 
 bool BaseBondGenerator::bondOutOfRange() const
@@ -268,6 +308,30 @@ void BaseBondGenerator::setFinishedFlag()
     msite_current = msite_last;
 }
 
+
+void BaseBondGenerator::updateSelectionRanks()
+{
+    const int cntsites = mstructure->countSites();
+    mselection_rankstart.assign(cntsites + 1, 0);
+    SiteIndices::const_iterator ii;
+    for (ii = msite_first; ii != msite_last; ++ii)
+    {
+        ++mselection_rankstart[*ii + 1];
+    }
+    for (int i = 0; i < cntsites; ++i)
+    {
+        mselection_rankstart[i + 1] += mselection_rankstart[i];
+    }
+    mselection_ranks.resize(msite_last - msite_first);
+    SiteIndices rankfill(
+            mselection_rankstart.begin(), mselection_rankstart.end() - 1);
+    for (ii = msite_first; ii != msite_last; ++ii)
+    {
+        mselection_ranks[rankfill[*ii]++] = ii - msite_first;
+    }
+    mselection_ranks_dirty = false;
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
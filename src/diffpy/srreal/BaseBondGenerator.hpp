@@ -45,9 +45,9 @@ class BaseBondGenerator
 
         // configuration
         virtual void selectAnchorSite(int);
-        void selectSiteRange(int first, int last);
-        void selectSites(const SiteIndices&);
-        void selectSites(
+        virtual void selectSiteRange(int first, int last);
+        virtual void selectSites(const SiteIndices&);
+        virtual void selectSites(
                 SiteIndices::const_iterator first,
                 SiteIndices::const_iterator last);
         virtual void setRmin(double);
@@ -66,6 +66,11 @@ class BaseBondGenerator
         virtual const R3::Matrix& Ucartesian0() const;
         virtual const R3::Matrix& Ucartesian1() const;
         double msd() const;
+        /// Cartesian matrix that transforms a displacement of the site
+        /// to a displacement of the bonded atom.  This is an identity
+        /// unless the atom is a symmetry image of the site.
+        virtual const R3::Matrix& Rcartesian0() const;
+        virtual const R3::Matrix& Rcartesian1() const;
 
     protected:
 
@@ -89,11 +94,23 @@ class BaseBondGenerator
         virtual void rewindSymmetry();
         virtual void getNextBond();
         void updateDistance();
+        void advanceWhileInvalid();
+        void appendSelectionPositions(int site, SiteIndices& positions);
 
     private:
 
+        // data
+        // positions of sites in a general selection stored as compressed
+        // row, mselection_ranks[k] for k in [mselection_rankstart[i],
+        // mselection_rankstart[i + 1]) are the positions of site i.
+        bool mselection_isrange;
+        int mselection_rangefirst;
+        bool mselection_ranks_dirty;
+        SiteIndices mselection_rankstart;
+        SiteIndices mselection_ranks;
+
         // methods
-        void advanceWhileInvalid();
+        void updateSelectionRanks();
         bool bondOutOfRange() const;
         bool atSelfPair() const;
         void setFinishedFlag();
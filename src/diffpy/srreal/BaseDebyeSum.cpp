@@ -16,13 +16,17 @@
 *
 *****************************************************************************/
 
+#include <cmath>
 #include <cassert>
+#include <algorithm>
 #include <string>
 #include <stdexcept>
 #include <sstream>
 #include <functional>
+#include <boost/unordered_map.hpp>
 
 #include <diffpy/srreal/BaseDebyeSum.hpp>
+#include <diffpy/srreal/BondBatch.hpp>
 #include <diffpy/mathutils.hpp>
 #include <diffpy/validators.hpp>
 #include <diffpy/serialization.ipp>
@@ -31,6 +35,7 @@ using namespace std;
 using namespace diffpy::validators;
 using diffpy::mathutils::eps_gt;
 using diffpy::mathutils::eps_eq;
+using diffpy::mathutils::DOUBLE_MAX;
 
 namespace diffpy {
 namespace srreal {
@@ -42,11 +47,165 @@ namespace {
 /// Default cutoff for the Q-decreasing scale of the sine contributions.
 const double DEFAULT_DEBYE_PRECISION = 1e-6;
 
+/// Relative error of the binned summation is about the fourth cumulant
+/// term of the distances in one bin, (qmax * binwidth)**4 / 192.
+const double DEBYE_BINNING_ERRORSCALE = 1.0 / 192;
+
+/// Maximum number of distance bins for one atom type pair.
+const int DEBYE_BINNING_MAXBINS = 1 << 24;
+
+/// Maximum number of atom types for the summation by type pairs.
+const int DEBYE_TYPEPAIR_MAXTYPES = 16;
+
+/// Number of recurrence steps between exact evaluations of sin and exp.
+const int DEBYE_RESYNC = 16;
+
+/// Number of consecutive Q-points advanced together by the recurrence.
+const int DEBYE_LANES = 4;
+
+/// Damped sine exp(-sigma2 * q**2 / 2) * sin(q * dist - c3 * q**3)
+/// at DEBYE_LANES consecutive points q = (kq + j) * qstep.  Each lane is
+/// advanced by DEBYE_LANES Q-points with a rotation of its (cos, sin)
+/// pair and a ratio of the Gaussian damping.  The lanes are independent
+/// so that the compiler can vectorize the advance across the Q-grid.
+/// The cubic phase term uses a nested rotation of the phase increments.
+/// Call seed to evaluate the terms exactly at kq, ..., kq + DEBYE_LANES - 1.
+class DampedSineRecurrence
+{
+    public:
+
+        // constructor
+        DampedSineRecurrence(double qstep, double dist,
+                double sigma2, double c3) :
+            mqstep(qstep), mdist(dist), msigma2(sigma2), mc3(c3),
+            mcubic(c3 != 0.0)
+        {
+            const double hl = DEBYE_LANES * mqstep;
+            mdwratio2 = exp(-msigma2 * hl * hl);
+            const double h3 = mqstep * mqstep * mqstep;
+            const double l3 = DEBYE_LANES * DEBYE_LANES * DEBYE_LANES;
+            mrot3sin = sin(-6 * mc3 * h3 * l3);
+            mrot3cos = cos(-6 * mc3 * h3 * l3);
+            for (int j = 0; j < DEBYE_LANES; ++j)
+            {
+                msine[j] = 0.0;
+                mcosine[j] = 1.0;
+                mrotsin[j] = sin(hl * mdist);
+                mrotcos[j] = cos(hl * mdist);
+                mrot2sin[j] = 0.0;
+                mrot2cos[j] = 1.0;
+                mdw[j] = 1.0;
+                mdwratio[j] = 1.0;
+            }
+        }
+
+        // methods
+        void seed(int kq)
+        {
+            const double h = mqstep;
+            const double hl = DEBYE_LANES * h;
+            const double h3 = h * h * h;
+            const double nl = DEBYE_LANES;
+            for (int j = 0; j < DEBYE_LANES; ++j)
+            {
+                const double k = kq + j;
+                const double q = k * h;
+                const double phi = q * mdist - mc3 * q * q * q;
+                msine[j] = sin(phi);
+                mcosine[j] = cos(phi);
+                mdw[j] = exp(-0.5 * msigma2 * q * q);
+                mdwratio[j] = exp(-0.5 * msigma2 * hl * (2 * q + hl));
+                if (!mcubic)  continue;
+                // first and second differences of the phase at k
+                // for the step of DEBYE_LANES points
+                const double d1phi = hl * mdist -
+                    mc3 * h3 * nl * (3.0 * k * k + 3.0 * k * nl + nl * nl);
+                const double d2phi = -mc3 * h3 * 6 * nl * nl * (k + nl);
+                mrotsin[j] = sin(d1phi);
+                mrotcos[j] = cos(d1phi);
+                mrot2sin[j] = sin(d2phi);
+                mrot2cos[j] = cos(d2phi);
+            }
+        }
+
+
+        void advance()
+        {
+            for (int j = 0; j < DEBYE_LANES; ++j)
+            {
+                const double s = msine[j] * mrotcos[j] +
+                    mcosine[j] * mrotsin[j];
+                mcosine[j] = mcosine[j] * mrotcos[j] - msine[j] * mrotsin[j];
+                msine[j] = s;
+                mdw[j] *= mdwratio[j];
+                mdwratio[j] *= mdwratio2;
+            }
+            if (!mcubic)  return;
+            for (int j = 0; j < DEBYE_LANES; ++j)
+            {
+                const double rs = mrotsin[j] * mrot2cos[j] +
+                    mrotcos[j] * mrot2sin[j];
+                mrotcos[j] = mrotcos[j] * mrot2cos[j] -
+                    mrotsin[j] * mrot2sin[j];
+                mrotsin[j] = rs;
+                const double r2s = mrot2sin[j] * mrot3cos +
+                    mrot2cos[j] * mrot3sin;
+                mrot2cos[j] = mrot2cos[j] * mrot3cos - mrot2sin[j] * mrot3sin;
+                mrot2sin[j] = r2s;
+            }
+        }
+
+
+        /// Advance to the lanes starting at kq, where kq - kqlo
+        /// is a multiple of DEBYE_LANES.
+        void moveTo(int kq, int kqlo)
+        {
+            const int nk = (kq - kqlo) / DEBYE_LANES;
+            if (nk % DEBYE_RESYNC)  this->advance();
+            else  this->seed(kq);
+        }
+
+
+        const double* damping() const  { return mdw; }
+        const double* sine() const  { return msine; }
+        const double* cosine() const  { return mcosine; }
+
+    private:
+
+        // data
+        const double mqstep;
+        const double mdist;
+        const double msigma2;
+        const double mc3;
+        const bool mcubic;
+        double msine[DEBYE_LANES];
+        double mcosine[DEBYE_LANES];
+        double mrotsin[DEBYE_LANES];
+        double mrotcos[DEBYE_LANES];
+        double mrot2sin[DEBYE_LANES];
+        double mrot2cos[DEBYE_LANES];
+        double mrot3sin;
+        double mrot3cos;
+        double mdw[DEBYE_LANES];
+        double mdwratio[DEBYE_LANES];
+        double mdwratio2;
+};
+
+
+/// Number of leading values in x[0:n] that are above the cutoff precision.
+int countAboveCutoff(const double* x, int n, double prec)
+{
+    int rv = 0;
+    while (rv < n && !eps_eq(0.0, x[rv], prec))  ++rv;
+    return rv;
+}
+
 }   // namespace
 
 // Constructor ---------------------------------------------------------------
 
-BaseDebyeSum::BaseDebyeSum()
+BaseDebyeSum::BaseDebyeSum() :
+    mdistancebinning(false), mgradientmode(false), mpartialsmode(false)
 {
     // default configuration
     this->setPeakWidthModelByType("jeong");
@@ -54,6 +213,8 @@ BaseDebyeSum::BaseDebyeSum()
     this->setQmax(DEFAULT_QGRID_QMAX);
     this->setQstep(DEFAULT_QGRID_QSTEP);
     this->setDebyePrecision(DEFAULT_DEBYE_PRECISION);
+    mdistancebins.binwidth = 0.0;
+    mdistancebins.isempty = true;
     // attributes
     this->registerDoubleAttribute("debyeprecision", this,
             &BaseDebyeSum::getDebyePrecision,
@@ -70,19 +231,27 @@ eventticker::EventTicker& BaseDebyeSum::ticker() const
     return mticker;
 }
 
+
+string BaseDebyeSum::getParallelData() const
+{
+    QuantityType pvalues(this->countParallelValues());
+    if (!pvalues.empty())  this->packParallelValues(&pvalues[0]);
+    ostringstream storage(ios::binary);
+    diffpy::serialization::oarchive oa(storage, ios::binary);
+    oa << pvalues;
+    return storage.str();
+}
+
 // results
 
 QuantityType BaseDebyeSum::getF() const
 {
     QuantityType rv = this->value();
-    const double& totocc = mstructure_cache.totaloccupancy;
+    const QuantityType fscale = this->fscaleAtkQ();
     const int npts = pdfutils_qmaxSteps(this);
     for (int kq = pdfutils_qminSteps(this); kq < npts; ++kq)
     {
-        double sfavg = this->sfAverageAtkQ(kq);
-        double fscale = (sfavg * totocc) == 0 ? 0.0 :
-            1.0 / (sfavg * sfavg * totocc);
-        rv[kq] *= fscale;
+        rv[kq] *= fscale[kq];
     }
     return rv;
 }
@@ -150,15 +319,171 @@ const double& BaseDebyeSum::getDebyePrecision() const
     return mdebyeprecision;
 }
 
+
+void BaseDebyeSum::setDistanceBinning(bool flag)
+{
+    if (mdistancebinning != flag)  mticker.click();
+    mdistancebinning = flag;
+}
+
+
+bool BaseDebyeSum::getDistanceBinning() const
+{
+    return mdistancebinning;
+}
+
+// derivatives with respect to the site parameters
+
+void BaseDebyeSum::setGradientMode(bool flag)
+{
+    if (flag)  this->checkGradientSupport();
+    if (mgradientmode != flag)  mticker.click();
+    mgradientmode = flag;
+}
+
+
+bool BaseDebyeSum::getGradientMode() const
+{
+    return mgradientmode;
+}
+
+
+vector<QuantityType> BaseDebyeSum::getFGradients() const
+{
+    vector<QuantityType> rv;
+    const int npts = pdfutils_qmaxSteps(this);
+    const int ngrad = npts ? int(mgradient.size() / npts) : 0;
+    if (!ngrad)  return rv;
+    const QuantityType fscale = this->fscaleAtkQ();
+    rv.reserve(ngrad);
+    for (int p = 0; p < ngrad; ++p)
+    {
+        QuantityType::const_iterator g = mgradient.begin() + p * npts;
+        rv.push_back(QuantityType(g, g + npts));
+        QuantityType& f = rv.back();
+        for (int kq = pdfutils_qminSteps(this); kq < npts; ++kq)
+        {
+            f[kq] *= fscale[kq];
+        }
+    }
+    return rv;
+}
+
+// partial F for the pairs of atom types
+
+void BaseDebyeSum::setPartialsMode(bool flag)
+{
+    if (mpartialsmode != flag)  mticker.click();
+    mpartialsmode = flag;
+}
+
+
+bool BaseDebyeSum::getPartialsMode() const
+{
+    return mpartialsmode;
+}
+
+
+vector< pair<string, string> > BaseDebyeSum::getPartialTypePairs() const
+{
+    return mpartials.getTypePairs();
+}
+
+
+vector<QuantityType> BaseDebyeSum::getPartialFs() const
+{
+    vector<QuantityType> rv;
+    const int npts = mpartials.countPoints();
+    const int npairs = npts ? mpartials.countTypePairs() : 0;
+    if (!npairs)  return rv;
+    const QuantityType fscale = this->fscaleAtkQ();
+    assert(npts == int(fscale.size()));
+    rv.reserve(npairs);
+    for (int p = 0; p < npairs; ++p)
+    {
+        const double* v = mpartials.at(p);
+        rv.push_back(QuantityType(v, v + npts));
+        QuantityType& f = rv.back();
+        for (int kq = pdfutils_qminSteps(this); kq < npts; ++kq)
+        {
+            f[kq] *= fscale[kq];
+        }
+    }
+    return rv;
+}
+
+
+vector<QuantityType> BaseDebyeSum::getPartialDebyeSums() const
+{
+    vector<QuantityType> rv;
+    const int npts = mpartialsums.countPoints();
+    const int npairs = npts ? mpartialsums.countTypePairs() : 0;
+    if (!npairs)  return rv;
+    const double& totocc = mstructure_cache.totaloccupancy;
+    const double scale = (totocc == 0) ? 0.0 : (1.0 / totocc);
+    rv.reserve(npairs);
+    for (int p = 0; p < npairs; ++p)
+    {
+        const double* v = mpartialsums.at(p);
+        rv.push_back(QuantityType(v, v + npts));
+        QuantityType& s = rv.back();
+        for (int kq = pdfutils_qminSteps(this); kq < npts; ++kq)
+        {
+            s[kq] *= scale;
+        }
+    }
+    return rv;
+}
+
 // Protected Methods ---------------------------------------------------------
 
 // PairQuantity overloads
 
 void BaseDebyeSum::resetValue()
 {
+    // check derivatives support before any data are changed
+    if (mgradientmode)  this->checkGradientSupport();
     this->cacheStructureData();
     this->resizeValue(pdfutils_qmaxSteps(this));
     this->PairQuantity::resetValue();
+    // distance histograms for every pair of atom types
+    const int ntypes = mstructure_cache.sftypeatkq.size();
+    mdistancebins.typepairbins.clear();
+    mdistancebins.typepairbins.resize(ntypes * ntypes);
+    mdistancebins.isempty = true;
+    const double qmaxcalc = pdfutils_qmaxSteps(this) * this->getQstep();
+    double bw = pow(this->getDebyePrecision() / DEBYE_BINNING_ERRORSCALE,
+            0.25) / qmaxcalc;
+    mdistancebins.binwidth = (bw > 0 && bw < DOUBLE_MAX) ? bw : 0.0;
+    // sine sums for every pair of atom types unless there are too many
+    const int npairs = (ntypes <= DEBYE_TYPEPAIR_MAXTYPES) ?
+        (ntypes * ntypes) : 0;
+    mtypepairsums.sfproduct.clear();
+    mtypepairsums.sfproduct.resize(npairs);
+    mtypepairsums.sinesums.clear();
+    mtypepairsums.sinesums.resize(npairs);
+    mtypepairsums.used.clear();
+    size_t ngradpts = mgradientmode ? (GRADIENT_SITE_PARAMS *
+            this->countSites() * pdfutils_qmaxSteps(this)) : 0;
+    mgradient.assign(ngradpts, 0.0);
+    // partial sums use atom types without the site occupancies
+    if (mpartialsmode)
+    {
+        mpartials.reset(*mstructure, pdfutils_qmaxSteps(this));
+        mpartialsums.reset(*mstructure, pdfutils_qmaxSteps(this));
+    }
+    else
+    {
+        mpartials.clear();
+        mpartialsums.clear();
+    }
+    vector<int>& ptype = mstructure_cache.partialtype;
+    ptype.assign(mpartialsmode ? ntypes : 0, -1);
+    const int cntsites = mpartialsmode ? this->countSites() : 0;
+    for (int i = 0; i < cntsites; ++i)
+    {
+        ptype[mstructure_cache.typeofsite[i]] = mpartials.typeIndexOfSite(i);
+    }
 }
 
 
@@ -167,29 +492,133 @@ void BaseDebyeSum::addPairContribution(const BaseBondGenerator& bnds,
 {
     const double dist = bnds.distance();
     if (eps_eq(0.0, dist))  return;
+    if (mgradientmode)
+    {
+        const int smscale = summationscale * bnds.multiplicity();
+        return this->addDampedSinesGradient(bnds, smscale);
+    }
     // calculate sigma parameter for the Debye-Waller dampign Gaussian
     const double fwhm = this->getPeakWidthModel()->calculate(bnds);
     const double fwhmtosigma = 1.0 / (2 * sqrt(2 * M_LN2));
     const double dwsigma = fwhmtosigma * fwhm;
-    const int nqpts = pdfutils_qmaxSteps(this);
     const int smscale = summationscale * bnds.multiplicity();
-    const double& sineprec = this->getDebyePrecision();
-    for (int kq = pdfutils_qminSteps(this); kq < nqpts; ++kq)
+    if (this->binPairContribution(bnds.site0(), bnds.site1(),
+                dist, dwsigma, smscale))  return;
+    const int tp0 = mstructure_cache.typeofsite[bnds.site0()];
+    const int tp1 = mstructure_cache.typeofsite[bnds.site1()];
+    this->addDampedSines(tp0, tp1, smscale / dist, dist,
+            dwsigma * dwsigma, 0.0);
+}
+
+
+bool BaseDebyeSum::acceptsBondBatch() const
+{
+    return !mgradientmode && this->getPeakWidthModel()->hasBatchCalculate();
+}
+
+
+/// Add Debye sum contributions from a batch of bonds.  The peak widths
+/// are evaluated for the whole batch and each bond is then summed by
+/// the same kernel as in addPairContribution, so the results are equal.
+void BaseDebyeSum::addPairContributions(const BondBatch& batch)
+{
+    const int nbonds = batch.size();
+    if (!nbonds)  return;
+    std::vector<double>& dwsigma = mbatchbuffer.dwsigma;
+    dwsigma.resize(nbonds);
+    this->getPeakWidthModel()->calculateBatch(batch, &dwsigma[0]);
+    const double fwhmtosigma = 1.0 / (2 * sqrt(2 * M_LN2));
+    for (int b = 0; b < nbonds; ++b)
+    {
+        const double dist = batch.distance[b];
+        if (eps_eq(0.0, dist))  continue;
+        const double sigma = fwhmtosigma * dwsigma[b];
+        const int smscale = batch.summationscale[b] * batch.multiplicity[b];
+        const int site0 = batch.site0[b];
+        const int site1 = batch.site1[b];
+        if (this->binPairContribution(site0, site1,
+                    dist, sigma, smscale))  continue;
+        const int tp0 = mstructure_cache.typeofsite[site0];
+        const int tp1 = mstructure_cache.typeofsite[site1];
+        this->addDampedSines(tp0, tp1, smscale / dist, dist,
+                sigma * sigma, 0.0);
+    }
+}
+
+
+void BaseDebyeSum::flushPairContributions()
+{
+    this->sumDistanceBins();
+    this->sumTypePairs();
+}
+
+
+void BaseDebyeSum::executeParallelMerge(const string& pdata)
+{
+    istringstream storage(pdata, ios::binary);
+    diffpy::serialization::iarchive ia(storage, ios::binary);
+    QuantityType pvalues;
+    ia >> pvalues;
+    if (pvalues.size() != this->countParallelValues())
+    {
+        throw invalid_argument("Merged data array must have the same size.");
+    }
+    if (pvalues.empty())  return;
+    this->mergeParallelValues(&pvalues[0], pvalues.size());
+}
+
+
+/// Raw parallel data hold the value followed by the derivatives
+/// in the gradient mode and by the partial values and Debye sums.
+size_t BaseDebyeSum::countParallelValues() const
+{
+    return mvalue.size() + mgradient.size() +
+        mpartials.values().size() + mpartialsums.values().size();
+}
+
+
+void BaseDebyeSum::packParallelValues(double* pvalues) const
+{
+    const QuantityType& pv = mpartials.values();
+    const QuantityType& ps = mpartialsums.values();
+    pvalues = copy(mvalue.begin(), mvalue.end(), pvalues);
+    pvalues = copy(mgradient.begin(), mgradient.end(), pvalues);
+    pvalues = copy(pv.begin(), pv.end(), pvalues);
+    copy(ps.begin(), ps.end(), pvalues);
+}
+
+
+void BaseDebyeSum::mergeParallelValues(const double* pvalues, size_t n)
+{
+    if (n != this->countParallelValues())
     {
-        const double q = kq * this->getQstep();
-        const double dwscale = exp(-0.5 * pow(dwsigma * q, 2));
-        const double sinescale = smscale * dwscale *
-            this->sfSiteAtkQ(bnds.site0(), kq) *
-            this->sfSiteAtkQ(bnds.site1(), kq) / dist;
-        if (eps_eq(0.0, sinescale, sineprec))   break;
-        mvalue[kq] += sinescale * sin(q * dist);
+        throw invalid_argument("Merged data array must have the same size.");
     }
+    transform(mvalue.begin(), mvalue.end(), pvalues,
+            mvalue.begin(), plus<double>());
+    pvalues += mvalue.size();
+    transform(mgradient.begin(), mgradient.end(), pvalues,
+            mgradient.begin(), plus<double>());
+    pvalues += mgradient.size();
+    QuantityType& pv = mpartials.values();
+    transform(pv.begin(), pv.end(), pvalues, pv.begin(), plus<double>());
+    pvalues += pv.size();
+    QuantityType& ps = mpartialsums.values();
+    transform(ps.begin(), ps.end(), pvalues, ps.begin(), plus<double>());
+}
+
+
+bool BaseDebyeSum::allowsFastUpdate() const
+{
+    return !mgradientmode;
 }
 
 
 void BaseDebyeSum::stashPartialValue()
 {
     mdbsumstash = this->value();
+    mpartials.stash();
+    mpartialsums.stash();
 }
 
 
@@ -198,26 +627,38 @@ void BaseDebyeSum::restorePartialValue()
     assert(mdbsumstash.size() == mvalue.size());
     mvalue = mdbsumstash;
     mdbsumstash.clear();
+    mpartials.restore(0);
+    mpartialsums.restore(0);
 }
 
 
-double BaseDebyeSum::sfSiteAtQ(int siteidx, const double& q) const
+void BaseDebyeSum::stashTrialValue()
 {
-    return 1.0;
+    this->PairQuantity::stashTrialValue();
+    mtrialgradient = mgradient;
+    mtrialpartials = mpartials;
+    mtrialpartialsums = mpartialsums;
 }
 
-// Private Methods -----------------------------------------------------------
 
-double BaseDebyeSum::sfSiteAtkQ(int siteidx, int kq) const
+void BaseDebyeSum::restoreTrialValue()
+{
+    this->PairQuantity::restoreTrialValue();
+    mgradient.swap(mtrialgradient);
+    mtrialgradient.clear();
+    mpartials = mtrialpartials;
+    mtrialpartials.clear();
+    mpartialsums = mtrialpartialsums;
+    mtrialpartialsums.clear();
+}
+
+
+double BaseDebyeSum::sfSiteAtQ(int siteidx, const double& q) const
 {
-    assert(0 <= siteidx && siteidx < int(mstructure_cache.typeofsite.size()));
-    int typeidx = mstructure_cache.typeofsite[siteidx];
-    assert(typeidx < int(mstructure_cache.sftypeatkq.size()));
-    const QuantityType& sfarray = mstructure_cache.sftypeatkq[typeidx];
-    assert(0 <= kq && kq < int(sfarray.size()));
-    return sfarray[kq];
+    return 1.0;
 }
 
+// Private Methods -----------------------------------------------------------
 
 double BaseDebyeSum::sfAverageAtkQ(int kq) const
 {
@@ -226,28 +667,66 @@ double BaseDebyeSum::sfAverageAtkQ(int kq) const
 }
 
 
+QuantityType BaseDebyeSum::fscaleAtkQ() const
+{
+    const double& totocc = mstructure_cache.totaloccupancy;
+    const int npts = pdfutils_qmaxSteps(this);
+    QuantityType rv(npts, 0.0);
+    for (int kq = pdfutils_qminSteps(this); kq < npts; ++kq)
+    {
+        double sfavg = this->sfAverageAtkQ(kq);
+        rv[kq] = (sfavg * totocc) == 0 ? 0.0 :
+            1.0 / (sfavg * sfavg * totocc);
+    }
+    return rv;
+}
+
+
 void BaseDebyeSum::cacheStructureData()
 {
     int cntsites = this->countSites();
     const int nqpts = pdfutils_qmaxSteps(this);
     QuantityType zeros(nqpts, 0.0);
-    boost::unordered_map<string,int> atomtypeidx;
+    // keep arrays from the last structure when configuration is unchanged
+    boost::unordered_map<SiteTypeKey, QuantityType> sfcached;
+    const bool reusable = !(this->ticker() > mstructure_cache.sfticker) &&
+        (mstructure_cache.typekeys.size() ==
+         mstructure_cache.sftypeatkq.size());
+    for (size_t k = 0; reusable && k < mstructure_cache.typekeys.size(); ++k)
+    {
+        QuantityType& sfarray = mstructure_cache.sftypeatkq[k];
+        if (int(sfarray.size()) != nqpts)  continue;
+        sfcached[mstructure_cache.typekeys[k]].swap(sfarray);
+    }
+    boost::unordered_map<SiteTypeKey, int> atomtypeidx;
     // sftypeatkq
     mstructure_cache.typeofsite.clear();
     mstructure_cache.typeofsite.reserve(cntsites);
     mstructure_cache.sftypeatkq.clear();
+    mstructure_cache.typekeys.clear();
     for (int siteidx = 0; siteidx < cntsites; ++siteidx)
     {
-        const string& smbl = mstructure->siteAtomType(siteidx);
-        if (!atomtypeidx.count(smbl))
+        SiteTypeKey key(mstructure->siteAtomType(siteidx),
+                mstructure->siteOccupancy(siteidx));
+        if (!atomtypeidx.count(key))
         {
-            atomtypeidx.insert(make_pair(smbl, int(atomtypeidx.size())));
+            atomtypeidx.insert(make_pair(key, int(atomtypeidx.size())));
         }
-        int tpidx = atomtypeidx[smbl];
+        int tpidx = atomtypeidx[key];
         mstructure_cache.typeofsite.push_back(tpidx);
         // do nothing if the type has been already cached
         if (tpidx < int(mstructure_cache.sftypeatkq.size()))  continue;
         assert(tpidx == int(mstructure_cache.sftypeatkq.size()));
+        mstructure_cache.typekeys.push_back(key);
+        // reuse array from the previous structure when available
+        boost::unordered_map<SiteTypeKey, QuantityType>::iterator sfc;
+        sfc = sfcached.find(key);
+        if (sfc != sfcached.end())
+        {
+            mstructure_cache.sftypeatkq.push_back(QuantityType());
+            mstructure_cache.sftypeatkq.back().swap(sfc->second);
+            continue;
+        }
         // here we need to build a new array
         mstructure_cache.sftypeatkq.push_back(zeros);
         QuantityType& sfarray = mstructure_cache.sftypeatkq.back();
@@ -259,6 +738,7 @@ void BaseDebyeSum::cacheStructureData()
     }
     assert(cntsites == int(mstructure_cache.typeofsite.size()));
     assert(atomtypeidx.size() == mstructure_cache.sftypeatkq.size());
+    mstructure_cache.sfticker = this->ticker();
     // totaloccupancy
     mstructure_cache.totaloccupancy = mstructure->totalOccupancy();
     // sfaverageatkq
@@ -287,6 +767,296 @@ void BaseDebyeSum::cacheStructureData()
             bind1st(multiplies<double>(), tosc));
 }
 
+
+void BaseDebyeSum::checkGradientSupport() const
+{
+    if (this->getPeakWidthModel()->hasGradient())  return;
+    const char* emsg = "Peak width model does not support gradients.";
+    throw logic_error(emsg);
+}
+
+
+/// Add bond contribution to the distance histogram of its atom types.
+/// The bins keep sums of the weights and of their moments, so that
+/// the binned contributions can reproduce the average position and
+/// the spread of distances in each bin.
+bool BaseDebyeSum::binPairContribution(int site0, int site1,
+        double dist, double dwsigma, double smscale)
+{
+    const double& bw = mdistancebins.binwidth;
+    if (!mdistancebinning || !(bw > 0))  return false;
+    const double u = dist / bw;
+    if (!(u < DEBYE_BINNING_MAXBINS))  return false;
+    const int kb = int(floor(u + 0.5));
+    int tp0 = mstructure_cache.typeofsite[site0];
+    int tp1 = mstructure_cache.typeofsite[site1];
+    if (tp0 > tp1)  swap(tp0, tp1);
+    const int ntypes = mstructure_cache.sftypeatkq.size();
+    vector<DistanceBin>& bins =
+        mdistancebins.typepairbins[ntypes * tp0 + tp1];
+    if (kb >= int(bins.size()))
+    {
+        DistanceBin zerobin = {0.0, 0.0, 0.0, 0.0, 0.0};
+        bins.resize(kb + 1, zerobin);
+    }
+    DistanceBin& bn = bins[kb];
+    const double x = dist - kb * bw;
+    const double w = smscale / dist;
+    bn.weight += w;
+    bn.moment1 += w * x;
+    bn.moment2 += w * x * x;
+    bn.moment3 += w * x * x * x;
+    bn.sigma2 += w * dwsigma * dwsigma;
+    mdistancebins.isempty = false;
+    return true;
+}
+
+
+/// Add Debye sum over the distance histograms.  The distances in each
+/// bin are represented by the first three cumulants of their weighted
+/// distribution.  The variance adds to the Debye-Waller damping and
+/// the third cumulant gives a phase shift of the sine term.
+void BaseDebyeSum::sumDistanceBins()
+{
+    if (mdistancebins.isempty)  return;
+    const int ntypes = mstructure_cache.sftypeatkq.size();
+    const double& bw = mdistancebins.binwidth;
+    for (int tp0 = 0; tp0 < ntypes; ++tp0)
+    {
+        for (int tp1 = tp0; tp1 < ntypes; ++tp1)
+        {
+            vector<DistanceBin>& bins =
+                mdistancebins.typepairbins[ntypes * tp0 + tp1];
+            const int nbins = bins.size();
+            for (int kb = 0; kb < nbins; ++kb)
+            {
+                const DistanceBin& bn = bins[kb];
+                if (bn.weight == 0.0)  continue;
+                const double w = bn.weight;
+                const double mu = bn.moment1 / w;
+                const double e2 = bn.moment2 / w;
+                const double e3 = bn.moment3 / w;
+                const double kappa2 = e2 - mu * mu;
+                const double kappa3 = e3 - 3 * mu * e2 + 2 * mu * mu * mu;
+                const double dist = kb * bw + mu;
+                const double sigma2 = bn.sigma2 / w + kappa2;
+                this->addDampedSines(tp0, tp1, w, dist,
+                        sigma2, kappa3 / 6);
+            }
+            bins.clear();
+        }
+    }
+    mdistancebins.isempty = true;
+}
+
+
+/// Add scale * sf0 * sf1 * exp(-sigma2 * q**2 / 2) * sin(q * dist - c3 * q**3)
+/// to the Debye sum, where sf0, sf1 are scattering factors of atom types
+/// tp0, tp1.  The damped sine is advanced by recurrence relations in
+/// DEBYE_LANES independent lanes of consecutive Q-points and evaluated
+/// exactly after every DEBYE_RESYNC steps of a lane, which keeps the
+/// relative round-off error at about DEBYE_RESYNC * eps.  The summation
+/// stops where the scale of the sine term drops below debyeprecision.
+/// The terms are added without scattering factors to the sine sums of
+/// the type pair when available and multiplied out in sumTypePairs.
+void BaseDebyeSum::addDampedSines(int tp0, int tp1,
+        double scale, double dist, double sigma2, double c3)
+{
+    const int kqlo = pdfutils_qminSteps(this);
+    const int nqpts = pdfutils_qmaxSteps(this);
+    const double& sineprec = this->getDebyePrecision();
+    DampedSineRecurrence dsr(this->getQstep(), dist, sigma2, c3);
+    if (mtypepairsums.sinesums.empty())
+    {
+        const QuantityType& sf0 = mstructure_cache.sftypeatkq[tp0];
+        const QuantityType& sf1 = mstructure_cache.sftypeatkq[tp1];
+        double* ypartial = this->partialValue(tp0, tp1);
+        double* spartial = this->partialDebyeSum(tp0, tp1);
+        const double occscale = scale * this->occupancyProduct(tp0, tp1);
+        double sinescale[DEBYE_LANES];
+        for (int kq = kqlo; kq < nqpts; kq += DEBYE_LANES)
+        {
+            dsr.moveTo(kq, kqlo);
+            const double* dw = dsr.damping();
+            const double* sn = dsr.sine();
+            const int nl = min(DEBYE_LANES, nqpts - kq);
+            for (int j = 0; j < nl; ++j)
+            {
+                sinescale[j] = scale * dw[j] * sf0[kq + j] * sf1[kq + j];
+            }
+            const int n = countAboveCutoff(sinescale, nl, sineprec);
+            for (int j = 0; j < n; ++j)
+            {
+                mvalue[kq + j] += sinescale[j] * sn[j];
+            }
+            for (int j = 0; ypartial && j < n; ++j)
+            {
+                ypartial[kq + j] += sinescale[j] * sn[j];
+            }
+            for (int j = 0; spartial && j < n; ++j)
+            {
+                spartial[kq + j] += occscale * dw[j] * sn[j];
+            }
+            if (n < nl)  break;
+        }
+        return;
+    }
+    if (tp0 > tp1)  swap(tp0, tp1);
+    const int idx = mstructure_cache.sftypeatkq.size() * tp0 + tp1;
+    QuantityType& sinesum = mtypepairsums.sinesums[idx];
+    QuantityType& sfproduct = mtypepairsums.sfproduct[idx];
+    if (sinesum.empty())
+    {
+        sinesum.assign(nqpts, 0.0);
+        mtypepairsums.used.push_back(idx);
+    }
+    if (sfproduct.empty())
+    {
+        const QuantityType& sf0 = mstructure_cache.sftypeatkq[tp0];
+        const QuantityType& sf1 = mstructure_cache.sftypeatkq[tp1];
+        sfproduct.resize(nqpts);
+        for (int kq = 0; kq < nqpts; ++kq)  sfproduct[kq] = sf0[kq] * sf1[kq];
+    }
+    double dwscale[DEBYE_LANES];
+    double sinescale[DEBYE_LANES];
+    for (int kq = kqlo; kq < nqpts; kq += DEBYE_LANES)
+    {
+        dsr.moveTo(kq, kqlo);
+        const double* dw = dsr.damping();
+        const double* sn = dsr.sine();
+        const int nl = min(DEBYE_LANES, nqpts - kq);
+        for (int j = 0; j < nl; ++j)
+        {
+            dwscale[j] = scale * dw[j];
+            sinescale[j] = dwscale[j] * sfproduct[kq + j];
+        }
+        const int n = countAboveCutoff(sinescale, nl, sineprec);
+        for (int j = 0; j < n; ++j)  sinesum[kq + j] += dwscale[j] * sn[j];
+        if (n < nl)  break;
+    }
+}
+
+
+/// Add the damped sine term of the current bond directly to the Debye
+/// sum together with its derivatives for the bond distance and peak
+/// width, which BondGradient applies to the parameters of both sites.
+void BaseDebyeSum::addDampedSinesGradient(
+        const BaseBondGenerator& bnds, int smscale)
+{
+    BondGradient& bg = mbondgradient;
+    bg.update(bnds, *mstructure, *(this->getPeakWidthModel()));
+    const double& dist = bg.distance;
+    const double fwhmtosigma = 1.0 / (2 * sqrt(2 * M_LN2));
+    const double c2 = fwhmtosigma * fwhmtosigma;
+    const double sigma2 = c2 * bg.fwhm * bg.fwhm;
+    const int kqlo = pdfutils_qminSteps(this);
+    const int nqpts = pdfutils_qmaxSteps(this);
+    if (kqlo >= nqpts)  return;
+    const double& sineprec = this->getDebyePrecision();
+    const double& qstep = this->getQstep();
+    const int tp0 = mstructure_cache.typeofsite[bnds.site0()];
+    const int tp1 = mstructure_cache.typeofsite[bnds.site1()];
+    const QuantityType& sf0 = mstructure_cache.sftypeatkq[tp0];
+    const QuantityType& sf1 = mstructure_cache.sftypeatkq[tp1];
+    std::vector<double>& tdist = mgradientbuffer.tdist;
+    std::vector<double>& tfwhm = mgradientbuffer.tfwhm;
+    tdist.resize(nqpts - kqlo);
+    tfwhm.resize(nqpts - kqlo);
+    double* ypartial = this->partialValue(tp0, tp1);
+    double* spartial = this->partialDebyeSum(tp0, tp1);
+    DampedSineRecurrence dsr(qstep, dist, sigma2, 0.0);
+    const double scale = smscale / dist;
+    const double occscale = scale * this->occupancyProduct(tp0, tp1);
+    double sinescale[DEBYE_LANES];
+    int n = 0;
+    for (int kq = kqlo; kq < nqpts; kq += DEBYE_LANES)
+    {
+        dsr.moveTo(kq, kqlo);
+        const double* dw = dsr.damping();
+        const double* sn = dsr.sine();
+        const double* cs = dsr.cosine();
+        const int nl = min(DEBYE_LANES, nqpts - kq);
+        for (int j = 0; j < nl; ++j)
+        {
+            sinescale[j] = scale * dw[j] * sf0[kq + j] * sf1[kq + j];
+        }
+        const int nj = countAboveCutoff(sinescale, nl, sineprec);
+        for (int j = 0; j < nj; ++j, ++n)
+        {
+            const double q = (kq + j) * qstep;
+            const double t = sinescale[j] * sn[j];
+            mvalue[kq + j] += t;
+            if (ypartial)  ypartial[kq + j] += t;
+            if (spartial)  spartial[kq + j] += occscale * dw[j] * sn[j];
+            tdist[n] = sinescale[j] * q * cs[j] - t / dist;
+            tfwhm[n] = -t * q * q * c2 * bg.fwhm;
+        }
+        if (nj < nl)  break;
+    }
+    if (!n)  return;
+    bg.accumulate(&mgradient[kqlo], nqpts, &tdist[0], &tfwhm[0], n);
+}
+
+
+/// Multiply the sine sums of atom type pairs by the products of their
+/// scattering factors and add them to the Debye sum and to the partial
+/// values of the type pair.  The partial Debye sums get the sine sums
+/// weighted by the site occupancies.
+void BaseDebyeSum::sumTypePairs()
+{
+    const int nqpts = pdfutils_qmaxSteps(this);
+    const int ntypes = mstructure_cache.sftypeatkq.size();
+    vector<int>::const_iterator ii = mtypepairsums.used.begin();
+    for (; ii != mtypepairsums.used.end(); ++ii)
+    {
+        QuantityType& sinesum = mtypepairsums.sinesums[*ii];
+        const QuantityType& sfproduct = mtypepairsums.sfproduct[*ii];
+        const int tp0 = *ii / ntypes;
+        const int tp1 = *ii % ntypes;
+        double* ypartial = this->partialValue(tp0, tp1);
+        double* spartial = this->partialDebyeSum(tp0, tp1);
+        const double occprod = this->occupancyProduct(tp0, tp1);
+        for (int kq = pdfutils_qminSteps(this); kq < nqpts; ++kq)
+        {
+            mvalue[kq] += sfproduct[kq] * sinesum[kq];
+            if (ypartial)  ypartial[kq] += sfproduct[kq] * sinesum[kq];
+            if (spartial)  spartial[kq] += occprod * sinesum[kq];
+        }
+        sinesum.clear();
+    }
+    mtypepairsums.used.clear();
+}
+
+
+double* BaseDebyeSum::partialValue(int tp0, int tp1)
+{
+    if (mpartials.values().empty())  return NULL;
+    const vector<int>& ptype = mstructure_cache.partialtype;
+    assert(0 <= tp0 && tp0 < int(ptype.size()));
+    assert(0 <= tp1 && tp1 < int(ptype.size()));
+    return mpartials.at(mpartials.pairIndexOfTypes(ptype[tp0], ptype[tp1]));
+}
+
+
+double* BaseDebyeSum::partialDebyeSum(int tp0, int tp1)
+{
+    if (mpartialsums.values().empty())  return NULL;
+    const vector<int>& ptype = mstructure_cache.partialtype;
+    assert(0 <= tp0 && tp0 < int(ptype.size()));
+    assert(0 <= tp1 && tp1 < int(ptype.size()));
+    const int p = mpartialsums.pairIndexOfTypes(ptype[tp0], ptype[tp1]);
+    return mpartialsums.at(p);
+}
+
+
+double BaseDebyeSum::occupancyProduct(int tp0, int tp1) const
+{
+    const vector<SiteTypeKey>& tk = mstructure_cache.typekeys;
+    assert(0 <= tp0 && tp0 < int(tk.size()));
+    assert(0 <= tp1 && tp1 < int(tk.size()));
+    return tk[tp0].second * tk[tp1].second;
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
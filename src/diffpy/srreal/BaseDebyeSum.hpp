@@ -19,9 +19,13 @@
 #ifndef BASEDEBYESUM_HPP_INCLUDED
 #define BASEDEBYESUM_HPP_INCLUDED
 
+#include <boost/serialization/version.hpp>
+
 #include <diffpy/srreal/PairQuantity.hpp>
+#include <diffpy/srreal/BondGradient.hpp>
 #include <diffpy/srreal/PeakWidthModel.hpp>
 #include <diffpy/srreal/PDFUtils.hpp>
+#include <diffpy/srreal/TypePairPartials.hpp>
 
 namespace diffpy {
 namespace srreal {
@@ -37,6 +41,7 @@ class BaseDebyeSum :
 
         // PairQuantity overloads
         virtual eventticker::EventTicker& ticker() const;
+        virtual std::string getParallelData() const;
 
         // results
         /// F values on a full Q-grid starting at 0
@@ -59,25 +64,98 @@ class BaseDebyeSum :
         /// return relative cutoff value for Debye sum contribution
         const double& getDebyePrecision() const;
 
+        // Summation over binned pair distances
+        /// sum over distance histograms of atom type pairs, where the bins
+        /// are narrow enough to give relative error about debyeprecision
+        void setDistanceBinning(bool);
+        bool getDistanceBinning() const;
+
+        // derivatives with respect to the site parameters
+        /// sum derivatives of the value with respect to the Cartesian
+        /// coordinates and Uij of all sites in the same bond traversal.
+        /// The pair terms are then summed without distance binning.
+        void setGradientMode(bool);
+        bool getGradientMode() const;
+        /// derivatives of F at index site * GRADIENT_SITE_PARAMS + p,
+        /// see BondGradient.hpp for the order of site parameters p
+        std::vector<QuantityType> getFGradients() const;
+
+        // partial F for the pairs of atom types
+        /// sum the value also separately for every pair of atom types
+        /// in the same bond traversal.  The partial F equal F calculated
+        /// with setTypeMask for one pair of atom types and their plain
+        /// sum is the total F.
+        void setPartialsMode(bool);
+        bool getPartialsMode() const;
+        /// atom type pairs in the order of the partial results
+        std::vector< std::pair<std::string, std::string> >
+            getPartialTypePairs() const;
+        /// partial F on a full Q-grid ordered as in getPartialTypePairs
+        std::vector<QuantityType> getPartialFs() const;
+        /// partial Debye sums S_ab(Q) of the damped sine terms without
+        /// scattering factors, where each pair is weighted by the site
+        /// occupancies, divided by the total occupancy.  When scattering
+        /// factors do not depend on occupancy, the partial F of atom
+        /// types a, b is S_ab(Q) * f_a(Q) * f_b(Q) / <f(Q)>**2.
+        /// Returned on a full Q-grid ordered as in getPartialTypePairs.
+        std::vector<QuantityType> getPartialDebyeSums() const;
+
     protected:
 
         // PairQuantity overloads
         virtual void resetValue();
         virtual void addPairContribution(const BaseBondGenerator&, int);
+        virtual bool acceptsBondBatch() const;
+        virtual void addPairContributions(const BondBatch&);
+        virtual void flushPairContributions();
+        virtual void executeParallelMerge(const std::string& pdata);
+        virtual size_t countParallelValues() const;
+        virtual void packParallelValues(double* pvalues) const;
+        virtual void mergeParallelValues(const double* pvalues, size_t n);
         // support for PQEvaluatorOptimized
+        virtual bool allowsFastUpdate() const;
         virtual void stashPartialValue();
         virtual void restorePartialValue();
+        // support for trial changes
+        virtual void stashTrialValue();
+        virtual void restoreTrialValue();
 
         // own methods
+        /// scattering factor of a site at Q.  The values are cached per
+        /// atom type and occupancy and reused for the sites and structures
+        /// with the same pair until the ticker changes, therefore they
+        /// must not depend on any other site data.
         virtual double sfSiteAtQ(int, const double& Q) const;
 
     private:
 
         // methods
         /// cache structure factors data for a quick access during summation
-        double sfSiteAtkQ(int siteidx, int kq) const;
         double sfAverageAtkQ(int kq) const;
         void cacheStructureData();
+        /// throw logic_error when the peak width model has no derivatives
+        void checkGradientSupport() const;
+        /// add bond to the distance histogram, return false if not binned
+        bool binPairContribution(int site0, int site1,
+                double dist, double dwsigma, double smscale);
+        /// add Debye sum over all distance bins and clear them
+        void sumDistanceBins();
+        void addDampedSines(int tp0, int tp1,
+                double scale, double dist, double sigma2, double c3);
+        /// add damped sines of the current bond and their derivatives
+        /// for the parameters of its sites
+        void addDampedSinesGradient(const BaseBondGenerator&, int smscale);
+        /// scale factors that convert the Debye sum to F
+        QuantityType fscaleAtkQ() const;
+        void sumTypePairs();
+        /// partial values for a pair of sftypeatkq types or NULL
+        /// if not summed
+        double* partialValue(int tp0, int tp1);
+        /// partial Debye sums for a pair of sftypeatkq types or NULL
+        /// if not summed
+        double* partialDebyeSum(int tp0, int tp1);
+        /// product of site occupancies for a pair of sftypeatkq types
+        double occupancyProduct(int tp0, int tp1) const;
 
         // data
         // configuration
@@ -85,13 +163,67 @@ class BaseDebyeSum :
         double mqmax;
         double mqstep;
         double mdebyeprecision;
+        typedef std::pair<std::string, double> SiteTypeKey;
         struct {
             std::vector<int> typeofsite;
             std::vector<QuantityType> sftypeatkq;
             QuantityType sfaverageatkq;
             double totaloccupancy;
+            // atom type and occupancy for each sftypeatkq array and
+            // the configuration ticker when they were calculated
+            std::vector<SiteTypeKey> typekeys;
+            eventticker::EventTicker sfticker;
+            /// atom type index in mpartials for each sftypeatkq array
+            std::vector<int> partialtype;
         } mstructure_cache;
         QuantityType mdbsumstash;
+        // distance histograms for the binned summation
+        bool mdistancebinning;
+        /// moments of the bond weights with respect to the bin center
+        struct DistanceBin
+        {
+            double weight;
+            double moment1;
+            double moment2;
+            double moment3;
+            double sigma2;
+        };
+        struct {
+            double binwidth;
+            bool isempty;
+            /// bins for the atom type pairs at ntypes * tpidx0 + tpidx1
+            std::vector< std::vector<DistanceBin> > typepairbins;
+        } mdistancebins;
+        // Debye sums without scattering factors for the atom type pairs
+        struct {
+            /// products of scattering factors at ntypes * tpidx0 + tpidx1
+            std::vector<QuantityType> sfproduct;
+            /// sums of the damped sine terms for the type pairs
+            std::vector<QuantityType> sinesums;
+            /// indices of the non-empty sinesums
+            std::vector<int> used;
+        } mtypepairsums;
+        // per-bond temporary buffers for the bond batch
+        struct {
+            std::vector<double> dwsigma;
+        } mbatchbuffer;
+        // derivatives of the value for the parameters of all sites,
+        // stored as mgradient[p * pdfutils_qmaxSteps(this) + kq]
+        bool mgradientmode;
+        QuantityType mgradient;
+        QuantityType mtrialgradient;
+        // derivatives for the current bond, temporary buffers
+        BondGradient mbondgradient;
+        struct {
+            std::vector<double> tdist;
+            std::vector<double> tfwhm;
+        } mgradientbuffer;
+        // partial values for the pairs of atom types
+        bool mpartialsmode;
+        TypePairPartials mpartials;
+        TypePairPartials mtrialpartials;
+        TypePairPartials mpartialsums;
+        TypePairPartials mtrialpartialsums;
 
         // serialization
         friend class boost::serialization::access;
@@ -109,6 +241,10 @@ class BaseDebyeSum :
             ar & mstructure_cache.sftypeatkq;
             ar & mstructure_cache.sfaverageatkq;
             ar & mstructure_cache.totaloccupancy;
+            if (version > 0)  ar & mdistancebinning;
+            if (version > 1)  ar & mgradientmode & mgradient;
+            if (version > 2)  ar & mpartialsmode & mpartials;
+            if (version > 3)  ar & mpartialsums;
         }
 
 };  // class BaseDebyeSum
@@ -119,5 +255,6 @@ class BaseDebyeSum :
 // Serialization -------------------------------------------------------------
 
 BOOST_CLASS_EXPORT_KEY(diffpy::srreal::BaseDebyeSum)
+BOOST_CLASS_VERSION(diffpy::srreal::BaseDebyeSum, 4)
 
 #endif  // BASEDEBYESUM_HPP_INCLUDED
@@ -0,0 +1,84 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class BondBatch -- block of atom pairs stored as structure of arrays
+*     for a batch evaluation of pair contributions.
+*
+*****************************************************************************/
+
+#include <stdexcept>
+
+#include <diffpy/srreal/BondBatch.hpp>
+#include <diffpy/srreal/BaseBondGenerator.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Constructor ---------------------------------------------------------------
+
+BondBatch::BondBatch(int capacity) : mcapacity(capacity)
+{
+    if (mcapacity < 1)
+    {
+        throw invalid_argument("BondBatch capacity must be at least 1.");
+    }
+    site0.reserve(mcapacity);
+    site1.reserve(mcapacity);
+    r01x.reserve(mcapacity);
+    r01y.reserve(mcapacity);
+    r01z.reserve(mcapacity);
+    distance.reserve(mcapacity);
+    multiplicity.reserve(mcapacity);
+    msd.reserve(mcapacity);
+    summationscale.reserve(mcapacity);
+}
+
+// Public Methods ------------------------------------------------------------
+
+void BondBatch::append(const BaseBondGenerator& bnds, int scale)
+{
+    const R3::Vector& r01 = bnds.r01();
+    site0.push_back(bnds.site0());
+    site1.push_back(bnds.site1());
+    r01x.push_back(r01[0]);
+    r01y.push_back(r01[1]);
+    r01z.push_back(r01[2]);
+    const double d = bnds.distance();
+    distance.push_back(d);
+    multiplicity.push_back(bnds.multiplicity());
+    // msd is undefined for direction of zero-length bond
+    msd.push_back((d > 0.0) ? bnds.msd() : 0.0);
+    summationscale.push_back(scale);
+}
+
+
+void BondBatch::clear()
+{
+    site0.clear();
+    site1.clear();
+    r01x.clear();
+    r01y.clear();
+    r01z.clear();
+    distance.clear();
+    multiplicity.clear();
+    msd.clear();
+    summationscale.clear();
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
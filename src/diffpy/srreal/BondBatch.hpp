@@ -0,0 +1,69 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class BondBatch -- block of atom pairs stored as structure of arrays
+*     for a batch evaluation of pair contributions.
+*
+*****************************************************************************/
+
+#ifndef BONDBATCH_HPP_INCLUDED
+#define BONDBATCH_HPP_INCLUDED
+
+#include <vector>
+#include <diffpy/srreal/forwardtypes.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+/// default number of bonds in one batch
+const int DEFAULT_BONDBATCH_CAPACITY = 256;
+
+class BondBatch
+{
+    public:
+
+        // constructor
+        BondBatch(int capacity=DEFAULT_BONDBATCH_CAPACITY);
+
+        // methods
+        /// append the current bond of a bond generator
+        void append(const BaseBondGenerator& bnds, int scale);
+        void clear();
+        int size() const  { return distance.size(); }
+        bool empty() const  { return distance.empty(); }
+        bool full() const  { return this->size() >= mcapacity; }
+        int capacity() const  { return mcapacity; }
+
+        // data - one element per bond
+        SiteIndices site0;
+        SiteIndices site1;
+        std::vector<double> r01x;
+        std::vector<double> r01y;
+        std::vector<double> r01z;
+        std::vector<double> distance;
+        std::vector<int> multiplicity;
+        std::vector<double> msd;
+        std::vector<int> summationscale;
+
+    private:
+
+        // data
+        int mcapacity;
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // BONDBATCH_HPP_INCLUDED
@@ -19,6 +19,7 @@
 #include <cassert>
 #include <cmath>
 #include <sstream>
+#include <stdexcept>
 
 #include <diffpy/srreal/BondCalculator.hpp>
 #include <diffpy/validators.hpp>
@@ -35,6 +36,8 @@ namespace srreal {
 namespace {
 
 const double DEFAULT_BONDCALCULATOR_RMAX = 5.0;
+// number of double values per bond in the raw parallel data
+const size_t BOND_ENTRY_VALUES = 6;
 
 }   // namespace
 
@@ -81,6 +84,41 @@ class BondOp {
         }
 
 
+        static double* pack(double* dst,
+                const BondCalculator::BondDataStorage& bonds)
+        {
+            BondCalculator::BondDataStorage::const_iterator bi;
+            for (bi = bonds.begin(); bi != bonds.end(); ++bi)
+            {
+                *(dst++) = bi->distance;
+                *(dst++) = bi->site0;
+                *(dst++) = bi->site1;
+                *(dst++) = bi->direction0;
+                *(dst++) = bi->direction1;
+                *(dst++) = bi->direction2;
+            }
+            return dst;
+        }
+
+
+        static const double* unpack(BondCalculator::BondDataStorage& bonds,
+                const double* src, size_t count)
+        {
+            bonds.resize(count);
+            BondCalculator::BondDataStorage::iterator bi;
+            for (bi = bonds.begin(); bi != bonds.end(); ++bi)
+            {
+                bi->distance = *(src++);
+                bi->site0 = int(*(src++));
+                bi->site1 = int(*(src++));
+                bi->direction0 = *(src++);
+                bi->direction1 = *(src++);
+                bi->direction2 = *(src++);
+            }
+            return src;
+        }
+
+
         static BondCalculator::BondEntry entryFrom(
                 const BaseBondGenerator& bnds)
         {
@@ -208,9 +246,8 @@ void BondCalculator::addPairContribution(
         int summationscale)
 {
     assert(summationscale == +1 || summationscale == -1);
-    static R3::Vector ru01;
     const R3::Vector& r01 = bnds.r01();
-    ru01 = r01 / bnds.distance();
+    R3::Vector ru01 = r01 / bnds.distance();
     if (!(this->checkConeFilters(ru01)))  return;
     BondDataStorage& bes = (summationscale > 0) ? maddbonds : mpopbonds;
     bes.push_back(BondOp::entryFrom(bnds));
@@ -228,6 +265,41 @@ void BondCalculator::executeParallelMerge(const std::string& pdata)
 }
 
 
+/// Raw parallel data hold counts of popped and added bonds followed
+/// by their entries.
+size_t BondCalculator::countParallelValues() const
+{
+    size_t rv = 2 +
+        BOND_ENTRY_VALUES * (mpopbonds.size() + maddbonds.size());
+    return rv;
+}
+
+
+void BondCalculator::packParallelValues(double* pvalues) const
+{
+    *(pvalues++) = mpopbonds.size();
+    *(pvalues++) = maddbonds.size();
+    pvalues = BondOp::pack(pvalues, mpopbonds);
+    pvalues = BondOp::pack(pvalues, maddbonds);
+}
+
+
+void BondCalculator::mergeParallelValues(const double* pvalues, size_t n)
+{
+    const size_t npop = (n < 2) ? 0 : size_t(pvalues[0]);
+    const size_t nadd = (n < 2) ? 0 : size_t(pvalues[1]);
+    if (n != 2 + BOND_ENTRY_VALUES * (npop + nadd))
+    {
+        throw invalid_argument("Invalid size of merged bond data.");
+    }
+    BondDataStorage bpop, badd;
+    pvalues = BondOp::unpack(bpop, pvalues + 2, npop);
+    pvalues = BondOp::unpack(badd, pvalues, nadd);
+    BondOp::bmerge(mpopbonds, bpop);
+    BondOp::bmerge(maddbonds, badd);
+}
+
+
 void BondCalculator::finishValue()
 {
     // filter-out entries marked for removal
@@ -250,14 +322,33 @@ void BondCalculator::finishValue()
 
 void BondCalculator::stashPartialValue()
 {
+    // bonds marked for removal must survive the resetValue call
     mstashedbonds.swap(mbonds);
+    mstashedpopbonds.swap(mpopbonds);
 }
 
 
 void BondCalculator::restorePartialValue()
 {
     mbonds.swap(mstashedbonds);
+    mpopbonds.swap(mstashedpopbonds);
     mstashedbonds.clear();
+    mstashedpopbonds.clear();
+}
+
+
+void BondCalculator::stashTrialValue()
+{
+    this->PairQuantity::stashTrialValue();
+    mtrialbonds = mbonds;
+}
+
+
+void BondCalculator::restoreTrialValue()
+{
+    this->PairQuantity::restoreTrialValue();
+    mbonds.swap(mtrialbonds);
+    mtrialbonds.clear();
 }
 
 // Private Methods -----------------------------------------------------------
@@ -51,11 +51,17 @@ class BondCalculator : public PairQuantity
         virtual void resetValue();
         virtual void addPairContribution(const BaseBondGenerator&, int);
         virtual void executeParallelMerge(const std::string& pdata);
+        virtual size_t countParallelValues() const;
+        virtual void packParallelValues(double* pvalues) const;
+        virtual void mergeParallelValues(const double* pvalues, size_t n);
         virtual void finishValue();
 
         // support for PQEvaluatorOptimized
         virtual void stashPartialValue();
         virtual void restorePartialValue();
+        // support for trial changes
+        virtual void stashTrialValue();
+        virtual void restoreTrialValue();
 
         friend class BondOp;
         class BondEntry {
@@ -106,6 +112,8 @@ class BondCalculator : public PairQuantity
         std::vector<double> mfilter_degrees;
         BondDataStorage mbonds;
         BondDataStorage mstashedbonds;
+        BondDataStorage mstashedpopbonds;
+        BondDataStorage mtrialbonds;
         BondDataStorage mpopbonds;
         BondDataStorage maddbonds;
 
@@ -0,0 +1,131 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class BondGradient -- derivatives of the bond distance and of the peak
+*     width with respect to the positions and displacement parameters
+*     of the two bonded sites.
+*
+*****************************************************************************/
+
+#include <cassert>
+
+#include <diffpy/srreal/BondGradient.hpp>
+#include <diffpy/srreal/BaseBondGenerator.hpp>
+#include <diffpy/srreal/PeakWidthModel.hpp>
+#include <diffpy/srreal/StructureAdapter.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+// Public Methods ------------------------------------------------------------
+
+/// The bonded atoms may be symmetry images of their sites, the site
+/// displacements are therefore rotated by Rcartesian0 and Rcartesian1.
+/// The peak width depends on the distance and on the mean square
+/// displacement along the bond, msd = u' * U0 * u + u' * U1 * u for
+/// the unit bond vector u.
+void BondGradient::update(const BaseBondGenerator& bnds,
+        const StructureAdapter& stru, const PeakWidthModel& pwm)
+{
+    distance = bnds.distance();
+    fwhm = pwm.calculate(bnds);
+    r01 = bnds.r01();
+    double dw[2];
+    pwm.calculateGradient(bnds, dw);
+    dfwhmdmsd = dw[0];
+    dfwhmddistance = dw[1];
+    const double& dwdmsd = dfwhmdmsd;
+    const double& dwddist = dfwhmddistance;
+    const int sites[2] = {bnds.site0(), bnds.site1()};
+    const R3::Matrix* U[2] = {&bnds.Ucartesian0(), &bnds.Ucartesian1()};
+    const R3::Matrix* R[2] = {&bnds.Rcartesian0(), &bnds.Rcartesian1()};
+    bool anisotropy[2];
+    R3::Vector u = (distance > 0) ? R3::Vector(r01 / distance) :
+        R3::Vector(R3::zerovector);
+    // derivative of the msd with respect to r01
+    dmsd = R3::zerovector;
+    for (int t = 0; t < 2; ++t)
+    {
+        anisotropy[t] = stru.siteAnisotropy(sites[t]);
+        if (!anisotropy[t] || !(distance > 0))  continue;
+        R3::Vector Uu = R3::prod(*U[t], u);
+        dmsd += 2.0 / distance * (Uu - R3::dot(u, Uu) * u);
+    }
+    for (int t = 0; t < 2; ++t)
+    {
+        offset[t] = GRADIENT_SITE_PARAMS * sites[t];
+        const double sgn = t ? +1.0 : -1.0;
+        // the site displacement d moves the atom by R * d
+        R3::Vector v = R3::prod(R3::trans(*R[t]), u);
+        R3::Vector m = R3::prod(R3::trans(*R[t]), dmsd);
+        double* dd = ddistance[t];
+        double* dfw = dfwhm[t];
+        for (int i = 0; i < R3::Ndim; ++i)
+        {
+            dd[i] = sgn * v[i];
+            dfw[i] = dwddist * dd[i] + dwdmsd * sgn * m[i];
+        }
+        // Uij of the atom are R * U * R', the msd is then v' * U * v
+        for (int i = R3::Ndim; i < GRADIENT_SITE_PARAMS; ++i)  dd[i] = 0.0;
+        if (anisotropy[t])
+        {
+            dfw[3] = dwdmsd * v[0] * v[0];
+            dfw[4] = dwdmsd * v[1] * v[1];
+            dfw[5] = dwdmsd * v[2] * v[2];
+            dfw[6] = dwdmsd * 2 * v[0] * v[1];
+            dfw[7] = dwdmsd * 2 * v[0] * v[2];
+            dfw[8] = dwdmsd * 2 * v[1] * v[2];
+        }
+        else
+        {
+            dfw[3] = dwdmsd;
+            dfw[4] = dfw[5] = dfw[6] = dfw[7] = dfw[8] = 0.0;
+        }
+    }
+}
+
+
+void BondGradient::accumulate(double* gradient, size_t stride,
+        const double* tdist, const double* tfwhm, int npts) const
+{
+    for (int t = 0; t < 2; ++t)
+    {
+        for (int p = 0; p < GRADIENT_SITE_PARAMS; ++p)
+        {
+            const double a = ddistance[t][p];
+            const double b = dfwhm[t][p];
+            if (a == 0.0 && b == 0.0)  continue;
+            double* pg = gradient + (offset[t] + p) * stride;
+            for (int k = 0; k < npts; ++k)
+            {
+                pg[k] += a * tdist[k] + b * tfwhm[k];
+            }
+        }
+    }
+}
+
+
+void BondGradient::strain(const R3::Matrix& M, double& dd, double& dw) const
+{
+    dd = dw = 0.0;
+    if (!(distance > 0))  return;
+    R3::Vector dr = R3::prod(M, r01);
+    dd = R3::dot(r01, dr) / distance;
+    dw = dfwhmddistance * dd + dfwhmdmsd * R3::dot(dmsd, dr);
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
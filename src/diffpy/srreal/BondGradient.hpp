@@ -0,0 +1,79 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class BondGradient -- derivatives of the bond distance and of the peak
+*     width with respect to the positions and displacement parameters
+*     of the two bonded sites.
+*
+*****************************************************************************/
+
+#ifndef BONDGRADIENT_HPP_INCLUDED
+#define BONDGRADIENT_HPP_INCLUDED
+
+#include <cstddef>
+#include <diffpy/srreal/forwardtypes.hpp>
+#include <diffpy/srreal/R3linalg.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+class PeakWidthModel;
+class StructureAdapter;
+
+/// Number of gradient parameters per site.  These are Cartesian
+/// coordinates x, y, z followed by U11, U22, U33, U12, U13, U23, where
+/// the off-diagonal parameters change both symmetric elements of Uij.
+/// For isotropic sites U11 stands for Uiso and U22 to U23 are unused.
+const int GRADIENT_SITE_PARAMS = 9;
+
+class BondGradient
+{
+    public:
+
+        // methods
+        /// evaluate the derivatives for the current bond of a generator
+        void update(const BaseBondGenerator&,
+                const StructureAdapter&, const PeakWidthModel&);
+        /// add d(term)/d(parameter) for all parameters of the two sites
+        /// to gradient[p * stride + k] for k < npts, where tdist[k] and
+        /// tfwhm[k] are the derivatives of the bond term with respect
+        /// to its distance and peak width.
+        void accumulate(double* gradient, size_t stride,
+                const double* tdist, const double* tfwhm, int npts) const;
+        /// derivatives of the distance and of the peak width for
+        /// a change of the bond vector d(r01) = M * r01
+        void strain(const R3::Matrix& M, double& dd, double& dw) const;
+
+        // data
+        double distance;
+        double fwhm;
+        /// gradient parameter offsets of site0 and site1
+        int offset[2];
+        /// derivatives of the distance for site0 and site1 parameters
+        double ddistance[2][GRADIENT_SITE_PARAMS];
+        /// derivatives of the peak width for site0 and site1 parameters
+        double dfwhm[2][GRADIENT_SITE_PARAMS];
+        /// bond vector and the derivative of the bond msd with respect to it
+        R3::Vector r01;
+        R3::Vector dmsd;
+        /// derivatives of the peak width for the bond msd and distance
+        double dfwhmdmsd;
+        double dfwhmddistance;
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // BONDGRADIENT_HPP_INCLUDED
@@ -0,0 +1,147 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class CellGrid -- binning of points to a rectangular grid of cubic cells
+*     for a fast lookup of points close to a given position.
+*
+*****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include <diffpy/srreal/CellGrid.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Local Constants -----------------------------------------------------------
+
+namespace {
+
+// relative padding of the cell size and search radius for round-off errors
+const double CELLGRID_PADDING = 1e-6;
+
+}   // namespace
+
+// Constructor ---------------------------------------------------------------
+
+CellGrid::CellGrid() : mlo(R3::zerovector), mcellsize(1.0)
+{
+    fill(mcellcount, mcellcount + R3::Ndim, 1);
+    mcellstart.assign(2, 0);
+}
+
+// Public Methods ------------------------------------------------------------
+
+void CellGrid::build(const vector<R3::Vector>& points, double cellsize)
+{
+    const int npts = points.size();
+    R3::Vector hi;
+    mlo = R3::zerovector;
+    hi = R3::zerovector;
+    for (int i = 0; i < npts; ++i)
+    {
+        const R3::Vector& xyz = points[i];
+        for (int k = 0; k < R3::Ndim; ++k)
+        {
+            if (i == 0 || xyz[k] < mlo[k])  mlo[k] = xyz[k];
+            if (i == 0 || xyz[k] > hi[k])  hi[k] = xyz[k];
+        }
+    }
+    R3::Vector extent = hi - mlo;
+    // use cells larger than cellsize, but no more than about 2 per point
+    double h = cellsize * (1.0 + CELLGRID_PADDING);
+    if (!(h > 0.0))  h = max(1.0, R3::norm(extent));
+    const double maxcells = 2.0 * npts + 8;
+    while (true)
+    {
+        double ncells = 1.0;
+        for (int k = 0; k < R3::Ndim; ++k)
+        {
+            ncells *= floor(extent[k] / h) + 1;
+        }
+        if (ncells <= maxcells)  break;
+        h *= 2;
+    }
+    mcellsize = h;
+    int ncells = 1;
+    for (int k = 0; k < R3::Ndim; ++k)
+    {
+        mcellcount[k] = int(floor(extent[k] / h)) + 1;
+        ncells *= mcellcount[k];
+    }
+    // counting sort of the points to the cells
+    SiteIndices pointcell(npts);
+    mcellstart.assign(ncells + 1, 0);
+    for (int i = 0; i < npts; ++i)
+    {
+        pointcell[i] = this->cellIndex(points[i]);
+        ++mcellstart[pointcell[i] + 1];
+    }
+    for (int c = 0; c < ncells; ++c)  mcellstart[c + 1] += mcellstart[c];
+    mcellpoints.resize(npts);
+    SiteIndices cellfill(mcellstart.begin(), mcellstart.end() - 1);
+    for (int i = 0; i < npts; ++i)
+    {
+        mcellpoints[cellfill[pointcell[i]]++] = i;
+    }
+}
+
+
+void CellGrid::appendNearPoints(const R3::Vector& center, double radius,
+        SiteIndices& indices) const
+{
+    const double r = radius + CELLGRID_PADDING * (radius + mcellsize);
+    int lo[R3::Ndim], hi[R3::Ndim];
+    for (int k = 0; k < R3::Ndim; ++k)
+    {
+        // clip in floating point to be safe for huge or infinite radius
+        double clo = floor((center[k] - mlo[k] - r) / mcellsize);
+        double chi = floor((center[k] - mlo[k] + r) / mcellsize);
+        if (chi < 0 || clo > mcellcount[k] - 1)  return;
+        lo[k] = int(max(0.0, clo));
+        hi[k] = int(min(mcellcount[k] - 1.0, chi));
+    }
+    for (int c0 = lo[0]; c0 <= hi[0]; ++c0)
+    {
+        for (int c1 = lo[1]; c1 <= hi[1]; ++c1)
+        {
+            int c = (c0 * mcellcount[1] + c1) * mcellcount[2];
+            indices.insert(indices.end(),
+                    mcellpoints.begin() + mcellstart[c + lo[2]],
+                    mcellpoints.begin() + mcellstart[c + hi[2] + 1]);
+        }
+    }
+}
+
+// Private Methods -----------------------------------------------------------
+
+int CellGrid::cellIndex(const R3::Vector& xyz) const
+{
+    int cidx[R3::Ndim];
+    for (int k = 0; k < R3::Ndim; ++k)
+    {
+        int c = int(floor((xyz[k] - mlo[k]) / mcellsize));
+        cidx[k] = max(0, min(mcellcount[k] - 1, c));
+    }
+    int rv = (cidx[0] * mcellcount[1] + cidx[1]) * mcellcount[2] + cidx[2];
+    return rv;
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
@@ -0,0 +1,66 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class CellGrid -- binning of points to a rectangular grid of cubic cells
+*     for a fast lookup of points close to a given position.
+*
+*****************************************************************************/
+
+#ifndef CELLGRID_HPP_INCLUDED
+#define CELLGRID_HPP_INCLUDED
+
+#include <vector>
+#include <diffpy/srreal/R3linalg.hpp>
+#include <diffpy/srreal/forwardtypes.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+class CellGrid
+{
+    public:
+
+        // constructor
+        CellGrid();
+
+        // methods
+        /// sort points to cells with an edge of at least cellsize
+        void build(const std::vector<R3::Vector>& points, double cellsize);
+        /// append indices of all points that may be within radius
+        /// from the center.  Indices are in no particular order.
+        void appendNearPoints(const R3::Vector& center, double radius,
+                SiteIndices& indices) const;
+        /// edge length of the grid cells
+        const double& getCellSize() const  { return mcellsize; }
+
+    private:
+
+        // data
+        R3::Vector mlo;
+        double mcellsize;
+        int mcellcount[R3::Ndim];
+        // points in each cell stored as a compressed row, mcellpoints[k]
+        // for k in [mcellstart[i], mcellstart[i + 1]) are in the cell i.
+        SiteIndices mcellstart;
+        SiteIndices mcellpoints;
+
+        // methods
+        int cellIndex(const R3::Vector& xyz) const;
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // CELLGRID_HPP_INCLUDED
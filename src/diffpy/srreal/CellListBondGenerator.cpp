@@ -0,0 +1,116 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class CellListBondGenerator -- bond generator for non-periodic structures
+*     that visits only sites in the cells neighboring the anchor site.
+*
+*     Sites are binned to a rectangular grid of cubic cells with the
+*     edge of at least rmax.  Bonds to the anchor site are thus only
+*     possible with sites in the same or adjacent cells.  The candidate
+*     sites are visited in the order of the site selection so that
+*     the generated bonds are the same as for the BaseBondGenerator.
+*
+*     The structure must not change while the generator is in use.
+*
+*****************************************************************************/
+
+#include <algorithm>
+
+#include <diffpy/srreal/CellListBondGenerator.hpp>
+#include <diffpy/srreal/StructureAdapter.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Constructor ---------------------------------------------------------------
+
+CellListBondGenerator::CellListBondGenerator(StructureAdapterConstPtr stru) :
+    BaseBondGenerator(stru),
+    mcells_dirty(true)
+{ }
+
+// Public Methods ------------------------------------------------------------
+
+// loop control
+
+void CellListBondGenerator::rewind()
+{
+    if (mcells_dirty)
+    {
+        const int cntsites = mstructure->countSites();
+        std::vector<R3::Vector> positions(cntsites);
+        for (int i = 0; i < cntsites; ++i)
+        {
+            positions[i] = mstructure->siteCartesianPosition(i);
+        }
+        mcells.build(positions, this->getRmax());
+        mcells_dirty = false;
+    }
+    this->collectCandidates();
+    mcandidate = mcandidates.begin();
+    this->jumpToCandidate();
+    // avoid calling rewindSymmetry at an invalid site
+    if (this->finished())   return;
+    this->rewindSymmetry();
+    this->advanceWhileInvalid();
+}
+
+// configuration
+
+void CellListBondGenerator::setRmax(double rmax)
+{
+    if (this->getRmax() != rmax)    mcells_dirty = true;
+    this->BaseBondGenerator::setRmax(rmax);
+}
+
+// Protected Methods ---------------------------------------------------------
+
+void CellListBondGenerator::getNextBond()
+{
+    if (this->iterateSymmetry())  return;
+    ++mcandidate;
+    this->jumpToCandidate();
+    // avoid calling rewindSymmetry at an invalid site
+    if (!(this->finished()))  this->rewindSymmetry();
+}
+
+// Private Methods -----------------------------------------------------------
+
+void CellListBondGenerator::collectCandidates()
+{
+    mcandidates.clear();
+    if (msite_first == msite_last)  return;
+    mnearsites.clear();
+    mcells.appendNearPoints(mr0, this->getRmax(), mnearsites);
+    SiteIndices::const_iterator ii = mnearsites.begin();
+    for (; ii != mnearsites.end(); ++ii)
+    {
+        this->appendSelectionPositions(*ii, mcandidates);
+    }
+    sort(mcandidates.begin(), mcandidates.end());
+}
+
+
+void CellListBondGenerator::jumpToCandidate()
+{
+    msite_current = (mcandidate == mcandidates.end()) ? msite_last :
+        (msite_first + *mcandidate);
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
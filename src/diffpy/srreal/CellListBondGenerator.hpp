@@ -0,0 +1,71 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class CellListBondGenerator -- bond generator for non-periodic structures
+*     that visits only sites in the cells neighboring the anchor site.
+*
+*****************************************************************************/
+
+#ifndef CELLLISTBONDGENERATOR_HPP_INCLUDED
+#define CELLLISTBONDGENERATOR_HPP_INCLUDED
+
+#include <diffpy/srreal/BaseBondGenerator.hpp>
+#include <diffpy/srreal/CellGrid.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+/// minimum number of sites for which the adapters use the cell list
+const int CELLLIST_MINIMUM_SITES = 64;
+
+class CellListBondGenerator : public BaseBondGenerator
+{
+    public:
+
+        // constructor
+        CellListBondGenerator(StructureAdapterConstPtr);
+
+        // methods
+        // loop control
+        virtual void rewind();
+
+        // configuration
+        virtual void setRmax(double);
+
+    protected:
+
+        // methods
+        virtual void getNextBond();
+
+    private:
+
+        // data
+        // spatial grid of site positions with the cell size of rmax
+        bool mcells_dirty;
+        CellGrid mcells;
+        // sorted positions of the candidate sites in the selection
+        SiteIndices mcandidates;
+        SiteIndices::const_iterator mcandidate;
+        SiteIndices mnearsites;
+
+        // methods
+        void collectCandidates();
+        void jumpToCandidate();
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // CELLLISTBONDGENERATOR_HPP_INCLUDED
@@ -16,6 +16,9 @@
 *
 *****************************************************************************/
 
+#include <algorithm>
+#include <typeinfo>
+
 #include <diffpy/srreal/ConstantPeakWidth.hpp>
 #include <diffpy/serialization.hpp>
 
@@ -61,6 +64,48 @@ double ConstantPeakWidth::calculate(const BaseBondGenerator& bnds) const
 }
 
 
+bool ConstantPeakWidth::hasBatchCalculate() const
+{
+    return typeid(*this) == typeid(ConstantPeakWidth);
+}
+
+
+void ConstantPeakWidth::calculateBatch(
+        const BondBatch& batch, double* fwhm) const
+{
+    std::fill(fwhm, fwhm + batch.size(), this->getWidth());
+}
+
+
+bool ConstantPeakWidth::hasGradient() const
+{
+    return typeid(*this) == typeid(ConstantPeakWidth);
+}
+
+
+void ConstantPeakWidth::calculateGradient(
+        const BaseBondGenerator& bnds, double* dfwhm) const
+{
+    dfwhm[0] = 0.0;
+    dfwhm[1] = 0.0;
+}
+
+
+vector<string> ConstantPeakWidth::namesOfGradientAttributes() const
+{
+    vector<string> rv;
+    if (this->hasGradient())  rv.push_back("width");
+    return rv;
+}
+
+
+void ConstantPeakWidth::calculateAttributeGradient(
+        const BaseBondGenerator& bnds, double* dfwhm) const
+{
+    dfwhm[0] = 1.0;
+}
+
+
 double ConstantPeakWidth::maxWidth(
         StructureAdapterPtr stru, double rmin, double rmax) const
 {
@@ -39,6 +39,14 @@ class ConstantPeakWidth : public PeakWidthModel
         virtual double calculate(const BaseBondGenerator&) const;
         virtual double maxWidth(StructureAdapterPtr,
                 double rmin, double rmax) const;
+        virtual bool hasBatchCalculate() const;
+        virtual void calculateBatch(const BondBatch&, double* fwhm) const;
+        virtual bool hasGradient() const;
+        virtual void calculateGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
+        virtual std::vector<std::string> namesOfGradientAttributes() const;
+        virtual void calculateAttributeGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
 
         // data access
         const double& getWidth() const;
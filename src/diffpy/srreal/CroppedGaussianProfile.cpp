@@ -19,6 +19,7 @@
 *****************************************************************************/
 
 #include <cmath>
+#include <typeinfo>
 
 #include <gsl/gsl_sf_erf.h>
 
@@ -69,6 +70,25 @@ double CroppedGaussianProfile::operator()(double x, double fwhm) const
 }
 
 
+void CroppedGaussianProfile::sampleGrid(double* y, int npts,
+        double x0, double dx, double fwhm) const
+{
+    bool useexprecurrence = (typeid(CroppedGaussianProfile) == typeid(*this))
+        && this->canSampleGaussian() && fwhm > 0 && dx > 0;
+    if (!useexprecurrence)
+    {
+        this->PeakProfile::sampleGrid(y, npts, x0, dx, fwhm);
+        return;
+    }
+    this->sampleGaussian(y, npts, x0, dx, fwhm);
+    for (int k = 0; k < npts; ++k)
+    {
+        double xrel = (x0 + k * dx) / fwhm;
+        y[k] = (fabs(xrel) >= mhalfboundrel) ? 0.0 : (mscale * y[k]);
+    }
+}
+
+
 void CroppedGaussianProfile::setPrecision(double eps)
 {
     this->GaussianProfile::setPrecision(eps);
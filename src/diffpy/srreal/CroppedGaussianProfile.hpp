@@ -38,6 +38,8 @@ class CroppedGaussianProfile : public GaussianProfile
         // methods
         const std::string& type() const;
         double operator()(double x, double fwhm) const;
+        void sampleGrid(double* y, int npts,
+                double x0, double dx, double fwhm) const;
         void setPrecision(double eps);
 
     private:
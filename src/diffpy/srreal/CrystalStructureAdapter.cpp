@@ -21,6 +21,7 @@
 *****************************************************************************/
 
 #include <cassert>
+#include <algorithm>
 
 #include <diffpy/serialization.ipp>
 #include <diffpy/validators.hpp>
@@ -153,8 +154,54 @@ CrystalStructureAdapter::getEquivalentAtoms(int idx) const
 
 CrystalStructureAdapter::AtomVector
 CrystalStructureAdapter::expandLatticeAtom(const Atom& a0) const
+{
+    return this->expandLatticeAtom(a0, NULL);
+}
+
+
+const std::vector<R3::Matrix>&
+CrystalStructureAdapter::getEquivalentRotations(int idx) const
+{
+    assert(0 <= idx && idx < this->countSites());
+    if (!this->isSymmetryCached())  this->updateSymmetryPositions();
+    return msymrotations[idx];
+}
+
+
+void CrystalStructureAdapter::updateSymmetryPositions() const
+{
+    // build asymmetric unit in lattice coordinates
+    AtomVector lcatoms(this->begin(), this->end());
+    AtomVector::iterator lcai = lcatoms.begin();
+    for (; lcai != lcatoms.end(); ++lcai)  this->toFractional(*lcai);
+    // build symmetry positions for all atoms in the asymmetric unit
+    msymatoms.resize(this->countSites());
+    msymrotations.resize(this->countSites());
+    assert(lcatoms.size() == msymatoms.size());
+    lcai = lcatoms.begin();
+    std::vector<AtomVector>::iterator saii = msymatoms.begin();
+    std::vector< std::vector<R3::Matrix> >::iterator srii =
+        msymrotations.begin();
+    for (; lcai != lcatoms.end(); ++lcai, ++saii, ++srii)
+    {
+        *saii = this->expandLatticeAtom(*lcai, &(*srii));
+        AtomVector::iterator ai = saii->begin();
+        for (; ai != saii->end(); ++ai)  this->toCartesian(*ai);
+    }
+    msymmetry_cached = true;
+}
+
+// Private Methods -----------------------------------------------------------
+
+/// Expand atom a0 in fractional coordinates to its symmetry positions.
+/// When specified, the rotations are set to Cartesian matrices of the
+/// first symmetry operation that generated each position.
+CrystalStructureAdapter::AtomVector
+CrystalStructureAdapter::expandLatticeAtom(
+        const Atom& a0, std::vector<R3::Matrix>* rotations) const
 {
     using mathutils::eps_eq;
+    if (rotations)  rotations->clear();
     AtomVector eqsites;
     vector<R3::Vector> eqsumpos;
     vector<int> eqduplicity;
@@ -176,6 +223,10 @@ CrystalStructureAdapter::expandLatticeAtom(const Atom& a0) const
             R3::Matrix utmp = R3::prod(a0.uij_cartn, R3::trans(op->R));
             a1.uij_cartn = R3::prod(op->R, utmp);
             eqsites.push_back(a1);
+            if (rotations)
+            {
+                rotations->push_back(this->cartesianRotation(op->R));
+            }
             eqsumpos.push_back(R3::zerovector);
             eqduplicity.push_back(0);
             ieq = eqsites.size() - 1;
@@ -190,13 +241,14 @@ CrystalStructureAdapter::expandLatticeAtom(const Atom& a0) const
         assert(eqsumpos.empty());
         assert(eqduplicity.empty());
         eqsites.push_back(a0);
+        if (rotations)  rotations->push_back(R3::identity());
         eqsumpos.push_back(a0.xyz_cartn);
         eqduplicity.push_back(1);
     }
     // calculate mean values from equivalent sites and adjust any roundoffs
     assert(eqsites.size() == eqduplicity.size());
     assert(eqsites.size() == eqsumpos.size());
-    iterator ai = eqsites.begin();
+    AtomVector::iterator ai = eqsites.begin();
     vector<R3::Vector>::const_iterator sii = eqsumpos.begin();
     vector<int>::const_iterator dpi = eqduplicity.begin();
     for (; ai != eqsites.end(); ++ai, ++sii, ++dpi)
@@ -207,35 +259,13 @@ CrystalStructureAdapter::expandLatticeAtom(const Atom& a0) const
 }
 
 
-void CrystalStructureAdapter::updateSymmetryPositions() const
-{
-    // build asymmetric unit in lattice coordinates
-    AtomVector lcatoms(this->begin(), this->end());
-    AtomVector::iterator lcai = lcatoms.begin();
-    for (; lcai != lcatoms.end(); ++lcai)  this->toFractional(*lcai);
-    // build symmetry positions for all atoms in the asymmetric unit
-    msymatoms.resize(this->countSites());
-    assert(lcatoms.size() == msymatoms.size());
-    lcai = lcatoms.begin();
-    std::vector<AtomVector>::iterator saii = msymatoms.begin();
-    for (; lcai != lcatoms.end(); ++lcai, ++saii)
-    {
-        *saii = this->expandLatticeAtom(*lcai);
-        iterator ai = saii->begin();
-        for (; ai != saii->end(); ++ai)  this->toCartesian(*ai);
-    }
-    msymmetry_cached = true;
-}
-
-// Private Methods -----------------------------------------------------------
-
 int CrystalStructureAdapter::findEqualPosition(
         const AtomVector& eqsites, const Atom& a0) const
 {
     const double symeps = this->getSymmetryPrecision();
     const Lattice& L = this->getLattice();
     R3::Vector dxyz;
-    const_iterator ai = eqsites.begin();
+    AtomVector::const_iterator ai = eqsites.begin();
     for (; ai != eqsites.end(); ++ai)
     {
         dxyz = ai->xyz_cartn - a0.xyz_cartn;
@@ -247,10 +277,32 @@ int CrystalStructureAdapter::findEqualPosition(
     return -1;
 }
 
+
+/// Return Cartesian matrix of the fractional rotation R.
+R3::Matrix
+CrystalStructureAdapter::cartesianRotation(const R3::Matrix& R) const
+{
+    const Lattice& L = this->getLattice();
+    R3::Matrix rv;
+    for (int j = 0; j < R3::Ndim; ++j)
+    {
+        R3::Vector ej = R3::zerovector;
+        ej[j] = 1.0;
+        R3::Vector rej = L.cartesian(R3::mxvecproduct(R, L.fractional(ej)));
+        for (int i = 0; i < R3::Ndim; ++i)  rv(i, j) = rej[i];
+    }
+    return rv;
+}
+
+
 bool CrystalStructureAdapter::isSymmetryCached() const
 {
-    msymmetry_cached = msymmetry_cached &&
-        (int(msymatoms.size()) == this->countSites());
+    // avoid writes to cached flag so that concurrent calls are safe
+    if (msymmetry_cached && (int(msymatoms.size()) != this->countSites() ||
+                msymrotations.size() != msymatoms.size()))
+    {
+        msymmetry_cached = false;
+    }
     return msymmetry_cached;
 }
 
@@ -280,6 +332,21 @@ bool operator!=(
 // class CrystalStructureBondGenerator
 //////////////////////////////////////////////////////////////////////////////
 
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+typedef PeriodicStructureBondGenerator::BondCandidate BondCandidate;
+
+bool siteOuterOrder(const BondCandidate& bc0, const BondCandidate& bc1)
+{
+    if (bc0.selpos != bc1.selpos)  return bc0.selpos < bc1.selpos;
+    if (bc0.symidx != bc1.symidx)  return bc0.symidx < bc1.symidx;
+    return bc0.tidx < bc1.tidx;
+}
+
+}   // namespace
+
 // Constructor ---------------------------------------------------------------
 
 CrystalStructureBondGenerator::CrystalStructureBondGenerator(
@@ -289,6 +356,7 @@ CrystalStructureBondGenerator::CrystalStructureBondGenerator(
     assert(mcstructure);
     msymidx = 0;
     mpuc1 = &(R3::zeromatrix());
+    mprc0 = mprc1 = &(R3::identity());
 }
 
 // Public Methods ------------------------------------------------------------
@@ -298,6 +366,7 @@ void CrystalStructureBondGenerator::selectAnchorSite(int anchor)
     this->BaseBondGenerator::selectAnchorSite(anchor);
     const Atom& a0 = this->symatoms(anchor)[0];
     mr0 = a0.xyz_cartn;
+    mprc0 = &(this->symrotations(anchor)[0]);
 }
 
 
@@ -306,6 +375,18 @@ const R3::Matrix& CrystalStructureBondGenerator::Ucartesian1() const
     return *mpuc1;
 }
 
+
+const R3::Matrix& CrystalStructureBondGenerator::Rcartesian0() const
+{
+    return *mprc0;
+}
+
+
+const R3::Matrix& CrystalStructureBondGenerator::Rcartesian1() const
+{
+    return *mprc1;
+}
+
 // Protected Methods ---------------------------------------------------------
 
 bool CrystalStructureBondGenerator::iterateSymmetry()
@@ -338,7 +419,8 @@ void CrystalStructureBondGenerator::rewindSymmetry()
 
 void CrystalStructureBondGenerator::getNextBond()
 {
-    this->BaseBondGenerator::getNextBond();
+    if (mcellsearch)  this->PeriodicStructureBondGenerator::getNextBond();
+    else  this->BaseBondGenerator::getNextBond();
 }
 
 
@@ -348,9 +430,38 @@ void CrystalStructureBondGenerator::updater1()
     assert(msymidx < sa.size());
     mr1 = mrcsphere + sa[msymidx].xyz_cartn;
     mpuc1 = &(sa[msymidx].uij_cartn);
+    mprc1 = &(this->symrotations(this->site1())[msymidx]);
     this->updateDistance();
 }
 
+
+int CrystalStructureBondGenerator::countSymmetryPositions(int siteidx)
+{
+    return this->symatoms(siteidx).size();
+}
+
+
+const R3::Vector&
+CrystalStructureBondGenerator::symmetryPosition(int siteidx, int symidx)
+{
+    return this->symatoms(siteidx)[symidx].xyz_cartn;
+}
+
+
+void CrystalStructureBondGenerator::selectSymmetryPosition(int symidx)
+{
+    msymidx = symidx;
+}
+
+
+/// Sort bond candidates to the order of the symmetry and sphere sweep,
+/// which loops over selected sites, symmetry positions and then over
+/// lattice translations.
+void CrystalStructureBondGenerator::sortBondCandidates()
+{
+    sort(mcandidates.begin(), mcandidates.end(), siteOuterOrder);
+}
+
 // Private Methods -----------------------------------------------------------
 
 const CrystalStructureAdapter::AtomVector&
@@ -360,6 +471,14 @@ CrystalStructureBondGenerator::symatoms(int idx)
     return mcstructure->msymatoms[idx];
 }
 
+
+const std::vector<R3::Matrix>&
+CrystalStructureBondGenerator::symrotations(int idx)
+{
+    assert(0 <= idx && idx < int(mcstructure->msymrotations.size()));
+    return mcstructure->msymrotations[idx];
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
@@ -89,6 +89,9 @@ class CrystalStructureAdapter : public PeriodicStructureAdapter
         const SymOpRotTrans& getSymOp(int i) const;
         /// return all symmetry equivalent atoms in the unit cell for site i
         const AtomVector& getEquivalentAtoms(int idx) const;
+        /// return Cartesian rotations from the site i to its equivalent
+        /// atoms, these map site displacements to equivalent positions
+        const std::vector<R3::Matrix>& getEquivalentRotations(int idx) const;
         /// return all symmetry related atoms in fractional coordinates
         AtomVector expandLatticeAtom(const Atom&) const;
         void updateSymmetryPositions() const;
@@ -100,9 +103,15 @@ class CrystalStructureAdapter : public PeriodicStructureAdapter
         SymOpVector msymops;
         double msymmetry_precision;
         mutable std::vector<AtomVector> msymatoms;
+        /// Cartesian rotations of the symmetry positions, these are not
+        /// serialized and are rebuilt in the next symmetry update
+        mutable std::vector< std::vector<R3::Matrix> > msymrotations;
         mutable bool msymmetry_cached;
 
         // symmetry helpers
+        AtomVector expandLatticeAtom(const Atom&,
+                std::vector<R3::Matrix>* rotations) const;
+        R3::Matrix cartesianRotation(const R3::Matrix& R) const;
         /// return index of AtomVector atom at an equal position or -1
         int findEqualPosition(const AtomVector&, const Atom&) const;
         /// fuzzy check if symmetry positions are up to date
@@ -149,6 +158,8 @@ class CrystalStructureBondGenerator : public PeriodicStructureBondGenerator
 
         // data access
         virtual const R3::Matrix& Ucartesian1() const;
+        virtual const R3::Matrix& Rcartesian0() const;
+        virtual const R3::Matrix& Rcartesian1() const;
 
     protected:
 
@@ -157,11 +168,17 @@ class CrystalStructureBondGenerator : public PeriodicStructureBondGenerator
         virtual void rewindSymmetry();
         virtual void getNextBond();
         virtual void updater1();
+        virtual int countSymmetryPositions(int siteidx);
+        virtual const R3::Vector& symmetryPosition(int siteidx, int symidx);
+        virtual void selectSymmetryPosition(int symidx);
+        virtual void sortBondCandidates();
 
         // data
         const CrystalStructureAdapter* mcstructure;
         size_t msymidx;
         const R3::Matrix* mpuc1;
+        const R3::Matrix* mprc0;
+        const R3::Matrix* mprc1;
 
     private:
 
@@ -169,6 +186,7 @@ class CrystalStructureBondGenerator : public PeriodicStructureBondGenerator
 
         // methods
         const AtomVector& symatoms(int idx);
+        const std::vector<R3::Matrix>& symrotations(int idx);
 
 };
 
@@ -97,7 +97,7 @@ eventticker::EventTicker& DebyePDFCalculator::ticker() const
 QuantityType DebyePDFCalculator::getPDF() const
 {
     QuantityType rgrid = this->getRgrid();
-    QuantityType pdf0 = this->getPDFAtQmin(this->getQmin());
+    QuantityType pdf0 = this->getPDFAtQmin(this->getF(), this->getQmin());
     QuantityType pdf1 = this->applyEnvelopes(rgrid, pdf0);
     return pdf1;
 }
@@ -116,7 +116,35 @@ QuantityType DebyePDFCalculator::getRDF() const
 
 QuantityType DebyePDFCalculator::getRDFperR() const
 {
-    return this->getPDFAtQmin(0.0);
+    return this->getPDFAtQmin(this->getF(), 0.0);
+}
+
+
+vector<QuantityType> DebyePDFCalculator::getPDFGradients() const
+{
+    vector<QuantityType> rv = this->getFGradients();
+    QuantityType rgrid = this->getRgrid();
+    vector<QuantityType>::iterator gi = rv.begin();
+    for (; gi != rv.end(); ++gi)
+    {
+        QuantityType pdf0 = this->getPDFAtQmin(*gi, this->getQmin());
+        *gi = this->applyEnvelopes(rgrid, pdf0);
+    }
+    return rv;
+}
+
+
+vector<QuantityType> DebyePDFCalculator::getPartialPDFs() const
+{
+    vector<QuantityType> rv = this->getPartialFs();
+    QuantityType rgrid = this->getRgrid();
+    vector<QuantityType>::iterator fi = rv.begin();
+    for (; fi != rv.end(); ++fi)
+    {
+        QuantityType pdf0 = this->getPDFAtQmin(*fi, this->getQmin());
+        *fi = this->applyEnvelopes(rgrid, pdf0);
+    }
+    return rv;
 }
 
 // Q-range configuration
@@ -273,10 +301,10 @@ double DebyePDFCalculator::sfSiteAtQ(int siteidx, const double& Q) const
 
 // Private Methods -----------------------------------------------------------
 
-QuantityType DebyePDFCalculator::getPDFAtQmin(double qmin) const
+QuantityType DebyePDFCalculator::getPDFAtQmin(
+        QuantityType fpad, double qmin) const
 {
     // build a zero padded F vector that gives dr <= rstep
-    QuantityType fpad = this->getF();
     // zero all F values below qmin
     int nqmin = pdfutils_qminSteps(qmin, this->getQstep());
     if (nqmin > int(fpad.size()))  nqmin = fpad.size();
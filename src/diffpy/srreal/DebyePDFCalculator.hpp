@@ -73,6 +73,10 @@ class DebyePDFCalculator :
         QuantityType getPDF() const;
         QuantityType getRDF() const;
         QuantityType getRDFperR() const;
+        /// derivatives of PDF ordered as in getFGradients
+        std::vector<QuantityType> getPDFGradients() const;
+        /// partial PDFs ordered as in getPartialTypePairs
+        std::vector<QuantityType> getPartialPDFs() const;
 
         // Q-range configuration
         void setQmin(double);
@@ -109,7 +113,8 @@ class DebyePDFCalculator :
     private:
 
         // methods
-        QuantityType getPDFAtQmin(double qmin) const;
+        /// PDF on the r-grid from F values with Q below qmin discarded
+        QuantityType getPDFAtQmin(QuantityType fpad, double qmin) const;
         void updateQstep();
         /// complete lower bound extension of the calculated grid
         double rcalclo() const;
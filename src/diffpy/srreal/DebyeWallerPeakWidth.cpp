@@ -17,6 +17,8 @@
 *
 *****************************************************************************/
 
+#include <typeinfo>
+
 #include <diffpy/srreal/DebyeWallerPeakWidth.hpp>
 #include <diffpy/srreal/StructureAdapter.hpp>
 #include <diffpy/serialization.hpp>
@@ -59,6 +61,45 @@ double DebyeWallerPeakWidth::calculate(const BaseBondGenerator& bnds) const
 }
 
 
+/// Batch calculation is used only for this class, because derived
+/// classes may override the calculate method.
+bool DebyeWallerPeakWidth::hasBatchCalculate() const
+{
+    return typeid(*this) == typeid(DebyeWallerPeakWidth);
+}
+
+
+void DebyeWallerPeakWidth::calculateBatch(
+        const BondBatch& batch, double* fwhm) const
+{
+    using diffpy::mathutils::GAUSS_SIGMA_TO_FWHM;
+    const int n = batch.size();
+    const double* msdval = n ? &batch.msd[0] : NULL;
+    for (int i = 0; i < n; ++i)
+    {
+        fwhm[i] = (msdval[i] < 0.0) ? 0.0 :
+            GAUSS_SIGMA_TO_FWHM * sqrt(msdval[i]);
+    }
+}
+
+
+bool DebyeWallerPeakWidth::hasGradient() const
+{
+    return typeid(*this) == typeid(DebyeWallerPeakWidth);
+}
+
+
+void DebyeWallerPeakWidth::calculateGradient(
+        const BaseBondGenerator& bnds, double* dfwhm) const
+{
+    using diffpy::mathutils::GAUSS_SIGMA_TO_FWHM;
+    double msdval = bnds.msd();
+    dfwhm[0] = (msdval <= 0.0) ? 0.0 :
+        GAUSS_SIGMA_TO_FWHM / (2 * sqrt(msdval));
+    dfwhm[1] = 0.0;
+}
+
+
 double DebyeWallerPeakWidth::maxWidth(StructureAdapterPtr stru,
                 double rmin, double rmax) const
 {
@@ -39,6 +39,11 @@ class DebyeWallerPeakWidth : public PeakWidthModel
         virtual double calculate(const BaseBondGenerator&) const;
         virtual double maxWidth(StructureAdapterPtr,
                 double rmin, double rmax) const;
+        virtual bool hasBatchCalculate() const;
+        virtual void calculateBatch(const BondBatch&, double* fwhm) const;
+        virtual bool hasGradient() const;
+        virtual void calculateGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
 };
 
 
@@ -0,0 +1,118 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class FFTWSineTransform -- discrete sine transformation by the FFTW
+*     RODFT00 real-to-real transform.  Available only when libdiffpy
+*     is built with FFTW support.
+*
+*****************************************************************************/
+
+#include <stdexcept>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <fftw3.h>
+
+#include <diffpy/srreal/FFTWSineTransform.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Local Constants and Helpers -----------------------------------------------
+
+namespace {
+
+const char* EMSGFFT = "Fourier Transformation failed.";
+
+/// number of cached plans when the cache is reset
+const size_t FFTWSINETRANSFORM_MAXPLANS = 16;
+
+/// FFTW planner is not thread safe and has to be serialized
+boost::mutex& plannermutex()
+{
+    static boost::mutex rv;
+    return rv;
+}
+
+
+void destroyPlan(void* p)
+{
+    boost::lock_guard<boost::mutex> lock(plannermutex());
+    fftw_destroy_plan(static_cast<fftw_plan>(p));
+}
+
+}   // namespace
+
+// Constructors --------------------------------------------------------------
+
+SineTransformPtr FFTWSineTransform::create() const
+{
+    SineTransformPtr rv(new FFTWSineTransform());
+    return rv;
+}
+
+
+SineTransformPtr FFTWSineTransform::clone() const
+{
+    return this->create();
+}
+
+// Public Methods ------------------------------------------------------------
+
+const string& FFTWSineTransform::type() const
+{
+    static string rv = "fftw";
+    return rv;
+}
+
+
+/// RODFT00 of n - 1 points y[1:n] gives 2 * F[k] in y[k].
+void FFTWSineTransform::transform(double* y, int n)
+{
+    if (n <= 0)  return;
+    y[0] = 0.0;
+    if (n == 1)  return;
+    boost::shared_ptr<void>& pp = mplans[n];
+    if (!pp)
+    {
+        if (mplans.size() > FFTWSINETRANSFORM_MAXPLANS)
+        {
+            mplans.clear();
+            return this->transform(y, n);
+        }
+        // planning with FFTW_ESTIMATE does not touch the array
+        vector<double> a(n - 1);
+        fftw_plan p;
+        {
+            boost::lock_guard<boost::mutex> lock(plannermutex());
+            p = fftw_plan_r2r_1d(n - 1, &a[0], &a[0], FFTW_RODFT00,
+                    FFTW_ESTIMATE | FFTW_UNALIGNED);
+        }
+        if (!p)  throw invalid_argument(EMSGFFT);
+        pp.reset(p, destroyPlan);
+    }
+    fftw_execute_r2r(static_cast<fftw_plan>(pp.get()), y + 1, y + 1);
+    for (int k = 1; k < n; ++k)  y[k] *= 0.5;
+}
+
+// Registration --------------------------------------------------------------
+
+bool reg_FFTWSineTransform = FFTWSineTransform().registerThisType();
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
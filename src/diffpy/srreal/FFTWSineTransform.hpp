@@ -0,0 +1,58 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class FFTWSineTransform -- discrete sine transformation by the FFTW
+*     RODFT00 real-to-real transform.  Available only when libdiffpy
+*     is built with FFTW support.
+*
+*****************************************************************************/
+
+#ifndef FFTWSINETRANSFORM_HPP_INCLUDED
+#define FFTWSINETRANSFORM_HPP_INCLUDED
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+#include <diffpy/srreal/SineTransform.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+/// @class FFTWSineTransform
+/// @brief sine transformation backend using the FFTW library
+
+class FFTWSineTransform : public SineTransform
+{
+    public:
+
+        // constructors
+        SineTransformPtr create() const;
+        SineTransformPtr clone() const;
+
+        // methods
+        const std::string& type() const;
+        void transform(double* y, int n);
+
+    private:
+
+        // data
+        /// FFTW plans for the transformation sizes
+        std::map<int, boost::shared_ptr<void> > mplans;
+
+};  // class FFTWSineTransform
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // FFTWSINETRANSFORM_HPP_INCLUDED
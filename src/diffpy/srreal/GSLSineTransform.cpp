@@ -0,0 +1,195 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class GSLSineTransform -- discrete sine transformation by the GSL
+*     mixed-radix real FFT.  Even sizes use a real FFT of the same size
+*     with pre- and post-processing, odd sizes use an odd extension.
+*
+*****************************************************************************/
+
+#include <cmath>
+#include <cassert>
+#include <stdexcept>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_fft_real.h>
+
+#include <diffpy/srreal/GSLSineTransform.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Local Constants -----------------------------------------------------------
+
+namespace {
+
+const char* EMSGFFT = "Fourier Transformation failed.";
+
+/// number of cached plans when the cache is reset
+const size_t GSLSINETRANSFORM_MAXPLANS = 16;
+
+}   // namespace
+
+// class GSLSineTransform::Plan ----------------------------------------------
+
+/// GSL wavetable and work buffers for one transformation size
+class GSLSineTransform::Plan
+{
+    public:
+
+        // constructor
+        explicit Plan(int n) :
+            nfft((n % 2) ? (2 * n) : n),
+            wavetable(gsl_fft_real_wavetable_alloc(nfft)),
+            workspace(gsl_fft_real_workspace_alloc(nfft))
+        {
+            if (!wavetable || !workspace)
+            {
+                this->release();
+                throw invalid_argument(EMSGFFT);
+            }
+            if (nfft != n)  buffer.resize(nfft);
+            // sin(pi * j / n) for the even-size pre-processing
+            else
+            {
+                sines.resize(n / 2 + 1);
+                for (int j = 0; j <= n / 2; ++j)  sines[j] = sin(M_PI * j / n);
+            }
+        }
+
+        ~Plan()  { this->release(); }
+
+        // data
+        const int nfft;
+        gsl_fft_real_wavetable* wavetable;
+        gsl_fft_real_workspace* workspace;
+        QuantityType sines;
+        QuantityType buffer;
+
+    private:
+
+        void release()
+        {
+            if (wavetable)  gsl_fft_real_wavetable_free(wavetable);
+            if (workspace)  gsl_fft_real_workspace_free(workspace);
+            wavetable = NULL;
+            workspace = NULL;
+        }
+
+        // non-copyable
+        Plan(const Plan&);
+        Plan& operator=(const Plan&);
+};
+
+// Constructors --------------------------------------------------------------
+
+SineTransformPtr GSLSineTransform::create() const
+{
+    SineTransformPtr rv(new GSLSineTransform());
+    return rv;
+}
+
+
+/// Return new instance of the same type.  The cached plans and buffers
+/// are not shared so the clone can be used in a different thread.
+SineTransformPtr GSLSineTransform::clone() const
+{
+    return this->create();
+}
+
+// Public Methods ------------------------------------------------------------
+
+const string& GSLSineTransform::type() const
+{
+    static string rv = "gsl";
+    return rv;
+}
+
+
+void GSLSineTransform::transform(double* y, int n)
+{
+    if (n <= 0)  return;
+    y[0] = 0.0;
+    if (n == 1)  return;
+    Plan& plan = this->getPlan(n);
+    int status;
+    // odd extension of y to a real array of 2 * n points.  The imaginary
+    // components of its Fourier transform are -2 * F[k].
+    if (plan.nfft != n)
+    {
+        double* z = &(plan.buffer[0]);
+        z[0] = z[n] = 0.0;
+        for (int j = 1; j < n; ++j)
+        {
+            z[j] = y[j];
+            z[2 * n - j] = -y[j];
+        }
+        status = gsl_fft_real_transform(z, 1, plan.nfft,
+                plan.wavetable, plan.workspace);
+        if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
+        for (int k = 1; k < n; ++k)  y[k] = -0.5 * z[2 * k];
+        return;
+    }
+    // even size - combine y[j] and y[n - j] to an array whose Fourier
+    // transform has the even terms F[2k] in imaginary components and
+    // the differences F[2k + 1] - F[2k - 1] in the real components.
+    for (int j = 1; j <= n / 2; ++j)
+    {
+        const double a = y[j];
+        const double b = y[n - j];
+        const double y1 = plan.sines[j] * (a + b);
+        const double y2 = 0.5 * (a - b);
+        y[j] = y1 + y2;
+        y[n - j] = y1 - y2;
+    }
+    status = gsl_fft_real_transform(y, 1, n, plan.wavetable, plan.workspace);
+    if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
+    // unpack the half-complex result with R[k] at 2k - 1, I[k] at 2k
+    double fodd = 0.5 * y[0];
+    y[0] = 0.0;
+    for (int k = 1; k < n / 2; ++k)
+    {
+        const double rk = y[2 * k - 1];
+        y[2 * k - 1] = fodd;
+        y[2 * k] = -y[2 * k];
+        fodd += rk;
+    }
+    y[n - 1] = fodd;
+}
+
+// Private Methods -----------------------------------------------------------
+
+GSLSineTransform::Plan& GSLSineTransform::getPlan(int n)
+{
+    PlanPtr& pp = mplans[n];
+    if (pp)  return *pp;
+    if (mplans.size() > GSLSINETRANSFORM_MAXPLANS)
+    {
+        mplans.clear();
+        return this->getPlan(n);
+    }
+    pp.reset(new Plan(n));
+    return *pp;
+}
+
+// Registration --------------------------------------------------------------
+
+bool reg_GSLSineTransform = GSLSineTransform().registerThisType();
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
@@ -0,0 +1,65 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class GSLSineTransform -- discrete sine transformation by the GSL
+*     mixed-radix real FFT.  Even sizes use a real FFT of the same size
+*     with pre- and post-processing, odd sizes use an odd extension.
+*
+*****************************************************************************/
+
+#ifndef GSLSINETRANSFORM_HPP_INCLUDED
+#define GSLSINETRANSFORM_HPP_INCLUDED
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+#include <diffpy/srreal/SineTransform.hpp>
+#include <diffpy/srreal/QuantityType.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+/// @class GSLSineTransform
+/// @brief built-in sine transformation backend using GSL real FFT
+
+class GSLSineTransform : public SineTransform
+{
+    public:
+
+        // constructors
+        SineTransformPtr create() const;
+        SineTransformPtr clone() const;
+
+        // methods
+        const std::string& type() const;
+        void transform(double* y, int n);
+
+    private:
+
+        // types
+        class Plan;
+        typedef boost::shared_ptr<Plan> PlanPtr;
+
+        // data
+        std::map<int, PlanPtr> mplans;
+
+        // methods
+        Plan& getPlan(int n);
+
+};  // class GSLSineTransform
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // GSLSINETRANSFORM_HPP_INCLUDED
@@ -18,6 +18,9 @@
 *****************************************************************************/
 
 #include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <typeinfo>
 
 #include <diffpy/srreal/GaussianProfile.hpp>
 #include <diffpy/mathutils.hpp>
@@ -29,6 +32,41 @@ namespace srreal {
 
 using diffpy::mathutils::DOUBLE_EPS;
 
+// Local Constants and Helpers -----------------------------------------------
+
+namespace {
+
+// number of recurrence steps between exact evaluations of exp.
+// The relative round-off error grows as about GAUSSIAN_RESYNC**2 * eps.
+const int GAUSSIAN_RESYNC = 16;
+// smallest peak precision for which the exp recurrence is used
+const double GAUSSIAN_RECURRENCE_MINPRECISION = 1e-12;
+
+// Evaluate A * exp(-a * x**2) at x = x0 + j * h for j < n and store
+// the values in y[j * stride].  The steps must go away from the peak
+// center so that the updated ratios never exceed 1.
+void gaussianSweep(double* y, int stride, int n,
+        double x0, double h, double A, double a)
+{
+    const double c = exp(-2 * a * h * h);
+    for (int j0 = 0; j0 < n; j0 += GAUSSIAN_RESYNC)
+    {
+        const double x = x0 + j0 * h;
+        double g = A * exp(-a * x * x);
+        double r = exp(-a * (2 * x * h + h * h));
+        const int jlast = min(n, j0 + GAUSSIAN_RESYNC);
+        double* py = y + j0 * stride;
+        for (int j = j0; j < jlast; ++j, py += stride)
+        {
+            *py = g;
+            g *= r;
+            r *= c;
+        }
+    }
+}
+
+}   // namespace
+
 // Constructors --------------------------------------------------------------
 
 GaussianProfile::GaussianProfile()
@@ -82,6 +120,28 @@ double GaussianProfile::xboundhi(double fwhm) const
 }
 
 
+void GaussianProfile::sampleGrid(double* y, int npts,
+        double x0, double dx, double fwhm) const
+{
+    // derived classes may redefine operator() and must use generic loop
+    bool useexprecurrence = (typeid(GaussianProfile) == typeid(*this)) &&
+        this->canSampleGaussian();
+    if (useexprecurrence)  this->sampleGaussian(y, npts, x0, dx, fwhm);
+    else  this->PeakProfile::sampleGrid(y, npts, x0, dx, fwhm);
+}
+
+
+/// Exact derivative that also applies to profiles which scale
+/// the Gaussian by a constant within their bounds.
+double GaussianProfile::xderivative(double x, double fwhm) const
+{
+    if (fwhm <= 0)  return 0.0;
+    const PeakProfile& pkf = *this;
+    double rv = -8 * M_LN2 * x / (fwhm * fwhm) * pkf(x, fwhm);
+    return rv;
+}
+
+
 void GaussianProfile::setPrecision(double eps)
 {
     // correct any settings below DOUBLE_EPS
@@ -91,6 +151,37 @@ void GaussianProfile::setPrecision(double eps)
     else  mhalfboundrel = 0.0;
 }
 
+// Protected Methods ---------------------------------------------------------
+
+bool GaussianProfile::canSampleGaussian() const
+{
+    return this->getPrecision() >= GAUSSIAN_RECURRENCE_MINPRECISION;
+}
+
+
+void GaussianProfile::sampleGaussian(double* y, int npts,
+        double x0, double dx, double fwhm) const
+{
+    if (npts <= 0)  return;
+    if (fwhm <= 0 || !(dx > 0))
+    {
+        this->PeakProfile::sampleGrid(y, npts, x0, dx, fwhm);
+        return;
+    }
+    const double A = 2 * sqrt(M_LN2 / M_PI) / fwhm;
+    const double a = 4 * M_LN2 / (fwhm * fwhm);
+    // start from the grid point nearest to the peak center and sweep
+    // to both sides, where the Gaussian ratios are less than one.
+    double kc = floor(0.5 - x0 / dx);
+    const int kcenter = int(max(0.0, min(npts - 1.0, kc)));
+    const double xc = x0 + kcenter * dx;
+    gaussianSweep(y + kcenter, 1, npts - kcenter, xc, dx, A, a);
+    if (kcenter > 0)
+    {
+        gaussianSweep(y + kcenter - 1, -1, kcenter, xc - dx, -dx, A, a);
+    }
+}
+
 // Registration --------------------------------------------------------------
 
 bool reg_GaussianProfile = GaussianProfile().registerThisType();
@@ -39,6 +39,9 @@ class GaussianProfile : public PeakProfile
         double operator()(double x, double fwhm) const;
         double xboundlo(double fwhm) const;
         double xboundhi(double fwhm) const;
+        void sampleGrid(double* y, int npts,
+                double x0, double dx, double fwhm) const;
+        double xderivative(double x, double fwhm) const;
         void setPrecision(double eps);
 
     protected:
@@ -46,6 +49,13 @@ class GaussianProfile : public PeakProfile
         // data
         double mhalfboundrel;
 
+        // methods
+        /// check if sampleGaussian is accurate enough for the precision
+        bool canSampleGaussian() const;
+        /// Gaussian values on a grid evaluated by an exp recurrence
+        void sampleGaussian(double* y, int npts,
+                double x0, double dx, double fwhm) const;
+
 };
 
 }   // namespace srreal
@@ -18,6 +18,8 @@
 *
 *****************************************************************************/
 
+#include <typeinfo>
+
 #include <diffpy/srreal/JeongPeakWidth.hpp>
 #include <diffpy/mathutils.hpp>
 #include <diffpy/serialization.hpp>
@@ -74,6 +76,75 @@ double JeongPeakWidth::calculate(const BaseBondGenerator& bnds) const
 }
 
 
+bool JeongPeakWidth::hasBatchCalculate() const
+{
+    return typeid(*this) == typeid(JeongPeakWidth);
+}
+
+
+void JeongPeakWidth::calculateBatch(const BondBatch& batch, double* fwhm) const
+{
+    this->DebyeWallerPeakWidth::calculateBatch(batch, fwhm);
+    const int n = batch.size();
+    for (int i = 0; i < n; ++i)
+    {
+        double corr = this->msdSharpeningRatio(batch.distance[i]);
+        // avoid calculating square root of negative value
+        fwhm[i] = (corr <= 0) ? 0.0 : (sqrt(corr) * fwhm[i]);
+    }
+}
+
+
+bool JeongPeakWidth::hasGradient() const
+{
+    return typeid(*this) == typeid(JeongPeakWidth);
+}
+
+
+void JeongPeakWidth::calculateGradient(
+        const BaseBondGenerator& bnds, double* dfwhm) const
+{
+    double r = bnds.distance();
+    double corr = this->msdSharpeningRatio(r);
+    dfwhm[0] = dfwhm[1] = 0.0;
+    if (corr <= 0)  return;
+    double fwhm0 = this->DebyeWallerPeakWidth::calculate(bnds);
+    this->DebyeWallerPeakWidth::calculateGradient(bnds, dfwhm);
+    double dcorr = this->getDelta1() / pow(r, 2) +
+        2 * this->getDelta2() / pow(r, 3) +
+        2 * pow(this->getQbroad(), 2) * r;
+    dfwhm[0] *= sqrt(corr);
+    dfwhm[1] = fwhm0 * dcorr / (2 * sqrt(corr));
+}
+
+
+vector<string> JeongPeakWidth::namesOfGradientAttributes() const
+{
+    vector<string> rv;
+    if (!this->hasGradient())  return rv;
+    rv.push_back("delta1");
+    rv.push_back("delta2");
+    rv.push_back("qbroad");
+    return rv;
+}
+
+
+/// The peak width is fwhm0 * sqrt(corr) for the sharpening ratio
+/// corr = 1 - delta1 / r - delta2 / r**2 + qbroad**2 * r**2.
+void JeongPeakWidth::calculateAttributeGradient(
+        const BaseBondGenerator& bnds, double* dfwhm) const
+{
+    double r = bnds.distance();
+    double corr = this->msdSharpeningRatio(r);
+    dfwhm[0] = dfwhm[1] = dfwhm[2] = 0.0;
+    if (corr <= 0)  return;
+    double c = this->DebyeWallerPeakWidth::calculate(bnds) / (2 * sqrt(corr));
+    dfwhm[0] = -c / r;
+    dfwhm[1] = -c / pow(r, 2);
+    dfwhm[2] = c * 2 * this->getQbroad() * pow(r, 2);
+}
+
+
 double JeongPeakWidth::maxWidth(StructureAdapterPtr stru,
         double rmin, double rmax) const
 {
@@ -41,6 +41,14 @@ class JeongPeakWidth : public DebyeWallerPeakWidth
         virtual double calculate(const BaseBondGenerator&) const;
         virtual double maxWidth(StructureAdapterPtr,
                 double rmin, double rmax) const;
+        virtual bool hasBatchCalculate() const;
+        virtual void calculateBatch(const BondBatch&, double* fwhm) const;
+        virtual bool hasGradient() const;
+        virtual void calculateGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
+        virtual std::vector<std::string> namesOfGradientAttributes() const;
+        virtual void calculateAttributeGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
 
         // data access
         const double& getDelta1() const;
@@ -15,6 +15,8 @@
 * class Lattice -- vector and matrix conversions between general and
 *     Cartesian coordinate systems
 *
+*     All const methods are reentrant and safe to call concurrently.
+*
 *****************************************************************************/
 
 #ifndef LATTICE_HPP_INCLUDED
@@ -112,22 +114,22 @@ class Lattice
         template <class V>
             double anglerad(const V& u, const V& v) const;
         // conversion of coordinates and tensors
-        const R3::Vector& cartesian(const R3::Vector& lv) const;
+        R3::Vector cartesian(const R3::Vector& lv) const;
         template <class V>
-            const R3::Vector& cartesian(const V& lv) const;
-        const R3::Vector& fractional(const R3::Vector& cv) const;
+            R3::Vector cartesian(const V& lv) const;
+        R3::Vector fractional(const R3::Vector& cv) const;
         template <class V>
-            const R3::Vector& fractional(const V& cv) const;
-        const R3::Vector& ucvCartesian(const R3::Vector& cv) const;
+            R3::Vector fractional(const V& cv) const;
+        R3::Vector ucvCartesian(const R3::Vector& cv) const;
         template <class V>
-            const R3::Vector& ucvCartesian(const V& cv) const;
-        const R3::Vector& ucvFractional(const R3::Vector& lv) const;
+            R3::Vector ucvCartesian(const V& cv) const;
+        R3::Vector ucvFractional(const R3::Vector& lv) const;
         template <class V>
-            const R3::Vector& ucvFractional(const V& lv) const;
-        const R3::Matrix& cartesianMatrix(const R3::Matrix& Ml) const;
-        const R3::Matrix& fractionalMatrix(const R3::Matrix& Mc) const;
+            R3::Vector ucvFractional(const V& lv) const;
+        R3::Matrix cartesianMatrix(const R3::Matrix& Ml) const;
+        R3::Matrix fractionalMatrix(const R3::Matrix& Mc) const;
         // largest cell diagonal in fractional coordinates
-        const R3::Vector& ucMaxDiagonal() const;
+        R3::Vector ucMaxDiagonal() const;
         double ucMaxDiagonalLength() const;
 
         // comparison
@@ -489,7 +491,7 @@ double Lattice::norm(const V& u) const
 template <class V>
 double Lattice::distance(const V& u, const V& v) const
 {
-    static R3::Vector duv;
+    R3::Vector duv;
     duv[0] = u[0] - v[0];
     duv[1] = u[1] - v[1];
     duv[2] = u[2] - v[2];
@@ -515,9 +517,9 @@ double Lattice::anglerad(const V& u, const V& v) const
 
 
 template <class V>
-const R3::Vector& Lattice::cartesian(const V& lv) const
+R3::Vector Lattice::cartesian(const V& lv) const
 {
-    static R3::Vector lvcopy;
+    R3::Vector lvcopy;
     lvcopy[0] = lv[0];
     lvcopy[1] = lv[1];
     lvcopy[2] = lv[2];
@@ -526,9 +528,9 @@ const R3::Vector& Lattice::cartesian(const V& lv) const
 
 
 template <class V>
-const R3::Vector& Lattice::fractional(const V& cv) const
+R3::Vector Lattice::fractional(const V& cv) const
 {
-    static R3::Vector cvcopy;
+    R3::Vector cvcopy;
     cvcopy[0] = cv[0];
     cvcopy[1] = cv[1];
     cvcopy[2] = cv[2];
@@ -537,9 +539,9 @@ const R3::Vector& Lattice::fractional(const V& cv) const
 
 
 template <class V>
-const R3::Vector& Lattice::ucvCartesian(const V& cv) const
+R3::Vector Lattice::ucvCartesian(const V& cv) const
 {
-    static R3::Vector cvcopy;
+    R3::Vector cvcopy;
     cvcopy[0] = cv[0];
     cvcopy[1] = cv[1];
     cvcopy[2] = cv[2];
@@ -548,9 +550,9 @@ const R3::Vector& Lattice::ucvCartesian(const V& cv) const
 
 
 template <class V>
-const R3::Vector& Lattice::ucvFractional(const V& cv) const
+R3::Vector Lattice::ucvFractional(const V& cv) const
 {
-    static R3::Vector cvcopy;
+    R3::Vector cvcopy;
     cvcopy[0] = cv[0];
     cvcopy[1] = cv[1];
     cvcopy[2] = cv[2];
@@ -0,0 +1,206 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class NeighborList -- cache of atom pairs within rmax + skin distance
+*     that is reused until some atoms move by more than half the skin.
+*
+* class NeighborListBondGenerator -- bond generator that visits only
+*     the atom pairs in the NeighborList
+*
+*     The list stores for every anchor site all neighbor sites together
+*     with a lattice offset of the periodic image.  Bond vectors are
+*     then recalculated from the current site positions.  This works
+*     for the AtomicStructureAdapter and PeriodicStructureAdapter, where
+*     the site positions fully define the atom positions.
+*
+*****************************************************************************/
+
+#include <cassert>
+#include <algorithm>
+#include <typeinfo>
+
+#include <diffpy/srreal/NeighborList.hpp>
+#include <diffpy/srreal/PeriodicStructureAdapter.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+//////////////////////////////////////////////////////////////////////////////
+// class NeighborList
+//////////////////////////////////////////////////////////////////////////////
+
+// Constructor ---------------------------------------------------------------
+
+NeighborList::NeighborList() :
+    mcutoff(0.0),
+    mperiodic(false),
+    mbuildcount(0)
+{ }
+
+// Public Methods ------------------------------------------------------------
+
+bool NeighborList::isSupported(StructureAdapterConstPtr stru)
+{
+    if (!stru)  return false;
+    const type_info& tp = typeid(*stru);
+    bool rv = (tp == typeid(AtomicStructureAdapter)) ||
+        (tp == typeid(PeriodicStructureAdapter));
+    return rv;
+}
+
+
+/// Rebuild the list unless all atom pairs within the rmax of bnds
+/// are already in the list.  The bnds generator is used for building
+/// and its configuration is changed.  Return true if list was rebuilt.
+bool NeighborList::update(BaseBondGenerator& bnds,
+        StructureAdapterConstPtr stru, double skin)
+{
+    assert(NeighborList::isSupported(stru));
+    const double rmax = bnds.getRmax();
+    if (!this->isOutdated(stru, rmax))  return false;
+    this->build(bnds, stru, rmax, skin);
+    return true;
+}
+
+// Private Methods -----------------------------------------------------------
+
+bool NeighborList::isOutdated(StructureAdapterConstPtr stru, double rmax) const
+{
+    const int cntsites = stru->countSites();
+    if (mstart.empty() || cntsites != int(mpositions.size()))  return true;
+    const PeriodicStructureAdapter* pstru =
+        dynamic_cast<const PeriodicStructureAdapter*>(stru.get());
+    if (bool(pstru) != mperiodic)  return true;
+    if (pstru && pstru->getLattice() != mlattice)  return true;
+    double maxshift = 0.0;
+    R3::Vector dr;
+    for (int i = 0; i < cntsites; ++i)
+    {
+        dr = stru->siteCartesianPosition(i) - mpositions[i];
+        maxshift = max(maxshift, R3::norm(dr));
+    }
+    // pair distance can shrink by at most twice the largest shift
+    bool rv = (rmax + 2 * maxshift > mcutoff);
+    return rv;
+}
+
+
+void NeighborList::build(BaseBondGenerator& bnds,
+        StructureAdapterConstPtr stru, double rmax, double skin)
+{
+    mcutoff = rmax + skin;
+    const PeriodicStructureAdapter* pstru =
+        dynamic_cast<const PeriodicStructureAdapter*>(stru.get());
+    mperiodic = bool(pstru);
+    if (pstru)  mlattice = pstru->getLattice();
+    const int cntsites = stru->countSites();
+    mpositions.resize(cntsites);
+    for (int i = 0; i < cntsites; ++i)
+    {
+        mpositions[i] = stru->siteCartesianPosition(i);
+    }
+    mstart.assign(1, 0);
+    msite1.clear();
+    moffset.clear();
+    bnds.setRmin(0.0);
+    bnds.setRmax(mcutoff);
+    bnds.selectSiteRange(0, cntsites);
+    R3::Vector offset;
+    for (int i0 = 0; i0 < cntsites; ++i0)
+    {
+        bnds.selectAnchorSite(i0);
+        for (bnds.rewind(); !bnds.finished(); bnds.next())
+        {
+            const int i1 = bnds.site1();
+            offset = bnds.r01() - mpositions[i1];
+            offset += mpositions[i0];
+            msite1.push_back(i1);
+            moffset.push_back(offset);
+        }
+        mstart.push_back(msite1.size());
+    }
+    ++mbuildcount;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// class NeighborListBondGenerator
+//////////////////////////////////////////////////////////////////////////////
+
+// Constructor ---------------------------------------------------------------
+
+NeighborListBondGenerator::NeighborListBondGenerator(
+        StructureAdapterConstPtr stru,
+        boost::shared_ptr<const NeighborList> nbl) :
+    BaseBondGenerator(stru), mneighbors(nbl)
+{
+    assert(mneighbors);
+}
+
+// Public Methods ------------------------------------------------------------
+
+void NeighborListBondGenerator::rewind()
+{
+    const NeighborList& nbl = *mneighbors;
+    assert(int(nbl.mpositions.size()) == mstructure->countSites());
+    assert(this->getRmax() <= nbl.mcutoff);
+    mcandidates.clear();
+    if (msite_first != msite_last)
+    {
+        const int i0 = this->site0();
+        for (int k = nbl.mstart[i0]; k < nbl.mstart[i0 + 1]; ++k)
+        {
+            mpositions.clear();
+            this->appendSelectionPositions(nbl.msite1[k], mpositions);
+            SiteIndices::const_iterator pp = mpositions.begin();
+            for (; pp != mpositions.end(); ++pp)
+            {
+                mcandidates.push_back(make_pair(*pp, k));
+            }
+        }
+        sort(mcandidates.begin(), mcandidates.end());
+    }
+    mcandidate = mcandidates.begin();
+    this->jumpToCandidate();
+    this->advanceWhileInvalid();
+}
+
+// Protected Methods ---------------------------------------------------------
+
+void NeighborListBondGenerator::getNextBond()
+{
+    ++mcandidate;
+    this->jumpToCandidate();
+}
+
+// Private Methods -----------------------------------------------------------
+
+void NeighborListBondGenerator::jumpToCandidate()
+{
+    if (mcandidate == mcandidates.end())
+    {
+        msite_current = msite_last;
+        return;
+    }
+    msite_current = msite_first + mcandidate->first;
+    mr1 = mstructure->siteCartesianPosition(this->site1());
+    mr1 += mneighbors->moffset[mcandidate->second];
+    this->updateDistance();
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
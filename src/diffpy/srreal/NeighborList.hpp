@@ -0,0 +1,112 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class NeighborList -- cache of atom pairs within rmax + skin distance
+*     that is reused until some atoms move by more than half the skin.
+*
+* class NeighborListBondGenerator -- bond generator that visits only
+*     the atom pairs in the NeighborList
+*
+*****************************************************************************/
+
+#ifndef NEIGHBORLIST_HPP_INCLUDED
+#define NEIGHBORLIST_HPP_INCLUDED
+
+#include <vector>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+
+#include <diffpy/srreal/BaseBondGenerator.hpp>
+#include <diffpy/srreal/Lattice.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+class NeighborList
+{
+    friend class NeighborListBondGenerator;
+
+    public:
+
+        // constructor
+        NeighborList();
+
+        // methods
+        /// check if neighbor list can be used for the structure adapter
+        static bool isSupported(StructureAdapterConstPtr);
+        /// rebuild the list with the bnds generator if it is outdated
+        bool update(BaseBondGenerator& bnds,
+                StructureAdapterConstPtr, double skin);
+        /// number of times the list was built
+        int countBuilds() const  { return mbuildcount; }
+
+    private:
+
+        // data
+        /// distance cutoff used when building the list
+        double mcutoff;
+        bool mperiodic;
+        Lattice mlattice;
+        /// reference site positions at the time of the last build
+        std::vector<R3::Vector> mpositions;
+        /// neighbors of site i are at [mstart[i], mstart[i + 1])
+        SiteIndices mstart;
+        SiteIndices msite1;
+        /// r01 = r1 - r0 + moffset, a lattice vector for periodic structures
+        std::vector<R3::Vector> moffset;
+        int mbuildcount;
+
+        // methods
+        bool isOutdated(StructureAdapterConstPtr, double rmax) const;
+        void build(BaseBondGenerator& bnds,
+                StructureAdapterConstPtr, double rmax, double skin);
+
+};
+
+
+class NeighborListBondGenerator : public BaseBondGenerator
+{
+    public:
+
+        // constructor
+        NeighborListBondGenerator(StructureAdapterConstPtr,
+                boost::shared_ptr<const NeighborList>);
+
+        // methods
+        // loop control
+        virtual void rewind();
+
+    protected:
+
+        // methods
+        virtual void getNextBond();
+
+    private:
+
+        // data
+        boost::shared_ptr<const NeighborList> mneighbors;
+        /// sorted pairs of selection positions and neighbor list indices
+        std::vector< std::pair<int, int> > mcandidates;
+        std::vector< std::pair<int, int> >::const_iterator mcandidate;
+        SiteIndices mpositions;
+
+        // methods
+        void jumpToCandidate();
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // NEIGHBORLIST_HPP_INCLUDED
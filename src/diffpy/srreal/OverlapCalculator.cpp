@@ -439,6 +439,12 @@ void OverlapCalculator::executeParallelMerge(const std::string& pdata)
     mvalue.insert(mvalue.end(), pvalue.begin(), pvalue.end());
 }
 
+
+void OverlapCalculator::mergeParallelValues(const double* pvalues, size_t n)
+{
+    mvalue.insert(mvalue.end(), pvalues, pvalues + n);
+}
+
 // Private Methods -----------------------------------------------------------
 
 int OverlapCalculator::count() const
@@ -473,9 +479,9 @@ const double& OverlapCalculator::subvalue(int offset, int index) const
 }
 
 
-const R3::Vector& OverlapCalculator::subdirection(int index) const
+R3::Vector OverlapCalculator::subdirection(int index) const
 {
-    static R3::Vector rv;
+    R3::Vector rv;
     rv[0] = this->subvalue(DIRECTION0_OFFSET, index);
     rv[1] = this->subvalue(DIRECTION1_OFFSET, index);
     rv[2] = this->subvalue(DIRECTION2_OFFSET, index);
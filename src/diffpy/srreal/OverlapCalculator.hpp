@@ -88,6 +88,7 @@ class OverlapCalculator : public PairQuantity
         virtual void configureBondGenerator(BaseBondGenerator&) const;
         virtual void addPairContribution(const BaseBondGenerator&, int);
         virtual void executeParallelMerge(const std::string&);
+        virtual void mergeParallelValues(const double* pvalues, size_t n);
 
     private:
 
@@ -99,7 +100,7 @@ class OverlapCalculator : public PairQuantity
         int count() const;
         QuantityType subvector(int offset, OverlapFlag flag) const;
         const double& subvalue(int offset, int index) const;
-        const R3::Vector& subdirection(int index) const;
+        R3::Vector subdirection(int index) const;
         double suboverlap(int index, int iflip=0, int jflip=0) const;
         void cacheStructureData();
         const std::list<int>& getNeighborIds(int i) const;
@@ -20,10 +20,14 @@
 #include <sstream>
 #include <cmath>
 #include <cassert>
+#include <typeinfo>
 
 #include <diffpy/serialization.ipp>
 #include <diffpy/srreal/PDFCalculator.hpp>
+#include <diffpy/srreal/BondBatch.hpp>
+#include <diffpy/srreal/GaussianProfile.hpp>
 #include <diffpy/srreal/StructureAdapter.hpp>
+#include <diffpy/srreal/PeriodicStructureAdapter.hpp>
 #include <diffpy/srreal/R3linalg.hpp>
 #include <diffpy/srreal/PDFUtils.hpp>
 #include <diffpy/mathutils.hpp>
@@ -36,10 +40,70 @@ using namespace std;
 using namespace diffpy::validators;
 using namespace diffpy::mathutils;
 
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+const char* LATTICE_PARAMETER_NAMES[] =
+    {"a", "b", "c", "alpha", "beta", "gamma"};
+const int LATTICE_PARAMETERS = 6;
+
+/// index of a lattice parameter name or -1 when not found
+int latticeParameterIndex(const string& name)
+{
+    for (int i = 0; i < LATTICE_PARAMETERS; ++i)
+    {
+        if (name == LATTICE_PARAMETER_NAMES[i])  return i;
+    }
+    return -1;
+}
+
+
+/// lattice of a periodic structure or NULL for other structures
+const Lattice* latticeOf(const StructureAdapterPtr& stru)
+{
+    const PeriodicStructureAdapter* pstru =
+        dynamic_cast<const PeriodicStructureAdapter*>(stru.get());
+    return pstru ? &(pstru->getLattice()) : NULL;
+}
+
+
+/// Set M to the Cartesian matrix for derivatives of vectors with fixed
+/// fractional coordinates, dr / dp = M * r, where p is the lattice
+/// parameter of index i.  Return the derivative of log(volume).
+double latticeStrain(const Lattice& L, int i, R3::Matrix& M)
+{
+    assert(0 <= i && i < LATTICE_PARAMETERS);
+    double lp[LATTICE_PARAMETERS] = {L.a(), L.b(), L.c(),
+        L.alpha(), L.beta(), L.gamma()};
+    const double h = cbrt(DOUBLE_EPS) * max(1.0, fabs(lp[i]));
+    Lattice Lhi = L;
+    Lattice Llo = L;
+    lp[i] += h;
+    Lhi.setLatPar(lp[0], lp[1], lp[2], lp[3], lp[4], lp[5]);
+    lp[i] -= 2 * h;
+    Llo.setLatPar(lp[0], lp[1], lp[2], lp[3], lp[4], lp[5]);
+    for (int j = 0; j < R3::Ndim; ++j)
+    {
+        R3::Vector ej = R3::zerovector;
+        ej[j] = 1.0;
+        R3::Vector fj = L.fractional(ej);
+        R3::Vector dej = (Lhi.cartesian(fj) - Llo.cartesian(fj)) / (2 * h);
+        for (int k = 0; k < R3::Ndim; ++k)  M(k, j) = dej[k];
+    }
+    double rv = (Lhi.volume() - Llo.volume()) / (2 * h * L.volume());
+    return rv;
+}
+
+}   // namespace
+
 // Constructor ---------------------------------------------------------------
 
-PDFCalculator::PDFCalculator()
+PDFCalculator::PDFCalculator() :
+    mhistogramprecision(0.0), mgradientmode(false), mpartialsmode(false),
+    mislinked(false)
 {
+    mresults.cached = 0;
     // default configuration
     this->setPeakWidthModelByType("jeong");
     this->setPeakProfileByType("gaussian");
@@ -72,6 +136,9 @@ PDFCalculator::PDFCalculator()
             &PDFCalculator::getRstep, &PDFCalculator::setRstep);
     this->registerDoubleAttribute("maxextension", this,
             &PDFCalculator::getMaxExtension, &PDFCalculator::setMaxExtension);
+    this->registerDoubleAttribute("histogramprecision", this,
+            &PDFCalculator::getHistogramPrecision,
+            &PDFCalculator::setHistogramPrecision);
     this->registerDoubleAttribute("extendedrmin", this,
             &PDFCalculator::getExtendedRmin);
     this->registerDoubleAttribute("extendedrmax", this,
@@ -90,133 +157,349 @@ eventticker::EventTicker& PDFCalculator::ticker() const
     tic.updateFrom(this->ScatteringFactorTableOwner::ticker());
     const PeakProfilePtr& pkpf = this->getPeakProfile();
     if (pkpf)  tic.updateFrom(pkpf->ticker());
+    vector<PDFCalculatorPtr>::const_iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  tic.updateFrom((*lp)->ticker());
     return tic;
 }
 
+
+string PDFCalculator::getParallelData() const
+{
+    QuantityType pvalues(this->countParallelValues());
+    if (!pvalues.empty())  this->packParallelValues(&pvalues[0]);
+    ostringstream storage(ios::binary);
+    diffpy::serialization::oarchive oa(storage, ios::binary);
+    oa << pvalues;
+    return storage.str();
+}
+
 // results
 
 QuantityType PDFCalculator::getPDF() const
 {
-    QuantityType pdf = this->getExtendedPDF();
-    this->cutRipplePoints(pdf);
-    return pdf;
+    this->validateResultsCache();
+    return this->cutRipplePoints(this->cachedExtendedPDF());
 }
 
 
 QuantityType PDFCalculator::getRDF() const
 {
-    QuantityType rdf = this->getExtendedRDF();
-    this->cutRipplePoints(rdf);
-    return rdf;
+    this->validateResultsCache();
+    return this->cutRipplePoints(this->cachedExtendedRDF());
 }
 
 
 QuantityType PDFCalculator::getRDFperR() const
 {
-    QuantityType rdfperr = this->getExtendedRDFperR();
-    this->cutRipplePoints(rdfperr);
-    return rdfperr;
+    this->validateResultsCache();
+    return this->cutRipplePoints(this->cachedExtendedRDFperR());
 }
 
 
 QuantityType PDFCalculator::getF() const
 {
-    QuantityType f_ext = this->getExtendedF();
+    this->validateResultsCache();
+    const QuantityType& f_ext = this->cachedExtendedF();
     assert(pdfutils_qmaxSteps(this) <= int(f_ext.size()));
     QuantityType rv(f_ext.begin(), f_ext.begin() + pdfutils_qmaxSteps(this));
     return rv;
 }
 
 
+void PDFCalculator::getPDF(double* y, size_t n) const
+{
+    this->validateResultsCache();
+    this->copyRipplePoints(this->cachedExtendedPDF(), y, n);
+}
+
+
+void PDFCalculator::getRDF(double* y, size_t n) const
+{
+    this->validateResultsCache();
+    this->copyRipplePoints(this->cachedExtendedRDF(), y, n);
+}
+
+
+void PDFCalculator::getRDFperR(double* y, size_t n) const
+{
+    this->validateResultsCache();
+    this->copyRipplePoints(this->cachedExtendedRDFperR(), y, n);
+}
+
+
+void PDFCalculator::getF(double* y, size_t n) const
+{
+    if (int(n) != pdfutils_qmaxSteps(this))
+    {
+        const char* emsg = "Array size does not match the Q-grid.";
+        throw invalid_argument(emsg);
+    }
+    this->validateResultsCache();
+    const QuantityType& f_ext = this->cachedExtendedF();
+    assert(n <= f_ext.size());
+    copy(f_ext.begin(), f_ext.begin() + n, y);
+}
+
+
 QuantityType PDFCalculator::getExtendedPDF() const
 {
-    // we need a full range PDF to apply termination ripples correctly
-    QuantityType rgrid_ext = this->getExtendedRgrid();
-    QuantityType f_ext = this->getExtendedF();
-    QuantityType pdf0 = fftftog(f_ext, this->getQstep());
-    // cut away the FFT padded points
-    assert(this->extendedRmaxSteps() <= int(pdf0.size()));
-    QuantityType pdf1(pdf0.begin() + this->extendedRminSteps(),
-            pdf0.begin() + this->extendedRmaxSteps());
-    QuantityType pdf2 = this->applyEnvelopes(rgrid_ext, pdf1);
-    return pdf2;
+    this->validateResultsCache();
+    return this->cachedExtendedPDF();
 }
 
 
 QuantityType PDFCalculator::getExtendedRDF() const
 {
-    QuantityType rdf(this->countExtendedPoints());
-    const double& totocc = mstructure_cache.totaloccupancy;
-    double sfavg = this->sfAverage();
-    double rdf_scale = (totocc * sfavg == 0.0) ? 0.0 :
-        1.0 / (totocc * sfavg * sfavg);
-    QuantityType::iterator iirdf = rdf.begin();
-    QuantityType::const_iterator iival, iival_last;
-    iival = this->value().begin() +
-        this->extendedRminSteps() - this->rcalcloSteps();
-    iival_last = this->value().begin() +
-        this->extendedRmaxSteps() - this->rcalcloSteps();
-    assert(iival >= this->value().begin());
-    assert(iival_last <= this->value().end());
-    assert(rdf.size() == size_t(iival_last - iival));
-    for (; iirdf != rdf.end(); ++iival, ++iirdf)
-    {
-        *iirdf = *iival * rdf_scale;
-    }
-    return rdf;
+    this->validateResultsCache();
+    return this->cachedExtendedRDF();
 }
 
 
 QuantityType PDFCalculator::getExtendedRDFperR() const
 {
-    QuantityType rdf_ext = this->getExtendedRDF();
-    QuantityType rgrid_ext = this->getExtendedRgrid();
-    assert(rdf_ext.size() == rgrid_ext.size());
-    QuantityType::const_iterator ri = rgrid_ext.begin();
-    QuantityType::iterator rdfi = rdf_ext.begin();
-    for (; ri != rgrid_ext.end(); ++ri, ++rdfi)
+    this->validateResultsCache();
+    return this->cachedExtendedRDFperR();
+}
+
+
+QuantityType PDFCalculator::getExtendedF() const
+{
+    this->validateResultsCache();
+    return this->cachedExtendedF();
+}
+
+
+QuantityType PDFCalculator::getExtendedRgrid() const
+{
+    this->validateResultsCache();
+    return this->cachedExtendedRgrid();
+}
+
+// derivatives with respect to the site parameters
+
+void PDFCalculator::setGradientMode(bool flag)
+{
+    if (flag)  this->checkGradientSupport();
+    if (mgradientmode != flag)  mticker.click();
+    mgradientmode = flag;
+}
+
+
+bool PDFCalculator::getGradientMode() const
+{
+    return mgradientmode;
+}
+
+
+vector<QuantityType> PDFCalculator::getPDFGradients() const
+{
+    this->validateResultsCache();
+    vector<QuantityType> rv;
+    const int ngrad = this->countGradients();
+    rv.reserve(ngrad);
+    for (int p = 0; p < ngrad; ++p)
     {
-        *rdfi = eps_gt(*ri, 0) ? (*rdfi / *ri) : 0.0;
+        QuantityType f = this->gradientExtendedF(p);
+        rv.push_back(this->cutRipplePoints(this->extendedPDFOf(f)));
     }
-    return rdf_ext;
+    return rv;
 }
 
 
-QuantityType PDFCalculator::getExtendedF() const
+vector<QuantityType> PDFCalculator::getFGradients() const
 {
-    QuantityType rdfperr_ext = this->getExtendedRDFperR();
-    QuantityType rgrid_ext = this->getExtendedRgrid();
-    QuantityType rdfperr_ext1 = this->applyBaseline(rgrid_ext, rdfperr_ext);
-    const double rmin_ext = this->getExtendedRmin();
-    QuantityType rv = fftgtof(rdfperr_ext1, this->getRstep(), rmin_ext);
-    assert(rv.empty() || eps_eq(M_PI,
-                this->getQstep() * rv.size() * this->getRstep()));
-    // zero all F points at Q < Qmin
-    QuantityType::iterator rvqmin =
-        rv.begin() + min(pdfutils_qminSteps(this), int(rv.size()));
-    fill(rv.begin(), rvqmin, 0.0);
-    // zero all F points at Q >= Qmax
-    assert(pdfutils_qmaxSteps(this) <= int(rv.size()));
-    QuantityType::iterator rvqmax = rv.begin() + pdfutils_qmaxSteps(this);
-    fill(rvqmax, rv.end(), 0.0);
+    this->validateResultsCache();
+    vector<QuantityType> rv;
+    const int ngrad = this->countGradients();
+    rv.reserve(ngrad);
+    for (int p = 0; p < ngrad; ++p)
+    {
+        QuantityType f = this->gradientExtendedF(p);
+        assert(pdfutils_qmaxSteps(this) <= int(f.size()));
+        f.resize(pdfutils_qmaxSteps(this));
+        rv.push_back(f);
+    }
     return rv;
 }
 
+// derivatives with respect to the attributes and lattice parameters
 
-QuantityType PDFCalculator::getExtendedRgrid() const
+void PDFCalculator::setGradientAttributes(const vector<string>& names)
 {
-    QuantityType rv;
-    rv.reserve(this->countExtendedPoints());
-    // make sure exact value of rmin will be in the extended grid
-    for (int i = this->extendedRminSteps(); i < this->extendedRmaxSteps(); ++i)
+    set<string> validnames = this->namesOfWritableDoubleAttributes();
+    const vector<string> wnames =
+        this->getPeakWidthModel()->namesOfGradientAttributes();
+    vector<string>::const_iterator nm = names.begin();
+    for (; nm != names.end(); ++nm)
     {
-        rv.push_back(i * this->getRstep());
+        if (latticeParameterIndex(*nm) >= 0)  continue;
+        if (!validnames.count(*nm))
+        {
+            ostringstream emsg;
+            emsg << "Invalid attribute name '" << *nm << "'.";
+            throw diffpy::attributes::DoubleAttributeError(emsg.str());
+        }
+        if (count(wnames.begin(), wnames.end(), *nm) ||
+                this->hasEnvelopeAttribute(*nm))
+        {
+            continue;
+        }
+        ostringstream emsg;
+        emsg << "Derivative of attribute '" << *nm << "' is not supported.";
+        throw invalid_argument(emsg.str());
+    }
+    if (!names.empty())  this->checkGradientSupport();
+    if (mgradientattrs != names)  mticker.click();
+    mgradientattrs = names;
+}
+
+
+const vector<string>& PDFCalculator::getGradientAttributes() const
+{
+    return mgradientattrs;
+}
+
+
+/// The per-bond derivatives are transformed to PDF like the value.
+/// Lattice parameters change also the number density in the linear
+/// baseline and envelope attributes scale the PDF before envelopes.
+vector<QuantityType> PDFCalculator::getPDFAttributeGradients() const
+{
+    this->validateResultsCache();
+    vector<QuantityType> rv;
+    const int ncalc = this->countCalcPoints();
+    const int nattrs = min(mgradientattrs.size(),
+            ncalc ? (mattrgradient.size() / ncalc) : 0);
+    rv.reserve(nattrs);
+    const QuantityType& rgrid_ext = this->cachedExtendedRgrid();
+    const PDFBaseline& baseline = *(this->getBaseline());
+    const bool linearbaseline = (baseline.type() == "linear");
+    const Lattice* L = latticeOf(mstructure);
+    for (int a = 0; a < nattrs; ++a)
+    {
+        const string& name = mgradientattrs[a];
+        QuantityType pdf;
+        if (this->hasEnvelopeAttribute(name))
+        {
+            const QuantityType& f = this->cachedExtendedF();
+            QuantityType pdf1 = this->extendedRawPDFOf(f);
+            pdf = this->applyEnvelopesDerivative(rgrid_ext, pdf1, name);
+            rv.push_back(this->cutRipplePoints(pdf));
+            continue;
+        }
+        QuantityType rdfperr = this->extendedRDFperROf(
+                this->extendedRDFOf(&mattrgradient[a * ncalc]));
+        int lidx = latticeParameterIndex(name);
+        if (lidx >= 0 && L && linearbaseline)
+        {
+            R3::Matrix M;
+            double dlogvolume = latticeStrain(*L, lidx, M);
+            for (size_t i = 0; i < rdfperr.size(); ++i)
+            {
+                rdfperr[i] -= dlogvolume * baseline(rgrid_ext[i]);
+            }
+        }
+        pdf = this->extendedPDFOf(this->extendedFOf(rdfperr));
+        rv.push_back(this->cutRipplePoints(pdf));
+    }
+    return rv;
+}
+
+// partial PDFs for the pairs of atom types
+
+void PDFCalculator::setPartialsMode(bool flag)
+{
+    if (mpartialsmode != flag)  mticker.click();
+    mpartialsmode = flag;
+}
+
+
+bool PDFCalculator::getPartialsMode() const
+{
+    return mpartialsmode;
+}
+
+
+vector< pair<string, string> > PDFCalculator::getPartialTypePairs() const
+{
+    return mpartials.getTypePairs();
+}
+
+
+vector<QuantityType> PDFCalculator::getPartialPDFs() const
+{
+    vector<QuantityType> rv;
+    this->validateResultsCache();
+    const int npairs = mpartials.countTypePairs();
+    rv.reserve(npairs);
+    for (int p = 0; p < npairs; ++p)
+    {
+        QuantityType f = this->partialExtendedF(p);
+        rv.push_back(this->cutRipplePoints(this->extendedPDFOf(f)));
+    }
+    return rv;
+}
+
+
+vector<QuantityType> PDFCalculator::getPartialFs() const
+{
+    vector<QuantityType> rv;
+    this->validateResultsCache();
+    const int npairs = mpartials.countTypePairs();
+    rv.reserve(npairs);
+    for (int p = 0; p < npairs; ++p)
+    {
+        QuantityType f = this->partialExtendedF(p);
+        assert(pdfutils_qmaxSteps(this) <= int(f.size()));
+        f.resize(pdfutils_qmaxSteps(this));
+        rv.push_back(f);
     }
-    assert(rv.empty() || !eps_lt(rv.front(), this->getExtendedRmin()));
-    assert(rv.empty() || !eps_gt(rv.back(), this->getExtendedRmax()));
     return rv;
 }
 
+// several configurations evaluated in one bond traversal
+
+void PDFCalculator::addLinkedCalculator(PDFCalculatorPtr pdfc)
+{
+    ensureNonNull("PDFCalculator", pdfc);
+    bool isused = (pdfc.get() == this) ||
+        (mlinked.end() != find(mlinked.begin(), mlinked.end(), pdfc));
+    if (isused)
+    {
+        const char* emsg = "Calculator is already evaluated with this one.";
+        throw invalid_argument(emsg);
+    }
+    if (pdfc->mislinked)
+    {
+        const char* emsg = "Calculator is already linked to another one.";
+        throw invalid_argument(emsg);
+    }
+    if (mislinked || !pdfc->mlinked.empty())
+    {
+        const char* emsg = "Linked calculator cannot have linked calculators.";
+        throw invalid_argument(emsg);
+    }
+    this->checkLinkedCalculator(*pdfc);
+    pdfc->mislinked = true;
+    mlinked.push_back(pdfc);
+    mticker.click();
+}
+
+
+void PDFCalculator::clearLinkedCalculators()
+{
+    if (!mlinked.empty())  mticker.click();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->mislinked = false;
+    mlinked.clear();
+}
+
+
+const vector<PDFCalculatorPtr>& PDFCalculator::getLinkedCalculators() const
+{
+    return mlinked;
+}
+
 // Q-range methods
 
 QuantityType PDFCalculator::getQgrid() const
@@ -248,21 +531,19 @@ void PDFCalculator::setQmax(double qmax)
 }
 
 
-const double& PDFCalculator::getQmax() const
+double PDFCalculator::getQmax() const
 {
-    static double rv;
-    rv = min(mqmax, M_PI / this->getRstep());
+    double rv = min(mqmax, M_PI / this->getRstep());
     return rv;
 }
 
 
-const double& PDFCalculator::getQstep() const
+double PDFCalculator::getQstep() const
 {
-    static double rv;
     // replicate the zero padding as done in fftgtof
     int Npad1 = this->extendedRmaxSteps();
     int Npad2 = (Npad1 > 0) ? (1 << int(ceil(log2(Npad1)))) : 0;
-    rv = (Npad2 > 0) ? M_PI / (Npad2 * this->getRstep()) : 0.0;
+    double rv = (Npad2 > 0) ? M_PI / (Npad2 * this->getRstep()) : 0.0;
     return rv;
 }
 
@@ -364,6 +645,20 @@ const PeakProfilePtr& PDFCalculator::getPeakProfile() const
     return mpeakprofile;
 }
 
+
+void PDFCalculator::setHistogramPrecision(double eps)
+{
+    ensureNonNegative("histogramprecision", eps);
+    if (mhistogramprecision != eps)  mticker.click();
+    mhistogramprecision = eps;
+}
+
+
+const double& PDFCalculator::getHistogramPrecision() const
+{
+    return mhistogramprecision;
+}
+
 // PDF baseline methods
 
 QuantityType PDFCalculator::applyBaseline(
@@ -449,6 +744,11 @@ void PDFCalculator::accept(diffpy::BaseAttributesVisitor& v) const
 
 void PDFCalculator::resetValue()
 {
+    // check derivatives support before any data are changed
+    if (this->hasGradients())  this->checkGradientSupport();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  this->checkLinkedCalculator(**lp);
+    this->cacheGradientAttributes();
     // calcPoints requires that structure and rlimits data are cached.
     this->cacheStructureData();
     this->cacheRlimitsData();
@@ -464,13 +764,43 @@ void PDFCalculator::resetValue()
     }
     this->resizeValue(this->countCalcPoints());
     this->PairQuantity::resetValue();
+    size_t ngradpts = mgradientmode ? (GRADIENT_SITE_PARAMS *
+            this->countSites() * this->countCalcPoints()) : 0;
+    mgradient.assign(ngradpts, 0.0);
+    mattrgradient.assign(mgradientattrs.size() * this->countCalcPoints(), 0.0);
+    if (mpartialsmode)  mpartials.reset(*mstructure, this->countCalcPoints());
+    else  mpartials.clear();
+    this->cachePartialWeights();
+    // the histogram mode is only supported for the Gaussian profile
+    // and it does not sum the derivatives or partial values
+    const PeakProfile& pkf = *(this->getPeakProfile());
+    bool usehistogram = !this->hasGradients() && !mpartialsmode &&
+        (typeid(GaussianProfile) == typeid(pkf));
+    mhistogram.setPrecision(usehistogram ? mhistogramprecision : 0.0);
+    mhistogram.setGrid(this->rcalcloSteps(),
+            this->getRstep(), this->countCalcPoints());
+    this->clearResultsCache();
+    // linked calculators use the same structure
+    for (lp = mlinked.begin(); lp != mlinked.end(); ++lp)
+    {
+        (*lp)->setStructure(mstructure);
+    }
 }
 
 
+/// The bond range covers the calculated r-grids of all linked calculators.
 void PDFCalculator::configureBondGenerator(BaseBondGenerator& bnds) const
 {
-    bnds.setRmin(this->rcalclo());
-    bnds.setRmax(this->rcalchi());
+    double rlo = this->rcalclo();
+    double rhi = this->rcalchi();
+    vector<PDFCalculatorPtr>::const_iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)
+    {
+        rlo = min(rlo, (*lp)->rcalclo());
+        rhi = max(rhi, (*lp)->rcalchi());
+    }
+    bnds.setRmin(rlo);
+    bnds.setRmax(rhi);
 }
 
 
@@ -478,26 +808,148 @@ void PDFCalculator::addPairContribution(const BaseBondGenerator& bnds,
         int summationscale)
 {
     double sfprod = this->sfSite(bnds.site0()) * this->sfSite(bnds.site1());
-    double peakscale = sfprod * bnds.multiplicity() * summationscale;
-    double fwhm = this->getPeakWidthModel()->calculate(bnds);
-    const PeakProfile& pkf = *(this->getPeakProfile());
-    double dist = bnds.distance();
-    double xlo = dist + pkf.xboundlo(fwhm);
-    double xhi = dist + pkf.xboundhi(fwhm);
-    int i = max(0, this->calcIndex(xlo));
-    int ilast = min(this->countCalcPoints(), this->calcIndex(xhi) + 1);
-    assert(ilast <= int(mvalue.size()));
-    assert(eps_gt(dist, 0.0));
-    for (; i < ilast; ++i)
+    double pairscale = bnds.multiplicity() * summationscale;
+    double peakscale = sfprod * pairscale;
+    double fwhm;
+    if (this->hasGradients())
     {
-        double x = (this->rcalcloSteps() + i) * this->getRstep() - dist;
-        double y = pkf(x, fwhm);
-        // Contributions in G(r) need to be normalized by pair distance,
-        // not by r as done in PDFfit or PDFfit2.  Here we rescale RDF
-        // in such way that division by r will give a correct result.
-        double yrdf = y * (x / dist + 1);
-        mvalue[i] += peakscale * yrdf;
+        this->addPeakGradient(bnds, peakscale);
+        fwhm = mbondgradient.fwhm;
+    }
+    else
+    {
+        fwhm = this->getPeakWidthModel()->calculate(bnds);
+        double* ypartial = this->partialValue(bnds.site0(), bnds.site1());
+        this->addPeak(bnds.distance(), fwhm, peakscale, ypartial);
+    }
+    if (mlinked.empty())  return;
+    this->addLinkedPeaks(bnds.site0(), bnds.site1(),
+            bnds.distance(), fwhm, pairscale);
+}
+
+
+bool PDFCalculator::acceptsBondBatch() const
+{
+    return !this->hasGradients() &&
+        this->getPeakWidthModel()->hasBatchCalculate();
+}
+
+
+void PDFCalculator::addPairContributions(const BondBatch& batch)
+{
+    const int nbonds = batch.size();
+    if (!nbonds)  return;
+    mbatchfwhm.resize(nbonds);
+    this->getPeakWidthModel()->calculateBatch(batch, &mbatchfwhm[0]);
+    for (int b = 0; b < nbonds; ++b)
+    {
+        const int& site0 = batch.site0[b];
+        const int& site1 = batch.site1[b];
+        double sfprod = this->sfSite(site0) * this->sfSite(site1);
+        double pairscale = batch.multiplicity[b] * batch.summationscale[b];
+        double peakscale = sfprod * pairscale;
+        double* ypartial = this->partialValue(site0, site1);
+        this->addPeak(batch.distance[b], mbatchfwhm[b], peakscale, ypartial);
+        if (mlinked.empty())  continue;
+        this->addLinkedPeaks(site0, site1,
+                batch.distance[b], mbatchfwhm[b], pairscale);
+    }
+}
+
+
+void PDFCalculator::flushPairContributions()
+{
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->flushPairContributions();
+    if (mhistogram.empty())  return;
+    assert(!mvalue.empty());
+    mhistogram.flush(*(this->getPeakProfile()), &mvalue[0]);
+}
+
+
+void PDFCalculator::executeParallelMerge(const string& pdata)
+{
+    istringstream storage(pdata, ios::binary);
+    diffpy::serialization::iarchive ia(storage, ios::binary);
+    QuantityType pvalues;
+    ia >> pvalues;
+    if (pvalues.size() != this->countParallelValues())
+    {
+        throw invalid_argument("Merged data array must have the same size.");
     }
+    if (pvalues.empty())  return;
+    this->mergeParallelValues(&pvalues[0], pvalues.size());
+}
+
+
+/// Raw parallel data hold the value followed by the site derivatives,
+/// the attribute derivatives, the partial values and by the raw data
+/// of the linked calculators.
+size_t PDFCalculator::countParallelValues() const
+{
+    size_t rv = mvalue.size() + mgradient.size() + mattrgradient.size() +
+        mpartials.values().size();
+    vector<PDFCalculatorPtr>::const_iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  rv += (*lp)->countParallelValues();
+    return rv;
+}
+
+
+void PDFCalculator::packParallelValues(double* pvalues) const
+{
+    const QuantityType& pv = mpartials.values();
+    pvalues = copy(mvalue.begin(), mvalue.end(), pvalues);
+    pvalues = copy(mgradient.begin(), mgradient.end(), pvalues);
+    pvalues = copy(mattrgradient.begin(), mattrgradient.end(), pvalues);
+    pvalues = copy(pv.begin(), pv.end(), pvalues);
+    vector<PDFCalculatorPtr>::const_iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)
+    {
+        (*lp)->packParallelValues(pvalues);
+        pvalues += (*lp)->countParallelValues();
+    }
+}
+
+
+void PDFCalculator::mergeParallelValues(const double* pvalues, size_t n)
+{
+    if (n != this->countParallelValues())
+    {
+        throw invalid_argument("Merged data array must have the same size.");
+    }
+    transform(mvalue.begin(), mvalue.end(), pvalues,
+            mvalue.begin(), plus<double>());
+    pvalues += mvalue.size();
+    transform(mgradient.begin(), mgradient.end(), pvalues,
+            mgradient.begin(), plus<double>());
+    pvalues += mgradient.size();
+    transform(mattrgradient.begin(), mattrgradient.end(), pvalues,
+            mattrgradient.begin(), plus<double>());
+    pvalues += mattrgradient.size();
+    QuantityType& pv = mpartials.values();
+    transform(pv.begin(), pv.end(), pvalues, pv.begin(), plus<double>());
+    pvalues += pv.size();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)
+    {
+        const size_t nl = (*lp)->countParallelValues();
+        (*lp)->mergeParallelValues(pvalues, nl);
+        pvalues += nl;
+    }
+}
+
+
+void PDFCalculator::finishValue()
+{
+    this->clearResultsCache();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->finishValue();
+}
+
+
+bool PDFCalculator::allowsFastUpdate() const
+{
+    return !this->hasGradients();
 }
 
 
@@ -505,6 +957,9 @@ void PDFCalculator::stashPartialValue()
 {
     mstashedvalue.value = this->value();
     mstashedvalue.rclosteps = this->rcalcloSteps();
+    mpartials.stash();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->stashPartialValue();
 }
 
 
@@ -524,6 +979,35 @@ void PDFCalculator::restorePartialValue()
     else  ti += min(-leftshift, int(mvalue.size()));
     for (; si != slast && ti != tlast; ++si, ++ti)  *ti = *si;
     mstashedvalue.value.clear();
+    mpartials.restore(leftshift);
+    this->clearResultsCache();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->restorePartialValue();
+}
+
+
+void PDFCalculator::stashTrialValue()
+{
+    this->PairQuantity::stashTrialValue();
+    mtrialgradient = mgradient;
+    mtrialattrgradient = mattrgradient;
+    mtrialpartials = mpartials;
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->stashTrialValue();
+}
+
+
+void PDFCalculator::restoreTrialValue()
+{
+    this->PairQuantity::restoreTrialValue();
+    mgradient.swap(mtrialgradient);
+    mtrialgradient.clear();
+    mattrgradient.swap(mtrialattrgradient);
+    mtrialattrgradient.clear();
+    mpartials = mtrialpartials;
+    mtrialpartials.clear();
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)  (*lp)->restoreTrialValue();
 }
 
 // calculation specific
@@ -548,7 +1032,7 @@ double PDFCalculator::extFromTerminationRipples() const
     const int nripples = 6;
     // extension due to termination ripples.
     // apply only when qmax is below the Nyquist frequency for rstep.
-    const double& qmax = this->getQmax();
+    const double qmax = this->getQmax();
     const double& dr = this->getRstep();
     double rv = (eps_gt(qmax, 0.0) && eps_lt(qmax, M_PI / dr)) ?
         (nripples * 2 * M_PI / qmax) : 0.0;
@@ -617,16 +1101,548 @@ int PDFCalculator::calcIndex(double r) const
 }
 
 
-void PDFCalculator::cutRipplePoints(QuantityType& y) const
+QuantityType PDFCalculator::cutRipplePoints(const QuantityType& y) const
 {
-    if (y.empty())  return;
+    if (y.empty())  return y;
     assert(int(y.size()) ==
             this->extendedRmaxSteps() - this->extendedRminSteps());
     int ncutlo = pdfutils_rminSteps(this) - this->extendedRminSteps();
     int ncuthi = this->extendedRmaxSteps() - pdfutils_rmaxSteps(this);
     assert(ncutlo + ncuthi <= int(y.size()));
-    y.erase(y.end() - ncuthi, y.end());
-    y.erase(y.begin(), y.begin() + ncutlo);
+    QuantityType rv(y.begin() + ncutlo, y.end() - ncuthi);
+    return rv;
+}
+
+
+void PDFCalculator::copyRipplePoints(const QuantityType& y,
+        double* out, size_t n) const
+{
+    int npts = max(0, pdfutils_rmaxSteps(this) - pdfutils_rminSteps(this));
+    if (int(n) != npts)
+    {
+        const char* emsg = "Array size does not match the r-grid.";
+        throw invalid_argument(emsg);
+    }
+    if (y.empty())  return;
+    int ncutlo = pdfutils_rminSteps(this) - this->extendedRminSteps();
+    assert(ncutlo + npts <= int(y.size()));
+    copy(y.begin() + ncutlo, y.begin() + ncutlo + npts, out);
+}
+
+// cached results
+
+void PDFCalculator::clearResultsCache()
+{
+    mresults.cached = 0;
+}
+
+
+/// Discard cached results when the calculator ticker, the Q-range
+/// or any double attribute of the baseline and envelopes has changed.
+void PDFCalculator::validateResultsCache() const
+{
+    vector<string>& tps = mresults.newtypes;
+    QuantityType& vals = mresults.newvalues;
+    tps.clear();
+    vals.clear();
+    vals.push_back(this->getQmin());
+    vals.push_back(this->getQmax());
+    vector<const Attributes*> objs;
+    objs.push_back(this->getBaseline().get());
+    tps.push_back(this->getBaseline()->type());
+    set<string> evtps = this->usedEnvelopeTypes();
+    set<string>::const_iterator tp = evtps.begin();
+    for (; tp != evtps.end(); ++tp)
+    {
+        objs.push_back(this->getEnvelopeByType(*tp).get());
+        tps.push_back(*tp);
+    }
+    vector<const Attributes*>::const_iterator obj = objs.begin();
+    for (; obj != objs.end(); ++obj)
+    {
+        set<string> names = (*obj)->namesOfDoubleAttributes();
+        set<string>::const_iterator nm = names.begin();
+        for (; nm != names.end(); ++nm)
+        {
+            tps.push_back(*nm);
+            vals.push_back((*obj)->getDoubleAttr(*nm));
+        }
+    }
+    eventticker::EventTicker::value_type tck = this->ticker().value();
+    if (mresults.ticker == tck && mresults.configtypes == tps &&
+            mresults.configvalues == vals)  return;
+    mresults.ticker = tck;
+    mresults.configtypes.swap(tps);
+    mresults.configvalues.swap(vals);
+    mresults.cached = 0;
+}
+
+
+const QuantityType& PDFCalculator::cachedExtendedRgrid() const
+{
+    const int flag = 1;
+    QuantityType& rv = mresults.rgrid;
+    if (mresults.cached & flag)  return rv;
+    rv.clear();
+    // make sure exact value of rmin will be in the extended grid
+    for (int i = this->extendedRminSteps(); i < this->extendedRmaxSteps(); ++i)
+    {
+        rv.push_back(i * this->getRstep());
+    }
+    assert(rv.empty() || !eps_lt(rv.front(), this->getExtendedRmin()));
+    assert(rv.empty() || !eps_gt(rv.back(), this->getExtendedRmax()));
+    mresults.cached |= flag;
+    return rv;
+}
+
+
+const QuantityType& PDFCalculator::cachedExtendedRDF() const
+{
+    const int flag = 2;
+    QuantityType& rdf = mresults.rdf;
+    if (mresults.cached & flag)  return rdf;
+    rdf = this->extendedRDFOf(mvalue.empty() ? NULL : &mvalue[0]);
+    mresults.cached |= flag;
+    return rdf;
+}
+
+
+const QuantityType& PDFCalculator::cachedExtendedRDFperR() const
+{
+    const int flag = 4;
+    QuantityType& rdfperr = mresults.rdfperr;
+    if (mresults.cached & flag)  return rdfperr;
+    rdfperr = this->extendedRDFperROf(this->cachedExtendedRDF());
+    mresults.cached |= flag;
+    return rdfperr;
+}
+
+
+const QuantityType& PDFCalculator::cachedExtendedF() const
+{
+    const int flag = 8;
+    QuantityType& rv = mresults.f;
+    if (mresults.cached & flag)  return rv;
+    const QuantityType& rdfperr_ext = this->cachedExtendedRDFperR();
+    const QuantityType& rgrid_ext = this->cachedExtendedRgrid();
+    QuantityType rdfperr_ext1 = this->applyBaseline(rgrid_ext, rdfperr_ext);
+    rv = this->extendedFOf(rdfperr_ext1);
+    mresults.cached |= flag;
+    return rv;
+}
+
+
+const QuantityType& PDFCalculator::cachedExtendedPDF() const
+{
+    const int flag = 16;
+    QuantityType& rv = mresults.pdf;
+    if (mresults.cached & flag)  return rv;
+    rv = this->extendedPDFOf(this->cachedExtendedF());
+    mresults.cached |= flag;
+    return rv;
+}
+
+
+QuantityType PDFCalculator::extendedRDFOf(const double* v) const
+{
+    QuantityType rdf(this->countExtendedPoints());
+    if (rdf.empty())  return rdf;
+    const double& totocc = mstructure_cache.totaloccupancy;
+    double sfavg = this->sfAverage();
+    double rdf_scale = (totocc * sfavg == 0.0) ? 0.0 :
+        1.0 / (totocc * sfavg * sfavg);
+    assert(v);
+    assert(this->extendedRminSteps() >= this->rcalcloSteps());
+    assert(this->extendedRmaxSteps() <= this->rcalchiSteps());
+    const double* pv = v + this->extendedRminSteps() - this->rcalcloSteps();
+    QuantityType::iterator iirdf = rdf.begin();
+    for (; iirdf != rdf.end(); ++pv, ++iirdf)
+    {
+        *iirdf = *pv * rdf_scale;
+    }
+    return rdf;
+}
+
+
+QuantityType PDFCalculator::extendedRDFperROf(const QuantityType& rdf) const
+{
+    const QuantityType& rgrid_ext = this->cachedExtendedRgrid();
+    assert(rdf.size() == rgrid_ext.size());
+    QuantityType rdfperr(rdf.size());
+    QuantityType::const_iterator ri = rgrid_ext.begin();
+    QuantityType::const_iterator rdfi = rdf.begin();
+    QuantityType::iterator rdfperri = rdfperr.begin();
+    for (; ri != rgrid_ext.end(); ++ri, ++rdfi, ++rdfperri)
+    {
+        *rdfperri = eps_gt(*ri, 0) ? (*rdfi / *ri) : 0.0;
+    }
+    return rdfperr;
+}
+
+
+QuantityType PDFCalculator::extendedFOf(const QuantityType& rdfperr) const
+{
+    const double rmin_ext = this->getExtendedRmin();
+    QuantityType rv = fftgtof(rdfperr, this->getRstep(), rmin_ext);
+    assert(rv.empty() || eps_eq(M_PI,
+                this->getQstep() * rv.size() * this->getRstep()));
+    // zero all F points at Q < Qmin
+    QuantityType::iterator rvqmin =
+        rv.begin() + min(pdfutils_qminSteps(this), int(rv.size()));
+    fill(rv.begin(), rvqmin, 0.0);
+    // zero all F points at Q >= Qmax
+    assert(pdfutils_qmaxSteps(this) <= int(rv.size()));
+    QuantityType::iterator rvqmax = rv.begin() + pdfutils_qmaxSteps(this);
+    fill(rvqmax, rv.end(), 0.0);
+    return rv;
+}
+
+
+QuantityType PDFCalculator::extendedPDFOf(const QuantityType& f) const
+{
+    const QuantityType& rgrid_ext = this->cachedExtendedRgrid();
+    QuantityType pdf1 = this->extendedRawPDFOf(f);
+    QuantityType rv = this->applyEnvelopes(rgrid_ext, pdf1);
+    return rv;
+}
+
+
+QuantityType PDFCalculator::extendedRawPDFOf(const QuantityType& f) const
+{
+    // we need a full range PDF to apply termination ripples correctly
+    QuantityType pdf0 = fftftog(f, this->getQstep());
+    // cut away the FFT padded points
+    assert(this->extendedRmaxSteps() <= int(pdf0.size()));
+    QuantityType rv(pdf0.begin() + this->extendedRminSteps(),
+            pdf0.begin() + this->extendedRmaxSteps());
+    return rv;
+}
+
+
+bool PDFCalculator::hasGradients() const
+{
+    return mgradientmode || !mgradientattrs.empty();
+}
+
+
+void PDFCalculator::checkGradientSupport() const
+{
+    if (this->getPeakWidthModel()->hasGradient())  return;
+    const char* emsg = "Peak width model does not support gradients.";
+    throw logic_error(emsg);
+}
+
+
+/// Linked calculator must share the peak width model so that its
+/// r-limits match the received peaks.  Pair masks are not supported,
+/// because the masks of this calculator would select the bonds for all
+/// linked calculators, but not their baselines and partial weights.
+void PDFCalculator::checkLinkedCalculator(const PDFCalculator& lpdfc) const
+{
+    const char* emsg = NULL;
+    if (lpdfc.getPeakWidthModel() != this->getPeakWidthModel())
+    {
+        emsg = "Linked calculator must use the peak width model "
+            "of this calculator.";
+    }
+    else if (lpdfc.hasGradients())
+    {
+        emsg = "Linked calculator does not support gradients.";
+    }
+    else if (this->usesPairMask() || lpdfc.usesPairMask())
+    {
+        emsg = "Linked calculators do not support pair masks.";
+    }
+    if (emsg)  throw logic_error(emsg);
+}
+
+
+/// Unlike hasMask this includes site and type masks that are not yet
+/// applied to the structure.
+bool PDFCalculator::usesPairMask() const
+{
+    if (this->hasMask())  return true;
+    boost::unordered_map<int, bool>::const_iterator ia;
+    for (ia = msiteallmask.begin(); ia != msiteallmask.end(); ++ia)
+    {
+        if (ia->second != mdefaultpairmask)  return true;
+    }
+    TypeMaskStorage::const_iterator tpmsk;
+    for (tpmsk = mtypemask.begin(); tpmsk != mtypemask.end(); ++tpmsk)
+    {
+        if (tpmsk->second != mdefaultpairmask)  return true;
+    }
+    return false;
+}
+
+
+int PDFCalculator::countGradients() const
+{
+    const int npts = this->countCalcPoints();
+    int rv = npts ? int(mgradient.size() / npts) : 0;
+    return rv;
+}
+
+
+QuantityType PDFCalculator::gradientExtendedF(int p) const
+{
+    const int npts = this->countCalcPoints();
+    assert(0 <= p && p < this->countGradients());
+    const double* g = &mgradient[p * npts];
+    QuantityType rv = this->extendedFOf(
+            this->extendedRDFperROf(this->extendedRDFOf(g)));
+    return rv;
+}
+
+
+void PDFCalculator::cacheGradientAttributes()
+{
+    const int nattrs = mgradientattrs.size();
+    mgradientattrs_cache.widthindex.assign(nattrs, -1);
+    mgradientattrs_cache.latticeindex.assign(nattrs, -1);
+    mgradientattrs_cache.latticestrain.clear();
+    mgradientbuffer.dwattr.clear();
+    if (!nattrs)  return;
+    const vector<string> wnames =
+        this->getPeakWidthModel()->namesOfGradientAttributes();
+    const Lattice* L = latticeOf(mstructure);
+    for (int a = 0; a < nattrs; ++a)
+    {
+        const string& name = mgradientattrs[a];
+        const int lidx = latticeParameterIndex(name);
+        const int widx = find(wnames.begin(), wnames.end(), name) -
+            wnames.begin();
+        if (lidx >= 0)
+        {
+            if (!L)
+            {
+                const char* emsg =
+                    "Lattice derivatives require a periodic structure.";
+                throw invalid_argument(emsg);
+            }
+            mgradientattrs_cache.latticeindex[a] = lidx;
+        }
+        else if (widx < int(wnames.size()))
+        {
+            mgradientattrs_cache.widthindex[a] = widx;
+            mgradientbuffer.dwattr.resize(wnames.size());
+        }
+        else if (!this->hasEnvelopeAttribute(name))
+        {
+            ostringstream emsg;
+            emsg << "Derivative of attribute '" << name <<
+                "' is not supported.";
+            throw invalid_argument(emsg.str());
+        }
+    }
+    const vector<int>& lindices = mgradientattrs_cache.latticeindex;
+    if (*max_element(lindices.begin(), lindices.end()) < 0)  return;
+    mgradientattrs_cache.latticestrain.resize(LATTICE_PARAMETERS);
+    for (int i = 0; i < LATTICE_PARAMETERS; ++i)
+    {
+        latticeStrain(*L, i, mgradientattrs_cache.latticestrain[i]);
+    }
+}
+
+
+QuantityType PDFCalculator::partialExtendedF(int p) const
+{
+    const double* v = mpartials.values().empty() ? NULL : mpartials.at(p);
+    QuantityType rdfperr = this->extendedRDFperROf(this->extendedRDFOf(v));
+    const QuantityType& rgrid_ext = this->cachedExtendedRgrid();
+    const PDFBaseline& baseline = *(this->getBaseline());
+    assert(p < int(mstructure_cache.partialweights.size()));
+    const double& w = mstructure_cache.partialweights[p];
+    for (size_t i = 0; i < rdfperr.size(); ++i)
+    {
+        rdfperr[i] += w * baseline(rgrid_ext[i]);
+    }
+    QuantityType rv = this->extendedFOf(rdfperr);
+    return rv;
+}
+
+
+/// The baseline share of a type pair is its active occupancy relative
+/// to the activeoccupancy of all pairs, so that the partial baselines
+/// agree with the setTypeMask calculation and sum to the total one.
+void PDFCalculator::cachePartialWeights()
+{
+    QuantityType& weights = mstructure_cache.partialweights;
+    weights.assign(mpartials.countTypePairs(), 0.0);
+    const double& totocc = mstructure_cache.totaloccupancy;
+    const double& actocc = mstructure_cache.activeoccupancy;
+    if (weights.empty() || totocc <= 0.0 || actocc == 0.0)  return;
+    // occupancies summed for every atom type
+    const int cntsites = this->countSites();
+    QuantityType typeocc(mpartials.countTypes(), 0.0);
+    for (int i = 0; i < cntsites; ++i)
+    {
+        typeocc[mpartials.typeIndexOfSite(i)] +=
+            mstructure->siteOccupancy(i) * mstructure->siteMultiplicity(i);
+    }
+    // occupancy products of the inverted pair masks
+    QuantityType invmask(weights.size(), 0.0);
+    boost::unordered_set< std::pair<int,int> >::const_iterator ij;
+    for (ij = minvertpairmask.begin(); ij != minvertpairmask.end(); ++ij)
+    {
+        const int& i = ij->first;
+        const int& j = ij->second;
+        bool outofbounds = (i < 0 || i >= cntsites || j < 0 || j >= cntsites);
+        if (outofbounds)  continue;
+        int sumscale = (i == j) ? 1 : 2;
+        double occij = sumscale *
+            mstructure->siteOccupancy(i) * mstructure->siteMultiplicity(i) *
+            mstructure->siteOccupancy(j) * mstructure->siteMultiplicity(j);
+        invmask[mpartials.pairIndexOfSites(i, j)] += occij;
+    }
+    const int ntypes = mpartials.countTypes();
+    for (int tp0 = 0; tp0 < ntypes; ++tp0)
+    {
+        for (int tp1 = tp0; tp1 < ntypes; ++tp1)
+        {
+            int p = mpartials.pairIndexOfTypes(tp0, tp1);
+            int sumscale = (tp0 == tp1) ? 1 : 2;
+            double occpair = sumscale * typeocc[tp0] * typeocc[tp1];
+            double active = mdefaultpairmask ?
+                (occpair - invmask[p]) : invmask[p];
+            weights[p] = active / totocc / actocc;
+        }
+    }
+}
+
+
+int PDFCalculator::peakWindow(double dist, double fwhm, int& ifirst) const
+{
+    const PeakProfile& pkf = *(this->getPeakProfile());
+    double xlo = dist + pkf.xboundlo(fwhm);
+    double xhi = dist + pkf.xboundhi(fwhm);
+    ifirst = max(0, this->calcIndex(xlo));
+    int ilast = min(this->countCalcPoints(), this->calcIndex(xhi) + 1);
+    assert(ilast <= int(mvalue.size()));
+    return max(0, ilast - ifirst);
+}
+
+
+void PDFCalculator::addPeak(double dist, double fwhm, double peakscale,
+        double* ypartial)
+{
+    assert(eps_gt(dist, 0.0));
+    int i;
+    const int npts = this->peakWindow(dist, fwhm, i);
+    if (!npts)  return;
+    if (!ypartial && mhistogram.add(dist, fwhm, peakscale))
+    {
+        if (mhistogram.full())  this->flushPairContributions();
+        return;
+    }
+    const PeakProfile& pkf = *(this->getPeakProfile());
+    const double rstep = this->getRstep();
+    const double x0 = (this->rcalcloSteps() + i) * rstep - dist;
+    if (int(mpeakbuffer.size()) < npts)  mpeakbuffer.resize(npts);
+    double* py = &mpeakbuffer[0];
+    pkf.sampleGrid(py, npts, x0, rstep, fwhm);
+    double* pv = &mvalue[i];
+    double* pp = ypartial ? (ypartial + i) : NULL;
+    for (int k = 0; k < npts; ++k)
+    {
+        double x = x0 + k * rstep;
+        // Contributions in G(r) need to be normalized by pair distance,
+        // not by r as done in PDFfit or PDFfit2.  Here we rescale RDF
+        // in such way that division by r will give a correct result.
+        double yrdf = py[k] * (x / dist + 1);
+        pv[k] += peakscale * yrdf;
+        if (pp)  pp[k] += peakscale * yrdf;
+    }
+}
+
+
+/// The peak term is c(r) = peakscale * P(r - dist, fwhm) * r / dist,
+/// its derivatives for the distance and peak width are passed to
+/// BondGradient, which applies them to the parameters of both sites.
+void PDFCalculator::addPeakGradient(
+        const BaseBondGenerator& bnds, double peakscale)
+{
+    BondGradient& bg = mbondgradient;
+    bg.update(bnds, *mstructure, *(this->getPeakWidthModel()));
+    const double& dist = bg.distance;
+    const double& fwhm = bg.fwhm;
+    assert(eps_gt(dist, 0.0));
+    int i;
+    const int npts = this->peakWindow(dist, fwhm, i);
+    if (!npts)  return;
+    const PeakProfile& pkf = *(this->getPeakProfile());
+    const double rstep = this->getRstep();
+    const double x0 = (this->rcalcloSteps() + i) * rstep - dist;
+    if (int(mpeakbuffer.size()) < npts)  mpeakbuffer.resize(npts);
+    double* py = &mpeakbuffer[0];
+    pkf.sampleGrid(py, npts, x0, rstep, fwhm);
+    std::vector<double>& tdist = mgradientbuffer.tdist;
+    std::vector<double>& tfwhm = mgradientbuffer.tfwhm;
+    if (int(tdist.size()) < npts)  tdist.resize(npts);
+    if (int(tfwhm.size()) < npts)  tfwhm.resize(npts);
+    double* pv = &mvalue[i];
+    double* pp = this->partialValue(bnds.site0(), bnds.site1());
+    if (pp)  pp += i;
+    for (int k = 0; k < npts; ++k)
+    {
+        double x = x0 + k * rstep;
+        double c = peakscale * (x / dist + 1);
+        pv[k] += c * py[k];
+        if (pp)  pp[k] += c * py[k];
+        tdist[k] = -c * (pkf.xderivative(x, fwhm) + py[k] / dist);
+        tfwhm[k] = c * pkf.fwhmderivative(x, fwhm);
+    }
+    const int ncalc = this->countCalcPoints();
+    if (mgradientmode)
+    {
+        bg.accumulate(&mgradient[i], ncalc, &tdist[0], &tfwhm[0], npts);
+    }
+    // derivatives for the peak width attributes and lattice parameters
+    const int nattrs = mgradientattrs.size();
+    std::vector<double>& dwattr = mgradientbuffer.dwattr;
+    if (!dwattr.empty())
+    {
+        this->getPeakWidthModel()->calculateAttributeGradient(
+                bnds, &dwattr[0]);
+    }
+    for (int a = 0; a < nattrs; ++a)
+    {
+        const int& widx = mgradientattrs_cache.widthindex[a];
+        const int& lidx = mgradientattrs_cache.latticeindex[a];
+        double dd = 0.0;
+        double dw = 0.0;
+        if (widx >= 0)  dw = dwattr[widx];
+        else if (lidx >= 0)
+        {
+            bg.strain(mgradientattrs_cache.latticestrain[lidx], dd, dw);
+        }
+        else  continue;
+        double* pg = &mattrgradient[a * ncalc + i];
+        for (int k = 0; k < npts; ++k)  pg[k] += dd * tdist[k] + dw * tfwhm[k];
+    }
+}
+
+
+double* PDFCalculator::partialValue(int site0, int site1)
+{
+    if (mpartials.values().empty())  return NULL;
+    return mpartials.at(mpartials.pairIndexOfSites(site0, site1));
+}
+
+
+void PDFCalculator::addLinkedPeaks(int site0, int site1,
+        double dist, double fwhm, double pairscale)
+{
+    vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+    for (; lp != mlinked.end(); ++lp)
+    {
+        PDFCalculator& lpdfc = **lp;
+        int i;
+        if (!lpdfc.peakWindow(dist, fwhm, i))  continue;
+        double sfprod = lpdfc.sfSite(site0) * lpdfc.sfSite(site1);
+        double* ypartial = lpdfc.partialValue(site0, site1);
+        lpdfc.addPeak(dist, fwhm, sfprod * pairscale, ypartial);
+    }
 }
 
 
@@ -646,15 +1662,25 @@ double PDFCalculator::sfAverage() const
 void PDFCalculator::cacheStructureData()
 {
     int cntsites = this->countSites();
-    // sfsite
+    // sfsite, look up every atom type only once and keep the values
+    // for the next structures while the configuration is unchanged
     mstructure_cache.sfsite.resize(cntsites);
     const ScatteringFactorTablePtr sftable = this->getScatteringFactorTable();
+    boost::unordered_map<string, double>& sftype = mstructure_cache.sftype;
+    if (this->ticker() > mstructure_cache.sfticker)  sftype.clear();
     for (int i = 0; i < cntsites; ++i)
     {
         const string& smbl = mstructure->siteAtomType(i);
-        mstructure_cache.sfsite[i] = sftable->lookup(smbl) *
+        boost::unordered_map<string, double>::iterator tp;
+        tp = sftype.find(smbl);
+        if (tp == sftype.end())
+        {
+            tp = sftype.insert(make_pair(smbl, sftable->lookup(smbl))).first;
+        }
+        mstructure_cache.sfsite[i] = tp->second *
             mstructure->siteOccupancy(i);
     }
+    mstructure_cache.sfticker = this->ticker();
     // sfaverage
     double totocc = mstructure->totalOccupancy();
     double totsf = 0.0;
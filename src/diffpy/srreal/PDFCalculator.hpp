@@ -19,16 +19,24 @@
 #ifndef PDFCALCULATOR_HPP_INCLUDED
 #define PDFCALCULATOR_HPP_INCLUDED
 
+#include <boost/serialization/version.hpp>
+#include <boost/unordered_map.hpp>
+
 #include <diffpy/srreal/PairQuantity.hpp>
+#include <diffpy/srreal/BondGradient.hpp>
 #include <diffpy/srreal/PeakProfile.hpp>
+#include <diffpy/srreal/PeakHistogram.hpp>
 #include <diffpy/srreal/PeakWidthModel.hpp>
 #include <diffpy/srreal/PDFBaseline.hpp>
 #include <diffpy/srreal/PDFEnvelope.hpp>
 #include <diffpy/srreal/ScatteringFactorTable.hpp>
+#include <diffpy/srreal/TypePairPartials.hpp>
 
 namespace diffpy {
 namespace srreal {
 
+typedef boost::shared_ptr<class PDFCalculator> PDFCalculatorPtr;
+
 class PDFCalculator :
     public PairQuantity,
     public PeakWidthModelOwner,
@@ -42,12 +50,23 @@ class PDFCalculator :
 
         // PairQuantity overloads
         virtual eventticker::EventTicker& ticker() const;
+        virtual std::string getParallelData() const;
 
         // results
+        // The results and their intermediate arrays are cached until
+        // the next change of the calculated value or configuration.
+        // The const result methods therefore must not be called
+        // concurrently for the same calculator.
         QuantityType getPDF() const;
         QuantityType getRDF() const;
         QuantityType getRDFperR() const;
         QuantityType getF() const;
+        /// write results to caller-owned array of n elements, where n
+        /// must equal the length of the r-grid or the Q-grid for getF
+        void getPDF(double* y, size_t n) const;
+        void getRDF(double* y, size_t n) const;
+        void getRDFperR(double* y, size_t n) const;
+        void getF(double* y, size_t n) const;
 
         /// PDF on an r-range extended for termination ripples
         QuantityType getExtendedPDF() const;
@@ -60,14 +79,72 @@ class PDFCalculator :
         /// r-grid extended for termination ripples
         QuantityType getExtendedRgrid() const;
 
+        // derivatives with respect to the site parameters
+        /// sum derivatives of the value with respect to the Cartesian
+        /// coordinates and Uij of all sites in the same bond traversal.
+        /// This needs GRADIENT_SITE_PARAMS * countSites() arrays of the
+        /// calculated r-grid and disables fast updates of the value.
+        void setGradientMode(bool);
+        bool getGradientMode() const;
+        /// derivatives of PDF at index site * GRADIENT_SITE_PARAMS + p,
+        /// see BondGradient.hpp for the order of site parameters p
+        std::vector<QuantityType> getPDFGradients() const;
+        /// derivatives of F ordered as in getPDFGradients
+        std::vector<QuantityType> getFGradients() const;
+
+        // derivatives with respect to the attributes and lattice parameters
+        /// sum derivatives of the value for the named double attributes
+        /// and lattice parameters "a", "b", "c", "alpha", "beta", "gamma"
+        /// in the same bond traversal.  Supported are the attributes
+        /// differentiated by the peak width model and the attributes of
+        /// PDF envelopes, other names throw invalid_argument.  Lattice
+        /// derivatives keep the fractional coordinates and Cartesian Uij
+        /// fixed.  Use an empty vector to disable, otherwise fast updates
+        /// of the value are disabled.
+        void setGradientAttributes(const std::vector<std::string>& names);
+        const std::vector<std::string>& getGradientAttributes() const;
+        /// derivatives of PDF ordered as in getGradientAttributes
+        std::vector<QuantityType> getPDFAttributeGradients() const;
+
+        // partial PDFs for the pairs of atom types
+        /// sum the value also separately for every pair of atom types
+        /// in the same bond traversal.  The partial PDFs equal the PDFs
+        /// calculated with setTypeMask for one pair of atom types and
+        /// their plain sum is the total PDF.  The partials are summed
+        /// without the distance histogram.
+        void setPartialsMode(bool);
+        bool getPartialsMode() const;
+        /// atom type pairs in the order of the partial results
+        std::vector< std::pair<std::string, std::string> >
+            getPartialTypePairs() const;
+        /// partial PDFs ordered as in getPartialTypePairs
+        std::vector<QuantityType> getPartialPDFs() const;
+        /// partial F ordered as in getPartialTypePairs
+        std::vector<QuantityType> getPartialFs() const;
+
+        // several configurations evaluated in one bond traversal
+        /// add calculator that receives the bonds of this calculator.
+        /// The linked calculator keeps its own scattering factors,
+        /// r-grid, Q-range, peak profile, baseline, envelopes and partials
+        /// mode, but it must use the same peak width model object as this
+        /// calculator and must not sum derivatives.  Pair masks are not
+        /// supported for either calculator.  A calculator can be linked
+        /// only once and it cannot have its own linked calculators.
+        /// Violations throw logic_error here or in eval.  Results of
+        /// the linked calculator are updated by eval of this calculator.
+        void addLinkedCalculator(PDFCalculatorPtr);
+        /// remove all linked calculators
+        void clearLinkedCalculators();
+        const std::vector<PDFCalculatorPtr>& getLinkedCalculators() const;
+
         // Q-range methods
         QuantityType getQgrid() const;
         // Q-range configuration
         void setQmin(double);
         const double& getQmin() const;
         void setQmax(double);
-        const double& getQmax() const;
-        const double& getQstep() const;
+        double getQmax() const;
+        double getQstep() const;
 
         // R-range methods
         QuantityType getRgrid() const;
@@ -92,6 +169,11 @@ class PDFCalculator :
         void setPeakProfileByType(const std::string& tp);
         PeakProfilePtr& getPeakProfile();
         const PeakProfilePtr& getPeakProfile() const;
+        /// relative peak error of the distance histogram mode, where
+        /// Gaussian peaks are binned by their widths and converted to PDF
+        /// by convolution.  Use zero to disable the histogram mode.
+        void setHistogramPrecision(double);
+        const double& getHistogramPrecision() const;
 
         // PDF baseline configuration
         // application on an array
@@ -111,9 +193,21 @@ class PDFCalculator :
         virtual void resetValue();
         virtual void configureBondGenerator(BaseBondGenerator&) const;
         virtual void addPairContribution(const BaseBondGenerator&, int);
+        virtual bool acceptsBondBatch() const;
+        virtual void addPairContributions(const BondBatch&);
+        virtual void flushPairContributions();
+        virtual void executeParallelMerge(const std::string& pdata);
+        virtual size_t countParallelValues() const;
+        virtual void packParallelValues(double* pvalues) const;
+        virtual void mergeParallelValues(const double* pvalues, size_t n);
+        virtual void finishValue();
         // support for PQEvaluatorOptimized
+        virtual bool allowsFastUpdate() const;
         virtual void stashPartialValue();
         virtual void restorePartialValue();
+        // support for trial changes
+        virtual void stashTrialValue();
+        virtual void restoreTrialValue();
 
     private:
 
@@ -142,7 +236,67 @@ class PDFCalculator :
         int calcIndex(double r) const;
         /// reduce extended grid to user-requested results grid
         /// by cutting away the points for termination ripples
-        void cutRipplePoints(QuantityType& y) const;
+        QuantityType cutRipplePoints(const QuantityType& y) const;
+        /// copy results grid part of the extended y to n-long array
+        void copyRipplePoints(const QuantityType& y,
+                double* out, size_t n) const;
+
+        // cached results
+        /// discard cached results
+        void clearResultsCache();
+        /// discard cached results if configuration has changed
+        void validateResultsCache() const;
+        const QuantityType& cachedExtendedRgrid() const;
+        const QuantityType& cachedExtendedRDF() const;
+        const QuantityType& cachedExtendedRDFperR() const;
+        const QuantityType& cachedExtendedF() const;
+        const QuantityType& cachedExtendedPDF() const;
+        /// RDF on the extended r-grid for values on the calculated r-grid
+        QuantityType extendedRDFOf(const double* v) const;
+        /// RDF divided by r on the extended r-grid
+        QuantityType extendedRDFperROf(const QuantityType& rdf) const;
+        /// F on the extended Q-grid from RDF divided by r
+        QuantityType extendedFOf(const QuantityType& rdfperr) const;
+        /// PDF on the extended r-grid from F
+        QuantityType extendedPDFOf(const QuantityType& f) const;
+        /// PDF on the extended r-grid from F before applying envelopes
+        QuantityType extendedRawPDFOf(const QuantityType& f) const;
+        /// true when the value is summed together with any derivatives
+        bool hasGradients() const;
+        /// throw logic_error when the peak width model has no derivatives
+        void checkGradientSupport() const;
+        /// throw logic_error when lpdfc cannot be evaluated with this one
+        void checkLinkedCalculator(const PDFCalculator& lpdfc) const;
+        /// true when any pairs are masked, also for a pending structure
+        bool usesPairMask() const;
+        /// number of the derivative arrays in the gradient mode
+        int countGradients() const;
+        /// derivative p transformed to F on the extended Q-grid.  The
+        /// baseline is not applied as it does not depend on the sites.
+        QuantityType gradientExtendedF(int p) const;
+        /// check the gradient attributes and cache their lookup indices
+        void cacheGradientAttributes();
+        /// partial value p with its share of the baseline transformed
+        /// to F on the extended Q-grid
+        QuantityType partialExtendedF(int p) const;
+        /// cache baseline fractions of the partial values
+        void cachePartialWeights();
+        /// number of calculated points in the window of a peak at dist,
+        /// the window starts at the calculated r-grid index ifirst
+        int peakWindow(double dist, double fwhm, int& ifirst) const;
+        /// add scaled profile of a peak at dist to the calculated values
+        /// and to the optional partial values ypartial
+        void addPeak(double dist, double fwhm, double peakscale,
+                double* ypartial);
+        /// add peak of the current bond and its derivatives for
+        /// the parameters of its sites
+        void addPeakGradient(const BaseBondGenerator&, double peakscale);
+        /// partial values for a pair of sites or NULL if not summed
+        double* partialValue(int site0, int site1);
+        /// add peak of a bond to the values of the linked calculators,
+        /// pairscale is the bond multiplicity times its summation scale
+        void addLinkedPeaks(int site0, int site1,
+                double dist, double fwhm, double pairscale);
 
         // structure factors - fast lookup by site index
         /// effective scattering factor at a given site scaled by occupancy
@@ -158,6 +312,8 @@ class PDFCalculator :
         double mqmax;
         double mrstep;
         double mmaxextension;
+        double mhistogramprecision;
+        bool mgradientmode;
         PeakProfilePtr mpeakprofile;
         PDFBaselinePtr mbaseline;
         struct {
@@ -165,6 +321,13 @@ class PDFCalculator :
             double sfaverage;
             double totaloccupancy;
             double activeoccupancy;
+            /// active occupancy of the atom type pairs relative to
+            /// activeoccupancy, which scales their baseline
+            QuantityType partialweights;
+            /// scattering factors of the atom types of recent structures,
+            /// which are valid while the ticker stays below sfticker
+            boost::unordered_map<std::string, double> sftype;
+            eventticker::EventTicker sfticker;
         } mstructure_cache;
         struct {
             int extendedrminsteps;
@@ -177,6 +340,63 @@ class PDFCalculator :
             QuantityType value;
             int rclosteps;
         } mstashedvalue;
+        // peak widths for the bond batch, a temporary buffer
+        std::vector<double> mbatchfwhm;
+        // profile values sampled over the peak window, a temporary buffer
+        std::vector<double> mpeakbuffer;
+        // binned peaks for the distance histogram mode
+        PeakHistogram mhistogram;
+        // derivatives of the value for the parameters of all sites,
+        // stored as mgradient[p * countCalcPoints() + i]
+        QuantityType mgradient;
+        QuantityType mtrialgradient;
+        // derivatives for the current bond, temporary buffers
+        BondGradient mbondgradient;
+        struct {
+            std::vector<double> tdist;
+            std::vector<double> tfwhm;
+            std::vector<double> dwattr;
+        } mgradientbuffer;
+        // derivatives for the attributes in mgradientattrs, stored as
+        // mattrgradient[a * countCalcPoints() + i], envelope attributes
+        // are differentiated in getPDFAttributeGradients
+        std::vector<std::string> mgradientattrs;
+        QuantityType mattrgradient;
+        QuantityType mtrialattrgradient;
+        // index of each gradient attribute in the peak width attributes
+        // or in the lattice parameters, -1 when not applicable
+        struct {
+            std::vector<int> widthindex;
+            std::vector<int> latticeindex;
+            std::vector<R3::Matrix> latticestrain;
+        } mgradientattrs_cache;
+        // partial values for the pairs of atom types
+        bool mpartialsmode;
+        TypePairPartials mpartials;
+        TypePairPartials mtrialpartials;
+        // calculators that receive the bonds of this one
+        std::vector<PDFCalculatorPtr> mlinked;
+        // true when this calculator receives the bonds of another one
+        bool mislinked;
+        // intermediate results that were calculated for the current value
+        mutable struct {
+            /// configuration the results were calculated for, the
+            /// calculator ticker, Q-range and the attributes of the
+            /// baseline and envelopes
+            eventticker::EventTicker::value_type ticker;
+            std::vector<std::string> configtypes;
+            QuantityType configvalues;
+            // bit flags of the cached arrays
+            int cached;
+            QuantityType rgrid;
+            QuantityType rdf;
+            QuantityType rdfperr;
+            QuantityType f;
+            QuantityType pdf;
+            // temporary buffers for checking the configuration
+            std::vector<std::string> newtypes;
+            QuantityType newvalues;
+        } mresults;
         // serialization
         friend class boost::serialization::access;
         template<class Archive>
@@ -201,6 +421,24 @@ class PDFCalculator :
             ar & mrlimits_cache.extendedrmaxsteps;
             ar & mrlimits_cache.rcalclosteps;
             ar & mrlimits_cache.rcalchisteps;
+            if (version > 0)  ar & mhistogramprecision;
+            if (version > 1)  ar & mgradientmode & mgradient;
+            if (version > 2)  ar & mgradientattrs & mattrgradient;
+            if (version > 3)
+            {
+                ar & mpartialsmode & mpartials;
+                ar & mstructure_cache.partialweights;
+            }
+            if (version > 4)  ar & mlinked & mislinked;
+            // peak width models are saved by value, restore the one
+            // shared with the linked calculators
+            std::vector<PDFCalculatorPtr>::iterator lp = mlinked.begin();
+            for (; Archive::is_loading::value && lp != mlinked.end(); ++lp)
+            {
+                (*lp)->setPeakWidthModel(this->getPeakWidthModel());
+            }
+            // cached results are not saved and must be recalculated
+            this->clearResultsCache();
         }
 
 };  // class PDFCalculator
@@ -211,5 +449,6 @@ class PDFCalculator :
 // Serialization -------------------------------------------------------------
 
 BOOST_CLASS_EXPORT_KEY(diffpy::srreal::PDFCalculator)
+BOOST_CLASS_VERSION(diffpy::srreal::PDFCalculator, 5)
 
 #endif  // PDFCALCULATOR_HPP_INCLUDED
@@ -18,11 +18,14 @@
 
 #include <sstream>
 #include <stdexcept>
+#include <cmath>
+#include <algorithm>
 #include <boost/serialization/export.hpp>
 
 #include <diffpy/srreal/PDFEnvelope.hpp>
 #include <diffpy/HasClassRegistry.ipp>
 #include <diffpy/validators.hpp>
+#include <diffpy/mathutils.hpp>
 #include <diffpy/serialization.ipp>
 
 using namespace std;
@@ -35,6 +38,22 @@ template class HasClassRegistry<srreal::PDFEnvelope>;
 
 namespace srreal {
 
+// class PDFEnvelope ---------------------------------------------------------
+
+double PDFEnvelope::attributeDerivative(
+        const double& r, const string& name) const
+{
+    using diffpy::mathutils::DOUBLE_EPS;
+    const double v = this->getDoubleAttr(name);
+    const double h = cbrt(DOUBLE_EPS) * max(1.0, fabs(v));
+    PDFEnvelopePtr e = this->clone();
+    e->setDoubleAttr(name, v + h);
+    double yhi = (*e)(r);
+    e->setDoubleAttr(name, v - h);
+    double ylo = (*e)(r);
+    return (yhi - ylo) / (2 * h);
+}
+
 // class PDFEnvelopeOwner ----------------------------------------------------
 
 // public methods
@@ -59,6 +78,44 @@ QuantityType PDFEnvelopeOwner::applyEnvelopes(
 }
 
 
+QuantityType PDFEnvelopeOwner::applyEnvelopesDerivative(
+        const QuantityType& x, const QuantityType& y, const string& name) const
+{
+    assert(x.size() == y.size());
+    QuantityType z = y;
+    if (!this->hasEnvelopeAttribute(name))
+    {
+        fill(z.begin(), z.end(), 0.0);
+        return z;
+    }
+    EnvelopeStorage::const_iterator evit;
+    for (evit = menvelope.begin(); evit != menvelope.end(); ++evit)
+    {
+        PDFEnvelope& fenvelope = *(evit->second);
+        const bool differentiate = fenvelope.hasDoubleAttr(name);
+        QuantityType::const_iterator xi = x.begin();
+        QuantityType::iterator zi = z.begin();
+        for (; xi != x.end(); ++xi, ++zi)
+        {
+            *zi *= differentiate ?
+                fenvelope.attributeDerivative(*xi, name) : fenvelope(*xi);
+        }
+    }
+    return z;
+}
+
+
+bool PDFEnvelopeOwner::hasEnvelopeAttribute(const string& name) const
+{
+    EnvelopeStorage::const_iterator evit;
+    for (evit = menvelope.begin(); evit != menvelope.end(); ++evit)
+    {
+        if (evit->second->hasDoubleAttr(name))  return true;
+    }
+    return false;
+}
+
+
 void PDFEnvelopeOwner::addEnvelope(PDFEnvelopePtr envlp)
 {
     ensureNonNull("PDFEnvelope", envlp);
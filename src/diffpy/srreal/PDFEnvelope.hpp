@@ -45,6 +45,10 @@ class PDFEnvelope :
 {
     public:
         virtual double operator()(const double& r) const = 0;
+        /// derivative of the envelope at r with respect to its named
+        /// double attribute, by default a central difference
+        virtual double attributeDerivative(
+                const double& r, const std::string& name) const;
 };
 
 
@@ -61,6 +65,12 @@ class PDFEnvelopeOwner
 
         // application on (x, y) data
         QuantityType applyEnvelopes(const QuantityType& x, const QuantityType& y) const;
+        /// derivative of applyEnvelopes with respect to a double attribute
+        /// of the envelopes, zero when no envelope has such attribute
+        QuantityType applyEnvelopesDerivative(const QuantityType& x,
+                const QuantityType& y, const std::string& name) const;
+        /// true if the named double attribute belongs to an envelope
+        bool hasEnvelopeAttribute(const std::string& name) const;
 
         // access and configuration of PDF envelope functions
         // configuration of envelopes
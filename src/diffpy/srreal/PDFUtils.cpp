@@ -16,12 +16,10 @@
 *
 *****************************************************************************/
 
-#include <stdexcept>
-
-#include <gsl/gsl_errno.h>
-#include <gsl/gsl_fft_complex.h>
+#include <algorithm>
 
 #include <diffpy/srreal/PDFUtils.hpp>
+#include <diffpy/srreal/SineTransform.hpp>
 #include <diffpy/mathutils.hpp>
 #include <diffpy/validators.hpp>
 
@@ -32,14 +30,6 @@ using namespace diffpy::mathutils;
 namespace diffpy {
 namespace srreal {
 
-// Local Constants -----------------------------------------------------------
-
-namespace {
-
-const char* EMSGFFT = "Fourier Transformation failed.";
-
-}   // namespace
-
 // PDFUtils functions --------------------------------------------------------
 
 QuantityType fftgtof(const QuantityType& g, double rstep, double rmin)
@@ -49,37 +39,13 @@ QuantityType fftgtof(const QuantityType& g, double rstep, double rmin)
     int Npad1 = padrmin + g.size();
     // pad to the next power of 2 for fast Fourier transformation
     int Npad2 = (1 << int(ceil(log2(Npad1))));
-    // sine transformations needs an odd extension
-    // gpadc array has to be doubled for complex coefficients
-    int Npad4 = 4 * Npad2;
-    valarray<double> gpadc(0.0, Npad4);
-    QuantityType::const_iterator gi;
-    // copy the original g signal
-    int ilo = padrmin;
-    for (gi = g.begin(); gi != g.end(); ++gi, ++ilo)
-    {
-        gpadc[2 * ilo] = *gi;
-    }
-    // copy the odd part of g skipping the first point,
-    // because it is periodic image of gpadc[0]
-    int ihi = 2 * Npad2 - 1;
-    for (ilo = 1; ilo < Npad2; ++ilo, --ihi)
-    {
-        gpadc[2 * ihi] = -1 * gpadc[2 * ilo];
-    }
-    int status;
-    status = gsl_fft_complex_radix2_inverse(&(gpadc[0]), 1, 2 * Npad2);
-    if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
-    QuantityType f(Npad2);
-    for (int i = 0; i < Npad2; ++i)
-    {
-        f[i] = gpadc[2 * i + 1] * Npad2 * rstep;
-    }
-    // real components should be all close to zero
-    assert(fabs(valarray<double>(gpadc[slice(0, 2 * Npad2, 2)]).min()) <=
-            SQRT_DOUBLE_EPS * gpadc.max());
-    assert(fabs(valarray<double>(gpadc[slice(0, 2 * Npad2, 2)]).max()) <=
-            SQRT_DOUBLE_EPS * gpadc.max());
+    QuantityType f(Npad2, 0.0);
+    copy(g.begin(), g.end(), f.begin() + padrmin);
+    // the sine transformation ignores the first point, which would
+    // be cancelled by its image in an odd extension of g
+    SineTransform::getThreadDefault().transform(&(f[0]), Npad2);
+    QuantityType::iterator fi;
+    for (fi = f.begin(); fi != f.end(); ++fi)  *fi *= rstep;
     return f;
 }
 
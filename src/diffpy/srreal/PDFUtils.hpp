@@ -38,6 +38,9 @@ const double DEFAULT_PDFCALCULATOR_MAXEXTENSION = 10.0;
 /// and it was tuned to give average zero slope in the difference curve
 /// between pdffit2 and PDFCalculator results.
 const double DEFAULT_PEAKPRECISION = 3.33e-6;
+/// Precision of the PDFCalculator histogram mode with peak errors
+/// comparable to the default peak precision cutoff.
+const double DEFAULT_HISTOGRAMPRECISION = DEFAULT_PEAKPRECISION;
 
 const double DEFAULT_QGRID_QMAX = 10.0;
 const double DEFAULT_QGRID_QSTEP = 0.05;
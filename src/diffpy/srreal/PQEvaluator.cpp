@@ -18,15 +18,30 @@
 * class PQEvaluatorOptimized -- optimized PairQuantity evaluator with fast
 *     quantity updates
 *
+* class PQEvaluatorThreaded -- PairQuantity evaluator that splits the sum
+*     over atom pairs among several threads of the calling process
+*
 *****************************************************************************/
 
 
 #include <stdexcept>
 #include <sstream>
+#include <deque>
+#include <numeric>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/exception_ptr.hpp>
 
 #include <diffpy/serialization.ipp>
 #include <diffpy/srreal/PQEvaluator.hpp>
 #include <diffpy/srreal/PairQuantity.hpp>
+#include <diffpy/srreal/AtomicStructureAdapter.hpp>
+#include <diffpy/srreal/BondBatch.hpp>
+#include <diffpy/srreal/NeighborList.hpp>
 #include <diffpy/srreal/StructureDifference.hpp>
 
 using namespace std;
@@ -62,15 +77,108 @@ complementary_indices(const int sz, const SiteIndices& indices0)
     return rv;
 }
 
+/// Compare anchor sites by their cost, the most expensive first.
+class AnchorCostGreater
+{
+    public:
+
+        AnchorCostGreater(const vector<double>& costs) : mcosts(costs)  { }
+
+        bool operator()(int k0, int k1) const
+        {
+            return mcosts[k0] > mcosts[k1];
+        }
+
+    private:
+
+        const vector<double>& mcosts;
+};
+
 }   // namespace
 
+//////////////////////////////////////////////////////////////////////////////
+// class AnchorTasks -- queues of anchor sites for PQEvaluatorThreaded
+//////////////////////////////////////////////////////////////////////////////
+
+class AnchorTasks : boost::noncopyable
+{
+    public:
+
+        // constructor
+        AnchorTasks(int nthreads) :
+            mqueues(nthreads), mlocks(new boost::mutex[nthreads])
+        { }
+
+        /// Distribute anchors to thread queues so that the queues have
+        /// similar total cost.  Return false when there are no anchors
+        /// or when the most expensive anchor exceeds the average cost
+        /// per thread and cannot be balanced.
+        bool assign(const SiteIndices& anchors, const vector<double>& costs)
+        {
+            assert(anchors.size() == costs.size());
+            if (anchors.empty())  return false;
+            const int nthreads = mqueues.size();
+            double totalcost = accumulate(costs.begin(), costs.end(), 0.0);
+            double maxcost = costs.empty() ? 0.0 :
+                *max_element(costs.begin(), costs.end());
+            if (maxcost * nthreads > totalcost)  return false;
+            // assign in the order of decreasing cost to the least busy queue
+            vector<int> order(anchors.size());
+            for (size_t k = 0; k < order.size(); ++k)  order[k] = k;
+            stable_sort(order.begin(), order.end(), AnchorCostGreater(costs));
+            vector<double> loads(nthreads, 0.0);
+            vector<int>::const_iterator kk = order.begin();
+            for (; kk != order.end(); ++kk)
+            {
+                int t = min_element(loads.begin(), loads.end()) - loads.begin();
+                mqueues[t].push_back(anchors[*kk]);
+                loads[t] += costs[*kk];
+            }
+            return true;
+        }
+
+        /// Obtain the next anchor for thread tindex.  Take the most costly
+        /// anchor from the own queue or steal the cheapest one from another
+        /// thread.  Return false when there is no work left.
+        bool next(int tindex, int& i0)
+        {
+            const int nthreads = mqueues.size();
+            for (int k = 0; k < nthreads; ++k)
+            {
+                int t = (tindex + k) % nthreads;
+                boost::mutex::scoped_lock lock(mlocks[t]);
+                deque<int>& q = mqueues[t];
+                if (q.empty())  continue;
+                if (t == tindex)
+                {
+                    i0 = q.front();
+                    q.pop_front();
+                }
+                else
+                {
+                    i0 = q.back();
+                    q.pop_back();
+                }
+                return true;
+            }
+            return false;
+        }
+
+    private:
+
+        // data
+        vector< deque<int> > mqueues;
+        boost::scoped_array<boost::mutex> mlocks;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // class PQEvaluatorBasic
 //////////////////////////////////////////////////////////////////////////////
 
 PQEvaluatorBasic::PQEvaluatorBasic() :
     mconfigflags(0),
-    mcpuindex(0), mncpu(1), mtypeused(NONE)
+    mcpuindex(0), mncpu(1), mnthreads(0), mneighborskin(0.0),
+    mtypeused(NONE)
 { }
 
 
@@ -91,36 +199,49 @@ void PQEvaluatorBasic::updateValue(
 {
     mtypeused = BASIC;
     pq.setStructure(stru);
-    BaseBondGeneratorPtr bnds = pq.mstructure->createBondGenerator();
-    pq.configureBondGenerator(*bnds);
-    int cntsites = pq.mstructure->countSites();
-    // loop counter
-    long n = mcpuindex;
-    // split outer loop for many atoms.  The CPUs should have similar load.
-    bool chop_outer = (mncpu <= ((cntsites - 1) * CPU_LOAD_VARIANCE + 1));
-    bool chop_inner = !chop_outer;
-    bool hasmask = pq.hasMask();
-    if (!this->isParallel())  chop_outer = chop_inner = false;
-    bool usefullsum = this->getFlag(USEFULLSUM);
-    for (int i0 = 0; i0 < cntsites; ++i0)
+    BaseBondGeneratorPtr bnds = this->createBondGenerator(pq);
+    this->sumPairContributions(pq, *bnds, mcpuindex, mncpu);
+    mvalue_ticker.click();
+}
+
+
+/// Replace site idx in the AtomicStructureAdapter of pq with atom a
+/// and update the value by the pair contributions of that site.
+/// The value of pq must be evaluated for its current structure.
+void PQEvaluatorBasic::updateSite(PairQuantity& pq, int idx, const Atom& a)
+{
+    AtomicStructureAdapter& astru =
+        dynamic_cast<AtomicStructureAdapter&>(*pq.mstructure);
+    // recalculate completely if pq configuration has changed
+    if (pq.ticker() >= mvalue_ticker || this->isParallel() ||
+            !pq.allowsFastUpdate())
     {
-        if (chop_outer && (n++ % mncpu))    continue;
-        bnds->selectAnchorSite(i0);
-        int i1hi = usefullsum ? cntsites : (i0 + 1);
-        bnds->selectSiteRange(0, i1hi);
-        for (bnds->rewind(); !bnds->finished(); bnds->next())
-        {
-            if (chop_inner && (n++ % mncpu))    continue;
-            int i1 = bnds->site1();
-            if (hasmask && !pq.getPairMask(i0, i1))   continue;
-            int summationscale = (usefullsum || i0 == i1) ? 1 : 2;
-            pq.addPairContribution(*bnds, summationscale);
-        }
+        astru[idx] = a;
+        return this->updateValue(pq, pq.mstructure);
+    }
+    this->sumSiteContributions(pq, idx, -1);
+    astru[idx] = a;
+    // refresh structure data cached in pq, but keep its partial value
+    pq.stashPartialValue();
+    pq.setStructure(pq.mstructure);
+    if (pq.ticker() >= mvalue_ticker)
+    {
+        return this->updateValue(pq, pq.mstructure);
     }
+    pq.restorePartialValue();
+    this->sumSiteContributions(pq, idx, +1);
     mvalue_ticker.click();
 }
 
 
+/// End trial change of PairQuantity.  After rollback the value
+/// was restored for the structure at the start of the trial.
+void PQEvaluatorBasic::endTrial(bool rollback)
+{
+    if (rollback)  mvalue_ticker.click();
+}
+
+
 void PQEvaluatorBasic::setFlag(PQEvaluatorFlag flag, bool value)
 {
     if (value)  mconfigflags |= int(flag);
@@ -152,6 +273,177 @@ bool PQEvaluatorBasic::isParallel() const
     return mncpu > 1;
 }
 
+
+void PQEvaluatorBasic::setNumThreads(int nthreads)
+{
+    if (nthreads < 0)
+    {
+        const char* emsg = "Number of threads cannot be negative.";
+        throw invalid_argument(emsg);
+    }
+    mnthreads = nthreads;
+}
+
+
+int PQEvaluatorBasic::getNumThreads() const
+{
+    return mnthreads;
+}
+
+
+/// Set extra distance for caching neighbor atoms between evaluations.
+/// The cached list is rebuilt when atoms move by more than half the skin.
+/// Zero skin disables the neighbor list.
+void PQEvaluatorBasic::setNeighborListSkin(double skin)
+{
+    if (skin < 0)
+    {
+        const char* emsg = "Neighbor list skin cannot be negative.";
+        throw invalid_argument(emsg);
+    }
+    if (skin != mneighborskin)  mneighborlist.reset();
+    mneighborskin = skin;
+}
+
+
+const double& PQEvaluatorBasic::getNeighborListSkin() const
+{
+    return mneighborskin;
+}
+
+// Protected Methods ---------------------------------------------------------
+
+/// Create bond generator for the structure in pq configured for pq.
+/// Use the cached neighbor list when enabled and supported.
+BaseBondGeneratorPtr PQEvaluatorBasic::createBondGenerator(PairQuantity& pq)
+{
+    BaseBondGeneratorPtr bnds = pq.mstructure->createBondGenerator();
+    pq.configureBondGenerator(*bnds);
+    if (!(mneighborskin > 0) || !NeighborList::isSupported(pq.mstructure))
+    {
+        return bnds;
+    }
+    if (!mneighborlist)  mneighborlist.reset(new NeighborList);
+    mneighborlist->update(*bnds, pq.mstructure, mneighborskin);
+    bnds.reset(new NeighborListBondGenerator(pq.mstructure, mneighborlist));
+    pq.configureBondGenerator(*bnds);
+    return bnds;
+}
+
+
+/// Add pair contributions from the share cpuindex out of ncpu equal shares.
+/// The CPU share is further split by bonds among nthreads when tindex
+/// and nthreads are specified.  This does not change the evaluator and
+/// can run concurrently for different PairQuantity and BaseBondGenerator
+/// objects.
+void PQEvaluatorBasic::sumPairContributions(PairQuantity& pq,
+        BaseBondGenerator& bnds, int cpuindex, int ncpu,
+        int tindex, int nthreads) const
+{
+    int cntsites = pq.mstructure->countSites();
+    // loop counters for CPUs and threads
+    long n = cpuindex;
+    long m = tindex;
+    // split outer loop for many atoms.  The CPUs should have similar load.
+    bool chop_outer = (ncpu <= ((cntsites - 1) * CPU_LOAD_VARIANCE + 1));
+    bool chop_inner = !chop_outer;
+    bool hasmask = pq.hasMask();
+    if (ncpu <= 1)  chop_outer = chop_inner = false;
+    bool usefullsum = this->getFlag(USEFULLSUM);
+    boost::scoped_ptr<BondBatch> batch(createBondBatch(pq));
+    for (int i0 = 0; i0 < cntsites; ++i0)
+    {
+        if (chop_outer && (n++ % ncpu))    continue;
+        bnds.selectAnchorSite(i0);
+        int i1hi = usefullsum ? cntsites : (i0 + 1);
+        bnds.selectSiteRange(0, i1hi);
+        for (bnds.rewind(); !bnds.finished(); bnds.next())
+        {
+            if (chop_inner && (n++ % ncpu))    continue;
+            if (m++ % nthreads)    continue;
+            int i1 = bnds.site1();
+            if (hasmask && !pq.getPairMask(i0, i1))   continue;
+            int summationscale = (usefullsum || i0 == i1) ? 1 : 2;
+            addContribution(pq, bnds, summationscale, batch.get());
+        }
+    }
+    flushContributions(pq, batch.get());
+}
+
+
+/// Add pair contributions of site idx multiplied by sign.  Only the
+/// bonds of site idx are visited, for the full sum these are followed
+/// by the reverse bonds anchored at its neighbors.
+void PQEvaluatorBasic::sumSiteContributions(
+        PairQuantity& pq, int idx, int sign)
+{
+    const int cntsites = pq.mstructure->countSites();
+    const bool usefullsum = this->getFlag(USEFULLSUM);
+    const bool hasmask = pq.hasMask();
+    BaseBondGeneratorPtr bnds = this->createBondGenerator(pq);
+    boost::scoped_ptr<BondBatch> batch(createBondBatch(pq));
+    SiteIndices neighbors;
+    bnds->selectAnchorSite(idx);
+    bnds->selectSiteRange(0, cntsites);
+    for (bnds->rewind(); !bnds->finished(); bnds->next())
+    {
+        int i1 = bnds->site1();
+        if (hasmask && !pq.getPairMask(idx, i1))   continue;
+        if (usefullsum && i1 != idx)  neighbors.push_back(i1);
+        int summationscale = (usefullsum || idx == i1) ? sign : 2 * sign;
+        addContribution(pq, *bnds, summationscale, batch.get());
+    }
+    sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(unique(neighbors.begin(), neighbors.end()),
+            neighbors.end());
+    const SiteIndices selection(1, idx);
+    SiteIndices::const_iterator ii0 = neighbors.begin();
+    for (; ii0 != neighbors.end(); ++ii0)
+    {
+        bnds->selectAnchorSite(*ii0);
+        bnds->selectSites(selection.begin(), selection.end());
+        for (bnds->rewind(); !bnds->finished(); bnds->next())
+        {
+            addContribution(pq, *bnds, sign, batch.get());
+        }
+    }
+    flushContributions(pq, batch.get());
+}
+
+
+/// Return new BondBatch if pq can process bond batches or NULL otherwise.
+BondBatch* PQEvaluatorBasic::createBondBatch(const PairQuantity& pq)
+{
+    BondBatch* rv = pq.acceptsBondBatch() ? new BondBatch : NULL;
+    return rv;
+}
+
+
+/// Add pair contribution directly or through a batch when available.
+void PQEvaluatorBasic::addContribution(PairQuantity& pq,
+        const BaseBondGenerator& bnds, int summationscale, BondBatch* batch)
+{
+    if (!batch)  return pq.addPairContribution(bnds, summationscale);
+    batch->append(bnds, summationscale);
+    if (!batch->full())  return;
+    pq.addPairContributions(*batch);
+    batch->clear();
+}
+
+
+/// Add contributions of the pending bonds in the batch and clear it.
+/// Then let pq complete any contributions it has deferred.  This must
+/// be called at the end of every summation loop.
+void PQEvaluatorBasic::flushContributions(PairQuantity& pq, BondBatch* batch)
+{
+    if (batch && !batch->empty())
+    {
+        pq.addPairContributions(*batch);
+        batch->clear();
+    }
+    pq.flushPairContributions();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // class PQEvaluatorOptimized
 //////////////////////////////////////////////////////////////////////////////
@@ -167,8 +459,9 @@ void PQEvaluatorOptimized::updateValue(
 {
     mtypeused = OPTIMIZED;
     // revert to normal calculation if there is no structure or
-    // if PairQuantity uses mask
-    if (pq.ticker() >= mvalue_ticker || !mlast_structure || pq.hasMask())
+    // if PairQuantity uses mask or does not allow fast updates
+    if (pq.ticker() >= mvalue_ticker || !mlast_structure ||
+            pq.hasMask() || !pq.allowsFastUpdate())
     {
         return this->updateValueCompletely(pq, stru);
     }
@@ -179,7 +472,8 @@ void PQEvaluatorOptimized::updateValue(
         return this->updateValueCompletely(pq, stru);
     }
     if (this->getFlag(FIXEDSITEINDEX) &&
-            sd.diffmethod != StructureDifference::Method::SIDEBYSIDE)
+            sd.diffmethod != StructureDifference::Method::SIDEBYSIDE &&
+            sd.diffmethod != StructureDifference::Method::JOURNAL)
     {
         return this->updateValueCompletely(pq, stru);
     }
@@ -201,6 +495,7 @@ void PQEvaluatorOptimized::updateValue(
         anchors.insert(anchors.end(), unchanged.begin(), unchanged.end());
     }
     bnds0->selectSites(anchors.begin(), anchors.end());
+    boost::scoped_ptr<BondBatch> batch(createBondBatch(pq));
     SiteIndices::const_iterator last_anchor = usefullsum ?
         anchors.end() : (anchors.begin() + sd.pop0.size());
     SiteIndices::const_iterator ii0;
@@ -224,9 +519,10 @@ void PQEvaluatorOptimized::updateValue(
             int i1 = bnds0->site1();
             assert(pq.getPairMask(i0, i1));
             const int summationscale = (usefullsum || i0 == i1) ? -1 : -2;
-            pq.addPairContribution(*bnds0, summationscale);
+            addContribution(pq, *bnds0, summationscale, batch.get());
         }
     }
+    flushContributions(pq, batch.get());
     // Add contributions from the new atoms in the updated structure
     // save current value to override the resetValue call from setStructure
     assert(sd.stru1);
@@ -274,14 +570,40 @@ void PQEvaluatorOptimized::updateValue(
             int i1 = bnds1->site1();
             assert(pq.getPairMask(i0, i1));
             const int summationscale = (usefullsum || i0 == i1) ? +1 : +2;
-            pq.addPairContribution(*bnds1, summationscale);
+            addContribution(pq, *bnds1, summationscale, batch.get());
         }
     }
+    flushContributions(pq, batch.get());
     mlast_structure = pq.getStructure()->clone();
     mvalue_ticker.click();
 }
 
 
+void PQEvaluatorOptimized::updateSite(
+        PairQuantity& pq, int idx, const Atom& a)
+{
+    mtypeused = OPTIMIZED;
+    this->PQEvaluatorBasic::updateSite(pq, idx, a);
+    // the copy shares the change journal version for fast comparison
+    mlast_structure = pq.getStructure()->clone();
+}
+
+
+void PQEvaluatorOptimized::beginTrial()
+{
+    this->PQEvaluatorBasic::beginTrial();
+    mtrial_structure = mlast_structure;
+}
+
+
+void PQEvaluatorOptimized::endTrial(bool rollback)
+{
+    this->PQEvaluatorBasic::endTrial(rollback);
+    if (rollback)  mlast_structure = mtrial_structure;
+    mtrial_structure.reset();
+}
+
+
 void PQEvaluatorOptimized::updateValueCompletely(
         PairQuantity& pq, StructureAdapterPtr stru)
 {
@@ -289,6 +611,204 @@ void PQEvaluatorOptimized::updateValueCompletely(
     mlast_structure = pq.getStructure()->clone();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// class PQEvaluatorThreaded
+//////////////////////////////////////////////////////////////////////////////
+
+// Constructor ---------------------------------------------------------------
+
+PQEvaluatorThreaded::PQEvaluatorThreaded() : mworkersource(NULL)
+{ }
+
+// Public Methods ------------------------------------------------------------
+
+PQEvaluatorType PQEvaluatorThreaded::typeint() const
+{
+    return THREADED;
+}
+
+
+void PQEvaluatorThreaded::updateValue(
+        PairQuantity& pq, StructureAdapterPtr stru)
+{
+    const int nthreads = this->countThreads();
+    // there is nothing to gain from threads here
+    if (nthreads < 2)  return this->PQEvaluatorBasic::updateValue(pq, stru);
+    mtypeused = THREADED;
+    pq.setStructure(stru);
+    // Worker threads use private copies of pq that share its structure.
+    // Bond generators are created here, because createBondGenerator
+    // may update cached data in the structure adapter.
+    this->updateWorkers(pq, nthreads - 1);
+    vector<PairQuantity*> workers(nthreads, &pq);
+    vector<BaseBondGeneratorPtr> bonds(nthreads);
+    for (int k = 0; k < nthreads; ++k)
+    {
+        if (k > 0)  workers[k] = mworkers[k - 1].get();
+        bonds[k] = this->createBondGenerator(*workers[k]);
+    }
+    // Anchor sites of this CPU are distributed to threads according to
+    // their estimated bond counts and idle threads steal remaining anchors
+    // from the busy ones.  If a single anchor is too expensive for
+    // a balanced split, divide the bonds among threads as for parallel run.
+    const int cntsites = pq.mstructure->countSites();
+    bool chop_outer = (mncpu <= ((cntsites - 1) * CPU_LOAD_VARIANCE + 1));
+    if (!this->isParallel())  chop_outer = true;
+    SiteIndices anchors;
+    for (int i0 = 0; chop_outer && i0 < cntsites; ++i0)
+    {
+        if ((mcpuindex + i0) % mncpu)  continue;
+        anchors.push_back(i0);
+    }
+    vector<double> costs = this->estimateAnchorCosts(anchors, cntsites);
+    AnchorTasks tasks(nthreads);
+    bool stealing = tasks.assign(anchors, costs);
+    if (stealing)  manchorbonds.assign(cntsites, 0);
+    vector<boost::exception_ptr> errors(nthreads);
+    boost::thread_group threads;
+    try
+    {
+        for (int k = 1; k < nthreads; ++k)
+        {
+            threads.create_thread(boost::bind(
+                        &PQEvaluatorThreaded::sumShare, this,
+                        boost::ref(*workers[k]), boost::ref(*bonds[k]),
+                        stealing ? &tasks : NULL, k, nthreads,
+                        boost::ref(errors[k])));
+        }
+        this->sumShare(pq, *bonds[0],
+                stealing ? &tasks : NULL, 0, nthreads, errors[0]);
+    }
+    catch (...)
+    {
+        threads.join_all();
+        throw;
+    }
+    threads.join_all();
+    vector<boost::exception_ptr>::const_iterator ei = errors.begin();
+    for (; ei != errors.end(); ++ei)
+    {
+        if (*ei)  boost::rethrow_exception(*ei);
+    }
+    // merge partial results into pq
+    QuantityType pvalues;
+    for (int k = 1; k < nthreads; ++k)
+    {
+        pvalues.resize(workers[k]->countParallelValues());
+        if (pvalues.empty())  continue;
+        workers[k]->packParallelValues(&pvalues[0]);
+        pq.mergeParallelValues(&pvalues[0], pvalues.size());
+    }
+    mvalue_ticker.click();
+}
+
+// Private Methods -----------------------------------------------------------
+
+int PQEvaluatorThreaded::countThreads() const
+{
+    int rv = mnthreads ? mnthreads : boost::thread::hardware_concurrency();
+    return rv;
+}
+
+
+/// Prepare private copies of pq for the worker threads and set their
+/// structure to that of pq.  The copies are serialized again only when
+/// the configuration ticker of pq moved past their creation.  Pair masks
+/// do not change the ticker so they are always copied from pq.
+void PQEvaluatorThreaded::updateWorkers(PairQuantity& pq, int nworkers)
+{
+    bool reuse = (&pq == mworkersource) &&
+        (int(mworkers.size()) == nworkers) &&
+        (pq.ticker() < mworkers_ticker);
+    if (!reuse)
+    {
+        mworkers.clear();
+        mworkersource = NULL;
+        const string pqdata = dumpPairQuantityWithoutStructure(pq);
+        for (int k = 0; k < nworkers; ++k)
+        {
+            mworkers.push_back(loadPairQuantity(pqdata));
+        }
+        mworkersource = &pq;
+        mworkers_ticker.click();
+    }
+    vector<PairQuantityPtr>::iterator wi = mworkers.begin();
+    for (; wi != mworkers.end(); ++wi)
+    {
+        PairQuantity& wpq = **wi;
+        if (reuse)
+        {
+            wpq.mdefaultpairmask = pq.mdefaultpairmask;
+            wpq.minvertpairmask = pq.minvertpairmask;
+            wpq.msiteallmask = pq.msiteallmask;
+            wpq.mtypemask = pq.mtypemask;
+        }
+        wpq.setStructure(pq.mstructure);
+    }
+}
+
+
+/// Estimate relative cost of the anchor sites.  Use bond counts from
+/// the last evaluation if available, otherwise assume it is proportional
+/// to the number of sites in the summation range.
+vector<double> PQEvaluatorThreaded::estimateAnchorCosts(
+        const SiteIndices& anchors, int cntsites) const
+{
+    vector<double> rv;
+    rv.reserve(anchors.size());
+    bool usefullsum = this->getFlag(USEFULLSUM);
+    bool hascounts = (int(manchorbonds.size()) == cntsites);
+    SiteIndices::const_iterator ii0 = anchors.begin();
+    for (; ii0 != anchors.end(); ++ii0)
+    {
+        double c = hascounts ? (manchorbonds[*ii0] + 1) :
+            usefullsum ? cntsites : (*ii0 + 1);
+        rv.push_back(c);
+    }
+    return rv;
+}
+
+
+void PQEvaluatorThreaded::sumShare(PairQuantity& pq, BaseBondGenerator& bnds,
+        AnchorTasks* tasks, int tindex, int nthreads,
+        boost::exception_ptr& error)
+{
+    try
+    {
+        if (!tasks)
+        {
+            this->sumPairContributions(pq, bnds,
+                    mcpuindex, mncpu, tindex, nthreads);
+            return;
+        }
+        const bool usefullsum = this->getFlag(USEFULLSUM);
+        const bool hasmask = pq.hasMask();
+        const int cntsites = pq.mstructure->countSites();
+        boost::scoped_ptr<BondBatch> batch(createBondBatch(pq));
+        int i0;
+        while (tasks->next(tindex, i0))
+        {
+            bnds.selectAnchorSite(i0);
+            int i1hi = usefullsum ? cntsites : (i0 + 1);
+            bnds.selectSiteRange(0, i1hi);
+            // each anchor is visited once so there is no write conflict
+            int& nbonds = manchorbonds[i0];
+            for (bnds.rewind(); !bnds.finished(); bnds.next(), ++nbonds)
+            {
+                int i1 = bnds.site1();
+                if (hasmask && !pq.getPairMask(i0, i1))   continue;
+                int summationscale = (usefullsum || i0 == i1) ? 1 : 2;
+                addContribution(pq, bnds, summationscale, batch.get());
+            }
+        }
+        flushContributions(pq, batch.get());
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
 // Factory for PairQuantity evaluators ---------------------------------------
 
 PQEvaluatorPtr createPQEvaluator(PQEvaluatorType pqtp, PQEvaluatorPtr pqevsrc)
@@ -304,6 +824,10 @@ PQEvaluatorPtr createPQEvaluator(PQEvaluatorType pqtp, PQEvaluatorPtr pqevsrc)
             rv.reset(new PQEvaluatorOptimized());
             break;
 
+        case THREADED:
+            rv.reset(new PQEvaluatorThreaded());
+            break;
+
         default:
             ostringstream emsg;
             emsg << "Invalid PQEvaluatorType value " << pqtp;
@@ -314,6 +838,9 @@ PQEvaluatorPtr createPQEvaluator(PQEvaluatorType pqtp, PQEvaluatorPtr pqevsrc)
         rv->mconfigflags = pqevsrc->mconfigflags;
         rv->mcpuindex = pqevsrc->mcpuindex;
         rv->mncpu = pqevsrc->mncpu;
+        rv->mnthreads = pqevsrc->mnthreads;
+        rv->mneighborskin = pqevsrc->mneighborskin;
+        rv->mneighborlist = pqevsrc->mneighborlist;
         rv->mvalue_ticker = pqevsrc->mvalue_ticker;
         rv->mtypeused = pqevsrc->mtypeused;
     }
@@ -330,5 +857,7 @@ DIFFPY_INSTANTIATE_SERIALIZATION(diffpy::srreal::PQEvaluatorBasic)
 BOOST_CLASS_EXPORT_IMPLEMENT(diffpy::srreal::PQEvaluatorBasic)
 DIFFPY_INSTANTIATE_SERIALIZATION(diffpy::srreal::PQEvaluatorOptimized)
 BOOST_CLASS_EXPORT_IMPLEMENT(diffpy::srreal::PQEvaluatorOptimized)
+DIFFPY_INSTANTIATE_SERIALIZATION(diffpy::srreal::PQEvaluatorThreaded)
+BOOST_CLASS_EXPORT_IMPLEMENT(diffpy::srreal::PQEvaluatorThreaded)
 
 // End of file
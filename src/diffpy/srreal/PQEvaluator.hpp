@@ -18,6 +18,9 @@
 * class PQEvaluatorOptimized -- optimized PairQuantity evaluator with fast
 *     quantity updates
 *
+* class PQEvaluatorThreaded -- PairQuantity evaluator that splits the sum
+*     over atom pairs among several threads of the calling process
+*
 *****************************************************************************/
 
 
@@ -25,9 +28,11 @@
 #define PQEVALUATOR_HPP_INCLUDED
 
 #include <boost/shared_ptr.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/assume_abstract.hpp>
 #include <boost/serialization/export.hpp>
+#include <boost/serialization/version.hpp>
 
 #include <diffpy/EventTicker.hpp>
 #include <diffpy/srreal/QuantityType.hpp>
@@ -37,12 +42,16 @@ namespace diffpy {
 namespace srreal {
 
 class PairQuantity;
+class Atom;
+class AnchorTasks;
+class BondBatch;
+class NeighborList;
 
 /// shared pointer to PQEvaluatorBasic
 
 typedef boost::shared_ptr<class PQEvaluatorBasic> PQEvaluatorPtr;
 
-enum PQEvaluatorType {NONE, BASIC, OPTIMIZED};
+enum PQEvaluatorType {NONE, BASIC, OPTIMIZED, THREADED};
 
 enum PQEvaluatorFlag {
     // sum over full matrix of atom pairs, use pair symmetry otherwise.
@@ -65,13 +74,30 @@ class PQEvaluatorBasic
         virtual PQEvaluatorType typeint() const;
         PQEvaluatorType typeintused() const;
         virtual void updateValue(PairQuantity&, StructureAdapterPtr);
+        virtual void updateSite(PairQuantity&, int idx, const Atom&);
+        virtual void beginTrial()  { }
+        virtual void endTrial(bool rollback);
         void setFlag(PQEvaluatorFlag flag, bool value);
         bool getFlag(PQEvaluatorFlag flag) const;
         void setupParallelRun(int cpuindex, int ncpu);
         bool isParallel() const;
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        void setNeighborListSkin(double skin);
+        const double& getNeighborListSkin() const;
 
     protected:
 
+        // methods
+        BaseBondGeneratorPtr createBondGenerator(PairQuantity&);
+        void sumPairContributions(PairQuantity&, BaseBondGenerator&,
+                int cpuindex, int ncpu,
+                int tindex=0, int nthreads=1) const;
+        void sumSiteContributions(PairQuantity&, int idx, int sign);
+        static BondBatch* createBondBatch(const PairQuantity&);
+        static void addContribution(PairQuantity&,
+                const BaseBondGenerator&, int summationscale, BondBatch*);
+        static void flushContributions(PairQuantity&, BondBatch*);
 
         // data
         /// per-bit storage of boolean configuration flags
@@ -80,6 +106,12 @@ class PQEvaluatorBasic
         int mcpuindex;
         /// total number of the CPU units
         int mncpu;
+        /// number of threads for PQEvaluatorThreaded, 0 for hardware default
+        int mnthreads;
+        /// extra distance for the cached neighbor list, 0 for no caching
+        double mneighborskin;
+        /// neighbor list shared by bond generators from createBondGenerator
+        boost::shared_ptr<NeighborList> mneighborlist;
         /// ticker for recording when was the value updated
         eventticker::EventTicker mvalue_ticker;
         /// type of PQEvaluator that was actually used
@@ -93,6 +125,8 @@ class PQEvaluatorBasic
             void serialize(Archive& ar, const unsigned int version)
         {
             ar & mconfigflags & mcpuindex & mncpu & mvalue_ticker;
+            if (version > 0)  ar & mnthreads;
+            if (version > 1)  ar & mneighborskin;
         }
 };
 
@@ -104,11 +138,15 @@ class PQEvaluatorOptimized : public PQEvaluatorBasic
         // methods
         virtual PQEvaluatorType typeint() const;
         virtual void updateValue(PairQuantity&, StructureAdapterPtr);
+        virtual void updateSite(PairQuantity&, int idx, const Atom&);
+        virtual void beginTrial();
+        virtual void endTrial(bool rollback);
 
     private:
 
         // data
         StructureAdapterPtr mlast_structure;
+        StructureAdapterPtr mtrial_structure;
 
         // helper method
         void updateValueCompletely(PairQuantity&, StructureAdapterPtr);
@@ -124,6 +162,49 @@ class PQEvaluatorOptimized : public PQEvaluatorBasic
         }
 };
 
+
+class PQEvaluatorThreaded : public PQEvaluatorBasic
+{
+    public:
+
+        // constructor
+        PQEvaluatorThreaded();
+
+        // methods
+        virtual PQEvaluatorType typeint() const;
+        virtual void updateValue(PairQuantity&, StructureAdapterPtr);
+
+    private:
+
+        // data
+        /// number of bonds per anchor site from the last evaluation
+        std::vector<int> manchorbonds;
+        /// private copies of the evaluated PairQuantity for the extra
+        /// threads, they are reused until its configuration changes
+        std::vector< boost::shared_ptr<PairQuantity> > mworkers;
+        /// PairQuantity that was copied to mworkers
+        const PairQuantity* mworkersource;
+        /// ticker for recording when were mworkers copied
+        eventticker::EventTicker mworkers_ticker;
+
+        // helper methods
+        int countThreads() const;
+        void updateWorkers(PairQuantity&, int nworkers);
+        std::vector<double> estimateAnchorCosts(
+                const SiteIndices& anchors, int cntsites) const;
+        void sumShare(PairQuantity&, BaseBondGenerator&, AnchorTasks*,
+                int tindex, int nthreads, boost::exception_ptr&);
+
+        // serialization
+        friend class boost::serialization::access;
+        template<class Archive>
+            void serialize(Archive& ar, const unsigned int version)
+        {
+            using boost::serialization::base_object;
+            ar & base_object<PQEvaluatorBasic>(*this);
+        }
+};
+
 // Factory function for PairQuantity evaluators ------------------------------
 
 PQEvaluatorPtr createPQEvaluator(
@@ -137,5 +218,7 @@ PQEvaluatorPtr createPQEvaluator(
 BOOST_SERIALIZATION_ASSUME_ABSTRACT(diffpy::srreal::PQEvaluatorBasic)
 BOOST_CLASS_EXPORT_KEY(diffpy::srreal::PQEvaluatorBasic)
 BOOST_CLASS_EXPORT_KEY(diffpy::srreal::PQEvaluatorOptimized)
+BOOST_CLASS_EXPORT_KEY(diffpy::srreal::PQEvaluatorThreaded)
+BOOST_CLASS_VERSION(diffpy::srreal::PQEvaluatorBasic, 2)
 
 #endif  // PQEVALUATOR_HPP_INCLUDED
@@ -19,8 +19,17 @@
 #include <algorithm>
 #include <locale>
 #include <sstream>
+#include <cstring>
+#include <typeinfo>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <diffpy/srreal/PairQuantity.hpp>
+#include <diffpy/srreal/AtomicStructureAdapter.hpp>
+#include <diffpy/srreal/PeriodicStructureAdapter.hpp>
+#include <diffpy/srreal/CrystalStructureAdapter.hpp>
 #include <diffpy/mathutils.hpp>
 #include <diffpy/serialization.ipp>
 
@@ -29,6 +38,77 @@ using namespace std;
 namespace diffpy {
 namespace srreal {
 
+// Local Constants -----------------------------------------------------------
+
+namespace {
+
+const char PARALLEL_DATA_MAGIC[4] = {'D', 'P', 'Q', 'B'};
+const boost::uint32_t PARALLEL_DATA_VERSION = 1;
+const boost::uint32_t PARALLEL_DATA_BYTEORDER = 0x01020304;
+
+/// Index of the next structure to be processed by evalBatch threads.
+class BatchCounter
+{
+    public:
+
+        BatchCounter(int size) : mnext(0), msize(size)  { }
+
+        bool next(int& idx)
+        {
+            boost::mutex::scoped_lock lock(mlock);
+            if (mnext >= msize)  return false;
+            idx = mnext++;
+            return true;
+        }
+
+    private:
+
+        boost::mutex mlock;
+        int mnext;
+        int msize;
+};
+
+
+void eval_batch_items(PairQuantity& pq,
+        const vector<StructureAdapterPtr>& strus,
+        const SiteIndices& indices, BatchCounter& counter,
+        vector<QuantityType>& values, boost::exception_ptr& error)
+{
+    try
+    {
+        int k;
+        while (counter.next(k))
+        {
+            const int idx = indices[k];
+            values[idx] = pq.eval(strus[idx]);
+        }
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
+
+template <class T>
+bool assignStructureAs(StructureAdapter& dst, const StructureAdapter& src)
+{
+    if (typeid(dst) != typeid(T) || typeid(src) != typeid(T))  return false;
+    static_cast<T&>(dst) = static_cast<const T&>(src);
+    return true;
+}
+
+/// Copy the content of src to dst of the same adapter type.
+/// Return false if the adapter type is not supported.
+bool assignStructure(StructureAdapter& dst, const StructureAdapter& src)
+{
+    return assignStructureAs<AtomicStructureAdapter>(dst, src) ||
+        assignStructureAs<PeriodicStructureAdapter>(dst, src) ||
+        assignStructureAs<CrystalStructureAdapter>(dst, src);
+}
+
+}   // namespace
+
 // Class Constants -----------------------------------------------------------
 
 const int PairQuantity::ALLATOMSINT = -1;
@@ -36,8 +116,12 @@ const string PairQuantity::ALLATOMSSTR = "all";
 
 // Constructor ---------------------------------------------------------------
 
-PairQuantity::PairQuantity() : mstructure(emptyStructureAdapter())
+PairQuantity::PairQuantity() :
+    mstructure(emptyStructureAdapter()),
+    mvaluecurrent(false)
 {
+    mrollbacksite.index = -1;
+    mtrial.active = false;
     this->setRmin(0.0);
     this->setRmax(DEFAULT_BONDGENERATOR_RMAX);
     this->setEvaluatorType(BASIC);
@@ -61,6 +145,7 @@ const QuantityType& PairQuantity::eval(StructureAdapterPtr stru)
 {
     mevaluator->updateValue(*this, stru);
     this->finishValue();
+    mvaluecurrent = true;
     return this->value();
 }
 
@@ -86,6 +171,77 @@ const StructureAdapterPtr& PairQuantity::getStructure() const
 }
 
 
+/// Evaluate pair quantity for each structure and return their values.
+/// Structures are processed concurrently by private copies of this object
+/// using the thread count of the evaluator.  The structure and value
+/// of this object are not changed.
+vector<QuantityType>
+PairQuantity::evalBatch(const vector<StructureAdapterPtr>& strus)
+{
+    const int cnt = strus.size();
+    vector<QuantityType> rv(cnt);
+    // evaluate repeated structures only once, because concurrent use
+    // of one structure adapter may be unsafe.
+    vector<int> source(cnt);
+    SiteIndices indices;
+    boost::unordered_map<const StructureAdapter*, int> firstindex;
+    for (int i = 0; i < cnt; ++i)
+    {
+        const StructureAdapter* pstru = strus[i].get();
+        if (!firstindex.count(pstru))
+        {
+            firstindex[pstru] = i;
+            indices.push_back(i);
+        }
+        source[i] = firstindex[pstru];
+    }
+    int nthreads = mevaluator->getNumThreads();
+    if (!nthreads)  nthreads = boost::thread::hardware_concurrency();
+    nthreads = max(1, min(nthreads, int(indices.size())));
+    // calculator copies keep their caches between structures
+    const string pqdata = dumpPairQuantityWithoutStructure(*this);
+    vector<PairQuantityPtr> calcs(nthreads);
+    for (int k = 0; k < nthreads; ++k)
+    {
+        calcs[k] = loadPairQuantity(pqdata);
+        if (THREADED == calcs[k]->getEvaluatorType())
+        {
+            calcs[k]->setEvaluatorType(BASIC);
+        }
+    }
+    BatchCounter counter(indices.size());
+    vector<boost::exception_ptr> errors(nthreads);
+    boost::thread_group threads;
+    try
+    {
+        for (int k = 1; k < nthreads; ++k)
+        {
+            threads.create_thread(boost::bind(eval_batch_items,
+                        boost::ref(*calcs[k]), boost::cref(strus),
+                        boost::cref(indices), boost::ref(counter),
+                        boost::ref(rv), boost::ref(errors[k])));
+        }
+        eval_batch_items(*calcs[0], strus, indices, counter, rv, errors[0]);
+    }
+    catch (...)
+    {
+        threads.join_all();
+        throw;
+    }
+    threads.join_all();
+    vector<boost::exception_ptr>::const_iterator ei = errors.begin();
+    for (; ei != errors.end(); ++ei)
+    {
+        if (*ei)  boost::rethrow_exception(*ei);
+    }
+    for (int i = 0; i < cnt; ++i)
+    {
+        if (source[i] != i)  rv[i] = rv[source[i]];
+    }
+    return rv;
+}
+
+
 const QuantityType& PairQuantity::value() const
 {
     return mvalue;
@@ -114,6 +270,219 @@ string PairQuantity::getParallelData() const
 }
 
 
+size_t PairQuantity::getParallelDataSize() const
+{
+    size_t rv = sizeof(ParallelDataHeader) +
+        this->countParallelValues() * sizeof(double);
+    return rv;
+}
+
+
+void PairQuantity::writeParallelData(void* buffer, size_t size) const
+{
+    const size_t cnt = this->countParallelValues();
+    if (size < sizeof(ParallelDataHeader) + cnt * sizeof(double))
+    {
+        const char* emsg = "Buffer too small for the parallel data.";
+        throw invalid_argument(emsg);
+    }
+    ParallelDataHeader hdr;
+    memcpy(hdr.magic, PARALLEL_DATA_MAGIC, sizeof(hdr.magic));
+    hdr.version = PARALLEL_DATA_VERSION;
+    hdr.byteorder = PARALLEL_DATA_BYTEORDER;
+    hdr.valuesize = sizeof(double);
+    hdr.count = cnt;
+    char* pbuf = static_cast<char*>(buffer);
+    memcpy(pbuf, &hdr, sizeof(hdr));
+    pbuf += sizeof(hdr);
+    if (0 == reinterpret_cast<size_t>(pbuf) % sizeof(double))
+    {
+        this->packParallelValues(reinterpret_cast<double*>(pbuf));
+        return;
+    }
+    if (!cnt)  return;
+    QuantityType pvalues(cnt);
+    this->packParallelValues(&pvalues[0]);
+    memcpy(pbuf, &pvalues[0], cnt * sizeof(double));
+}
+
+
+void PairQuantity::mergeParallelData(
+        const void* buffer, size_t size, int ncpu)
+{
+    if (mmergedvaluescount >= ncpu)
+    {
+        const char* emsg = "Number of merged values exceeds NCPU.";
+        throw runtime_error(emsg);
+    }
+    ParallelDataHeader hdr;
+    if (size < sizeof(hdr))
+    {
+        throw invalid_argument("Truncated header of parallel data.");
+    }
+    memcpy(&hdr, buffer, sizeof(hdr));
+    if (memcmp(hdr.magic, PARALLEL_DATA_MAGIC, sizeof(hdr.magic)))
+    {
+        throw invalid_argument("Invalid format of parallel data.");
+    }
+    if (hdr.version != PARALLEL_DATA_VERSION)
+    {
+        throw invalid_argument("Unsupported version of parallel data.");
+    }
+    if (hdr.byteorder != PARALLEL_DATA_BYTEORDER ||
+            hdr.valuesize != sizeof(double))
+    {
+        throw invalid_argument("Incompatible binary layout of parallel data.");
+    }
+    if ((size - sizeof(hdr)) / sizeof(double) < hdr.count)
+    {
+        throw invalid_argument("Truncated parallel data.");
+    }
+    const char* pbuf = static_cast<const char*>(buffer) + sizeof(hdr);
+    // merge in place when the values are aligned, copy otherwise
+    QuantityType pcopy;
+    const double* pvalues = reinterpret_cast<const double*>(pbuf);
+    if (hdr.count && reinterpret_cast<size_t>(pbuf) % sizeof(double))
+    {
+        pcopy.resize(hdr.count);
+        memcpy(&pcopy[0], pbuf, hdr.count * sizeof(double));
+        pvalues = &pcopy[0];
+    }
+    this->mergeParallelValues(pvalues, hdr.count);
+    ++mmergedvaluescount;
+    if (mmergedvaluescount == ncpu)  this->finishValue();
+}
+
+
+/// Move site idx to a new Cartesian position and update the value.
+/// See replaceSite for details.
+void PairQuantity::moveSite(int idx, const R3::Vector& xyz)
+{
+    Atom a = this->getSiteUpdateStructure(idx)[idx];
+    a.xyz_cartn = xyz;
+    this->replaceSite(idx, a);
+}
+
+
+/// Replace site idx in the structure with a new atom and update the value
+/// by subtracting the old and adding the new pair contributions of that
+/// site.  This modifies the structure object, which must be exactly
+/// AtomicStructureAdapter or PeriodicStructureAdapter.  The value is
+/// calculated from scratch if it was not evaluated for the current
+/// structure and configuration.
+void PairQuantity::replaceSite(int idx, const Atom& a)
+{
+    AtomicStructureAdapter& astru = this->getSiteUpdateStructure(idx);
+    Atom a0 = astru[idx];
+    if (mvaluecurrent)  mevaluator->updateSite(*this, idx, a);
+    else
+    {
+        astru[idx] = a;
+        mevaluator->updateValue(*this, mstructure);
+    }
+    this->finishValue();
+    mvaluecurrent = true;
+    mrollbacksite.index = idx;
+    // copies of this object may share the saved atom
+    boost::shared_ptr<Atom>& ra = mrollbacksite.atom;
+    if (ra.unique())  *ra = a0;
+    else  ra.reset(new Atom(a0));
+}
+
+
+/// Revert the last moveSite or replaceSite call, for example,
+/// to reject a trial move.
+void PairQuantity::rollbackSite()
+{
+    if (mrollbacksite.index < 0)
+    {
+        const char* emsg = "There is no site update to roll back.";
+        throw logic_error(emsg);
+    }
+    const int idx = mrollbacksite.index;
+    Atom a0 = *mrollbacksite.atom;
+    this->replaceSite(idx, a0);
+    mrollbacksite.index = -1;
+}
+
+
+/// Start a trial change of the structure, which is ended by commit
+/// or reverted by rollback.  The structure can be changed by moveSite,
+/// replaceSite or by evaluation of the modified or another structure.
+/// The value must be evaluated for the current structure.  This saves
+/// a copy of the structure and of the full value arrays, including
+/// derivatives and partials of the concrete quantity, therefore the
+/// cost of beginTrial and rollback is O(value size + structure size)
+/// regardless of how many sites or bins the trial changes.
+void PairQuantity::beginTrial()
+{
+    if (!mvaluecurrent)
+    {
+        const char* emsg = "Value must be evaluated before beginTrial().";
+        throw logic_error(emsg);
+    }
+    mtrial.active = true;
+    mtrial.ticker = this->ticker();
+    mtrial.structure = mstructure;
+    mtrial.snapshot = mstructure->clone();
+    this->stashTrialValue();
+    mevaluator->beginTrial();
+}
+
+
+/// Accept the trial change.
+void PairQuantity::commit()
+{
+    if (!mtrial.active)
+    {
+        throw logic_error("There is no trial to commit.");
+    }
+    mtrial.active = false;
+    mtrial.structure.reset();
+    mtrial.snapshot.reset();
+    mtrial.value.clear();
+    mevaluator->endTrial(false);
+}
+
+
+/// Revert the structure and value to their state at beginTrial.
+/// Atoms of AtomicStructureAdapter, PeriodicStructureAdapter and
+/// CrystalStructureAdapter are restored in the original object, other
+/// structures are replaced with their copy from beginTrial.  The value
+/// is recalculated if the configuration changed during the trial.
+void PairQuantity::rollback()
+{
+    if (!mtrial.active)
+    {
+        throw logic_error("There is no trial to roll back.");
+    }
+    mtrial.active = false;
+    StructureAdapterPtr stru = mtrial.structure;
+    if (!assignStructure(*stru, *mtrial.snapshot))  stru = mtrial.snapshot;
+    mtrial.structure.reset();
+    mtrial.snapshot.reset();
+    if (this->ticker() > mtrial.ticker)
+    {
+        mevaluator->endTrial(false);
+        mtrial.value.clear();
+        this->eval(stru);
+        return;
+    }
+    this->setStructure(stru);
+    this->restoreTrialValue();
+    mtrial.value.clear();
+    this->finishValue();
+    mevaluator->endTrial(true);
+    mvaluecurrent = true;
+}
+
+
+bool PairQuantity::inTrial() const
+{
+    return mtrial.active;
+}
+
+
 void PairQuantity::setRmin(double rmin)
 {
     if (mrmin != rmin)  mticker.click();
@@ -166,6 +535,30 @@ void PairQuantity::setupParallelRun(int cpuindex, int ncpu)
 }
 
 
+void PairQuantity::setNumThreads(int nthreads)
+{
+    mevaluator->setNumThreads(nthreads);
+}
+
+
+int PairQuantity::getNumThreads() const
+{
+    return mevaluator->getNumThreads();
+}
+
+
+void PairQuantity::setNeighborListSkin(double skin)
+{
+    mevaluator->setNeighborListSkin(skin);
+}
+
+
+const double& PairQuantity::getNeighborListSkin() const
+{
+    return mevaluator->getNeighborListSkin();
+}
+
+
 void PairQuantity::maskAllPairs(bool mask)
 {
     minvertpairmask.clear();
@@ -233,13 +626,9 @@ bool PairQuantity::getPairMask(int i, int j) const
 void PairQuantity::
 setTypeMask(string smbli, string smblj, bool mask)
 {
-    static string upcaseall;
-    if (upcaseall.empty())
-    {
-        upcaseall = ALLATOMSSTR;
-        transform(upcaseall.begin(), upcaseall.end(),
-                upcaseall.begin(), ::toupper);
-    }
+    string upcaseall = ALLATOMSSTR;
+    transform(upcaseall.begin(), upcaseall.end(),
+            upcaseall.begin(), ::toupper);
     // accept "ALL" (upper ALLATOMSSTR) for smbli and smblj
     if (upcaseall == smbli)  smbli = ALLATOMSSTR;
     if (upcaseall == smblj)  smblj = ALLATOMSSTR;
@@ -293,6 +682,8 @@ void PairQuantity::resizeValue(size_t sz)
 void PairQuantity::resetValue()
 {
     mmergedvaluescount = 0;
+    mvaluecurrent = false;
+    mrollbacksite.index = -1;
     fill(mvalue.begin(), mvalue.end(), 0.0);
 }
 
@@ -319,6 +710,39 @@ void PairQuantity::executeParallelMerge(const string& pdata)
 }
 
 
+/// Add contributions from a batch of bonds.  This must be overloaded
+/// in classes that return true from acceptsBondBatch.
+void PairQuantity::addPairContributions(const BondBatch&)
+{
+    const char* emsg =
+        "addPairContributions() is not defined in the calculator class.";
+    throw logic_error(emsg);
+}
+
+
+size_t PairQuantity::countParallelValues() const
+{
+    return mvalue.size();
+}
+
+
+void PairQuantity::packParallelValues(double* pvalues) const
+{
+    copy(mvalue.begin(), mvalue.end(), pvalues);
+}
+
+
+void PairQuantity::mergeParallelValues(const double* pvalues, size_t n)
+{
+    if (n != mvalue.size())
+    {
+        throw invalid_argument("Merged data array must have the same size.");
+    }
+    transform(mvalue.begin(), mvalue.end(), pvalues,
+            mvalue.begin(), plus<double>());
+}
+
+
 int PairQuantity::countSites() const
 {
     int rv = mstructure.get() ? mstructure->countSites() : 0;
@@ -348,6 +772,20 @@ void PairQuantity::restorePartialValue()
     throw logic_error(emsg);
 }
 
+
+/// Save the value and any calculator data needed to restore the
+/// value for an unchanged structure after setStructure.
+void PairQuantity::stashTrialValue()
+{
+    mtrial.value = mvalue;
+}
+
+
+void PairQuantity::restoreTrialValue()
+{
+    mvalue.swap(mtrial.value);
+}
+
 // Private Methods -----------------------------------------------------------
 
 void PairQuantity::updateMaskData()
@@ -416,6 +854,27 @@ void PairQuantity::setPairMaskValue(int i, int j, bool mask)
     else    minvertpairmask.insert(ij);
 }
 
+
+/// Return the structure for single site updates or throw an exception.
+AtomicStructureAdapter& PairQuantity::getSiteUpdateStructure(int idx)
+{
+    const type_info& tp = typeid(*mstructure);
+    if (tp != typeid(AtomicStructureAdapter) &&
+            tp != typeid(PeriodicStructureAdapter))
+    {
+        const char* emsg = "Site updates require AtomicStructureAdapter "
+            "or PeriodicStructureAdapter.";
+        throw invalid_argument(emsg);
+    }
+    if (idx < 0 || idx >= this->countSites())
+    {
+        throw invalid_argument("Site index out of range.");
+    }
+    AtomicStructureAdapter& rv =
+        static_cast<AtomicStructureAdapter&>(*mstructure);
+    return rv;
+}
+
 // Other functions -----------------------------------------------------------
 
 /// The purpose of this function is to support Python pickling of
@@ -429,6 +888,37 @@ replacePairQuantityStructure(PairQuantity& pq, StructureAdapterPtr stru)
     return rv;
 }
 
+
+string dumpPairQuantityWithoutStructure(PairQuantity& pq)
+{
+    StructureAdapterPtr stru =
+        replacePairQuantityStructure(pq, emptyStructureAdapter());
+    ostringstream storage(ios::binary);
+    try
+    {
+        diffpy::serialization::oarchive oa(storage, ios::binary);
+        PairQuantity* ppq = &pq;
+        oa << ppq;
+    }
+    catch (...)
+    {
+        replacePairQuantityStructure(pq, stru);
+        throw;
+    }
+    replacePairQuantityStructure(pq, stru);
+    return storage.str();
+}
+
+
+PairQuantityPtr loadPairQuantity(const string& pqdata)
+{
+    istringstream storage(pqdata, ios::binary);
+    diffpy::serialization::iarchive ia(storage, ios::binary);
+    PairQuantity* ppq = NULL;
+    ia >> ppq;
+    return PairQuantityPtr(ppq);
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
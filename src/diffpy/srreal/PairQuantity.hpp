@@ -14,6 +14,13 @@
 *
 * class PairQuantity -- general implementation of pair quantity calculator
 *
+*     Thread safety: calculators do not share any mutable state, so that
+*     separate instances can be used concurrently in different threads.
+*     A single calculator must not be used from several threads at once,
+*     not even through const methods that may update internal caches.
+*     The same applies to structure adapters, which are only read by
+*     the calculators, but may cache derived data in their const methods.
+*
 *****************************************************************************/
 
 #ifndef PAIRQUANTITY_HPP_INCLUDED
@@ -22,6 +29,7 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/assume_abstract.hpp>
 #include <boost/serialization/utility.hpp>
+#include <boost/cstdint.hpp>
 
 #include <diffpy/boostextensions/serialize_unordered_set.hpp>
 #include <diffpy/boostextensions/serialize_unordered_map.hpp>
@@ -35,6 +43,13 @@ namespace diffpy {
 namespace srreal {
 
 class BaseBondGenerator;
+class BondBatch;
+class Atom;
+class AtomicStructureAdapter;
+
+/// shared pointer to PairQuantity
+
+typedef boost::shared_ptr<class PairQuantity> PairQuantityPtr;
 
 class PairQuantity : public diffpy::Attributes
 {
@@ -52,9 +67,26 @@ class PairQuantity : public diffpy::Attributes
         const QuantityType& eval();
         template <class T> const QuantityType& eval(const T&);
         const QuantityType& eval(StructureAdapterPtr);
+        std::vector<QuantityType>
+            evalBatch(const std::vector<StructureAdapterPtr>&);
+        template <class Iter>
+            std::vector<QuantityType> evalBatch(Iter first, Iter last);
         const QuantityType& value() const;
         void mergeParallelData(const std::string& pdata, int ncpu);
         virtual std::string getParallelData() const;
+        // raw binary format of parallel data
+        size_t getParallelDataSize() const;
+        void writeParallelData(void* buffer, size_t size) const;
+        void mergeParallelData(const void* buffer, size_t size, int ncpu);
+        // fast updates of a single site for Monte Carlo moves
+        void moveSite(int idx, const R3::Vector& xyz);
+        void replaceSite(int idx, const Atom&);
+        void rollbackSite();
+        // trial changes that can be committed or rolled back
+        void beginTrial();
+        void commit();
+        void rollback();
+        bool inTrial() const;
 
         // configuration
         template <class T> void setStructure(const T&);
@@ -69,6 +101,10 @@ class PairQuantity : public diffpy::Attributes
         PQEvaluatorType getEvaluatorType() const;
         PQEvaluatorType getEvaluatorTypeUsed() const;
         void setupParallelRun(int cpuindex, int ncpu);
+        void setNumThreads(int nthreads);
+        int getNumThreads() const;
+        void setNeighborListSkin(double skin);
+        const double& getNeighborListSkin() const;
         void maskAllPairs(bool mask);
         void invertMask();
         void setPairMask(int i, int j, bool mask);
@@ -83,6 +119,7 @@ class PairQuantity : public diffpy::Attributes
 
         friend class PQEvaluatorBasic;
         friend class PQEvaluatorOptimized;
+        friend class PQEvaluatorThreaded;
         friend StructureAdapterPtr
             replacePairQuantityStructure(PairQuantity&, StructureAdapterPtr);
 
@@ -91,13 +128,25 @@ class PairQuantity : public diffpy::Attributes
         virtual void resetValue();
         virtual void configureBondGenerator(BaseBondGenerator&) const;
         virtual void addPairContribution(const BaseBondGenerator&, int) { }
+        virtual bool acceptsBondBatch() const  { return false; }
+        virtual void addPairContributions(const BondBatch&);
+        virtual void flushPairContributions()  { }
         virtual void executeParallelMerge(const std::string& pdata);
+        virtual size_t countParallelValues() const;
+        virtual void packParallelValues(double* pvalues) const;
+        virtual void mergeParallelValues(const double* pvalues, size_t n);
         virtual void finishValue() { }
         int countSites() const;
         // support methods for PQEvaluatorOptimized
         bool hasMask() const;
+        /// false when the value cannot be updated by adding and removing
+        /// pair contributions of the changed sites
+        virtual bool allowsFastUpdate() const  { return true; }
         virtual void stashPartialValue();
         virtual void restorePartialValue();
+        // support methods for trial changes, these copy the whole value
+        virtual void stashTrialValue();
+        virtual void restoreTrialValue();
 
         // data
         typedef boost::unordered_map<
@@ -116,9 +165,27 @@ class PairQuantity : public diffpy::Attributes
 
     private:
 
+        // data
+        /// true when the value was evaluated for the current structure
+        bool mvaluecurrent;
+        /// site index and original atom of the last site update
+        struct {
+            int index;
+            boost::shared_ptr<Atom> atom;
+        } mrollbacksite;
+        /// state saved by beginTrial
+        struct {
+            bool active;
+            eventticker::EventTicker ticker;
+            StructureAdapterPtr structure;
+            StructureAdapterPtr snapshot;
+            QuantityType value;
+        } mtrial;
+
         // methods
         void updateMaskData();
         void setPairMaskValue(int i, int j, bool mask);
+        AtomicStructureAdapter& getSiteUpdateStructure(int idx);
 
         // serialization
         friend class boost::serialization::access;
@@ -150,6 +217,18 @@ const QuantityType& PairQuantity::eval(const T& stru)
 }
 
 
+template <class Iter>
+std::vector<QuantityType> PairQuantity::evalBatch(Iter first, Iter last)
+{
+    std::vector<StructureAdapterPtr> strus;
+    for (; first != last; ++first)
+    {
+        strus.push_back(convertToStructureAdapter(*first));
+    }
+    return this->evalBatch(strus);
+}
+
+
 template <class T>
 void PairQuantity::setStructure(const T& stru)
 {
@@ -159,12 +238,32 @@ void PairQuantity::setStructure(const T& stru)
 
 // Other functions -----------------------------------------------------------
 
+/// Raw parallel data from writeParallelData start with this header,
+/// which is followed by count values of type double in native byte order.
+/// The data can be merged directly from a caller-owned buffer, for example
+/// a shared memory segment, with mergeParallelData(buffer, size, ncpu).
+struct ParallelDataHeader
+{
+    char magic[4];
+    boost::uint32_t version;
+    boost::uint32_t byteorder;
+    boost::uint32_t valuesize;
+    boost::uint64_t count;
+};
+
+
 /// The purpose of this function is to support Python pickling of
 /// PairQuantity objects that hold Python-derived StructureAdapter classes.
 /// Use it only if you absolutely have to and you know what you do.
 StructureAdapterPtr
 replacePairQuantityStructure(PairQuantity& pq, StructureAdapterPtr stru);
 
+/// Serialize PairQuantity object without its structure, which may be
+/// a Python-derived class or too large for a copy.  The object can be
+/// restored with loadPairQuantity and used in another thread.
+std::string dumpPairQuantityWithoutStructure(PairQuantity& pq);
+PairQuantityPtr loadPairQuantity(const std::string& pqdata);
+
 }   // namespace srreal
 }   // namespace diffpy
 
@@ -0,0 +1,278 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class PeakHistogram -- pair distances binned to fine grids by their peak
+*     widths that are converted to a PDF by convolution with a Gaussian.
+*
+*****************************************************************************/
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_fft_complex.h>
+
+#include <diffpy/srreal/PeakHistogram.hpp>
+#include <diffpy/srreal/PeakProfile.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Local Constants -----------------------------------------------------------
+
+namespace {
+
+const char* EMSGFFT = "Fourier Transformation failed.";
+
+// relative peak error is about PEAKHISTOGRAM_ERRORSCALE * (h / sigma)**3
+// for 3-bin spread with a third cumulant of at most 0.75 * h**3
+const double PEAKHISTOGRAM_ERRORSCALE = 0.2;
+// narrower peaks are not binned and should be added directly
+const int PEAKHISTOGRAM_MAXOVERSAMPLING = 1024;
+// number of bins when the histogram should be flushed
+const size_t PEAKHISTOGRAM_MAXBINS = 1 << 23;
+
+}   // namespace
+
+// Constructor ---------------------------------------------------------------
+
+PeakHistogram::PeakHistogram() :
+    mrlosteps(0), mrstep(1.0), mnpts(0), mbincount(0)
+{
+    this->setPrecision(0.0);
+}
+
+// Public Methods ------------------------------------------------------------
+
+void PeakHistogram::setGrid(int rlosteps, double rstep, int npts)
+{
+    assert(rstep > 0);
+    mrlosteps = rlosteps;
+    mrstep = rstep;
+    mnpts = npts;
+    this->clear();
+}
+
+
+void PeakHistogram::setPrecision(double eps)
+{
+    mprecision = eps;
+    // the kernel variance must stay positive for up to 3/4 h**2 spread
+    mstepscale = min(0.5,
+            pow(max(0.0, eps) / PEAKHISTOGRAM_ERRORSCALE, 1.0 / 3));
+    this->clear();
+}
+
+
+const double& PeakHistogram::getPrecision() const
+{
+    return mprecision;
+}
+
+
+bool PeakHistogram::add(double dist, double fwhm, double peakscale)
+{
+    if (!(fwhm > 0.0) || !(dist > 0.0) || mnpts <= 0)  return false;
+    const double sigma2 = fwhm * fwhm / (8 * M_LN2);
+    const double hmax = mstepscale * sqrt(sigma2);
+    const double m = ceil(mrstep / hmax);
+    if (!(m <= PEAKHISTOGRAM_MAXOVERSAMPLING))  return false;
+    const int oversampling = max(1, int(m));
+    const double h = mrstep / oversampling;
+    // the kernel variance is 1/4 h**2 below the group variance range
+    // [k, k + 1) * h**2 / 2, so that the 3-bin spread has variance
+    // in [1/4, 3/4) * h**2 and all spread weights are non-negative.
+    const int k = int(floor(sigma2 / (0.5 * h * h)));
+    WidthGroup& grp = mgroups[make_pair(oversampling, k)];
+    if (grp.counts.empty())
+    {
+        grp.oversampling = oversampling;
+        grp.binstep = h;
+        grp.kernelsigma2 = (k - 0.5) * 0.5 * h * h;
+    }
+    const double u = dist / h;
+    const int j0 = int(floor(u + 0.5));
+    const double t = u - j0;
+    const double v = (sigma2 - grp.kernelsigma2) / (h * h);
+    const double w = peakscale / dist;
+    this->ensureBinRange(grp, j0 - 1, j0 + 1);
+    double* pc = &grp.counts[j0 - 1 - grp.binlo];
+    pc[0] += w * 0.5 * (v + t * t - t);
+    pc[1] += w * (1.0 - v - t * t);
+    pc[2] += w * 0.5 * (v + t * t + t);
+    return true;
+}
+
+
+bool PeakHistogram::empty() const
+{
+    return mgroups.empty();
+}
+
+
+bool PeakHistogram::full() const
+{
+    return mbincount > PEAKHISTOGRAM_MAXBINS;
+}
+
+
+void PeakHistogram::clear()
+{
+    mgroups.clear();
+    mbincount = 0;
+}
+
+
+void PeakHistogram::flush(const PeakProfile& pkf, double* y)
+{
+    WidthGroupStorage::const_iterator gg = mgroups.begin();
+    for (; gg != mgroups.end(); ++gg)
+    {
+        const WidthGroup& grp = gg->second;
+        const double fwhmk = sqrt(8 * M_LN2 * grp.kernelsigma2);
+        const int nbins = grp.counts.size();
+        const int nkernel = 2 * int(ceil(
+                    pkf.xboundhi(fwhmk) / grp.binstep)) + 1;
+        // compare direct sum over the occupied bins with the cost
+        // of 3 Fourier transforms over the padded bins
+        const int nused = nbins - count(
+                grp.counts.begin(), grp.counts.end(), 0.0);
+        double directcost = double(nused) *
+            (nkernel / grp.oversampling + 1);
+        double npad = pow(2.0, ceil(log2(nbins + nkernel)));
+        double fftcost = 3 * npad * log2(npad);
+        if (directcost <= fftcost)  this->convolveDirect(grp, pkf, fwhmk, y);
+        else  this->convolveFFT(grp, pkf, fwhmk, y);
+    }
+    this->clear();
+}
+
+// Private Methods -----------------------------------------------------------
+
+void PeakHistogram::ensureBinRange(WidthGroup& grp, int jlo, int jhi)
+{
+    const int nbins = grp.counts.size();
+    const int curlo = grp.binlo;
+    const int curhi = grp.binlo + nbins - 1;
+    if (nbins && curlo <= jlo && jhi <= curhi)  return;
+    int newlo = jlo;
+    int newhi = jhi;
+    if (nbins)
+    {
+        // grow by the current size to reduce reallocations, but
+        // not much beyond the bins that contribute to the output grid
+        const int m = grp.oversampling;
+        const int gridlo = mrlosteps * m - 1;
+        const int gridhi = (mrlosteps + mnpts - 1) * m + 1;
+        newlo = min(jlo, curlo);
+        newhi = max(jhi, curhi);
+        if (jlo < curlo)  newlo = min(jlo, max(curlo - nbins, gridlo));
+        if (jhi > curhi)  newhi = max(jhi, min(curhi + nbins, gridhi));
+    }
+    QuantityType counts(newhi - newlo + 1, 0.0);
+    copy(grp.counts.begin(), grp.counts.end(),
+            counts.begin() + (nbins ? (curlo - newlo) : 0));
+    mbincount += counts.size() - nbins;
+    grp.counts.swap(counts);
+    grp.binlo = newlo;
+}
+
+
+void PeakHistogram::convolveDirect(const WidthGroup& grp,
+        const PeakProfile& pkf, double fwhmk, double* y)
+{
+    const double h = grp.binstep;
+    const double xhi = pkf.xboundhi(fwhmk);
+    const int nbins = grp.counts.size();
+    for (int p = 0; p < nbins; ++p)
+    {
+        const double w = grp.counts[p];
+        if (w == 0.0)  continue;
+        const double dist = (grp.binlo + p) * h;
+        int ilo = int(ceil((dist - xhi) / mrstep)) - mrlosteps;
+        int ihi = int(floor((dist + xhi) / mrstep)) - mrlosteps;
+        ilo = max(0, ilo);
+        ihi = min(mnpts - 1, ihi);
+        if (ilo > ihi)  continue;
+        const int n = ihi - ilo + 1;
+        if (int(mkernel.size()) < n)  mkernel.resize(n);
+        const double r0 = (mrlosteps + ilo) * mrstep;
+        pkf.sampleGrid(&mkernel[0], n, r0 - dist, mrstep, fwhmk);
+        for (int k = 0; k < n; ++k)
+        {
+            double r = r0 + k * mrstep;
+            y[ilo + k] += r * w * mkernel[k];
+        }
+    }
+}
+
+
+void PeakHistogram::convolveFFT(const WidthGroup& grp,
+        const PeakProfile& pkf, double fwhmk, double* y)
+{
+    const double h = grp.binstep;
+    const int m = grp.oversampling;
+    const int nbins = grp.counts.size();
+    const int L = int(ceil(pkf.xboundhi(fwhmk) / h));
+    // zero padding avoids any overlap of periodic images
+    const int npad = 1 << int(ceil(log2(nbins + 2 * L + 1)));
+    // complex arrays with interleaved real and imaginary parts
+    mfftdata.assign(2 * npad, 0.0);
+    for (int p = 0; p < nbins; ++p)  mfftdata[2 * p] = grp.counts[p];
+    mkernel.resize(2 * L + 1);
+    pkf.sampleGrid(&mkernel[0], 2 * L + 1, -L * h, h, fwhmk);
+    mfftkernel.assign(2 * npad, 0.0);
+    for (int l = -L; l <= L; ++l)
+    {
+        mfftkernel[2 * ((l + npad) % npad)] = mkernel[l + L];
+    }
+    int status;
+    status = gsl_fft_complex_radix2_forward(&mfftdata[0], 1, npad);
+    if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
+    status = gsl_fft_complex_radix2_forward(&mfftkernel[0], 1, npad);
+    if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
+    for (int q = 0; q < npad; ++q)
+    {
+        const double a = mfftdata[2 * q];
+        const double b = mfftdata[2 * q + 1];
+        const double c = mfftkernel[2 * q];
+        const double d = mfftkernel[2 * q + 1];
+        mfftdata[2 * q] = a * c - b * d;
+        mfftdata[2 * q + 1] = a * d + b * c;
+    }
+    status = gsl_fft_complex_radix2_inverse(&mfftdata[0], 1, npad);
+    if (status != GSL_SUCCESS)  throw invalid_argument(EMSGFFT);
+    // pick the fine bins that coincide with the output grid
+    const int jlo = grp.binlo - L;
+    const int jhi = grp.binlo + nbins - 1 + L;
+    int ilo = int(ceil(double(jlo) / m)) - mrlosteps;
+    int ihi = int(floor(double(jhi) / m)) - mrlosteps;
+    ilo = max(0, ilo);
+    ihi = min(mnpts - 1, ihi);
+    for (int i = ilo; i <= ihi; ++i)
+    {
+        const int p = (mrlosteps + i) * m - grp.binlo;
+        const double r = (mrlosteps + i) * mrstep;
+        y[i] += r * mfftdata[2 * ((p + npad) % npad)];
+    }
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
@@ -0,0 +1,113 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class PeakHistogram -- pair distances binned to fine grids by their peak
+*     widths that are converted to a PDF by convolution with a Gaussian.
+*
+*     Peaks of a similar width share the same fine grid and Gaussian kernel.
+*     Every distance is spread to 3 neighboring bins so that the binned
+*     peak has the exact position and variance.  The residual error is
+*     about 0.2 * (h / sigma)**3 of the peak maximum, where h is the bin
+*     size.  Each width group is convolved by a fast Fourier transform
+*     or by a direct sum over the occupied bins, whichever is cheaper.
+*
+*****************************************************************************/
+
+#ifndef PEAKHISTOGRAM_HPP_INCLUDED
+#define PEAKHISTOGRAM_HPP_INCLUDED
+
+#include <map>
+#include <utility>
+#include <diffpy/srreal/QuantityType.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+class PeakProfile;
+
+class PeakHistogram
+{
+    public:
+
+        // constructor
+        PeakHistogram();
+
+        // methods
+        /// configure output grid at r = (rlosteps + i) * rstep, i < npts.
+        /// This also discards all binned distances.
+        void setGrid(int rlosteps, double rstep, int npts);
+        /// set relative peak error and discard all binned distances
+        void setPrecision(double eps);
+        const double& getPrecision() const;
+        /// bin peak of a Gaussian fwhm at dist with an area peakscale.
+        /// Return false when the peak is too narrow for the binning.
+        bool add(double dist, double fwhm, double peakscale);
+        /// true when there are no binned distances
+        bool empty() const;
+        /// true when binned data take too much memory and need flushing
+        bool full() const;
+        /// discard all binned distances
+        void clear();
+        /// add RDF contributions of all binned peaks to the y array
+        /// of the output grid and clear the histogram.  The Gaussian
+        /// profile pkf sets the cutoff of the convolution kernels.
+        void flush(const PeakProfile& pkf, double* y);
+
+    private:
+
+        // types
+        struct WidthGroup
+        {
+            /// number of fine bins per one output grid step
+            int oversampling;
+            /// size of the fine bins
+            double binstep;
+            /// variance of the Gaussian convolution kernel
+            double kernelsigma2;
+            /// bin index of the first element in counts
+            int binlo;
+            /// binned peak areas divided by the pair distance
+            QuantityType counts;
+        };
+        /// groups are keyed by the oversampling and the variance
+        /// in units of half the squared bin size
+        typedef std::map<std::pair<int, int>, WidthGroup> WidthGroupStorage;
+
+        // data
+        double mprecision;
+        /// upper bound of the bin size relative to the peak sigma
+        double mstepscale;
+        int mrlosteps;
+        double mrstep;
+        int mnpts;
+        WidthGroupStorage mgroups;
+        size_t mbincount;
+        // temporary buffers for the flush method
+        QuantityType mkernel;
+        QuantityType mfftdata;
+        QuantityType mfftkernel;
+
+        // methods
+        void ensureBinRange(WidthGroup& grp, int jlo, int jhi);
+        void convolveDirect(const WidthGroup& grp,
+                const PeakProfile& pkf, double fwhmk, double* y);
+        void convolveFFT(const WidthGroup& grp,
+                const PeakProfile& pkf, double fwhmk, double* y);
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // PEAKHISTOGRAM_HPP_INCLUDED
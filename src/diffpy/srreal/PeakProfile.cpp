@@ -55,6 +55,36 @@ const double& PeakProfile::getPrecision() const
     return mprecision;
 }
 
+
+void PeakProfile::sampleGrid(double* y, int npts,
+        double x0, double dx, double fwhm) const
+{
+    const PeakProfile& pkf = *this;
+    for (int k = 0; k < npts; ++k)  y[k] = pkf(x0 + k * dx, fwhm);
+}
+
+
+/// Central difference approximation, overload for an exact derivative.
+double PeakProfile::xderivative(double x, double fwhm) const
+{
+    if (fwhm <= 0)  return 0.0;
+    const PeakProfile& pkf = *this;
+    const double h = 1e-5 * fwhm;
+    double rv = (pkf(x + h, fwhm) - pkf(x - h, fwhm)) / (2 * h);
+    return rv;
+}
+
+
+/// Derivative for a profile of the form f(x / fwhm) / fwhm, which holds
+/// for all profiles with a constant shape.  Overload for other profiles.
+double PeakProfile::fwhmderivative(double x, double fwhm) const
+{
+    if (fwhm <= 0)  return 0.0;
+    const PeakProfile& pkf = *this;
+    double rv = -(pkf(x, fwhm) + x * this->xderivative(x, fwhm)) / fwhm;
+    return rv;
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
@@ -47,6 +47,13 @@ class PeakProfile :
         virtual double operator()(double x, double fwhm) const = 0;
         virtual double xboundlo(double fwhm) const = 0;
         virtual double xboundhi(double fwhm) const = 0;
+        /// fill y[k] with the profile value at x0 + k * dx, k < npts
+        virtual void sampleGrid(double* y, int npts,
+                double x0, double dx, double fwhm) const;
+        /// derivative of the profile with respect to x
+        virtual double xderivative(double x, double fwhm) const;
+        /// derivative of the profile with respect to fwhm
+        virtual double fwhmderivative(double x, double fwhm) const;
         virtual void setPrecision(double eps);
         const double& getPrecision() const;
         virtual eventticker::EventTicker& ticker() const  { return mticker; }
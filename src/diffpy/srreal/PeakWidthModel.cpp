@@ -16,6 +16,7 @@
 *
 *****************************************************************************/
 
+#include <stdexcept>
 #include <boost/serialization/export.hpp>
 
 #include <diffpy/srreal/PeakWidthModel.hpp>
@@ -33,6 +34,45 @@ template class HasClassRegistry<srreal::PeakWidthModel>;
 
 namespace srreal {
 
+// class PeakWidthModel ------------------------------------------------------
+
+/// Calculate peak widths for all bonds in the batch.  This must be
+/// overloaded in classes that return true from hasBatchCalculate.
+void PeakWidthModel::calculateBatch(const BondBatch&, double* fwhm) const
+{
+    const char* emsg =
+        "calculateBatch() is not defined in the peak width class.";
+    throw std::logic_error(emsg);
+}
+
+
+/// Calculate derivatives of the peak width for the current bond.
+/// This must be overloaded in classes that return true from hasGradient.
+void PeakWidthModel::calculateGradient(
+        const BaseBondGenerator&, double* dfwhm) const
+{
+    const char* emsg =
+        "calculateGradient() is not defined in the peak width class.";
+    throw std::logic_error(emsg);
+}
+
+
+std::vector<std::string> PeakWidthModel::namesOfGradientAttributes() const
+{
+    return std::vector<std::string>();
+}
+
+
+/// Calculate derivatives of the peak width with respect to its attributes.
+/// This must be overloaded in classes that define namesOfGradientAttributes.
+void PeakWidthModel::calculateAttributeGradient(
+        const BaseBondGenerator&, double* dfwhm) const
+{
+    const char* emsg = "calculateAttributeGradient() is not defined "
+        "in the peak width class.";
+    throw std::logic_error(emsg);
+}
+
 // class PeakWidthModelOwner -------------------------------------------------
 
 void PeakWidthModelOwner::setPeakWidthModel(PeakWidthModelPtr pwm)
@@ -25,6 +25,8 @@
 #ifndef PEAKWIDTHMODEL_HPP_INCLUDED
 #define PEAKWIDTHMODEL_HPP_INCLUDED
 
+#include <string>
+#include <vector>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/split_free.hpp>
@@ -33,6 +35,7 @@
 #include <diffpy/HasClassRegistry.hpp>
 #include <diffpy/EventTicker.hpp>
 #include <diffpy/srreal/BaseBondGenerator.hpp>
+#include <diffpy/srreal/BondBatch.hpp>
 
 namespace diffpy {
 namespace srreal {
@@ -48,6 +51,23 @@ class PeakWidthModel :
         virtual double maxWidth(StructureAdapterPtr,
                 double rmin, double rmax) const = 0;
         virtual eventticker::EventTicker& ticker() const  { return mticker; }
+        // batch evaluation of peak widths
+        virtual bool hasBatchCalculate() const  { return false; }
+        virtual void calculateBatch(const BondBatch&, double* fwhm) const;
+        // derivatives of the peak width
+        virtual bool hasGradient() const  { return false; }
+        /// set dfwhm[0] to the derivative of the peak width with respect
+        /// to the bond mean square displacement and dfwhm[1] to its
+        /// derivative with respect to the bond distance
+        virtual void calculateGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
+        /// names of double attributes that are differentiated by
+        /// calculateAttributeGradient
+        virtual std::vector<std::string> namesOfGradientAttributes() const;
+        /// set dfwhm[i] to the derivative of the peak width with respect
+        /// to the i-th attribute from namesOfGradientAttributes
+        virtual void calculateAttributeGradient(
+                const BaseBondGenerator&, double* dfwhm) const;
 
     protected:
 
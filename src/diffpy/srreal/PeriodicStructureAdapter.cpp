@@ -20,11 +20,13 @@
 *****************************************************************************/
 
 #include <cassert>
+#include <algorithm>
 
 #include <diffpy/serialization.ipp>
 #include <diffpy/srreal/PointsInSphere.hpp>
 #include <diffpy/srreal/StructureDifference.hpp>
 #include <diffpy/srreal/PeriodicStructureAdapter.hpp>
+#include <diffpy/srreal/CellListBondGenerator.hpp>
 
 using namespace std;
 
@@ -131,6 +133,20 @@ bool operator!=(
 // class PeriodicStructureBondGenerator
 //////////////////////////////////////////////////////////////////////////////
 
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+typedef PeriodicStructureBondGenerator::BondCandidate BondCandidate;
+
+bool translationOuterOrder(const BondCandidate& bc0, const BondCandidate& bc1)
+{
+    if (bc0.tidx != bc1.tidx)  return bc0.tidx < bc1.tidx;
+    return bc0.selpos < bc1.selpos;
+}
+
+}   // namespace
+
 // Constructor ---------------------------------------------------------------
 
 PeriodicStructureBondGenerator::PeriodicStructureBondGenerator(
@@ -148,6 +164,8 @@ PeriodicStructureBondGenerator::PeriodicStructureBondGenerator(
         xyzc = L.ucvCartesian(ai->xyz_cartn);
         mcartesian_positions_uc.push_back(xyzc);
     }
+    mcellsearch = false;
+    mcellsearch_dirty = true;
 }
 
 // Public Methods ------------------------------------------------------------
@@ -163,6 +181,16 @@ void PeriodicStructureBondGenerator::rewind()
         double rsphmin = this->getRmin() - buffzone;
         double rsphmax = this->getRmax() + buffzone;
         msphere.reset(new PointsInSphere(rsphmin, rsphmax, L));
+        mcellsearch_dirty = true;
+    }
+    if (mcellsearch_dirty)  this->updateCellSearch();
+    if (mcellsearch)
+    {
+        this->collectBondCandidates();
+        mcandidate = mcandidates.begin();
+        this->jumpToCandidate();
+        this->advanceWhileInvalid();
+        return;
     }
     // BaseBondGenerator::rewind calls this->rewindSymmetry,
     // which takes care of msphere configuration
@@ -215,6 +243,12 @@ void PeriodicStructureBondGenerator::rewindSymmetry()
 
 void PeriodicStructureBondGenerator::getNextBond()
 {
+    if (mcellsearch)
+    {
+        ++mcandidate;
+        this->jumpToCandidate();
+        return;
+    }
     ++msite_current;
     // go back to the first site if there is next symmetry element
     if (msite_current >= msite_last && this->iterateSymmetry())
@@ -225,7 +259,6 @@ void PeriodicStructureBondGenerator::getNextBond()
     if (!this->finished())  this->updater1();
 }
 
-// Private Methods -----------------------------------------------------------
 
 void PeriodicStructureBondGenerator::updater1()
 {
@@ -233,6 +266,107 @@ void PeriodicStructureBondGenerator::updater1()
     this->updateDistance();
 }
 
+// support for the cell grid search
+
+int PeriodicStructureBondGenerator::countSymmetryPositions(int siteidx)
+{
+    return 1;
+}
+
+
+const R3::Vector&
+PeriodicStructureBondGenerator::symmetryPosition(int siteidx, int symidx)
+{
+    assert(symidx == 0);
+    return mcartesian_positions_uc[siteidx];
+}
+
+
+/// Sort bond candidates to the order of the sphere sweep,
+/// where the loop over lattice translations is outside.
+void PeriodicStructureBondGenerator::sortBondCandidates()
+{
+    sort(mcandidates.begin(), mcandidates.end(), translationOuterOrder);
+}
+
+// Private Methods -----------------------------------------------------------
+
+/// Set up the cell grid search.  The grid pays off only for large unit
+/// cells, where most of the sphere sweep bonds are out of range.
+void PeriodicStructureBondGenerator::updateCellSearch()
+{
+    mcellsearch_dirty = false;
+    const int cntsites = mpstructure->countSites();
+    std::vector<R3::Vector> positions;
+    msymsite.clear();
+    msymstart.assign(1, 0);
+    for (int i = 0; i < cntsites; ++i)
+    {
+        const int nsym = this->countSymmetryPositions(i);
+        for (int k = 0; k < nsym; ++k)
+        {
+            positions.push_back(this->symmetryPosition(i, k));
+            msymsite.push_back(i);
+        }
+        msymstart.push_back(positions.size());
+    }
+    const Lattice& L = mpstructure->getLattice();
+    mcellsearch = (int(positions.size()) >= CELLLIST_MINIMUM_SITES) &&
+        (this->getRmax() < L.ucMaxDiagonalLength());
+    mtranslations.clear();
+    if (!mcellsearch)  return;
+    msympositions.build(positions, this->getRmax());
+    for (msphere->rewind(); !msphere->finished(); msphere->next())
+    {
+        mtranslations.push_back(L.cartesian(msphere->mno()));
+    }
+}
+
+
+void PeriodicStructureBondGenerator::collectBondCandidates()
+{
+    mcandidates.clear();
+    if (msite_first == msite_last)  return;
+    const double& rmax = this->getRmax();
+    BondCandidate bc;
+    const int ntrans = mtranslations.size();
+    for (bc.tidx = 0; bc.tidx < ntrans; ++bc.tidx)
+    {
+        R3::Vector center = mr0 - mtranslations[bc.tidx];
+        mnearpoints.clear();
+        msympositions.appendNearPoints(center, rmax, mnearpoints);
+        SiteIndices::const_iterator kk = mnearpoints.begin();
+        for (; kk != mnearpoints.end(); ++kk)
+        {
+            const int site = msymsite[*kk];
+            bc.symidx = *kk - msymstart[site];
+            mpositions.clear();
+            this->appendSelectionPositions(site, mpositions);
+            SiteIndices::const_iterator pp = mpositions.begin();
+            for (; pp != mpositions.end(); ++pp)
+            {
+                bc.selpos = *pp;
+                mcandidates.push_back(bc);
+            }
+        }
+    }
+    this->sortBondCandidates();
+}
+
+
+void PeriodicStructureBondGenerator::jumpToCandidate()
+{
+    if (mcandidate == mcandidates.end())
+    {
+        msite_current = msite_last;
+        return;
+    }
+    msite_current = msite_first + mcandidate->selpos;
+    this->selectSymmetryPosition(mcandidate->symidx);
+    mrcsphere = mtranslations[mcandidate->tidx];
+    this->updater1();
+}
+
 }   // namespace srreal
 }   // namespace diffpy
 
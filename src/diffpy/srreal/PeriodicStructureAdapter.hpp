@@ -26,6 +26,7 @@
 
 #include <diffpy/srreal/AtomicStructureAdapter.hpp>
 #include <diffpy/srreal/Lattice.hpp>
+#include <diffpy/srreal/CellGrid.hpp>
 
 namespace diffpy {
 namespace srreal {
@@ -78,6 +79,16 @@ class PeriodicStructureBondGenerator : public BaseBondGenerator
 {
     public:
 
+        // types
+        /// bond to a symmetry position of a selected site
+        /// translated by a lattice vector
+        struct BondCandidate
+        {
+            int selpos;
+            int symidx;
+            int tidx;
+        };
+
         // constructors
         PeriodicStructureBondGenerator(StructureAdapterConstPtr);
 
@@ -96,17 +107,38 @@ class PeriodicStructureBondGenerator : public BaseBondGenerator
         const PeriodicStructureAdapter* mpstructure;
         boost::scoped_ptr<PointsInSphere> msphere;
         R3::Vector mrcsphere;
+        /// visit only bonds found from the cell grid of symmetry positions
+        bool mcellsearch;
+        std::vector<BondCandidate> mcandidates;
 
         // methods
         virtual bool iterateSymmetry();
         virtual void rewindSymmetry();
         virtual void getNextBond();
         virtual void updater1();
+        // support for the cell grid search
+        virtual int countSymmetryPositions(int siteidx);
+        virtual const R3::Vector& symmetryPosition(int siteidx, int symidx);
+        virtual void selectSymmetryPosition(int symidx)  { }
+        virtual void sortBondCandidates();
 
     private:
 
         // data
         std::vector<R3::Vector> mcartesian_positions_uc;
+        bool mcellsearch_dirty;
+        CellGrid msympositions;
+        SiteIndices msymsite;
+        SiteIndices msymstart;
+        std::vector<R3::Vector> mtranslations;
+        std::vector<BondCandidate>::const_iterator mcandidate;
+        SiteIndices mnearpoints;
+        SiteIndices mpositions;
+
+        // methods
+        void updateCellSearch();
+        void collectBondCandidates();
+        void jumpToCandidate();
 };
 
 }   // namespace srreal
@@ -67,6 +67,20 @@ double QResolutionEnvelope::operator()(const double& r) const
 }
 
 
+double QResolutionEnvelope::attributeDerivative(
+        const double& r, const string& name) const
+{
+    if (name != "qdamp")
+    {
+        return this->PDFEnvelope::attributeDerivative(r, name);
+    }
+    double rv = (mqdamp > 0.0) ?
+        (-r * r * mqdamp * exp(-pow(r * mqdamp, 2) / 2)) :
+        0.0;
+    return rv;
+}
+
+
 void QResolutionEnvelope::setQdamp(double sc)
 {
     mqdamp = sc;
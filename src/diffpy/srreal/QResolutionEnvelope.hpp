@@ -40,6 +40,8 @@ class QResolutionEnvelope : public PDFEnvelope
 
         virtual const std::string& type() const;
         virtual double operator()(const double& r) const;
+        virtual double attributeDerivative(
+                const double& r, const std::string& name) const;
         void setQdamp(double sc);
         const double& getQdamp() const;
 
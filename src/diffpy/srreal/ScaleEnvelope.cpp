@@ -62,6 +62,14 @@ double ScaleEnvelope::operator()(const double& r) const
 }
 
 
+double ScaleEnvelope::attributeDerivative(
+        const double& r, const string& name) const
+{
+    if (name == "scale")  return 1.0;
+    return this->PDFEnvelope::attributeDerivative(r, name);
+}
+
+
 void ScaleEnvelope::setScale(double sc)
 {
     mscale = sc;
@@ -39,6 +39,8 @@ class ScaleEnvelope : public PDFEnvelope
         // methods
         const std::string& type() const;
         double operator()(const double& r) const;
+        double attributeDerivative(
+                const double& r, const std::string& name) const;
         void setScale(double sc);
         const double& getScale() const;
 
@@ -0,0 +1,92 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class SineTransform -- abstract base class for the discrete sine
+*     transformation of real data used in fftgtof and fftftog.
+*
+*****************************************************************************/
+
+#include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <diffpy/srreal/SineTransform.hpp>
+#include <diffpy/HasClassRegistry.ipp>
+
+using namespace std;
+
+namespace diffpy {
+
+// Unique instantiation of the template registry base class.
+template class HasClassRegistry<srreal::SineTransform>;
+
+namespace srreal {
+
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+/// Default backend type, automatic choice when empty.
+string& defaulttype()
+{
+    static string rv;
+    return rv;
+}
+
+/// lock for the default type, which may be read from several threads
+boost::mutex& defaulttype_mutex()
+{
+    static boost::mutex m;
+    return m;
+}
+
+}   // namespace
+
+// Public Methods ------------------------------------------------------------
+
+SineTransform& SineTransform::getThreadDefault()
+{
+    static boost::thread_specific_ptr<SineTransformPtr> tsp;
+    const string tp = SineTransform::getDefaultType();
+    if (!tsp.get() || (*tsp)->type() != tp)
+    {
+        tsp.reset(new SineTransformPtr(SineTransform::createByType(tp)));
+    }
+    return **tsp;
+}
+
+
+void SineTransform::setDefaultType(const string& tp)
+{
+    // make sure the type is valid
+    if (!tp.empty())  SineTransform::createByType(tp);
+    boost::mutex::scoped_lock lock(defaulttype_mutex());
+    defaulttype() = tp;
+}
+
+
+string SineTransform::getDefaultType()
+{
+    {
+        boost::mutex::scoped_lock lock(defaulttype_mutex());
+        if (!defaulttype().empty())  return defaulttype();
+    }
+    bool hasfftw = SineTransform::getRegisteredTypes().count("fftw");
+    string rv = hasfftw ? "fftw" : "gsl";
+    return rv;
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
@@ -0,0 +1,61 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class SineTransform -- abstract base class for the discrete sine
+*     transformation of real data used in fftgtof and fftftog.
+*
+*     Concrete backends keep plans and work buffers for every array size
+*     they have transformed.  They are therefore not safe for concurrent
+*     use and each thread should use its own instance, such as the one
+*     returned from SineTransform::getThreadDefault().
+*
+*****************************************************************************/
+
+#ifndef SINETRANSFORM_HPP_INCLUDED
+#define SINETRANSFORM_HPP_INCLUDED
+
+#include <string>
+#include <diffpy/HasClassRegistry.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+/// @class SineTransform
+/// @brief abstract base class for discrete sine transformation backends
+
+class SineTransform : public HasClassRegistry<SineTransform>
+{
+    public:
+
+        // methods
+        /// replace y[k] for k < n with sum(y[j] * sin(pi * j * k / n)),
+        /// where j runs from 1 to n - 1.  y[0] is ignored and set to 0.
+        virtual void transform(double* y, int n) = 0;
+
+        /// backend instance of the default type for the calling thread
+        static SineTransform& getThreadDefault();
+        /// set type of the default backend, empty string for automatic
+        /// choice that prefers "fftw" when available.  This should be
+        /// called before any concurrent use of getThreadDefault.
+        static void setDefaultType(const std::string& tp);
+        /// type of the default backend
+        static std::string getDefaultType();
+};
+
+typedef SineTransform::SharedPtr SineTransformPtr;
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // SINETRANSFORM_HPP_INCLUDED
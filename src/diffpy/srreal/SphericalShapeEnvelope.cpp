@@ -69,6 +69,20 @@ double SphericalShapeEnvelope::operator()(const double& r) const
 }
 
 
+double SphericalShapeEnvelope::attributeDerivative(
+        const double& r, const string& name) const
+{
+    if (name != "spdiameter")
+    {
+        return this->PDFEnvelope::attributeDerivative(r, name);
+    }
+    if (mspdiameter <= 0.0 || r > mspdiameter)  return 0.0;
+    double rdratio = r / mspdiameter;
+    double rv = 1.5 * rdratio * (1.0 - pow(rdratio, 2)) / mspdiameter;
+    return rv;
+}
+
+
 void SphericalShapeEnvelope::setSPDiameter(double spd)
 {
     mspdiameter = spd;
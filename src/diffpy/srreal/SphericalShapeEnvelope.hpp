@@ -42,6 +42,8 @@ class SphericalShapeEnvelope : public PDFEnvelope
 
         virtual const std::string& type() const;
         virtual double operator()(const double& r) const;
+        virtual double attributeDerivative(
+                const double& r, const std::string& name) const;
         void setSPDiameter(double spd);
         const double& getSPDiameter() const;
 
@@ -63,6 +63,15 @@ double StepCutEnvelope::operator()(const double& r) const
 }
 
 
+/// The step function has zero derivative except at the cutoff.
+double StepCutEnvelope::attributeDerivative(
+        const double& r, const string& name) const
+{
+    if (name == "stepcut")  return 0.0;
+    return this->PDFEnvelope::attributeDerivative(r, name);
+}
+
+
 void StepCutEnvelope::setStepCut(double sc)
 {
     mstepcut = sc;
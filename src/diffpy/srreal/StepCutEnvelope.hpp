@@ -41,6 +41,8 @@ class StepCutEnvelope : public PDFEnvelope
 
         virtual const std::string& type() const;
         virtual double operator()(const double& r) const;
+        virtual double attributeDerivative(
+                const double& r, const std::string& name) const;
         void setStepCut(double sc);
         const double& getStepCut() const;
 
@@ -37,7 +37,7 @@ class StructureDifference {
 
         // enumeration type for difference methods
         struct Method {
-            enum Type {NONE, SIDEBYSIDE, SORTED};
+            enum Type {NONE, SIDEBYSIDE, SORTED, JOURNAL};
         };
 
         // data
@@ -0,0 +1,220 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class TypePairPartials -- storage of partial values for the pairs
+*     of atom types, which are summed in the same bond traversal as
+*     the total value.
+*
+*****************************************************************************/
+
+#include <cassert>
+#include <algorithm>
+
+#include <diffpy/srreal/TypePairPartials.hpp>
+#include <diffpy/srreal/StructureAdapter.hpp>
+
+using namespace std;
+
+namespace diffpy {
+namespace srreal {
+
+// Local Helpers -------------------------------------------------------------
+
+namespace {
+
+/// index of name in the sorted types or -1 when not present
+int typeIndex(const vector<string>& types, const string& name)
+{
+    vector<string>::const_iterator ii;
+    ii = lower_bound(types.begin(), types.end(), name);
+    bool found = (ii != types.end() && *ii == name);
+    return found ? int(ii - types.begin()) : -1;
+}
+
+}   // namespace
+
+// Constructor ---------------------------------------------------------------
+
+TypePairPartials::TypePairPartials() : mnpts(0)
+{
+    mstashed.npts = 0;
+}
+
+// Public Methods ------------------------------------------------------------
+
+void TypePairPartials::reset(const StructureAdapter& stru, int npts)
+{
+    const int cntsites = stru.countSites();
+    mtypes.clear();
+    for (int i = 0; i < cntsites; ++i)
+    {
+        mtypes.push_back(stru.siteAtomType(i));
+    }
+    sort(mtypes.begin(), mtypes.end());
+    mtypes.erase(unique(mtypes.begin(), mtypes.end()), mtypes.end());
+    mtypeofsite.resize(cntsites);
+    for (int i = 0; i < cntsites; ++i)
+    {
+        mtypeofsite[i] = typeIndex(mtypes, stru.siteAtomType(i));
+        assert(mtypeofsite[i] >= 0);
+    }
+    mnpts = npts;
+    mvalues.assign(this->countTypePairs() * mnpts, 0.0);
+}
+
+
+void TypePairPartials::clear()
+{
+    mtypes.clear();
+    mtypeofsite.clear();
+    mnpts = 0;
+    mvalues.clear();
+}
+
+
+bool TypePairPartials::empty() const
+{
+    return mtypes.empty();
+}
+
+
+int TypePairPartials::countTypes() const
+{
+    return mtypes.size();
+}
+
+
+int TypePairPartials::countTypePairs() const
+{
+    const int k = this->countTypes();
+    return k * (k + 1) / 2;
+}
+
+
+int TypePairPartials::countPoints() const
+{
+    return mnpts;
+}
+
+
+const vector<string>& TypePairPartials::getTypes() const
+{
+    return mtypes;
+}
+
+
+vector< pair<string, string> > TypePairPartials::getTypePairs() const
+{
+    vector< pair<string, string> > rv;
+    rv.reserve(this->countTypePairs());
+    const int k = this->countTypes();
+    for (int i = 0; i < k; ++i)
+    {
+        for (int j = i; j < k; ++j)
+        {
+            rv.push_back(make_pair(mtypes[i], mtypes[j]));
+        }
+    }
+    return rv;
+}
+
+
+int TypePairPartials::typeIndexOfSite(int siteidx) const
+{
+    assert(0 <= siteidx && siteidx < int(mtypeofsite.size()));
+    return mtypeofsite[siteidx];
+}
+
+
+int TypePairPartials::pairIndexOfSites(int site0, int site1) const
+{
+    assert(0 <= site0 && site0 < int(mtypeofsite.size()));
+    assert(0 <= site1 && site1 < int(mtypeofsite.size()));
+    return this->pairIndexOfTypes(mtypeofsite[site0], mtypeofsite[site1]);
+}
+
+
+int TypePairPartials::pairIndexOfTypes(int tp0, int tp1) const
+{
+    if (tp0 > tp1)  swap(tp0, tp1);
+    const int k = this->countTypes();
+    assert(0 <= tp0 && tp1 < k);
+    return tp0 * (2 * k - tp0 - 1) / 2 + tp1;
+}
+
+
+double* TypePairPartials::at(int p)
+{
+    assert(0 <= p && p < this->countTypePairs());
+    return &mvalues[p * mnpts];
+}
+
+
+const double* TypePairPartials::at(int p) const
+{
+    assert(0 <= p && p < this->countTypePairs());
+    return &mvalues[p * mnpts];
+}
+
+
+QuantityType& TypePairPartials::values()
+{
+    return mvalues;
+}
+
+
+const QuantityType& TypePairPartials::values() const
+{
+    return mvalues;
+}
+
+
+void TypePairPartials::stash()
+{
+    mstashed.types = mtypes;
+    mstashed.npts = mnpts;
+    mstashed.values = mvalues;
+}
+
+
+void TypePairPartials::restore(int leftshift)
+{
+    const int k0 = mstashed.types.size();
+    const int& n0 = mstashed.npts;
+    // index ranges of the copied points in the stashed and new arrays
+    const int ilo = max(0, -leftshift);
+    const int ihi = min(mnpts, n0 - leftshift);
+    for (int i0 = 0; i0 < k0 && ilo < ihi; ++i0)
+    {
+        const int tp0 = typeIndex(mtypes, mstashed.types[i0]);
+        if (tp0 < 0)  continue;
+        for (int j0 = i0; j0 < k0; ++j0)
+        {
+            const int tp1 = typeIndex(mtypes, mstashed.types[j0]);
+            if (tp1 < 0)  continue;
+            const int p0 = i0 * (2 * k0 - i0 - 1) / 2 + j0;
+            const double* src = &mstashed.values[p0 * n0];
+            double* dst = this->at(this->pairIndexOfTypes(tp0, tp1));
+            for (int i = ilo; i < ihi; ++i)  dst[i] = src[i + leftshift];
+        }
+    }
+    mstashed.types.clear();
+    mstashed.npts = 0;
+    mstashed.values.clear();
+}
+
+}   // namespace srreal
+}   // namespace diffpy
+
+// End of file
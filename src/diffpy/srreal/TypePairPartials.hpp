@@ -0,0 +1,117 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class TypePairPartials -- storage of partial values for the pairs
+*     of atom types, which are summed in the same bond traversal as
+*     the total value.
+*
+*     Atom types are sorted by name and the partial arrays are ordered
+*     by the type pairs (i, j), where i <= j.  Stashed partial values
+*     are restored by the names of their atom types, which allows to
+*     update partials for a structure with different atom types.
+*
+*****************************************************************************/
+
+#ifndef TYPEPAIRPARTIALS_HPP_INCLUDED
+#define TYPEPAIRPARTIALS_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <diffpy/srreal/forwardtypes.hpp>
+#include <diffpy/srreal/QuantityType.hpp>
+
+namespace diffpy {
+namespace srreal {
+
+class StructureAdapter;
+
+class TypePairPartials
+{
+    public:
+
+        // constructor
+        TypePairPartials();
+
+        // methods
+        /// index sorted unique atom types of the structure sites and
+        /// assign zero arrays of npts points to every pair of the types
+        void reset(const StructureAdapter& stru, int npts);
+        /// remove all atom types and partial arrays
+        void clear();
+        /// true when there are no partial arrays
+        bool empty() const;
+        /// number of atom types
+        int countTypes() const;
+        /// number of the atom type pairs and of the partial arrays
+        int countTypePairs() const;
+        /// number of points in each partial array
+        int countPoints() const;
+        /// sorted unique atom types
+        const std::vector<std::string>& getTypes() const;
+        /// atom type pairs in the order of the partial arrays
+        std::vector< std::pair<std::string, std::string> >
+            getTypePairs() const;
+        /// index of the atom type of a site in getTypes
+        int typeIndexOfSite(int siteidx) const;
+        /// index of the atom type pair of two sites
+        int pairIndexOfSites(int site0, int site1) const;
+        /// index of the pair of atom types at indices tp0, tp1
+        int pairIndexOfTypes(int tp0, int tp1) const;
+        /// partial array for the type pair index p
+        double* at(int p);
+        const double* at(int p) const;
+        /// all partial arrays stored as values()[p * countPoints() + i]
+        QuantityType& values();
+        const QuantityType& values() const;
+        /// save the current partial values for the restore method
+        void stash();
+        /// copy stashed values to the arrays of the same atom type pairs,
+        /// where point i of the new array is the stashed point
+        /// i + leftshift.  Pairs of removed atom types are discarded.
+        void restore(int leftshift);
+
+    private:
+
+        // data
+        std::vector<std::string> mtypes;
+        std::vector<int> mtypeofsite;
+        int mnpts;
+        QuantityType mvalues;
+        struct {
+            std::vector<std::string> types;
+            int npts;
+            QuantityType values;
+        } mstashed;
+
+        // serialization
+        friend class boost::serialization::access;
+        template<class Archive>
+            void serialize(Archive& ar, const unsigned int version)
+        {
+            ar & mtypes;
+            ar & mtypeofsite;
+            ar & mnpts;
+            ar & mvalues;
+        }
+
+};
+
+}   // namespace srreal
+}   // namespace diffpy
+
+#endif  // TYPEPAIRPARTIALS_HPP_INCLUDED
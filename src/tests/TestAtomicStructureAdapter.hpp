@@ -23,6 +23,7 @@
 
 #include <diffpy/srreal/AtomicStructureAdapter.hpp>
 #include <diffpy/srreal/StructureDifference.hpp>
+#include <diffpy/srreal/CellListBondGenerator.hpp>
 #include "serialization_helpers.hpp"
 
 namespace diffpy {
@@ -30,6 +31,22 @@ namespace srreal {
 
 using namespace std;
 
+namespace {
+
+typedef vector< pair<int, double> > BondList;
+
+BondList generateBonds(BaseBondGenerator& bnds)
+{
+    BondList rv;
+    for (bnds.rewind(); !bnds.finished(); bnds.next())
+    {
+        rv.push_back(make_pair(bnds.site1(), bnds.distance()));
+    }
+    return rv;
+}
+
+}   // namespace
+
 //////////////////////////////////////////////////////////////////////////////
 // class TestAtomicStructureAdapter
 //////////////////////////////////////////////////////////////////////////////
@@ -108,6 +125,144 @@ class TestAtomicStructureAdapter : public CxxTest::TestSuite
         }
 
 
+        void test_diff_journal()
+        {
+            typedef StructureDifference::Method DM;
+            Atom ai;
+            ai.atomtype = "C";
+            const int SZ = 10;
+            for (int i = 0; i < SZ; ++i)
+            {
+                ai.xyz_cartn[0] = i;
+                mpstru->append(ai);
+            }
+            SiteIndices changed;
+            TS_ASSERT(!mpstru->getChangedSites(
+                        changed, mpstru->journalVersion()));
+            (*mpstru)[3].atomtype = "N";
+            StructureAdapterPtr stru0 = mstru->clone();
+            (*mpstru)[7].xyz_cartn[1] = 0.5;
+            mpstru->at(5);
+            StructureDifference sd = stru0->diff(mstru);
+            TS_ASSERT_EQUALS(DM::JOURNAL, sd.diffmethod);
+            TS_ASSERT_EQUALS(SiteIndices(1, 7), sd.pop0);
+            TS_ASSERT_EQUALS(SiteIndices(1, 7), sd.add1);
+            AtomicStructureAdapterPtr pstru0 =
+                boost::dynamic_pointer_cast<AtomicStructureAdapter>(stru0);
+            // site 3 can be still changed through a held reference
+            TS_ASSERT(mpstru->getChangedSites(
+                        changed, pstru0->journalVersion()));
+            TS_ASSERT_EQUALS(3u, changed.size());
+            TS_ASSERT_EQUALS(3, changed[0]);
+            TS_ASSERT_EQUALS(5, changed[1]);
+            TS_ASSERT_EQUALS(7, changed[2]);
+            StructureAdapterPtr stru1 = mstru->clone();
+            (*mpstru)[5].occupancy = 0.5;
+            sd = stru1->diff(mstru);
+            TS_ASSERT_EQUALS(DM::JOURNAL, sd.diffmethod);
+            TS_ASSERT_EQUALS(SiteIndices(1, 5), sd.add1);
+            // unrelated structure and reordered sites are compared in full
+            sd = stru1->diff(stru0);
+            TS_ASSERT_EQUALS(DM::SIDEBYSIDE, sd.diffmethod);
+            mpstru->erase(0);
+            sd = stru0->diff(mstru);
+            TS_ASSERT_EQUALS(DM::SORTED, sd.diffmethod);
+            TS_ASSERT(!mpstru->getChangedSites(
+                        changed, mpstru->journalVersion()));
+        }
+
+
+        void test_copy_on_write()
+        {
+            Atom ai;
+            ai.atomtype = "C";
+            const int SZ = 700;
+            vector<Atom> atoms;
+            for (int i = 0; i < SZ; ++i)
+            {
+                ai.xyz_cartn[0] = i;
+                mpstru->append(ai);
+                atoms.push_back(ai);
+            }
+            TS_ASSERT_EQUALS(SZ, mstru->countSites());
+            AtomicStructureAdapterPtr cpstru =
+                boost::make_shared<AtomicStructureAdapter>(*mpstru);
+            TS_ASSERT_EQUALS(*mpstru, *cpstru);
+            (*cpstru)[600].atomtype = "N";
+            mpstru->at(1).atomtype = "O";
+            TS_ASSERT_EQUALS("C", (*mpstru)[600].atomtype);
+            TS_ASSERT_EQUALS("C", (*cpstru)[1].atomtype);
+            StructureDifference sd = mstru->diff(cpstru);
+            TS_ASSERT_EQUALS(2u, sd.pop0.size());
+            // mutable iteration does not change the copy
+            AtomicStructureAdapter::iterator ii = mpstru->begin();
+            for (; ii != mpstru->end(); ++ii)  ii->occupancy = 0.5;
+            TS_ASSERT_EQUALS(1.0, (*cpstru)[SZ - 1].occupancy);
+            TS_ASSERT_EQUALS(0.5, mpstru->rbegin()->occupancy);
+            // insertion and removal across chunk boundaries
+            cpstru->assign(atoms.begin(), atoms.end());
+            ai.atomtype = "Si";
+            vector<Atom> extra(3, ai);
+            atoms.insert(atoms.begin() + 255, extra.begin(), extra.end());
+            cpstru->insert(cpstru->begin() + 255, extra.begin(), extra.end());
+            atoms.erase(atoms.begin() + 10, atoms.begin() + 200);
+            cpstru->erase(cpstru->begin() + 10, cpstru->begin() + 200);
+            atoms.erase(atoms.begin() + 2);
+            cpstru->erase(2);
+            TS_ASSERT_EQUALS(int(atoms.size()), cpstru->countSites());
+            const AtomicStructureAdapter& ccpstru = *cpstru;
+            TS_ASSERT(equal(atoms.begin(), atoms.end(), ccpstru.begin()));
+            TS_ASSERT(equal(atoms.rbegin(), atoms.rend(), ccpstru.rbegin()));
+        }
+
+
+        void test_copy_mutable_reference()
+        {
+            typedef StructureDifference::Method DM;
+            Atom ai;
+            ai.atomtype = "C";
+            const int SZ = 300;
+            for (int i = 0; i < SZ; ++i)
+            {
+                ai.xyz_cartn[0] = i;
+                mpstru->append(ai);
+            }
+            // reference obtained before the copy changes only the source
+            Atom& a1 = (*mpstru)[1];
+            AtomicStructureAdapterPtr cpstru =
+                boost::make_shared<AtomicStructureAdapter>(*mpstru);
+            const AtomicStructureAdapter& ccpstru = *cpstru;
+            StructureAdapterPtr stru1 = mstru->clone();
+            a1.atomtype = "N";
+            TS_ASSERT_EQUALS("C", ccpstru[1].atomtype);
+            TS_ASSERT_EQUALS("N", mstru->siteAtomType(1));
+            TS_ASSERT_EQUALS("C", stru1->siteAtomType(1));
+            StructureDifference sd = stru1->diff(mstru);
+            TS_ASSERT_EQUALS(DM::JOURNAL, sd.diffmethod);
+            TS_ASSERT_EQUALS(SiteIndices(1, 1), sd.pop0);
+            TS_ASSERT_EQUALS(SiteIndices(1, 1), sd.add1);
+            // the reference is still tracked after another copy
+            stru1 = mstru->clone();
+            a1.atomtype = "Si";
+            sd = stru1->diff(mstru);
+            TS_ASSERT_EQUALS(SiteIndices(1, 1), sd.add1);
+            // the same for mutable iterators
+            AtomicStructureAdapter::iterator ii = mpstru->begin() + 280;
+            stru1 = mstru->clone();
+            ii->occupancy = 0.5;
+            TS_ASSERT_EQUALS(1.0, stru1->siteOccupancy(280));
+            sd = stru1->diff(mstru);
+            TS_ASSERT_EQUALS(SiteIndices(1, 280), sd.add1);
+            // assignment updates atoms of the held reference
+            *mpstru = ccpstru;
+            TS_ASSERT_EQUALS("C", a1.atomtype);
+            TS_ASSERT_EQUALS(1.0, ii->occupancy);
+            a1.atomtype = "O";
+            TS_ASSERT_EQUALS("O", mstru->siteAtomType(1));
+            TS_ASSERT_EQUALS("C", ccpstru[1].atomtype);
+        }
+
+
         void test_serialization()
         {
             Atom ai;
@@ -148,6 +303,57 @@ class TestAtomicStructureAdapter : public CxxTest::TestSuite
             TS_ASSERT(!(*mpstru == *cpstru));
         }
 
+
+
+        void test_CellListBondGenerator()
+        {
+            // random packing in a 12 x 6 x 3 box
+            srand(0);
+            Atom ai;
+            ai.atomtype = "C";
+            const int SZ = 300;
+            for (int i = 0; i < SZ; ++i)
+            {
+                ai.xyz_cartn[0] = 12.0 * rand() / RAND_MAX;
+                ai.xyz_cartn[1] = 6.0 * rand() / RAND_MAX;
+                ai.xyz_cartn[2] = 3.0 * rand() / RAND_MAX;
+                mpstru->append(ai);
+            }
+            BaseBondGeneratorPtr bnds = mstru->createBondGenerator();
+            TS_ASSERT(boost::dynamic_pointer_cast<CellListBondGenerator>(bnds));
+            BaseBondGenerator bnds0(mstru);
+            SiteIndices selection;
+            for (int i = SZ - 1; i >= 0; i -= 3)  selection.push_back(i);
+            selection.push_back(SZ - 1);
+            const double rmaxvalues[] = {0.0, 1.0, 2.5, 30.0};
+            for (int k = 0; k < 4; ++k)
+            {
+                bnds->setRmin(0.5);
+                bnds->setRmax(rmaxvalues[k]);
+                bnds0.setRmin(0.5);
+                bnds0.setRmax(rmaxvalues[k]);
+                for (int i0 = 0; i0 < SZ; i0 += 7)
+                {
+                    bnds->selectAnchorSite(i0);
+                    bnds0.selectAnchorSite(i0);
+                    TS_ASSERT_EQUALS(generateBonds(bnds0),
+                            generateBonds(*bnds));
+                    bnds->selectSiteRange(i0 / 2, i0 + 1);
+                    bnds0.selectSiteRange(i0 / 2, i0 + 1);
+                    TS_ASSERT_EQUALS(generateBonds(bnds0),
+                            generateBonds(*bnds));
+                    bnds->selectSites(selection);
+                    bnds0.selectSites(selection);
+                    TS_ASSERT_EQUALS(generateBonds(bnds0),
+                            generateBonds(*bnds));
+                    bnds->selectSiteRange(0, SZ);
+                    bnds0.selectSiteRange(0, SZ);
+                }
+            }
+            BondList bl = generateBonds(*bnds);
+            TS_ASSERT(!bl.empty());
+        }
+
 };  // class TestAtomicStructureAdapter
 
 }   // namespace srreal
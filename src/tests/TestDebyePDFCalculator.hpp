@@ -173,6 +173,7 @@ class TestDebyePDFCalculator : public CxxTest::TestSuite
             mpdfc->setPeakWidthModelByType("constant");
             mpdfc->setDoubleAttr("width", 0.123);
             mpdfc->setDoubleAttr("debyeprecision", 0.00011);
+            mpdfc->setDistanceBinning(true);
             mpdfc->setScatteringFactorTableByType("electronnumber");
             mpdfc->getScatteringFactorTable()->setCustomAs("H", "H", 1.1);
             // dump it to string
@@ -187,6 +188,7 @@ class TestDebyePDFCalculator : public CxxTest::TestSuite
                     pdfc1->getPeakWidthModel()->type());
             TS_ASSERT_EQUALS(0.123, pdfc1->getDoubleAttr("width"));
             TS_ASSERT_EQUALS(0.00011, pdfc1->getDoubleAttr("debyeprecision"));
+            TS_ASSERT(pdfc1->getDistanceBinning());
             TS_ASSERT_EQUALS(string("electronnumber"),
                     pdfc1->getScatteringFactorTable()->type());
             TS_ASSERT_EQUALS(1.1,
@@ -194,6 +196,292 @@ class TestDebyePDFCalculator : public CxxTest::TestSuite
         }
 
 
+        void test_dampedSines()
+        {
+            AtomicStructureAdapterPtr stru(new AtomicStructureAdapter);
+            Atom a;
+            a.atomtype = "C";
+            stru->append(a);
+            a.xyz_cartn[0] = 2.5;
+            stru->append(a);
+            mpdfc->setQmax(40);
+            mpdfc->setDebyePrecision(0.0);
+            mpdfc->setPeakWidthModelByType("constant");
+            mpdfc->setDoubleAttr("width", 0.1);
+            mpdfc->eval(stru);
+            QuantityType qgrid = mpdfc->getQgrid();
+            QuantityType f = mpdfc->getF();
+            TS_ASSERT_EQUALS(qgrid.size(), f.size());
+            const double sigma = 0.1 / (2 * sqrt(2 * M_LN2));
+            double maxdiff = 0.0;
+            for (size_t i = 0; i < f.size(); ++i)
+            {
+                const double q = qgrid[i];
+                double f1 = exp(-0.5 * pow(sigma * q, 2)) * sin(q * 2.5) / 2.5;
+                maxdiff = max(maxdiff, fabs(f[i] - f1));
+            }
+            TS_ASSERT_LESS_THAN(maxdiff, 1e-13);
+        }
+
+
+        void test_typePairSums()
+        {
+            mpdfc->setRmax(30);
+            mpdfc->setQmax(30);
+            mpdfc->setDebyePrecision(0.0);
+            mpdfc->setPeakWidthModelByType("constant");
+            mpdfc->setDoubleAttr("width", 0.1);
+            const double sigma = 0.1 / (2 * sqrt(2 * M_LN2));
+            // mixed structure and a structure of too many site types
+            AtomicStructureAdapterPtr stru3(new AtomicStructureAdapter);
+            AtomicStructureAdapterPtr stru17(new AtomicStructureAdapter);
+            Atom a;
+            for (int i = 0; i < 17; ++i)
+            {
+                a.atomtype = "C";
+                a.occupancy = 0.5 + 0.01 * i;
+                a.xyz_cartn = R3::Vector(1.5 * i, 0.3 * sin(i), 0.0);
+                stru17->append(a);
+                if (i >= 3)  continue;
+                a.atomtype = i ? "O" : "Ni";
+                a.occupancy = 1.0;
+                stru3->append(a);
+            }
+            AtomicStructureAdapterPtr strus[2] = {stru3, stru17};
+            for (int n = 0; n < 2; ++n)
+            {
+                const AtomicStructureAdapter& stru = *(strus[n]);
+                mpdfc->eval(strus[n]);
+                QuantityType qgrid = mpdfc->getQgrid();
+                QuantityType f = mpdfc->getF();
+                TS_ASSERT_EQUALS(qgrid.size(), f.size());
+                const ScatteringFactorTable& sftb =
+                    *(mpdfc->getScatteringFactorTable());
+                double maxf = 0.0;
+                double maxdiff = 0.0;
+                for (size_t k = 1; k < f.size(); ++k)
+                {
+                    const double q = qgrid[k];
+                    double totocc = 0.0;
+                    double sfsum = 0.0;
+                    double value = 0.0;
+                    for (int i = 0; i < stru.countSites(); ++i)
+                    {
+                        const double fi = stru[i].occupancy *
+                            sftb.lookup(stru[i].atomtype, q);
+                        totocc += stru[i].occupancy;
+                        sfsum += fi;
+                        for (int j = 0; j < stru.countSites(); ++j)
+                        {
+                            if (i == j)  continue;
+                            const double fj = stru[j].occupancy *
+                                sftb.lookup(stru[j].atomtype, q);
+                            const double d = R3::distance(
+                                    stru[i].xyz_cartn, stru[j].xyz_cartn);
+                            value += fi * fj * exp(-0.5 * pow(sigma * q, 2)) *
+                                sin(q * d) / d;
+                        }
+                    }
+                    const double sfavg = sfsum / totocc;
+                    const double f1 = value / (sfavg * sfavg * totocc);
+                    maxf = max(maxf, fabs(f1));
+                    maxdiff = max(maxdiff, fabs(f[k] - f1));
+                }
+                TS_ASSERT(maxf > 0.1);
+                TS_ASSERT_LESS_THAN(maxdiff, 1e-12 * maxf);
+            }
+        }
+
+
+        void test_distanceBinning()
+        {
+            TS_ASSERT(!mpdfc->getDistanceBinning());
+            AtomicStructureAdapterPtr stru =
+                boost::make_shared<AtomicStructureAdapter>(*mstru10d1);
+            for (int i = 0; i < stru->countSites(); ++i)
+            {
+                (*stru)[i].xyz_cartn[1] = 0.1 * sin(1.7 * i);
+            }
+            mpdfc->setQmax(25);
+            DebyePDFCalculator pdfco = *mpdfc;
+            pdfco.setDistanceBinning(true);
+            pdfco.setEvaluatorType(OPTIMIZED);
+            pdfco.eval(stru);
+            // change position of 1 atom
+            stru->at(0).xyz_cartn[1] = 0.05;
+            mpdfc->eval(stru);
+            QuantityType g0 = mpdfc->getPDF();
+            mpdfc->setDistanceBinning(true);
+            TS_ASSERT(mpdfc->getDistanceBinning());
+            mpdfc->eval(stru);
+            QuantityType g1 = mpdfc->getPDF();
+            pdfco.eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfco.getEvaluatorTypeUsed());
+            QuantityType go = pdfco.getPDF();
+            TS_ASSERT_EQUALS(g0.size(), g1.size());
+            TS_ASSERT_EQUALS(g0.size(), go.size());
+            double maxg = 0.0;
+            double maxdiff1 = 0.0;
+            double maxdiffo = 0.0;
+            for (size_t i = 0; i < g0.size(); ++i)
+            {
+                maxg = max(maxg, fabs(g0[i]));
+                maxdiff1 = max(maxdiff1, fabs(g1[i] - g0[i]));
+                maxdiffo = max(maxdiffo, fabs(go[i] - g0[i]));
+            }
+            TS_ASSERT(maxdiff1 > 0.0);
+            TS_ASSERT_LESS_THAN(maxdiff1, 1e-5 * maxg);
+            TS_ASSERT_LESS_THAN(maxdiffo, 1e-5 * maxg);
+        }
+
+
+        void test_getPartialFs()
+        {
+            mpdfc->setRmax(30);
+            mpdfc->setQmax(30);
+            AtomicStructureAdapterPtr stru(new AtomicStructureAdapter);
+            Atom a;
+            a.uij_cartn = 0.005 * R3::identity();
+            const char* smbls[] = {"Ni", "O", "O", "C", "Ni", "O", "C"};
+            for (int i = 0; i < 7; ++i)
+            {
+                a.atomtype = smbls[i];
+                a.occupancy = (i % 3) ? 1.0 : 0.5;
+                a.xyz_cartn = R3::Vector(1.5 * i, 0.3 * sin(i), 0.2 * (i % 2));
+                stru->append(a);
+            }
+            TS_ASSERT(!mpdfc->getPartialsMode());
+            mpdfc->setPartialsMode(true);
+            TS_ASSERT(mpdfc->getPartialsMode());
+            DebyePDFCalculator pdfc1 = *mpdfc;
+            pdfc1.setPartialsMode(false);
+            // sine sums by type pairs, binned distances, gradient mode
+            for (int n = 0; n < 3; ++n)
+            {
+                mpdfc->setDistanceBinning(n == 1);
+                mpdfc->setGradientMode(n == 2);
+                mpdfc->eval(stru);
+                vector< pair<string, string> > tps =
+                    mpdfc->getPartialTypePairs();
+                TS_ASSERT_EQUALS(6u, tps.size());
+                TS_ASSERT_EQUALS(string("C"), tps[0].first);
+                TS_ASSERT_EQUALS(string("Ni"), tps[1].second);
+                vector<QuantityType> fp = mpdfc->getPartialFs();
+                vector<QuantityType> gp = mpdfc->getPartialPDFs();
+                QuantityType f = mpdfc->getF();
+                QuantityType g = mpdfc->getPDF();
+                TS_ASSERT_EQUALS(tps.size(), fp.size());
+                TS_ASSERT_EQUALS(tps.size(), gp.size());
+                QuantityType fsum(f.size(), 0.0);
+                QuantityType gsum(g.size(), 0.0);
+                for (size_t p = 0; p < tps.size(); ++p)
+                {
+                    for (size_t i = 0; i < f.size(); ++i)  fsum[i] += fp[p][i];
+                    for (size_t i = 0; i < g.size(); ++i)  gsum[i] += gp[p][i];
+                    // partial equals F calculated with a type mask
+                    pdfc1.setDistanceBinning(n == 1);
+                    pdfc1.setTypeMask("all", "all", false);
+                    pdfc1.setTypeMask(tps[p].first, tps[p].second, true);
+                    pdfc1.eval(stru);
+                    TS_ASSERT(allclose(pdfc1.getF(), fp[p]));
+                }
+                TS_ASSERT(allclose(f, fsum));
+                TS_ASSERT(allclose(g, gsum));
+            }
+            // fast update of the partial values
+            mpdfc->setGradientMode(false);
+            mpdfc->setEvaluatorType(OPTIMIZED);
+            mpdfc->eval(stru);
+            stru->at(2).atomtype = "Au";
+            stru->at(5).xyz_cartn[1] += 0.1;
+            mpdfc->eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, mpdfc->getEvaluatorTypeUsed());
+            DebyePDFCalculator pdfc2 = *mpdfc;
+            pdfc2.setEvaluatorType(BASIC);
+            pdfc2.eval(stru);
+            TS_ASSERT_EQUALS(10u, pdfc2.getPartialTypePairs().size());
+            TS_ASSERT_EQUALS(pdfc2.getPartialTypePairs(),
+                    mpdfc->getPartialTypePairs());
+            vector<QuantityType> fp = mpdfc->getPartialFs();
+            vector<QuantityType> fp2 = pdfc2.getPartialFs();
+            TS_ASSERT_EQUALS(fp2.size(), fp.size());
+            for (size_t p = 0; p < fp.size(); ++p)
+            {
+                TS_ASSERT(allclose(fp2[p], fp[p]));
+            }
+        }
+
+
+        void test_getPartialDebyeSums()
+        {
+            mpdfc->setRmax(30);
+            mpdfc->setQmax(30);
+            TS_ASSERT(mpdfc->getPartialDebyeSums().empty());
+            AtomicStructureAdapterPtr stru(new AtomicStructureAdapter);
+            Atom a;
+            a.uij_cartn = 0.005 * R3::identity();
+            const char* smbls[] = {"Ni", "O", "O", "C", "Ni", "O", "C"};
+            for (int i = 0; i < 7; ++i)
+            {
+                a.atomtype = smbls[i];
+                a.occupancy = (i % 3) ? 1.0 : 0.5;
+                a.xyz_cartn = R3::Vector(1.5 * i, 0.3 * sin(i), 0.2 * (i % 2));
+                stru->append(a);
+            }
+            mpdfc->setPartialsMode(true);
+            mpdfc->eval(stru);
+            const vector<QuantityType> s0 = mpdfc->getPartialDebyeSums();
+            TS_ASSERT_EQUALS(6u, s0.size());
+            // partial sums do not depend on the scattering factors
+            // or on the summation method
+            DebyePDFCalculator pdfc1 = *mpdfc;
+            pdfc1.setScatteringFactorTableByType("neutron");
+            for (int n = 0; n < 3; ++n)
+            {
+                pdfc1.setDistanceBinning(n == 1);
+                pdfc1.setGradientMode(n == 2);
+                pdfc1.eval(stru);
+                vector<QuantityType> s1 = pdfc1.getPartialDebyeSums();
+                TS_ASSERT_EQUALS(s0.size(), s1.size());
+                for (size_t p = 0; p < s0.size(); ++p)
+                {
+                    TS_ASSERT(allclose(s0[p], s1[p]));
+                }
+            }
+            // a single partial Debye sum equals F for one atom type
+            AtomicStructureAdapterPtr ni(new AtomicStructureAdapter);
+            for (int i = 0; i < 7; ++i)
+            {
+                if (stru->at(i).atomtype != "Ni")  continue;
+                ni->append(stru->at(i));
+            }
+            ni->append(ni->at(0));
+            ni->at(2).xyz_cartn[1] += 2.0;
+            mpdfc->eval(ni);
+            vector<QuantityType> sni = mpdfc->getPartialDebyeSums();
+            TS_ASSERT_EQUALS(1u, sni.size());
+            TS_ASSERT(allclose(mpdfc->getF(), sni[0]));
+            // fast update with the optimized evaluator
+            mpdfc->setEvaluatorType(OPTIMIZED);
+            mpdfc->eval(stru);
+            stru->at(2).atomtype = "Au";
+            stru->at(5).xyz_cartn[1] += 0.1;
+            mpdfc->eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, mpdfc->getEvaluatorTypeUsed());
+            DebyePDFCalculator pdfc2 = *mpdfc;
+            pdfc2.setEvaluatorType(BASIC);
+            pdfc2.eval(stru);
+            vector<QuantityType> s2 = pdfc2.getPartialDebyeSums();
+            vector<QuantityType> s3 = mpdfc->getPartialDebyeSums();
+            TS_ASSERT_EQUALS(10u, s2.size());
+            TS_ASSERT_EQUALS(s2.size(), s3.size());
+            for (size_t p = 0; p < s2.size(); ++p)
+            {
+                TS_ASSERT(allclose(s2[p], s3[p]));
+            }
+        }
+
+
         void test_DBPDF_change_atom()
         {
             mpdfc->setQmin(1.0);
@@ -338,6 +626,167 @@ class TestDebyePDFCalculator : public CxxTest::TestSuite
         }
 
 
+        void test_evalBatch()
+        {
+            vector<StructureAdapterPtr> strus;
+            strus.push_back(mstru10);
+            strus.push_back(mstru10d1);
+            strus.push_back(mstru9);
+            strus.push_back(mstru10);
+            strus.push_back(memptystru);
+            mpdfc->setNumThreads(3);
+            mpdfc->eval(mstru10r);
+            QuantityType v0 = mpdfc->value();
+            vector<QuantityType> values =
+                mpdfc->evalBatch(strus.begin(), strus.end());
+            TS_ASSERT_EQUALS(strus.size(), values.size());
+            // evalBatch does not change the calculator
+            TS_ASSERT_EQUALS(v0, mpdfc->value());
+            TS_ASSERT_EQUALS(mstru10r, mpdfc->getStructure());
+            DebyePDFCalculator dbpdfc;
+            for (size_t i = 0; i < strus.size(); ++i)
+            {
+                dbpdfc.eval(strus[i]);
+                TS_ASSERT(allclose(dbpdfc.value(), values[i]));
+            }
+            TS_ASSERT(!allclose(values[0], values[1]));
+        }
+
+
+        void test_sfcache_reuse()
+        {
+            // cached scattering factors follow the radiation type
+            mpdfc->eval(mstru10);
+            mpdfc->setScatteringFactorTableByType("neutron");
+            mpdfc->eval(mstru10d1);
+            DebyePDFCalculator dbpdfc;
+            dbpdfc.setScatteringFactorTableByType("neutron");
+            dbpdfc.eval(mstru10d1);
+            TS_ASSERT(allclose(dbpdfc.value(), mpdfc->value()));
+        }
+
+
+        void test_sfcache_occupancy()
+        {
+            // sites of the same type with different occupancies
+            AtomicStructureAdapterPtr stru2 =
+                boost::make_shared<AtomicStructureAdapter>();
+            stru2->assign(mstru10->begin(), mstru10->begin() + 2);
+            stru2->at(1).occupancy = 0.5;
+            AtomicStructureAdapterPtr stru2r =
+                boost::make_shared<AtomicStructureAdapter>();
+            stru2r->assign(stru2->rbegin(), stru2->rend());
+            DebyePDFCalculator dbpdfc;
+            mpdfc->eval(stru2);
+            dbpdfc.eval(stru2r);
+            TS_ASSERT(allclose(dbpdfc.value(), mpdfc->value()));
+            // cached arrays are not reused for a changed occupancy
+            AtomicStructureAdapterPtr stru2h =
+                boost::make_shared<AtomicStructureAdapter>(*stru2);
+            stru2h->at(0).occupancy = 0.5;
+            mpdfc->eval(stru2h);
+            dbpdfc.eval(stru2h);
+            TS_ASSERT(allclose(dbpdfc.value(), mpdfc->value()));
+            QuantityType vh = mpdfc->value();
+            mpdfc->eval(stru2);
+            dbpdfc.eval(stru2r);
+            TS_ASSERT(allclose(dbpdfc.value(), mpdfc->value()));
+            TS_ASSERT(!allclose(vh, mpdfc->value()));
+        }
+
+
+        void test_getGradients()
+        {
+            static const int uidx[6][2] =
+                {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+            const double h = 1e-6;
+            DebyePDFCalculator& pdfc = *mpdfc;
+            pdfc.setQmax(25.0);
+            pdfc.setRmax(6.0);
+            pdfc.setDebyePrecision(1e-14);
+            pdfc.setDoubleAttr("delta2", 1.5);
+            pdfc.setDoubleAttr("qbroad", 0.05);
+            AtomicStructureAdapterPtr mol(new AtomicStructureAdapter);
+            Atom a = (*mstru10)[0];
+            mol->append(a);
+            a.atomtype = "O";
+            a.xyz_cartn = R3::Vector(1.9, 0.3, -0.2);
+            a.anisotropy = true;
+            a.uij_cartn = R3::Matrix(
+                    0.011, 0.002, -0.001,
+                    0.002, 0.007, 0.0015,
+                    -0.001, 0.0015, 0.013);
+            mol->append(a);
+            a.xyz_cartn = R3::Vector(0.4, 2.1, 0.7);
+            mol->append(a);
+            pdfc.setGradientMode(true);
+            pdfc.eval(mol);
+            vector<QuantityType> fgrads = pdfc.getFGradients();
+            vector<QuantityType> ggrads = pdfc.getPDFGradients();
+            TS_ASSERT_EQUALS(size_t(3 * GRADIENT_SITE_PARAMS), fgrads.size());
+            TS_ASSERT_EQUALS(fgrads.size(), ggrads.size());
+            QuantityType f0 = pdfc.getF();
+            QuantityType g0 = pdfc.getPDF();
+            double fmax = 0.0;
+            for (size_t i = 0; i < f0.size(); ++i)
+            {
+                fmax = max(fmax, fabs(f0[i]));
+            }
+            double gmax = 0.0;
+            for (size_t i = 0; i < g0.size(); ++i)
+            {
+                gmax = max(gmax, fabs(g0[i]));
+            }
+            for (int p = 0; p < int(fgrads.size()); ++p)
+            {
+                const int k = p % GRADIENT_SITE_PARAMS;
+                // isotropic site has only the Uiso derivative
+                if (p > R3::Ndim && p < GRADIENT_SITE_PARAMS)
+                {
+                    TS_ASSERT_EQUALS(QuantityType(f0.size(), 0.0), fgrads[p]);
+                    continue;
+                }
+                QuantityType fd[2];
+                QuantityType gd[2];
+                for (int s = 0; s < 2; ++s)
+                {
+                    AtomicStructureAdapterPtr mol1(
+                            new AtomicStructureAdapter(*mol));
+                    Atom& a1 = (*mol1)[p / GRADIENT_SITE_PARAMS];
+                    const double dh = s ? -h : +h;
+                    if (k < R3::Ndim)  a1.xyz_cartn[k] += dh;
+                    else if (!a1.anisotropy)
+                    {
+                        a1.uij_cartn += dh * R3::identity();
+                    }
+                    else
+                    {
+                        const int i = uidx[k - R3::Ndim][0];
+                        const int j = uidx[k - R3::Ndim][1];
+                        a1.uij_cartn(i, j) += dh;
+                        if (i != j)  a1.uij_cartn(j, i) += dh;
+                    }
+                    pdfc.eval(mol1);
+                    fd[s] = pdfc.getF();
+                    gd[s] = pdfc.getPDF();
+                }
+                double ferr = 0.0;
+                for (size_t i = 0; i < f0.size(); ++i)
+                {
+                    double df = (fd[0][i] - fd[1][i]) / (2 * h);
+                    ferr = max(ferr, fabs(df - fgrads[p][i]));
+                }
+                TS_ASSERT_LESS_THAN(ferr, 1e-5 * fmax);
+                double gerr = 0.0;
+                for (size_t i = 0; i < g0.size(); ++i)
+                {
+                    double dg = (gd[0][i] - gd[1][i]) / (2 * h);
+                    gerr = max(gerr, fabs(dg - ggrads[p][i]));
+                }
+                TS_ASSERT_LESS_THAN(gerr, 1e-5 * gmax);
+            }
+        }
+
 };  // class TestDebyePDFCalculator
 
 // End of file
@@ -0,0 +1,139 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class TestEventTicker -- unit tests for the EventTicker class
+*
+*****************************************************************************/
+
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cxxtest/TestSuite.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <diffpy/EventTicker.hpp>
+#include <diffpy/serialization.hpp>
+
+using namespace std;
+using diffpy::eventticker::EventTicker;
+
+namespace {
+
+void click_all(vector<EventTicker>* tickers)
+{
+    vector<EventTicker>::iterator tc = tickers->begin();
+    for (; tc != tickers->end(); ++tc)  tc->click();
+}
+
+}   // namespace
+
+class TestEventTicker : public CxxTest::TestSuite
+{
+    public:
+
+        void test_click()
+        {
+            EventTicker tc0, tc1;
+            TS_ASSERT_EQUALS(tc0, tc1);
+            TS_ASSERT_EQUALS(0, tc0.value().first);
+            TS_ASSERT_EQUALS(0, tc0.value().second);
+            tc0.click();
+            TS_ASSERT_LESS_THAN(tc1, tc0);
+            TS_ASSERT_LESS_THAN(0, tc0.value().second);
+            tc1.click();
+            TS_ASSERT_LESS_THAN(tc0, tc1);
+            EventTicker::value_type v0 = tc0.value();
+            EventTicker::value_type v1 = tc1.value();
+            TS_ASSERT_EQUALS(v0.first, v1.first);
+            TS_ASSERT_EQUALS(v0.second + 1, v1.second);
+        }
+
+
+        void test_click_threads()
+        {
+            const int nthreads = 4;
+            const int nclicks = 10000;
+            vector< vector<EventTicker> > tickers(nthreads,
+                    vector<EventTicker>(nclicks));
+            EventTicker tc0, tc1;
+            tc0.click();
+            boost::thread_group threads;
+            for (int k = 0; k < nthreads; ++k)
+            {
+                threads.create_thread(boost::bind(click_all, &tickers[k]));
+            }
+            threads.join_all();
+            tc1.click();
+            // tickers of each thread are strictly increasing
+            bool ordered = true;
+            vector<EventTicker> alltickers;
+            for (int k = 0; k < nthreads; ++k)
+            {
+                const vector<EventTicker>& tks = tickers[k];
+                for (int i = 1; i < nclicks; ++i)
+                {
+                    ordered = ordered && (tks[i - 1] < tks[i]);
+                }
+                alltickers.insert(alltickers.end(), tks.begin(), tks.end());
+            }
+            TS_ASSERT(ordered);
+            // all tickers are distinct
+            sort(alltickers.begin(), alltickers.end());
+            bool distinct = true;
+            for (size_t i = 1; i < alltickers.size(); ++i)
+            {
+                distinct = distinct && (alltickers[i - 1] < alltickers[i]);
+            }
+            TS_ASSERT(distinct);
+            TS_ASSERT_LESS_THAN(tc0, alltickers.front());
+            TS_ASSERT_LESS_THAN(alltickers.back(), tc1);
+            EventTicker::value_type v0 = tc0.value();
+            EventTicker::value_type v1 = tc1.value();
+            TS_ASSERT_EQUALS(v0.first, v1.first);
+            TS_ASSERT_EQUALS(v0.second + nthreads * nclicks + 1, v1.second);
+        }
+
+
+        void test_updateFrom()
+        {
+            EventTicker tc0, tc1;
+            tc0.click();
+            tc1.updateFrom(tc0);
+            TS_ASSERT_EQUALS(tc0, tc1);
+            tc1.click();
+            tc1.updateFrom(tc0);
+            TS_ASSERT_LESS_THAN(tc0, tc1);
+        }
+
+
+        void test_serialization()
+        {
+            EventTicker tc0;
+            tc0.click();
+            stringstream storage(ios::in | ios::out | ios::binary);
+            diffpy::serialization::oarchive oa(storage, ios::binary);
+            oa << tc0;
+            diffpy::serialization::iarchive ia(storage, ios::binary);
+            EventTicker tc1;
+            ia >> tc1;
+            TS_ASSERT_EQUALS(tc0, tc1);
+            EventTicker tc2;
+            tc2.click();
+            TS_ASSERT_LESS_THAN(tc1, tc2);
+        }
+
+};  // class TestEventTicker
+
+// End of file
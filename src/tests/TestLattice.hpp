@@ -174,6 +174,24 @@ public:
         TS_ASSERT(allclose(ucv_check, ucv));
     }
 
+    void test_cartesianMatrix()
+    {
+        lattice->setLatPar(13, 17, 19, 37, 41, 47);
+        R3::Matrix U0 = R3::identity();
+        R3::Matrix U1 = R3::zeromatrix();
+        U1(0,1) = U1(1,0) = 0.2;
+        // results of repeated calls must not share storage
+        const R3::Matrix& C0 = lattice->cartesianMatrix(U0);
+        const R3::Matrix& C1 = lattice->cartesianMatrix(U1);
+        R3::Matrix U01 = U0 + U1;
+        R3::Matrix C01 = C0 + C1;
+        TS_ASSERT(allclose(C01, lattice->cartesianMatrix(U01)));
+        TS_ASSERT(allclose(U01, lattice->fractionalMatrix(C01)));
+        const R3::Matrix& A = lattice->base();
+        R3::Matrix AAinv = R3::prod(A, R3::inverse(A));
+        TS_ASSERT(allclose(R3::identity(), AAinv));
+    }
+
 };  // class TestLattice
 
 // End of file
@@ -16,18 +16,33 @@
 *
 *****************************************************************************/
 
+#include <cmath>
+#include <algorithm>
 #include <cxxtest/TestSuite.h>
 
 #include <diffpy/srreal/StructureAdapter.hpp>
 #include <diffpy/srreal/PDFCalculator.hpp>
+#include <diffpy/srreal/AtomicStructureAdapter.hpp>
+#include <diffpy/srreal/CrystalStructureAdapter.hpp>
+#include <diffpy/srreal/PeriodicStructureAdapter.hpp>
+#include <diffpy/srreal/PDFUtils.hpp>
 #include <diffpy/srreal/JeongPeakWidth.hpp>
 #include <diffpy/srreal/ConstantPeakWidth.hpp>
 #include <diffpy/srreal/QResolutionEnvelope.hpp>
 #include <diffpy/serialization.hpp>
+#include "test_helpers.hpp"
 
 using namespace std;
 using namespace diffpy::srreal;
 
+// Jeong peak width that does not provide the derivatives
+class NoGradientJeongPeakWidth : public JeongPeakWidth
+{ };
+
+//////////////////////////////////////////////////////////////////////////////
+// class TestPDFCalculator
+//////////////////////////////////////////////////////////////////////////////
+
 class TestPDFCalculator : public CxxTest::TestSuite
 {
     private:
@@ -37,6 +52,154 @@ class TestPDFCalculator : public CxxTest::TestSuite
         double meps;
         double mepsdb;
 
+        /// copy of the structure with the gradient parameter p shifted by h
+        StructureAdapterPtr shiftedParameter(
+                StructureAdapterPtr stru, int p, double h)
+        {
+            static const int uidx[6][2] =
+                {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+            StructureAdapterPtr rv = stru->clone();
+            AtomicStructureAdapter& astru =
+                static_cast<AtomicStructureAdapter&>(*rv);
+            Atom& a = astru[p / GRADIENT_SITE_PARAMS];
+            const int k = p % GRADIENT_SITE_PARAMS;
+            if (k < R3::Ndim)  a.xyz_cartn[k] += h;
+            else if (!a.anisotropy)  a.uij_cartn += h * R3::identity();
+            else
+            {
+                const int i = uidx[k - R3::Ndim][0];
+                const int j = uidx[k - R3::Ndim][1];
+                a.uij_cartn(i, j) += h;
+                if (i != j)  a.uij_cartn(j, i) += h;
+            }
+            return rv;
+        }
+
+
+        /// compare getPDFGradients with central differences of getPDF
+        void checkPDFGradients(PDFCalculator& pdfc, StructureAdapterPtr stru)
+        {
+            const bool uwidth =
+                (pdfc.getPeakWidthModel()->type() != "constant");
+            const double h = 1e-6;
+            pdfc.setGradientMode(true);
+            pdfc.eval(stru);
+            vector<QuantityType> grads = pdfc.getPDFGradients();
+            TS_ASSERT_EQUALS(size_t(GRADIENT_SITE_PARAMS * stru->countSites()),
+                    grads.size());
+            QuantityType g0 = pdfc.getPDF();
+            double gmax = 0.0;
+            for (size_t i = 0; i < g0.size(); ++i)
+            {
+                gmax = max(gmax, fabs(g0[i]));
+            }
+            TS_ASSERT_LESS_THAN(0.0, gmax);
+            for (int p = 0; p < int(grads.size()); ++p)
+            {
+                const int k = p % GRADIENT_SITE_PARAMS;
+                if (k > R3::Ndim && !stru->siteAnisotropy(
+                            p / GRADIENT_SITE_PARAMS))
+                {
+                    TS_ASSERT_EQUALS(QuantityType(g0.size(), 0.0), grads[p]);
+                    continue;
+                }
+                pdfc.eval(this->shiftedParameter(stru, p, +h));
+                QuantityType gp = pdfc.getPDF();
+                pdfc.eval(this->shiftedParameter(stru, p, -h));
+                QuantityType gm = pdfc.getPDF();
+                TS_ASSERT_EQUALS(g0.size(), grads[p].size());
+                double dgmax = 0.0;
+                double errmax = 0.0;
+                for (size_t i = 0; i < g0.size(); ++i)
+                {
+                    double dg = (gp[i] - gm[i]) / (2 * h);
+                    dgmax = max(dgmax, fabs(dg));
+                    errmax = max(errmax, fabs(dg - grads[p][i]));
+                }
+                if (k < R3::Ndim || uwidth)
+                {
+                    TS_ASSERT_LESS_THAN(1e-3 * gmax, dgmax);
+                }
+                TS_ASSERT_LESS_THAN(errmax, 1e-5 * gmax);
+            }
+            pdfc.setGradientMode(false);
+        }
+
+
+        /// copy of periodic structure with shifted lattice parameter
+        /// and the same fractional coordinates
+        StructureAdapterPtr shiftedLattice(
+                StructureAdapterPtr stru, int lidx, double h)
+        {
+            StructureAdapterPtr rv = stru->clone();
+            PeriodicStructureAdapter& pstru =
+                static_cast<PeriodicStructureAdapter&>(*rv);
+            const Lattice L = pstru.getLattice();
+            double lp[6] = {L.a(), L.b(), L.c(),
+                L.alpha(), L.beta(), L.gamma()};
+            lp[lidx] += h;
+            pstru.setLatPar(lp[0], lp[1], lp[2], lp[3], lp[4], lp[5]);
+            for (int i = 0; i < pstru.countSites(); ++i)
+            {
+                R3::Vector& xyz = pstru[i].xyz_cartn;
+                xyz = pstru.getLattice().cartesian(L.fractional(xyz));
+            }
+            return rv;
+        }
+
+
+        /// compare getPDFAttributeGradients with central differences
+        void checkPDFAttributeGradients(PDFCalculator& pdfc,
+                StructureAdapterPtr stru, const vector<string>& names)
+        {
+            const char* lpnames[6] =
+                {"a", "b", "c", "alpha", "beta", "gamma"};
+            const double h = 1e-6;
+            pdfc.setGradientAttributes(names);
+            pdfc.eval(stru);
+            vector<QuantityType> grads = pdfc.getPDFAttributeGradients();
+            TS_ASSERT_EQUALS(names.size(), grads.size());
+            QuantityType g0 = pdfc.getPDF();
+            double gmax = 0.0;
+            for (size_t i = 0; i < g0.size(); ++i)
+            {
+                gmax = max(gmax, fabs(g0[i]));
+            }
+            TS_ASSERT_LESS_THAN(0.0, gmax);
+            for (size_t a = 0; a < names.size() && a < grads.size(); ++a)
+            {
+                QuantityType gd[2];
+                int lidx = find(lpnames, lpnames + 6, names[a]) - lpnames;
+                for (int s = 0; s < 2; ++s)
+                {
+                    const double dh = s ? -h : +h;
+                    if (lidx < 6)
+                    {
+                        pdfc.eval(this->shiftedLattice(stru, lidx, dh));
+                        gd[s] = pdfc.getPDF();
+                        continue;
+                    }
+                    const double v = pdfc.getDoubleAttr(names[a]);
+                    pdfc.setDoubleAttr(names[a], v + dh);
+                    pdfc.eval(stru);
+                    gd[s] = pdfc.getPDF();
+                    pdfc.setDoubleAttr(names[a], v);
+                }
+                TS_ASSERT_EQUALS(g0.size(), grads[a].size());
+                double dgmax = 0.0;
+                double errmax = 0.0;
+                for (size_t i = 0; i < g0.size(); ++i)
+                {
+                    double dg = (gd[0][i] - gd[1][i]) / (2 * h);
+                    dgmax = max(dgmax, fabs(dg));
+                    errmax = max(errmax, fabs(dg - grads[a][i]));
+                }
+                TS_ASSERT_LESS_THAN(1e-3 * gmax, dgmax);
+                TS_ASSERT_LESS_THAN(errmax, 1e-5 * gmax);
+            }
+            pdfc.setGradientAttributes(vector<string>());
+        }
+
     public:
 
         void setUp()
@@ -226,6 +389,586 @@ class TestPDFCalculator : public CxxTest::TestSuite
         }
 
 
+        void test_setHistogramPrecision()
+        {
+            TS_ASSERT_EQUALS(0.0, mpdfc->getHistogramPrecision());
+            TS_ASSERT_THROWS(mpdfc->setHistogramPrecision(-1),
+                    invalid_argument);
+            mpdfc->setDoubleAttr("histogramprecision", 1e-5);
+            TS_ASSERT_EQUALS(1e-5, mpdfc->getHistogramPrecision());
+        }
+
+
+        void test_histogramPDF()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            mpdfc->setRmax(10);
+            const char* pwtypes[] = {"jeong", "constant"};
+            for (int k = 0; k < 2; ++k)
+            {
+                mpdfc->setPeakWidthModelByType(pwtypes[k]);
+                // use distance dependent or constant peak widths
+                if (k == 0)  mpdfc->setDoubleAttr("delta2", 2.0);
+                else  mpdfc->setDoubleAttr("width", 0.1);
+                mpdfc->setHistogramPrecision(0.0);
+                QuantityType pdf0 = mpdfc->eval(stru);
+                mpdfc->setHistogramPrecision(DEFAULT_HISTOGRAMPRECISION);
+                QuantityType pdf1 = mpdfc->eval(stru);
+                TS_ASSERT_EQUALS(pdf0.size(), pdf1.size());
+                double maxpdf = *max_element(pdf0.begin(), pdf0.end());
+                double maxdiff = 0.0;
+                for (size_t i = 0; i < pdf0.size(); ++i)
+                {
+                    maxdiff = max(maxdiff, fabs(pdf1[i] - pdf0[i]));
+                }
+                TS_ASSERT(maxdiff > 0.0);
+                TS_ASSERT_LESS_THAN(maxdiff,
+                        DEFAULT_HISTOGRAMPRECISION * maxpdf);
+            }
+            // cropped Gaussian peaks are always added directly
+            mpdfc->setPeakProfileByType("croppedgaussian");
+            mpdfc->setHistogramPrecision(0.0);
+            QuantityType pdf2 = mpdfc->eval(stru);
+            mpdfc->setHistogramPrecision(DEFAULT_HISTOGRAMPRECISION);
+            QuantityType pdf3 = mpdfc->eval(stru);
+            TS_ASSERT_EQUALS(pdf2, pdf3);
+        }
+
+
+        void test_resultsCache()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            mpdfc->setRmax(10);
+            mpdfc->setQmax(25);
+            mpdfc->eval(stru);
+            QuantityType pdf0 = mpdfc->getPDF();
+            TS_ASSERT_EQUALS(pdf0, mpdfc->getPDF());
+            // configuration changes must be reflected without eval
+            PDFCalculator pdfc1;
+            pdfc1.setRmax(10);
+            pdfc1.setQmax(25);
+            mpdfc->setDoubleAttr("scale", 2.0);
+            pdfc1.setDoubleAttr("scale", 2.0);
+            pdfc1.eval(stru);
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            mpdfc->setDoubleAttr("qdamp", 0.05);
+            pdfc1.setDoubleAttr("qdamp", 0.05);
+            pdfc1.eval(stru);
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            mpdfc->setQmin(2.0);
+            pdfc1.setQmin(2.0);
+            pdfc1.eval(stru);
+            TS_ASSERT_EQUALS(pdfc1.getF(), mpdfc->getF());
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            mpdfc->addEnvelopeByType("sphericalshape");
+            mpdfc->setDoubleAttr("spdiameter", 8.0);
+            pdfc1.addEnvelopeByType("sphericalshape");
+            pdfc1.setDoubleAttr("spdiameter", 8.0);
+            pdfc1.eval(stru);
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            // baseline slope is reset by eval of a periodic structure
+            mpdfc->setDoubleAttr("slope", -0.1);
+            pdfc1.setDoubleAttr("slope", -0.1);
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            // new value invalidates the cache
+            QuantityType pdf1 = mpdfc->getPDF();
+            StructureAdapterPtr stru1 = loadTestPeriodicStructure("NaCl.stru");
+            mpdfc->eval(stru1);
+            pdfc1.eval(stru1);
+            TS_ASSERT_DIFFERS(pdf1, mpdfc->getPDF());
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+        }
+
+
+        void test_sfcache()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            StructureAdapterPtr stru1 = loadTestPeriodicStructure("NaCl.stru");
+            mpdfc->setRmax(8);
+            // scattering factors of atom types follow the structure
+            mpdfc->eval(stru1);
+            mpdfc->eval(stru);
+            PDFCalculator pdfc1;
+            pdfc1.setRmax(8);
+            pdfc1.eval(stru);
+            TS_ASSERT_EQUALS(pdfc1.getPDF(), mpdfc->getPDF());
+            // and the changes of the scattering factor table
+            const string smbl = stru->siteAtomType(0);
+            mpdfc->getScatteringFactorTable()->setCustomAs(smbl, smbl, 5.0);
+            mpdfc->eval(stru);
+            PDFCalculator pdfc2;
+            pdfc2.setRmax(8);
+            pdfc2.getScatteringFactorTable()->setCustomAs(smbl, smbl, 5.0);
+            pdfc2.eval(stru);
+            TS_ASSERT_DIFFERS(pdfc1.getPDF(), mpdfc->getPDF());
+            TS_ASSERT_EQUALS(pdfc2.getPDF(), mpdfc->getPDF());
+        }
+
+
+        void test_getPDFarray()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("NaCl.stru");
+            mpdfc->setRmin(1);
+            mpdfc->setRmax(8);
+            mpdfc->setQmax(20);
+            mpdfc->eval(stru);
+            QuantityType y;
+            y.resize(mpdfc->getPDF().size());
+            mpdfc->getPDF(&y[0], y.size());
+            TS_ASSERT_EQUALS(mpdfc->getPDF(), y);
+            mpdfc->getRDF(&y[0], y.size());
+            TS_ASSERT_EQUALS(mpdfc->getRDF(), y);
+            mpdfc->getRDFperR(&y[0], y.size());
+            TS_ASSERT_EQUALS(mpdfc->getRDFperR(), y);
+            TS_ASSERT_THROWS(mpdfc->getPDF(&y[0], y.size() - 1),
+                    invalid_argument);
+            y.resize(mpdfc->getF().size());
+            mpdfc->getF(&y[0], y.size());
+            TS_ASSERT_EQUALS(mpdfc->getF(), y);
+            TS_ASSERT_THROWS(mpdfc->getF(&y[0], y.size() - 1),
+                    invalid_argument);
+        }
+
+
+        void test_trial()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            AtomicStructureAdapter& astru =
+                static_cast<AtomicStructureAdapter&>(*stru);
+            StructureAdapterPtr stru0 = stru->clone();
+            const AtomicStructureAdapter& astru0 =
+                static_cast<AtomicStructureAdapter&>(*stru0);
+            using diffpy::mathutils::EpsilonEqual;
+            EpsilonEqual allclose(meps);
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(8.0);
+            pdfc.setEvaluatorType(OPTIMIZED);
+            TS_ASSERT_THROWS(pdfc.beginTrial(), logic_error);
+            TS_ASSERT_THROWS(pdfc.rollback(), logic_error);
+            pdfc.eval(stru);
+            QuantityType g0 = pdfc.getPDF();
+            // rejected site move
+            pdfc.beginTrial();
+            TS_ASSERT(pdfc.inTrial());
+            R3::Vector xyz = astru[2].xyz_cartn;
+            xyz[1] += 0.2;
+            pdfc.moveSite(2, xyz);
+            TS_ASSERT(!allclose(g0, pdfc.getPDF()));
+            pdfc.rollback();
+            TS_ASSERT(!pdfc.inTrial());
+            TS_ASSERT_EQUALS(g0, pdfc.getPDF());
+            TS_ASSERT_EQUALS(astru0, astru);
+            // rejected change of the evaluated structure
+            pdfc.beginTrial();
+            astru[4].occupancy = 0.5;
+            astru[7].xyz_cartn[0] += 0.1;
+            pdfc.eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfc.getEvaluatorTypeUsed());
+            pdfc.rollback();
+            TS_ASSERT_EQUALS(g0, pdfc.getPDF());
+            TS_ASSERT_EQUALS(astru0, astru);
+            pdfc.eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfc.getEvaluatorTypeUsed());
+            TS_ASSERT(allclose(g0, pdfc.getPDF()));
+            // accepted move
+            pdfc.beginTrial();
+            pdfc.moveSite(2, xyz);
+            QuantityType g1 = pdfc.getPDF();
+            pdfc.commit();
+            TS_ASSERT_THROWS(pdfc.commit(), logic_error);
+            TS_ASSERT_EQUALS(g1, pdfc.getPDF());
+            TS_ASSERT_EQUALS(xyz, astru[2].xyz_cartn);
+            // configuration change during the trial
+            pdfc.beginTrial();
+            pdfc.moveSite(2, stru0->siteCartesianPosition(2));
+            pdfc.setRmax(7.0);
+            pdfc.rollback();
+            pdfc.setRmax(8.0);
+            pdfc.eval(stru);
+            TS_ASSERT(allclose(g1, pdfc.getPDF()));
+        }
+
+
+        void test_getPDFGradients()
+        {
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(6.0);
+            pdfc.setRstep(0.02);
+            pdfc.setDoubleAttr("peakprecision", 1e-12);
+            pdfc.setDoubleAttr("delta1", 0.2);
+            pdfc.setDoubleAttr("delta2", 1.5);
+            pdfc.setDoubleAttr("qbroad", 0.05);
+            pdfc.setDoubleAttr("qdamp", 0.03);
+            // finite molecule with isotropic and anisotropic sites
+            AtomicStructureAdapterPtr mol(new AtomicStructureAdapter);
+            Atom a;
+            a.atomtype = "Ni";
+            a.uij_cartn = 0.008 * R3::identity();
+            mol->append(a);
+            a.atomtype = "O";
+            a.xyz_cartn = R3::Vector(1.9, 0.3, -0.2);
+            a.anisotropy = true;
+            a.uij_cartn = R3::Matrix(
+                    0.011, 0.002, -0.001,
+                    0.002, 0.007, 0.0015,
+                    -0.001, 0.0015, 0.013);
+            mol->append(a);
+            a.xyz_cartn = R3::Vector(0.4, 2.1, 0.7);
+            a.anisotropy = false;
+            a.uij_cartn = 0.005 * R3::identity();
+            mol->append(a);
+            this->checkPDFGradients(pdfc, mol);
+            // crystal with sites in general positions of P 2_1/m
+            CrystalStructureAdapterPtr cr(new CrystalStructureAdapter);
+            cr->setLatPar(4.1, 4.6, 5.3, 90, 90, 90);
+            const Lattice& L = cr->getLattice();
+            Atom& a0 = (*mol)[0];
+            a0.xyz_cartn = L.cartesian(R3::Vector(0.11, 0.23, 0.31));
+            cr->append(a0);
+            Atom& a1 = (*mol)[1];
+            a1.xyz_cartn = L.cartesian(R3::Vector(0.37, 0.14, 0.62));
+            cr->append(a1);
+            R3::Matrix R = R3::identity();
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.0));
+            R(0, 0) = R(1, 1) = -1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.5));
+            R(2, 2) = -1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.0));
+            R(0, 0) = R(1, 1) = 1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.5));
+            TS_ASSERT_EQUALS(4, cr->siteMultiplicity(1));
+            this->checkPDFGradients(pdfc, cr);
+            // constant peak width does not depend on Uij
+            pdfc.setPeakWidthModelByType("constant");
+            pdfc.setDoubleAttr("width", 0.1);
+            this->checkPDFGradients(pdfc, mol);
+            // width model without derivatives is rejected before
+            // the calculator data change
+            PeakWidthModelPtr nogradpwm(new NoGradientJeongPeakWidth);
+            pdfc.setGradientMode(false);
+            pdfc.setPeakWidthModel(nogradpwm);
+            TS_ASSERT_THROWS(pdfc.setGradientMode(true), logic_error);
+            pdfc.setPeakWidthModelByType("jeong");
+            pdfc.setGradientMode(true);
+            pdfc.eval(mol);
+            QuantityType pdf0 = pdfc.getPDF();
+            vector<QuantityType> grad0 = pdfc.getPDFGradients();
+            pdfc.setPeakWidthModel(nogradpwm);
+            TS_ASSERT_THROWS(pdfc.eval(mol), logic_error);
+            TS_ASSERT_EQUALS(pdf0, pdfc.getPDF());
+            TS_ASSERT(grad0 == pdfc.getPDFGradients());
+        }
+
+
+        void test_getPDFGradients_rstep()
+        {
+            using diffpy::mathutils::EpsilonEqual;
+            EpsilonEqual allclose(meps);
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(6.0);
+            pdfc.setRstep(0.02);
+            pdfc.setDoubleAttr("qdamp", 0.03);
+            pdfc.setGradientMode(true);
+            StructureAdapterPtr cato = loadTestPeriodicStructure("CaTiO3.stru");
+            pdfc.eval(cato);
+            pdfc.getPDF();
+            // results cache must be updated for the new r-grid
+            pdfc.setRstep(0.05);
+            pdfc.eval(cato);
+            vector<QuantityType> grad = pdfc.getPDFGradients();
+            vector<QuantityType> fgrad = pdfc.getFGradients();
+            PDFCalculator pdfc1;
+            pdfc1.setRmax(6.0);
+            pdfc1.setRstep(0.05);
+            pdfc1.setDoubleAttr("qdamp", 0.03);
+            pdfc1.setGradientMode(true);
+            pdfc1.eval(cato);
+            vector<QuantityType> grad1 = pdfc1.getPDFGradients();
+            vector<QuantityType> fgrad1 = pdfc1.getFGradients();
+            TS_ASSERT_EQUALS(grad1.size(), grad.size());
+            TS_ASSERT_EQUALS(fgrad1.size(), fgrad.size());
+            for (size_t p = 0; p < grad1.size(); ++p)
+            {
+                TS_ASSERT_EQUALS(pdfc1.getRgrid().size(), grad[p].size());
+                TS_ASSERT(allclose(grad1[p], grad[p]));
+                TS_ASSERT(allclose(fgrad1[p], fgrad[p]));
+            }
+        }
+
+
+        void test_getPDFAttributeGradients()
+        {
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(6.0);
+            pdfc.setRstep(0.02);
+            pdfc.setDoubleAttr("peakprecision", 1e-12);
+            pdfc.setDoubleAttr("delta1", 0.2);
+            pdfc.setDoubleAttr("delta2", 1.5);
+            pdfc.setDoubleAttr("qbroad", 0.05);
+            pdfc.setDoubleAttr("qdamp", 0.03);
+            pdfc.setDoubleAttr("scale", 1.3);
+            pdfc.addEnvelopeByType("sphericalshape");
+            pdfc.setDoubleAttr("spdiameter", 12.0);
+            // triclinic cell with an anisotropic site
+            PeriodicStructureAdapterPtr pstru(new PeriodicStructureAdapter);
+            pstru->setLatPar(4.1, 4.6, 5.3, 84, 97, 103);
+            const Lattice& L = pstru->getLattice();
+            Atom a;
+            a.atomtype = "Ni";
+            a.xyz_cartn = L.cartesian(R3::Vector(0.11, 0.23, 0.31));
+            a.uij_cartn = 0.008 * R3::identity();
+            pstru->append(a);
+            a.atomtype = "O";
+            a.xyz_cartn = L.cartesian(R3::Vector(0.37, 0.14, 0.62));
+            a.anisotropy = true;
+            a.uij_cartn = R3::Matrix(
+                    0.011, 0.002, -0.001,
+                    0.002, 0.007, 0.0015,
+                    -0.001, 0.0015, 0.013);
+            pstru->append(a);
+            const char* pnames[] = {"delta1", "delta2", "qbroad",
+                "qdamp", "scale", "spdiameter",
+                "a", "b", "c", "alpha", "beta", "gamma"};
+            vector<string> names(pnames, pnames + 12);
+            this->checkPDFAttributeGradients(pdfc, pstru, names);
+            // crystal with lattice parameters allowed by P 2_1/m
+            CrystalStructureAdapterPtr cr(new CrystalStructureAdapter);
+            cr->setLatPar(4.1, 4.6, 5.3, 90, 90, 103);
+            cr->append((*pstru)[0]);
+            (*cr)[0].xyz_cartn =
+                cr->getLattice().cartesian(R3::Vector(0.11, 0.23, 0.31));
+            R3::Matrix R = R3::identity();
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.0));
+            R(0, 0) = R(1, 1) = -1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.5));
+            R(2, 2) = -1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.0));
+            R(0, 0) = R(1, 1) = 1;
+            cr->addSymOp(R, R3::Vector(0.0, 0.0, 0.5));
+            const char* cnames[] = {"a", "b", "c", "gamma", "delta2"};
+            this->checkPDFAttributeGradients(pdfc, cr,
+                    vector<string>(cnames, cnames + 5));
+            // site and attribute derivatives in the same evaluation
+            pdfc.setGradientMode(true);
+            pdfc.setGradientAttributes(names);
+            pdfc.eval(pstru);
+            TS_ASSERT_EQUALS(size_t(2 * GRADIENT_SITE_PARAMS),
+                    pdfc.getPDFGradients().size());
+            TS_ASSERT_EQUALS(names.size(),
+                    pdfc.getPDFAttributeGradients().size());
+            pdfc.setGradientMode(false);
+            // derivatives follow the PDF after a change of qmax
+            pdfc.getPDF();
+            pdfc.setQmax(15.0);
+            vector<QuantityType> qgrads = pdfc.getPDFAttributeGradients();
+            pdfc.getPDF();
+            TS_ASSERT(qgrads == pdfc.getPDFAttributeGradients());
+            // invalid or unsupported attributes
+            vector<string> bad(1, "invalid");
+            TS_ASSERT_THROWS(pdfc.setGradientAttributes(bad),
+                    diffpy::attributes::DoubleAttributeError);
+            bad[0] = "rmax";
+            TS_ASSERT_THROWS(pdfc.setGradientAttributes(bad),
+                    invalid_argument);
+            TS_ASSERT_EQUALS(names, pdfc.getGradientAttributes());
+            bad[0] = "a";
+            pdfc.setGradientAttributes(bad);
+            TS_ASSERT_THROWS(pdfc.eval(memptystru), invalid_argument);
+        }
+
+
+        void test_getPartialPDFs()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            AtomicStructureAdapter& astru =
+                static_cast<AtomicStructureAdapter&>(*stru);
+            using diffpy::mathutils::EpsilonEqual;
+            EpsilonEqual allclose(meps);
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(8.0);
+            pdfc.setQmax(25);
+            TS_ASSERT(!pdfc.getPartialsMode());
+            pdfc.eval(stru);
+            TS_ASSERT(pdfc.getPartialTypePairs().empty());
+            TS_ASSERT(pdfc.getPartialPDFs().empty());
+            pdfc.setPartialsMode(true);
+            pdfc.setEvaluatorType(OPTIMIZED);
+            pdfc.eval(stru);
+            QuantityType g = pdfc.getPDF();
+            vector< pair<string, string> > tps = pdfc.getPartialTypePairs();
+            TS_ASSERT_EQUALS(6u, tps.size());
+            TS_ASSERT_EQUALS(tps[0].first, tps[0].second);
+            TS_ASSERT(tps[0].second < tps[1].second);
+            vector<QuantityType> gp = pdfc.getPartialPDFs();
+            vector<QuantityType> fp = pdfc.getPartialFs();
+            TS_ASSERT_EQUALS(tps.size(), gp.size());
+            TS_ASSERT_EQUALS(tps.size(), fp.size());
+            // partials sum to the total
+            QuantityType gsum(g.size(), 0.0);
+            QuantityType f = pdfc.getF();
+            QuantityType fsum(f.size(), 0.0);
+            for (size_t p = 0; p < tps.size(); ++p)
+            {
+                for (size_t i = 0; i < g.size(); ++i)  gsum[i] += gp[p][i];
+                for (size_t i = 0; i < f.size(); ++i)  fsum[i] += fp[p][i];
+            }
+            TS_ASSERT(allclose(g, gsum));
+            TS_ASSERT(allclose(f, fsum));
+            // partials equal PDFs calculated with a type mask
+            PDFCalculator pdfc1;
+            pdfc1.setRmax(8.0);
+            pdfc1.setQmax(25);
+            for (size_t p = 0; p < tps.size(); ++p)
+            {
+                pdfc1.setTypeMask("all", "all", false);
+                pdfc1.setTypeMask(tps[p].first, tps[p].second, true);
+                pdfc1.eval(stru);
+                TS_ASSERT(allclose(pdfc1.getPDF(), gp[p]));
+            }
+            // fast update of the partials after a change of atom type
+            astru[0].atomtype = "Sr2+";
+            astru[5].xyz_cartn[1] += 0.1;
+            pdfc.eval(stru);
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfc.getEvaluatorTypeUsed());
+            TS_ASSERT_EQUALS(10u, pdfc.getPartialTypePairs().size());
+            PDFCalculator pdfc2;
+            pdfc2.setRmax(8.0);
+            pdfc2.setQmax(25);
+            pdfc2.setPartialsMode(true);
+            pdfc2.eval(stru);
+            TS_ASSERT_EQUALS(pdfc2.getPartialTypePairs(),
+                    pdfc.getPartialTypePairs());
+            gp = pdfc.getPartialPDFs();
+            vector<QuantityType> gp2 = pdfc2.getPartialPDFs();
+            TS_ASSERT_EQUALS(gp2.size(), gp.size());
+            for (size_t p = 0; p < gp.size(); ++p)
+            {
+                TS_ASSERT(allclose(gp2[p], gp[p]));
+            }
+        }
+
+
+        void test_linkedCalculators()
+        {
+            StructureAdapterPtr stru = loadTestPeriodicStructure("CaTiO3.stru");
+            AtomicStructureAdapter& astru =
+                static_cast<AtomicStructureAdapter&>(*stru);
+            using diffpy::mathutils::EpsilonEqual;
+            EpsilonEqual allclose(meps);
+            PDFCalculator& pdfc = *mpdfc;
+            pdfc.setRmax(6.0);
+            pdfc.setQmax(25);
+            pdfc.setDoubleAttr("delta2", 1.5);
+            // neutron PDF on a different grid
+            PDFCalculatorPtr pdfcn(new PDFCalculator);
+            pdfcn->setScatteringFactorTableByType("neutron");
+            pdfcn->setRmin(1.0);
+            pdfcn->setRmax(9.0);
+            pdfcn->setRstep(0.02);
+            pdfcn->setQmax(20);
+            pdfcn->setPartialsMode(true);
+            TS_ASSERT(pdfc.getLinkedCalculators().empty());
+            // linked calculator must share the peak width model
+            PeakWidthModelPtr pwmn = pdfcn->getPeakWidthModel();
+            TS_ASSERT_THROWS(pdfc.addLinkedCalculator(pdfcn), logic_error);
+            TS_ASSERT(pdfc.getLinkedCalculators().empty());
+            TS_ASSERT_EQUALS(pwmn, pdfcn->getPeakWidthModel());
+            pdfcn->setPeakWidthModel(pdfc.getPeakWidthModel());
+            // pair masks are not supported
+            pdfcn->setTypeMask("O", "O", false);
+            TS_ASSERT_THROWS(pdfc.addLinkedCalculator(pdfcn), logic_error);
+            pdfcn->setTypeMask("all", "all", true);
+            pdfc.setPairMask(0, 1, false);
+            TS_ASSERT_THROWS(pdfc.addLinkedCalculator(pdfcn), logic_error);
+            pdfc.setPairMask(0, 1, true);
+            TS_ASSERT(pdfc.getLinkedCalculators().empty());
+            pdfc.addLinkedCalculator(pdfcn);
+            TS_ASSERT_EQUALS(1u, pdfc.getLinkedCalculators().size());
+            TS_ASSERT_THROWS(pdfc.addLinkedCalculator(pdfcn),
+                    invalid_argument);
+            TS_ASSERT_THROWS(pdfc.addLinkedCalculator(mpdfc),
+                    invalid_argument);
+            TS_ASSERT_THROWS(pdfcn->addLinkedCalculator(PDFCalculatorPtr()),
+                    invalid_argument);
+            // calculator is linked only once and without nested links
+            PDFCalculatorPtr pdfc1(new PDFCalculator);
+            pdfc1->setPeakWidthModel(pdfc.getPeakWidthModel());
+            TS_ASSERT_THROWS(pdfc1->addLinkedCalculator(pdfcn),
+                    invalid_argument);
+            TS_ASSERT_THROWS(pdfcn->addLinkedCalculator(pdfc1),
+                    invalid_argument);
+            TS_ASSERT(pdfcn->getLinkedCalculators().empty());
+            // reference calculators
+            PDFCalculator pdfcx0;
+            pdfcx0.setRmax(6.0);
+            pdfcx0.setQmax(25);
+            PDFCalculator pdfcn0;
+            pdfcn0.setScatteringFactorTableByType("neutron");
+            pdfcn0.setRmin(1.0);
+            pdfcn0.setRmax(9.0);
+            pdfcn0.setRstep(0.02);
+            pdfcn0.setQmax(20);
+            pdfcn0.setPartialsMode(true);
+            pdfcx0.setDoubleAttr("delta2", 1.5);
+            pdfcn0.setDoubleAttr("delta2", 1.5);
+            const PQEvaluatorType evtps[] = {BASIC, OPTIMIZED, THREADED};
+            for (int k = 0; k < 3; ++k)
+            {
+                pdfc.setEvaluatorType(evtps[k]);
+                pdfc.setNumThreads(3);
+                pdfc.eval(stru);
+                astru[3].xyz_cartn[2] += 0.05;
+                pdfc.eval(stru);
+                TS_ASSERT_EQUALS(evtps[k], pdfc.getEvaluatorTypeUsed());
+                pdfcx0.eval(stru);
+                pdfcn0.eval(stru);
+                TS_ASSERT(allclose(pdfcx0.getPDF(), pdfc.getPDF()));
+                TS_ASSERT(allclose(pdfcn0.getPDF(), pdfcn->getPDF()));
+                TS_ASSERT(!allclose(pdfcx0.getPDF(), pdfcn->getPDF()));
+                vector<QuantityType> gp0 = pdfcn0.getPartialPDFs();
+                vector<QuantityType> gp = pdfcn->getPartialPDFs();
+                TS_ASSERT_EQUALS(6u, gp.size());
+                TS_ASSERT_EQUALS(gp0.size(), gp.size());
+                for (size_t p = 0; p < gp.size(); ++p)
+                {
+                    TS_ASSERT(allclose(gp0[p], gp[p]));
+                }
+            }
+            // configuration change of the linked calculator
+            pdfc.setEvaluatorType(OPTIMIZED);
+            pdfc.eval(stru);
+            pdfcn->setQmax(15);
+            pdfcn0.setQmax(15);
+            pdfc.eval(stru);
+            pdfcn0.eval(stru);
+            TS_ASSERT(allclose(pdfcn0.getPDF(), pdfcn->getPDF()));
+            // linked calculator does not sum derivatives
+            pdfcn->setGradientMode(true);
+            TS_ASSERT_THROWS(pdfc.eval(stru), logic_error);
+            pdfcn->setGradientMode(false);
+            // configuration changes that break the link are rejected
+            // without changing the linked calculator
+            QuantityType gn = pdfcn->getPDF();
+            pdfcn->setTypeMask("O", "O", false);
+            TS_ASSERT_THROWS(pdfc.eval(stru), logic_error);
+            pdfcn->setTypeMask("all", "all", true);
+            pdfc.setPeakWidthModelByType("jeong");
+            pdfc.setDoubleAttr("delta2", 1.5);
+            TS_ASSERT_THROWS(pdfc.eval(stru), logic_error);
+            TS_ASSERT_DIFFERS(pdfc.getPeakWidthModel(),
+                    pdfcn->getPeakWidthModel());
+            TS_ASSERT_EQUALS(gn, pdfcn->getPDF());
+            pdfcn->setPeakWidthModel(pdfc.getPeakWidthModel());
+            pdfc.eval(stru);
+            TS_ASSERT(allclose(pdfcn0.getPDF(), pdfcn->getPDF()));
+            pdfc.clearLinkedCalculators();
+            TS_ASSERT(pdfc.getLinkedCalculators().empty());
+            pdfc1->setPeakWidthModel(pdfcn->getPeakWidthModel());
+            pdfc1->addLinkedCalculator(pdfcn);
+            TS_ASSERT_EQUALS(1u, pdfc1->getLinkedCalculators().size());
+        }
+
+
         void test_serialization()
         {
             // build customized PDFCalculator
@@ -233,6 +976,7 @@ class TestPDFCalculator : public CxxTest::TestSuite
             mpdfc->setDoubleAttr("width", 0.123);
             mpdfc->setPeakProfileByType("gaussian");
             mpdfc->setDoubleAttr("peakprecision", 0.011);
+            mpdfc->setHistogramPrecision(1e-5);
             mpdfc->setScatteringFactorTableByType("electronnumber");
             mpdfc->getScatteringFactorTable()->setCustomAs("H", "H", 1.1);
             // dump it to string
@@ -247,6 +991,7 @@ class TestPDFCalculator : public CxxTest::TestSuite
                     pdfc1->getPeakWidthModel()->type());
             TS_ASSERT_EQUALS(0.123, pdfc1->getDoubleAttr("width"));
             TS_ASSERT_EQUALS(0.011, pdfc1->getDoubleAttr("peakprecision"));
+            TS_ASSERT_EQUALS(1e-5, pdfc1->getHistogramPrecision());
             TS_ASSERT_EQUALS(string("electronnumber"),
                     pdfc1->getScatteringFactorTable()->type());
             TS_ASSERT_EQUALS(1.1,
@@ -24,7 +24,13 @@
 
 #include <diffpy/srreal/PQEvaluator.hpp>
 #include <diffpy/srreal/AtomicStructureAdapter.hpp>
+#include <diffpy/srreal/PeriodicStructureAdapter.hpp>
 #include <diffpy/srreal/PDFCalculator.hpp>
+#include <diffpy/srreal/BondCalculator.hpp>
+#include <diffpy/srreal/DebyePDFCalculator.hpp>
+#include <diffpy/srreal/JeongPeakWidth.hpp>
+#include <diffpy/srreal/NeighborList.hpp>
+#include "test_helpers.hpp"
 
 namespace diffpy {
 namespace srreal {
@@ -32,6 +38,14 @@ namespace srreal {
 using namespace std;
 using diffpy::mathutils::EpsilonEqual;
 
+// Jeong peak width that disables batch evaluation of pair contributions
+class NoBatchJeongPeakWidth : public JeongPeakWidth
+{
+    public:
+
+        virtual bool hasBatchCalculate() const  { return false; }
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // class TestPQEvaluator
 //////////////////////////////////////////////////////////////////////////////
@@ -46,6 +60,39 @@ class TestPQEvaluator : public CxxTest::TestSuite
         AtomicStructureAdapterPtr mstru10r;
         AtomicStructureAdapterPtr mstru9;
 
+
+        /// check that site shifts rebuild the neighbor list only
+        /// when they exceed half of the skin
+        void checkNeighborListBuilds(StructureAdapterPtr stru)
+        {
+            AtomicStructureAdapter& astru =
+                dynamic_cast<AtomicStructureAdapter&>(*stru);
+            const double skin = 0.6;
+            NeighborList nlist;
+            BaseBondGeneratorPtr bnds = stru->createBondGenerator();
+            bnds->setRmax(4.0);
+            TS_ASSERT(nlist.update(*bnds, stru, skin));
+            TS_ASSERT_EQUALS(1, nlist.countBuilds());
+            bnds->setRmax(4.0);
+            TS_ASSERT(!nlist.update(*bnds, stru, skin));
+            // shifts below skin / 2 keep the list
+            astru[0].xyz_cartn[0] += 0.29;
+            astru[1].xyz_cartn[2] -= 0.2;
+            bnds->setRmax(4.0);
+            TS_ASSERT(!nlist.update(*bnds, stru, skin));
+            TS_ASSERT_EQUALS(1, nlist.countBuilds());
+            // shift above skin / 2 since the last build
+            astru[1].xyz_cartn[2] -= 0.11;
+            bnds->setRmax(4.0);
+            TS_ASSERT(nlist.update(*bnds, stru, skin));
+            TS_ASSERT_EQUALS(2, nlist.countBuilds());
+            // the new build is the reference for further shifts
+            astru[1].xyz_cartn[2] += 0.29;
+            bnds->setRmax(4.0);
+            TS_ASSERT(!nlist.update(*bnds, stru, skin));
+            TS_ASSERT_EQUALS(2, nlist.countBuilds());
+        }
+
      public:
 
         void setUp()
@@ -148,6 +195,387 @@ class TestPQEvaluator : public CxxTest::TestSuite
             TS_ASSERT(allclose(gb, go));
         }
 
+
+        void test_PDF_held_reference()
+        {
+            PDFCalculator pdfcb;
+            PDFCalculator pdfco;
+            pdfcb.setEvaluatorType(BASIC);
+            pdfco.setEvaluatorType(OPTIMIZED);
+            Atom& a = (*mstru10)[2];
+            for (int i = 0; i < 3; ++i)
+            {
+                a.xyz_cartn[0] += 0.1;
+                pdfcb.eval(mstru10);
+                pdfco.eval(mstru10);
+                TS_ASSERT(allclose(pdfcb.getPDF(), pdfco.getPDF()));
+            }
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfco.getEvaluatorTypeUsed());
+        }
+
+
+        void test_PDF_threaded()
+        {
+            PDFCalculator pdfcb;
+            PDFCalculator pdfct;
+            pdfcb.setEvaluatorType(BASIC);
+            pdfct.setEvaluatorType(THREADED);
+            TS_ASSERT_EQUALS(0, pdfct.getNumThreads());
+            TS_ASSERT_THROWS(pdfct.setNumThreads(-1), invalid_argument);
+            pdfct.setNumThreads(3);
+            TS_ASSERT_EQUALS(3, pdfct.getNumThreads());
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT_EQUALS(THREADED, pdfct.getEvaluatorTypeUsed());
+            QuantityType gb = pdfcb.getPDF();
+            QuantityType gt = pdfct.getPDF();
+            TS_ASSERT(allclose(gb, gt));
+            // periodic structure with more threads than atoms
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            pdfct.setNumThreads(16);
+            pdfcb.eval(nacl);
+            pdfct.eval(nacl);
+            gb = pdfcb.getPDF();
+            gt = pdfct.getPDF();
+            TS_ASSERT(allclose(gb, gt));
+            // single thread falls back to BASIC evaluation
+            pdfct.setNumThreads(1);
+            pdfct.eval(mstru10);
+            TS_ASSERT_EQUALS(BASIC, pdfct.getEvaluatorTypeUsed());
+            // thread count is preserved when changing evaluator type
+            pdfct.setNumThreads(2);
+            pdfct.setEvaluatorType(OPTIMIZED);
+            pdfct.setEvaluatorType(THREADED);
+            TS_ASSERT_EQUALS(2, pdfct.getNumThreads());
+        }
+
+
+        void test_PDF_threaded_reuse()
+        {
+            PDFCalculator pdfcb;
+            PDFCalculator pdfct;
+            pdfcb.setEvaluatorType(BASIC);
+            pdfct.setEvaluatorType(THREADED);
+            pdfct.setNumThreads(3);
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            // worker threads follow configuration changes
+            pdfcb.setDoubleAttr("delta2", 2.5);
+            pdfct.setDoubleAttr("delta2", 2.5);
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            pdfcb.setRmax(7.0);
+            pdfct.setRmax(7.0);
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            // pair masks and structure changes
+            pdfcb.setPairMask(0, 3, false);
+            pdfct.setPairMask(0, 3, false);
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            pdfcb.setPairMask(0, 3, true);
+            pdfct.setPairMask(0, 3, true);
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            pdfcb.eval(nacl);
+            pdfct.eval(nacl);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            pdfct.setNumThreads(4);
+            pdfcb.eval(mstru10);
+            pdfct.eval(mstru10);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+        }
+
+
+        void test_bonds_threaded()
+        {
+            BondCalculator bdcb;
+            BondCalculator bdct;
+            bdcb.setEvaluatorType(BASIC);
+            bdct.setEvaluatorType(THREADED);
+            bdct.setNumThreads(4);
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            bdcb.setRmax(4.5);
+            bdct.setRmax(4.5);
+            bdcb.eval(nacl);
+            bdct.eval(nacl);
+            TS_ASSERT_EQUALS(THREADED, bdct.getEvaluatorTypeUsed());
+            TS_ASSERT(allclose(bdcb.distances(), bdct.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdct.sites0());
+            TS_ASSERT_EQUALS(bdcb.sites1(), bdct.sites1());
+            // bond calculator uses full sum over all pairs
+            bdcb.eval(mstru10);
+            bdct.eval(mstru10);
+            TS_ASSERT(allclose(bdcb.distances(), bdct.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdct.sites0());
+        }
+
+
+        void test_PDF_threaded_balance()
+        {
+            // cluster with uneven number of neighbors per atom
+            AtomicStructureAdapterPtr stru(new AtomicStructureAdapter);
+            Atom ai = mstru10->at(0);
+            for (int i = 0; i < 60; ++i)
+            {
+                double r = (i < 20) ? 1.5 * i : 30 + 0.5 * i;
+                ai.xyz_cartn = R3::Vector(r, (i % 3) * 0.7, (i % 5) * 0.4);
+                stru->append(ai);
+            }
+            PDFCalculator pdfcb;
+            PDFCalculator pdfct;
+            pdfcb.setEvaluatorType(BASIC);
+            pdfct.setEvaluatorType(THREADED);
+            pdfct.setNumThreads(4);
+            pdfcb.eval(stru);
+            QuantityType gb = pdfcb.getPDF();
+            // the second run uses bond counts from the first one
+            pdfct.eval(stru);
+            TS_ASSERT(allclose(gb, pdfct.getPDF()));
+            pdfct.eval(stru);
+            TS_ASSERT(allclose(gb, pdfct.getPDF()));
+            // check masked sum
+            pdfcb.setPairMask(0, 1, false);
+            pdfct.setPairMask(0, 1, false);
+            pdfcb.eval(stru);
+            pdfct.eval(stru);
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfct.getPDF()));
+            TS_ASSERT_EQUALS(THREADED, pdfct.getEvaluatorTypeUsed());
+        }
+
+
+        void test_PDF_threaded_parallel()
+        {
+            // cluster large enough to split anchor sites among processes
+            AtomicStructureAdapterPtr stru(new AtomicStructureAdapter);
+            Atom ai = mstru10->at(0);
+            for (int i = 0; i < 60; ++i)
+            {
+                ai.xyz_cartn = R3::Vector(0.9 * i, (i % 3) * 0.7, 0.0);
+                stru->append(ai);
+            }
+            PDFCalculator pdfcb;
+            pdfcb.setEvaluatorType(BASIC);
+            pdfcb.eval(stru);
+            // processes use different numbers of threads
+            const int ncpu = 3;
+            const int nthreads[ncpu] = {1, 2, 4};
+            PDFCalculator pmaster;
+            pmaster.setStructure(stru);
+            for (int cpuindex = 0; cpuindex < ncpu; ++cpuindex)
+            {
+                PDFCalculator pslave;
+                pslave.setEvaluatorType(THREADED);
+                pslave.setNumThreads(nthreads[cpuindex]);
+                pslave.setupParallelRun(cpuindex, ncpu);
+                pslave.eval(stru);
+                pmaster.mergeParallelData(pslave.getParallelData(), ncpu);
+            }
+            TS_ASSERT(allclose(pdfcb.getPDF(), pmaster.getPDF()));
+            // small structure where processes split the bonds of each anchor
+            pdfcb.eval(mstru10);
+            pmaster.setStructure(mstru10);
+            for (int cpuindex = 0; cpuindex < ncpu; ++cpuindex)
+            {
+                PDFCalculator pslave;
+                pslave.setEvaluatorType(THREADED);
+                pslave.setNumThreads(nthreads[cpuindex]);
+                pslave.setupParallelRun(cpuindex, ncpu);
+                pslave.eval(mstru10);
+                pmaster.mergeParallelData(pslave.getParallelData(), ncpu);
+            }
+            TS_ASSERT(allclose(pdfcb.getPDF(), pmaster.getPDF()));
+        }
+
+
+        void test_bond_batch()
+        {
+            PeakWidthModelPtr jpw(new JeongPeakWidth);
+            PeakWidthModelPtr jpwnb(new NoBatchJeongPeakWidth);
+            TS_ASSERT(jpw->hasBatchCalculate());
+            TS_ASSERT(!jpwnb->hasBatchCalculate());
+            jpw->setDoubleAttr("delta2", 1.5);
+            jpwnb->setDoubleAttr("delta2", 1.5);
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            // PDFCalculator with basic evaluator
+            PDFCalculator pdfc, pdfcnb;
+            pdfc.setEvaluatorType(BASIC);
+            pdfcnb.setEvaluatorType(BASIC);
+            pdfc.setPeakWidthModel(jpw);
+            pdfcnb.setPeakWidthModel(jpwnb);
+            pdfc.eval(nacl);
+            pdfcnb.eval(nacl);
+            TS_ASSERT(allclose(pdfcnb.getPDF(), pdfc.getPDF()));
+            // DebyePDFCalculator with optimized evaluator
+            DebyePDFCalculator dbpdfc, dbpdfcnb;
+            dbpdfc.setEvaluatorType(OPTIMIZED);
+            dbpdfcnb.setEvaluatorType(OPTIMIZED);
+            dbpdfc.setPeakWidthModel(jpw);
+            dbpdfcnb.setPeakWidthModel(jpwnb);
+            dbpdfc.eval(mstru10);
+            dbpdfcnb.eval(mstru10);
+            TS_ASSERT(allclose(dbpdfcnb.value(), dbpdfc.value()));
+            dbpdfc.eval(mstru10d1);
+            dbpdfcnb.eval(mstru10d1);
+            TS_ASSERT_EQUALS(OPTIMIZED, dbpdfc.getEvaluatorTypeUsed());
+            TS_ASSERT(allclose(dbpdfcnb.value(), dbpdfc.value()));
+        }
+
+
+        void test_neighbor_list()
+        {
+            PDFCalculator pdfc, pdfcnl;
+            TS_ASSERT_EQUALS(0.0, pdfcnl.getNeighborListSkin());
+            TS_ASSERT_THROWS(pdfcnl.setNeighborListSkin(-1),
+                    invalid_argument);
+            pdfcnl.setNeighborListSkin(0.6);
+            TS_ASSERT_EQUALS(0.6, pdfcnl.getNeighborListSkin());
+            pdfc.setRmax(6.0);
+            pdfcnl.setRmax(6.0);
+            srand(0);
+            AtomicStructureAdapterPtr stru =
+                boost::make_shared<AtomicStructureAdapter>();
+            Atom ai = (*mstru10)[0];
+            for (int i = 0; i < 100; ++i)
+            {
+                ai.xyz_cartn = R3::Vector(rand(), rand(), rand());
+                ai.xyz_cartn *= 15.0 / RAND_MAX;
+                stru->append(ai);
+            }
+            // small random shifts keep the cached neighbor list
+            for (int step = 0; step < 4; ++step)
+            {
+                AtomicStructureAdapter::iterator ii = stru->begin();
+                for (; ii != stru->end(); ++ii)
+                {
+                    R3::Vector dxyz(rand(), rand(), rand());
+                    dxyz *= 0.14 / RAND_MAX;
+                    ii->xyz_cartn += dxyz;
+                }
+                pdfc.eval(stru);
+                pdfcnl.eval(stru);
+                TS_ASSERT(allclose(pdfc.getPDF(), pdfcnl.getPDF()));
+            }
+            // periodic structure evaluated with threads
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            pdfcnl.setEvaluatorType(THREADED);
+            pdfcnl.setNumThreads(3);
+            pdfc.eval(nacl);
+            pdfcnl.eval(nacl);
+            TS_ASSERT(allclose(pdfc.getPDF(), pdfcnl.getPDF()));
+            // shorter range uses the same list
+            pdfc.setRmax(4.0);
+            pdfcnl.setRmax(4.0);
+            pdfc.eval(nacl);
+            pdfcnl.eval(nacl);
+            TS_ASSERT(allclose(pdfc.getPDF(), pdfcnl.getPDF()));
+        }
+
+
+        void test_neighbor_list_builds()
+        {
+            this->checkNeighborListBuilds(mstru10->clone());
+            StructureAdapterPtr nacl = loadTestPeriodicStructure("NaCl.stru");
+            this->checkNeighborListBuilds(nacl);
+        }
+
+
+        void test_moveSite()
+        {
+            StructureAdapterPtr cato = loadTestPeriodicStructure("CaTiO3.stru");
+            PeriodicStructureAdapter& pcato =
+                static_cast<PeriodicStructureAdapter&>(*cato);
+            StructureAdapterPtr cato0 = cato->clone();
+            PDFCalculator pdfc, pdfcb;
+            pdfc.setRmax(8.0);
+            pdfcb.setRmax(8.0);
+            pdfc.setEvaluatorType(OPTIMIZED);
+            pdfc.eval(cato);
+            QuantityType g0 = pdfc.getPDF();
+            R3::Vector xyz = pcato[3].xyz_cartn;
+            xyz[0] += 0.13;
+            pdfc.moveSite(3, xyz);
+            TS_ASSERT_EQUALS(xyz, pcato[3].xyz_cartn);
+            pdfcb.eval(cato->clone());
+            QuantityType gb = pdfcb.getPDF();
+            TS_ASSERT(!allclose(g0, gb));
+            TS_ASSERT(allclose(gb, pdfc.getPDF()));
+            // replace atom with a different element and displacement
+            Atom a = pcato[5];
+            const string smbl5 = a.atomtype;
+            a.atomtype = "Sr";
+            a.uij_cartn *= 1.5;
+            pdfc.replaceSite(5, a);
+            pdfcb.eval(cato->clone());
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfc.getPDF()));
+            // site updates of a copy keep the rollback data of the original
+            PDFCalculator pdfc1 = pdfc;
+            pdfc1.setStructure(cato->clone());
+            Atom a1 = a;
+            a1.atomtype = "Ba";
+            pdfc1.replaceSite(5, a1);
+            // reject the last change
+            pdfc.rollbackSite();
+            TS_ASSERT_EQUALS(smbl5, pcato[5].atomtype);
+            TS_ASSERT(allclose(gb, pdfc.getPDF()));
+            TS_ASSERT_THROWS(pdfc.rollbackSite(), logic_error);
+            // the optimized evaluator keeps track of the changed sites
+            pdfc.replaceSite(5, a);
+            pdfc.eval(cato);
+            TS_ASSERT_EQUALS(OPTIMIZED, pdfc.getEvaluatorTypeUsed());
+            TS_ASSERT(allclose(pdfcb.getPDF(), pdfc.getPDF()));
+            // new evaluation discards the rollback data
+            TS_ASSERT_THROWS(pdfc.rollbackSite(), logic_error);
+            pdfc.eval(cato0);
+            TS_ASSERT(allclose(g0, pdfc.getPDF()));
+            // unsupported structures and indices
+            TS_ASSERT_THROWS(pdfc.moveSite(-1, xyz), invalid_argument);
+            pdfc.setStructure(emptyStructureAdapter());
+            TS_ASSERT_THROWS(pdfc.moveSite(0, xyz), invalid_argument);
+        }
+
+
+        void test_moveSite_fullsum()
+        {
+            BondCalculator bdc, bdcb;
+            bdc.setRmax(2.5);
+            bdcb.setRmax(2.5);
+            AtomicStructureAdapterPtr stru =
+                boost::make_shared<AtomicStructureAdapter>(*mstru10);
+            bdc.eval(stru);
+            // site updates before evaluation calculate the full value
+            bdc.setStructure(stru);
+            R3::Vector xyz(4.5, 0.3, 0.0);
+            bdc.moveSite(4, xyz);
+            bdcb.eval(stru->clone());
+            TS_ASSERT(allclose(bdcb.distances(), bdc.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdc.sites0());
+            TS_ASSERT_EQUALS(bdcb.sites1(), bdc.sites1());
+            xyz = R3::Vector(8.2, 1.1, 0.0);
+            bdc.moveSite(0, xyz);
+            bdcb.eval(stru->clone());
+            TS_ASSERT(allclose(bdcb.distances(), bdc.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdc.sites0());
+            TS_ASSERT_EQUALS(bdcb.sites1(), bdc.sites1());
+            bdc.rollbackSite();
+            bdc.moveSite(4, R3::Vector(4, 0, 0));
+            bdcb.eval(mstru10);
+            TS_ASSERT(allclose(bdcb.distances(), bdc.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdc.sites0());
+            TS_ASSERT_EQUALS(bdcb.sites1(), bdc.sites1());
+            // trial rollback restores the bonds
+            bdc.beginTrial();
+            bdc.moveSite(2, R3::Vector(7.5, 0.5, 0.0));
+            bdc.moveSite(5, R3::Vector(3.0, 0.5, 0.0));
+            bdc.rollback();
+            TS_ASSERT(allclose(bdcb.distances(), bdc.distances()));
+            TS_ASSERT_EQUALS(bdcb.sites0(), bdc.sites0());
+            TS_ASSERT_EQUALS(bdcb.sites1(), bdc.sites1());
+        }
+
 };  // class TestPQEvaluator
 
 }   // namespace srreal
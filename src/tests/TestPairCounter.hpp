@@ -115,6 +115,40 @@ public:
         TS_ASSERT_EQUALS(100 * 99 / 2, pmaster.value()[0]);
     }
 
+
+    void test_parallel_binary()
+    {
+        const int ncpu = 3;
+        PairCounter pmaster;
+        PairCounter pslave[ncpu];
+        pmaster.setStructure(mline100);
+        for (int cpuindex = 0; cpuindex < ncpu; ++cpuindex)
+        {
+            PairCounter& p = pslave[cpuindex];
+            p.setupParallelRun(cpuindex, ncpu);
+            p.eval(mline100);
+            // use unaligned buffer for the last CPU
+            const int offset = (cpuindex == ncpu - 1) ? 1 : 0;
+            vector<double> storage(p.getParallelDataSize() + 1);
+            char* buffer = reinterpret_cast<char*>(&storage[0]) + offset;
+            p.writeParallelData(buffer, p.getParallelDataSize());
+            pmaster.mergeParallelData(buffer, p.getParallelDataSize(), ncpu);
+        }
+        TS_ASSERT_EQUALS(100 * 99 / 2, pmaster.value()[0]);
+        // check the handling of invalid data
+        string pdata = pslave[0].getParallelData();
+        PairCounter pc;
+        pc.setStructure(mline100);
+        TS_ASSERT_THROWS(pc.mergeParallelData(pdata.data(), pdata.size(), 1),
+                invalid_argument);
+        vector<double> storage(pc.getParallelDataSize());
+        TS_ASSERT_THROWS(pc.writeParallelData(&storage[0], 8),
+                invalid_argument);
+        pslave[0].writeParallelData(&storage[0], pc.getParallelDataSize());
+        TS_ASSERT_THROWS(pc.mergeParallelData(&storage[0], 20, 1),
+                invalid_argument);
+    }
+
 };  // class TestPairCounter
 
 // End of file
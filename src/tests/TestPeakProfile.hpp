@@ -17,6 +17,8 @@
 *****************************************************************************/
 
 #include <cmath>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <cxxtest/TestSuite.h>
 
@@ -106,6 +108,57 @@ class TestPeakProfile : public CxxTest::TestSuite
         }
 
 
+        void test_sampleGrid()
+        {
+            const char* tps[] = {"gaussian", "croppedgaussian"};
+            const double fwhm = 0.37;
+            const int npts = 100;
+            vector<double> y(npts);
+            for (int t = 0; t < 2; ++t)
+            {
+                PeakProfilePtr pkf = PeakProfile::createByType(tps[t]);
+                pkf->setPrecision(1e-6);
+                const double ymax = (*pkf)(0, fwhm);
+                const double eps = pkf->getPrecision() * ymax;
+                // peak center inside, left and right of the grid
+                double x0s[] = {-0.61, 0.13, -1.5};
+                for (int i = 0; i < 3; ++i)
+                {
+                    const double x0 = x0s[i];
+                    const double dx = 0.011;
+                    pkf->sampleGrid(&y[0], npts, x0, dx, fwhm);
+                    double maxdiff = 0.0;
+                    for (int k = 0; k < npts; ++k)
+                    {
+                        double x = x0 + k * dx;
+                        double dy = fabs(y[k] - (*pkf)(x, fwhm));
+                        maxdiff = max(maxdiff, dy);
+                    }
+                    TS_ASSERT_LESS_THAN(maxdiff, eps);
+                }
+                // zero and negative grid steps sample the profile directly
+                const double dxs[] = {0.0, -0.011};
+                for (int i = 0; i < 2; ++i)
+                {
+                    const double x0 = 0.13;
+                    const double dx = dxs[i];
+                    pkf->sampleGrid(&y[0], npts, x0, dx, fwhm);
+                    double maxdiff = 0.0;
+                    for (int k = 0; k < npts; ++k)
+                    {
+                        double x = x0 + k * dx;
+                        double dy = fabs(y[k] - (*pkf)(x, fwhm));
+                        maxdiff = max(maxdiff, dy);
+                    }
+                    TS_ASSERT_LESS_THAN(maxdiff, 1e-12 * ymax);
+                }
+            }
+            mpkgauss->sampleGrid(&y[0], npts, -0.5, 0.01, 0.0);
+            TS_ASSERT_EQUALS(0.0, *max_element(y.begin(), y.end()));
+            TS_ASSERT_EQUALS(0.0, *min_element(y.begin(), y.end()));
+        }
+
+
         void test_serialization()
         {
             mpkgauss->setPrecision(0.0123);
@@ -21,9 +21,11 @@
 
 #include <typeinfo>
 #include <sstream>
+#include <algorithm>
 #include <cxxtest/TestSuite.h>
 
 #include <diffpy/srreal/PeriodicStructureAdapter.hpp>
+#include <diffpy/srreal/CrystalStructureAdapter.hpp>
 #include "test_helpers.hpp"
 #include "serialization_helpers.hpp"
 
@@ -44,6 +46,45 @@ int countBonds(BaseBondGenerator& bnds)
 }
 
 
+vector<double> sortedDistances(BaseBondGenerator& bnds)
+{
+    vector<double> rv;
+    for (bnds.rewind(); !bnds.finished(); bnds.next())
+    {
+        rv.push_back(bnds.distance());
+    }
+    sort(rv.begin(), rv.end());
+    return rv;
+}
+
+
+/// return supercell expanded n times along each axis
+template <class T>
+boost::shared_ptr<T> makeSupercell(StructureAdapterPtr stru, int n)
+{
+    typedef boost::shared_ptr<const PeriodicStructureAdapter> PPtr;
+    PPtr pstru = boost::dynamic_pointer_cast<PPtr::element_type>(stru);
+    const Lattice& L = pstru->getLattice();
+    boost::shared_ptr<T> rv(new T);
+    rv->setLatPar(n * L.a(), n * L.b(), n * L.c(),
+            L.alpha(), L.beta(), L.gamma());
+    PeriodicStructureAdapter::const_iterator ai = pstru->begin();
+    for (; ai != pstru->end(); ++ai)
+    {
+        R3::Vector mno;
+        for (mno[0] = 0; mno[0] < n; ++mno[0])
+        for (mno[1] = 0; mno[1] < n; ++mno[1])
+        for (mno[2] = 0; mno[2] < n; ++mno[2])
+        {
+            Atom a = *ai;
+            a.xyz_cartn += L.cartesian(mno);
+            rv->append(a);
+        }
+    }
+    return rv;
+}
+
+
 template <class Tstru, class Tbnds>
 double testmsd0(const Tstru& stru, const Tbnds& bnds)
 {
@@ -414,6 +455,67 @@ class TestPeriodicStructureBondGenerator : public CxxTest::TestSuite
             }
         }
 
+
+
+        void test_cellSearchSupercell()
+        {
+            const int n = 4;
+            const int ncells = n * n * n;
+            PeriodicStructureAdapterPtr sc =
+                makeSupercell<PeriodicStructureAdapter>(m_ni, n);
+            TS_ASSERT_EQUALS(4 * ncells, sc->countSites());
+            BaseBondGeneratorPtr bnds = sc->createBondGenerator();
+            m_nibnds->setRmin(0.1);
+            m_nibnds->setRmax(5.0);
+            bnds->setRmin(0.1);
+            bnds->setRmax(5.0);
+            for (int i = 0; i < sc->countSites(); i += 37)
+            {
+                m_nibnds->selectAnchorSite(i / ncells);
+                bnds->selectAnchorSite(i);
+                vector<double> d0 = sortedDistances(*m_nibnds);
+                vector<double> d1 = sortedDistances(*bnds);
+                TS_ASSERT_EQUALS(d0.size(), d1.size());
+                for (size_t k = 0; k < d0.size() && k < d1.size(); ++k)
+                {
+                    TS_ASSERT_DELTA(d0[k], d1[k], 1e-10);
+                }
+            }
+            // arbitrary site selection gives the same bonds as a range
+            SiteIndices selection;
+            for (int i = 0; i < sc->countSites(); ++i)  selection.push_back(i);
+            bnds->selectAnchorSite(5);
+            vector<double> d2 = sortedDistances(*bnds);
+            bnds->selectSites(selection);
+            TS_ASSERT_EQUALS(d2, sortedDistances(*bnds));
+            // crystal with a half of the supercell and a translation symmetry
+            CrystalStructureAdapterPtr cr(new CrystalStructureAdapter);
+            const Lattice& L = sc->getLattice();
+            cr->setLatPar(L.a(), L.b(), L.c(),
+                    L.alpha(), L.beta(), L.gamma());
+            for (int i = 0; i < sc->countSites(); ++i)
+            {
+                if (L.fractional((*sc)[i].xyz_cartn)[0] < 0.5 - 1e-6)
+                {
+                    cr->append((*sc)[i]);
+                }
+            }
+            TS_ASSERT_EQUALS(sc->countSites() / 2, cr->countSites());
+            cr->addSymOp(R3::identity(), R3::Vector(0.0, 0.0, 0.0));
+            cr->addSymOp(R3::identity(), R3::Vector(0.5, 0.0, 0.0));
+            BaseBondGeneratorPtr cbnds = cr->createBondGenerator();
+            cbnds->setRmin(0.1);
+            cbnds->setRmax(5.0);
+            cbnds->selectAnchorSite(0);
+            bnds->selectSiteRange(0, sc->countSites());
+            vector<double> d3 = sortedDistances(*cbnds);
+            TS_ASSERT_EQUALS(d2.size(), d3.size());
+            for (size_t k = 0; k < d3.size() && k < d2.size(); ++k)
+            {
+                TS_ASSERT_DELTA(d2[k], d3[k], 1e-10);
+            }
+        }
+
 };  // class TestPeriodicStructureBondGenerator
 
 }   // namespace srreal
@@ -0,0 +1,165 @@
+/*****************************************************************************
+*
+* libdiffpy         Complex Modeling Initiative
+*                   (c) 2013 Brookhaven Science Associates,
+*                   Brookhaven National Laboratory.
+*                   All rights reserved.
+*
+* File coded by:    Pavol Juhas
+*
+* See AUTHORS.txt for a list of people who contributed.
+* See LICENSE.txt for license information.
+*
+******************************************************************************
+*
+* class TestSineTransform -- unit tests for the sine transformation backends
+*
+*****************************************************************************/
+
+#include <cmath>
+#include <set>
+#include <algorithm>
+#include <cxxtest/TestSuite.h>
+
+#include <diffpy/srreal/SineTransform.hpp>
+#include <diffpy/srreal/PDFUtils.hpp>
+
+using namespace std;
+using namespace diffpy::srreal;
+
+namespace {
+
+QuantityType directSineTransform(const QuantityType& y)
+{
+    const int n = y.size();
+    QuantityType rv(n, 0.0);
+    for (int k = 0; k < n; ++k)
+    {
+        for (int j = 1; j < n; ++j)
+        {
+            rv[k] += y[j] * sin(M_PI * ((j * k) % (2 * n)) / n);
+        }
+    }
+    return rv;
+}
+
+
+double maxAbsDifference(const QuantityType& a, const QuantityType& b)
+{
+    double rv = 0.0;
+    for (size_t i = 0; i < a.size(); ++i)  rv = max(rv, fabs(a[i] - b[i]));
+    return rv;
+}
+
+}   // namespace
+
+class TestSineTransform : public CxxTest::TestSuite
+{
+    private:
+
+        set<string> mtypes;
+
+    public:
+
+        void setUp()
+        {
+            mtypes = SineTransform::getRegisteredTypes();
+        }
+
+
+        void test_types()
+        {
+            TS_ASSERT(mtypes.count("gsl"));
+            set<string>::const_iterator tp = mtypes.begin();
+            for (; tp != mtypes.end(); ++tp)
+            {
+                SineTransformPtr st = SineTransform::createByType(*tp);
+                TS_ASSERT_EQUALS(*tp, st->type());
+                TS_ASSERT_EQUALS(*tp, st->clone()->type());
+            }
+        }
+
+
+        void test_defaultType()
+        {
+            const string tp0 = SineTransform::getDefaultType();
+            TS_ASSERT_EQUALS(tp0, SineTransform::getThreadDefault().type());
+            SineTransform::setDefaultType("gsl");
+            TS_ASSERT_EQUALS("gsl", SineTransform::getDefaultType());
+            TS_ASSERT_EQUALS("gsl", SineTransform::getThreadDefault().type());
+            TS_ASSERT_THROWS(SineTransform::setDefaultType("invalid"),
+                    invalid_argument);
+            TS_ASSERT_EQUALS("gsl", SineTransform::getDefaultType());
+            SineTransform::setDefaultType("");
+            TS_ASSERT_EQUALS(tp0, SineTransform::getDefaultType());
+        }
+
+
+        void test_transform()
+        {
+            const int sizes[] = {1, 2, 3, 4, 7, 8, 12, 17, 64, 100};
+            const int nsizes = sizeof(sizes) / sizeof(int);
+            set<string>::const_iterator tp = mtypes.begin();
+            for (; tp != mtypes.end(); ++tp)
+            {
+                SineTransformPtr st = SineTransform::createByType(*tp);
+                // repeat to use the cached plans
+                for (int rep = 0; rep < 2; ++rep)
+                {
+                    for (int i = 0; i < nsizes; ++i)
+                    {
+                        const int n = sizes[i];
+                        QuantityType y(n);
+                        for (int j = 0; j < n; ++j)
+                        {
+                            y[j] = cos(0.3 * j * j) + 0.1 * j;
+                        }
+                        QuantityType f0 = directSineTransform(y);
+                        st->transform(&y[0], n);
+                        TS_ASSERT_EQUALS(0.0, y[0]);
+                        TS_ASSERT_DELTA(0.0, maxAbsDifference(f0, y), 1e-10);
+                    }
+                }
+            }
+        }
+
+
+        void test_fftgtof()
+        {
+            const double rstep = 0.05;
+            const double rmin = 0.5;
+            QuantityType g(71);
+            for (size_t i = 0; i < g.size(); ++i)
+            {
+                double r = rmin + i * rstep;
+                g[i] = r * exp(-r);
+            }
+            QuantityType f = fftgtof(g, rstep, rmin);
+            TS_ASSERT_EQUALS(128u, f.size());
+            const double qstep = M_PI / (f.size() * rstep);
+            double maxdiff = 0.0;
+            for (size_t k = 0; k < f.size(); ++k)
+            {
+                double fk = 0.0;
+                for (size_t i = 0; i < g.size(); ++i)
+                {
+                    double r = rmin + i * rstep;
+                    fk += g[i] * sin(k * qstep * r) * rstep;
+                }
+                maxdiff = max(maxdiff, fabs(f[k] - fk));
+            }
+            TS_ASSERT_DELTA(0.0, maxdiff, 1e-12);
+            QuantityType g1 = fftftog(f, qstep);
+            TS_ASSERT_EQUALS(f.size(), g1.size());
+            const int padrmin = int(round(rmin / rstep));
+            double maxdiffg = 0.0;
+            for (size_t i = 1; i < g.size(); ++i)
+            {
+                maxdiffg = max(maxdiffg, fabs(g1[padrmin + i] - g[i]));
+            }
+            TS_ASSERT_DELTA(0.0, maxdiffg, 1e-12);
+        }
+
+};  // class TestSineTransform
+
+// End of file